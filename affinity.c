@@ -0,0 +1,291 @@
+/*
+ * Receive affinity.
+ *
+ * svc_xprt_do_enqueue() picks the pool of the cpu it runs on.  That is
+ * the cpu that received the data when it is called from a socket
+ * callback, but often it runs from svc_xprt_received() on the cpu of
+ * the thread that has just finished reading a request, so the next one
+ * is handled in that thread's pool instead of near the softirq that
+ * brought it in, and its data has to cross caches, or sockets.
+ *
+ * With affinity on, nfsd_enqueue_xprt() takes the cpu the network
+ * stack last received the transport's data on (sk_incoming_cpu, which
+ * TCP and UDP keep up to date) and looks for an idle thread in that
+ * cpu's pool first.  If the pool has none, the transport goes to an
+ * idle thread of another pool rather than waiting; only when no pool
+ * has an idle thread is it queued on its home pool.  This only makes
+ * a difference with more than one pool (the sunrpc pool_mode parameter
+ * set to percpu or pernode), where the threads of a pool run on its
+ * cpus.
+ *
+ * The enqueue follows svc_xprt_do_enqueue(), which is what is used
+ * with affinity off.  The per-connection request limit of the sunrpc
+ * module is not visible here and is not applied; it is off by default.
+ *
+ * With busy-poll on (busypoll.c) the enqueue is taken over as well, so
+ * that a transport can go to a thread spinning in its home pool, which
+ * is then the pool of the current cpu unless affinity is on too.  The
+ * same goes for fair share (sched.c), which may hold a transport back
+ * before it is queued, and for a wait target (overload.c), which needs
+ * to know when a transport started waiting.
+ */
+
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/sunrpc/svc.h>
+#include <linux/sunrpc/svc_xprt.h>
+#include <linux/sunrpc/svcsock.h>
+#include <linux/sunrpc/xprtsock.h>
+#include <net/sock.h>
+
+#include "nfsd.h"
+#include "netns.h"
+#include "affinity.h"
+#include "busypoll.h"
+#include "sched.h"
+#include "overload.h"
+
+struct nfsd_affinity_stats {
+	unsigned long		home;		/* to a thread of the home pool */
+	unsigned long		stolen;		/* to an idle thread elsewhere */
+	unsigned long		queued;		/* no idle thread anywhere */
+};
+
+struct nfsd_affinity {
+	bool					af_enabled;
+	struct nfsd_affinity_stats __percpu	*af_stats;
+};
+
+static bool affinity_has_work(struct svc_xprt *xprt)
+{
+	if (xprt->xpt_flags & ((1 << XPT_CONN) | (1 << XPT_CLOSE)))
+		return true;
+	if (xprt->xpt_flags & ((1 << XPT_DATA) | (1 << XPT_DEFERRED)))
+		return xprt->xpt_ops->xpo_has_wspace(xprt);
+	return false;
+}
+
+/* the cpu the stack last received data for @xprt on */
+static int affinity_rx_cpu(struct svc_xprt *xprt)
+{
+	struct svc_sock *svsk;
+	int cpu;
+
+	if (xprt->xpt_class->xcl_ident != XPRT_TRANSPORT_TCP &&
+	    xprt->xpt_class->xcl_ident != XPRT_TRANSPORT_UDP)
+		return raw_smp_processor_id();
+	svsk = container_of(xprt, struct svc_sock, sk_xprt);
+	cpu = READ_ONCE(svsk->sk_sk->sk_incoming_cpu);
+	if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_online(cpu))
+		return raw_smp_processor_id();
+	return cpu;
+}
+
+/* what svc_pool_for_cpu() returns, which is not exported */
+static struct svc_pool *affinity_pool(struct svc_serv *serv, int cpu)
+{
+	struct svc_pool_map *m = &svc_pool_map;
+	unsigned int pidx = 0;
+
+	switch (m->mode) {
+	case SVC_POOL_PERCPU:
+		pidx = m->to_pool[cpu];
+		break;
+	case SVC_POOL_PERNODE:
+		pidx = m->to_pool[cpu_to_node(cpu)];
+		break;
+	}
+	return &serv->sv_pools[pidx % serv->sv_nrpools];
+}
+
+/*
+ * Wake an idle thread of @pool, giving it @xprt if @assign.  Returns
+ * false if the pool has no idle thread.
+ */
+static bool affinity_wake(struct svc_pool *pool, struct svc_xprt *xprt,
+			  bool assign)
+{
+	struct svc_rqst *rqstp;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(rqstp, &pool->sp_all_threads, rq_all) {
+		if (test_bit(RQ_BUSY, &rqstp->rq_flags))
+			continue;
+		if (assign) {
+			spin_lock_bh(&rqstp->rq_lock);
+			if (test_and_set_bit(RQ_BUSY, &rqstp->rq_flags)) {
+				spin_unlock_bh(&rqstp->rq_lock);
+				continue;
+			}
+			rqstp->rq_xprt = xprt;
+			svc_xprt_get(xprt);
+			spin_unlock_bh(&rqstp->rq_lock);
+		}
+		rcu_read_unlock();
+		atomic_long_inc(&pool->sp_stats.threads_woken);
+		wake_up_process(rqstp->rq_task);
+		return true;
+	}
+	rcu_read_unlock();
+	return false;
+}
+
+static void affinity_queue(struct svc_pool *pool, struct svc_xprt *xprt)
+{
+	spin_lock_bh(&pool->sp_lock);
+	list_add_tail(&xprt->xpt_ready, &pool->sp_sockets);
+	pool->sp_stats.sockets_queued++;
+	spin_unlock_bh(&pool->sp_lock);
+}
+
+/*
+ * svo_enqueue_xprt for the nfsd service: called by the RPC layer when
+ * @xprt may have work.
+ */
+void
+nfsd_enqueue_xprt(struct svc_xprt *xprt)
+{
+	struct nfsd_net *nn = net_generic(xprt->xpt_net, nfsd_net_id);
+	struct nfsd_affinity *af = nn->affinity;
+	struct net *net = xprt->xpt_net;
+	bool sched;
+
+	sched = nfsd_sched_enabled(net);
+	if (!sched && !nfsd_busypoll_enabled(net) &&
+	    !nfsd_overload_enabled(net) &&
+	    !(af && READ_ONCE(af->af_enabled) &&
+	      xprt->xpt_server->sv_nrpools > 1)) {
+		svc_xprt_do_enqueue(xprt);
+		return;
+	}
+
+	if (!affinity_has_work(xprt))
+		return;
+	/* XPT_BUSY stays set until svc_xprt_received() */
+	if (test_and_set_bit(XPT_BUSY, &xprt->xpt_flags)) {
+		/* a parked transport has to be let go to be closed */
+		if (sched && test_bit(XPT_CLOSE, &xprt->xpt_flags))
+			nfsd_sched_unpark(xprt);
+		return;
+	}
+	nfsd_overload_stamp(xprt);
+	/* held back until its client is below its share again */
+	if (sched && !nfsd_sched_admit(xprt))
+		return;
+	nfsd_queue_xprt(xprt);
+}
+
+/*
+ * Hand @xprt, which has XPT_BUSY set, to a thread or queue it on a pool.
+ */
+void
+nfsd_queue_xprt(struct svc_xprt *xprt)
+{
+	struct nfsd_net *nn = net_generic(xprt->xpt_net, nfsd_net_id);
+	struct nfsd_affinity *af = nn->affinity;
+	struct svc_serv *serv = xprt->xpt_server;
+	struct svc_pool *home, *pool;
+	bool affinity, polling;
+	unsigned int i;
+
+	affinity = af && READ_ONCE(af->af_enabled) && serv->sv_nrpools > 1;
+	polling = nfsd_busypoll_enabled(xprt->xpt_net);
+
+	if (affinity)
+		home = affinity_pool(serv, affinity_rx_cpu(xprt));
+	else
+		home = affinity_pool(serv, raw_smp_processor_id());
+	atomic_long_inc(&home->sp_stats.packets);
+
+	/* a spinning thread picks it off the queue without a wakeup */
+	if (polling && nfsd_busypoll_claim(xprt->xpt_net, home)) {
+		affinity_queue(home, xprt);
+		smp_mb();
+		if (!nfsd_busypoll_spinning(xprt->xpt_net, home))
+			affinity_wake(home, xprt, false);
+		return;
+	}
+
+	if (affinity_wake(home, xprt, true)) {
+		if (affinity)
+			this_cpu_inc(af->af_stats->home);
+		return;
+	}
+	for (i = 1; affinity && i < serv->sv_nrpools; i++) {
+		pool = &serv->sv_pools[(home->sp_id + i) % serv->sv_nrpools];
+		if (affinity_wake(pool, xprt, true)) {
+			this_cpu_inc(af->af_stats->stolen);
+			return;
+		}
+	}
+
+	affinity_queue(home, xprt);
+	if (affinity)
+		this_cpu_inc(af->af_stats->queued);
+	/* a home thread may have gone idle meanwhile; it will find it */
+	affinity_wake(home, xprt, false);
+}
+
+void
+nfsd_affinity_set(struct net *net, bool enabled)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+
+	WRITE_ONCE(nn->affinity->af_enabled, enabled);
+}
+
+/*
+ * Format the mode and counters into @buf for the pool_affinity control
+ * file.
+ */
+int
+nfsd_affinity_show(struct net *net, char *buf, int size)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_affinity *af = nn->affinity;
+	struct nfsd_affinity_stats sum = { 0 };
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct nfsd_affinity_stats *s = per_cpu_ptr(af->af_stats, cpu);
+
+		sum.home += s->home;
+		sum.stolen += s->stolen;
+		sum.queued += s->queued;
+	}
+	return scnprintf(buf, size, "enabled %d\npools %d\nhome %lu\n"
+			 "stolen %lu\nqueued %lu\n", READ_ONCE(af->af_enabled),
+			 nfsd_nrpools(net), sum.home, sum.stolen, sum.queued);
+}
+
+int
+nfsd_affinity_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_affinity *af;
+
+	af = kzalloc(sizeof(*af), GFP_KERNEL);
+	if (!af)
+		return -ENOMEM;
+	af->af_stats = alloc_percpu(struct nfsd_affinity_stats);
+	if (!af->af_stats) {
+		kfree(af);
+		return -ENOMEM;
+	}
+	nn->affinity = af;
+	return 0;
+}
+
+void
+nfsd_affinity_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_affinity *af = nn->affinity;
+
+	if (!af)
+		return;
+	nn->affinity = NULL;
+	free_percpu(af->af_stats);
+	kfree(af);
+}
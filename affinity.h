@@ -0,0 +1,22 @@
+/*
+ * Receive affinity.
+ *
+ * When enabled, transports with work are handed to a thread of the pool
+ * of the cpu that received their data, and to another pool's idle
+ * thread only when that pool has none.
+ */
+
+#ifndef LINUX_NFSD_AFFINITY_H
+#define LINUX_NFSD_AFFINITY_H
+
+struct net;
+struct svc_xprt;
+
+int	nfsd_affinity_init(struct net *);
+void	nfsd_affinity_shutdown(struct net *);
+void	nfsd_enqueue_xprt(struct svc_xprt *);
+void	nfsd_queue_xprt(struct svc_xprt *);
+void	nfsd_affinity_set(struct net *, bool);
+int	nfsd_affinity_show(struct net *, char *, int);
+
+#endif /* LINUX_NFSD_AFFINITY_H */
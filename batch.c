@@ -0,0 +1,431 @@
+/*
+ * Batched replies on TCP connections.
+ *
+ * A client that pipelines small calls on one connection, GETATTR,
+ * ACCESS and LOOKUP by the dozen, gets every reply in a send of its
+ * own: svc_tcp_sendto() pushes each one out as it is written, in a
+ * packet of its own more often than not, and the client acknowledges
+ * every one of them.
+ *
+ * With a window set, the socket of a connection is corked (TCP_CORK)
+ * while a reply on it is likely to be followed by another: when a
+ * thread starts on a request while other requests of the connection
+ * are being served, or while the connection has more data queued.
+ * The replies written meanwhile are held back by the network stack,
+ * which sends them in full segments, and the socket is uncorked to
+ * push out what is left as soon as the connection has no request in
+ * progress or queued.  Once the number of replies held back reaches a
+ * limit, or once they have been held back for the window, they are
+ * pushed out and the socket corked again for the requests still in
+ * progress.  A work item looks for connections left corked past their
+ * window, so a reply is never held back for much longer than the window
+ * plus a tick, and never for the 200ms after which the network stack
+ * would send it anyway.
+ *
+ * Corking and uncorking are serialized on the transport's xpt_mutex,
+ * which svc_send() holds to write a reply, so the option set on the
+ * socket follows the state kept here.
+ *
+ * Batching is off with no window, which is the default.
+ */
+
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/tcp.h>
+#include <linux/workqueue.h>
+#include <linux/sunrpc/svc_xprt.h>
+#include <linux/sunrpc/svcsock.h>
+
+#include "nfsd.h"
+#include "netns.h"
+#include "batch.h"
+
+/* connections batched at a time; the others send as before */
+#define NFSD_BATCH_SLOTS	256
+#define NFSD_BATCH_PROBES	8
+#define NFSD_BATCH_MAX_USECS	10000
+#define NFSD_BATCH_MAX_REPLIES	1024
+/* sends of 1, 2-3, 4-7, 8-15 and 16 or more replies */
+#define NFSD_BATCH_BUCKETS	5
+
+/* why the replies held back on a connection are pushed out */
+enum {
+	BATCH_HOLD,		/* they are not */
+	BATCH_IDLE,
+	BATCH_FULL,
+	BATCH_EXPIRED,
+};
+
+struct nfsd_batch_stats {
+	unsigned long		replies;
+	unsigned long		sends;
+	unsigned long		full;
+	unsigned long		expired;
+	unsigned long		per_send[NFSD_BATCH_BUCKETS];
+};
+
+/* protected by nb_lock, and the cork by the transport's xpt_mutex too */
+struct nfsd_batch_conn {
+	struct svc_xprt		*bc_xprt;	/* referenced; NULL if free */
+	unsigned int		bc_busy;	/* requests being served */
+	unsigned int		bc_replies;	/* held back */
+	bool			bc_corked;
+	u64			bc_corked_at;	/* ns */
+};
+
+struct nfsd_batch {
+	unsigned int		nb_usecs;	/* window, 0 for no batching */
+	unsigned int		nb_replies;	/* most replies held back */
+	spinlock_t		nb_lock;
+	struct nfsd_batch_conn	nb_conns[NFSD_BATCH_SLOTS];
+	struct delayed_work	nb_work;
+	struct nfsd_batch_stats __percpu *nb_stats;
+};
+
+static struct nfsd_batch *batch(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+
+	return nn->batch;
+}
+
+static bool batch_eligible(struct svc_xprt *xprt)
+{
+	return xprt && xprt->xpt_class->xcl_ident == XPRT_TRANSPORT_TCP &&
+	       !test_bit(XPT_LISTENER, &xprt->xpt_flags);
+}
+
+static void batch_cork(struct svc_xprt *xprt, int on)
+{
+	struct svc_sock *svsk = container_of(xprt, struct svc_sock, sk_xprt);
+
+	kernel_setsockopt(svsk->sk_sock, SOL_TCP, TCP_CORK, (char *)&on,
+			  sizeof(on));
+}
+
+static void batch_schedule(struct nfsd_batch *nb)
+{
+	unsigned int usecs = READ_ONCE(nb->nb_usecs);
+
+	if (usecs)
+		schedule_delayed_work(&nb->nb_work, usecs_to_jiffies(usecs));
+}
+
+static void batch_account(struct nfsd_batch *nb, unsigned int replies,
+			  int why)
+{
+	struct nfsd_batch_stats *s = get_cpu_ptr(nb->nb_stats);
+
+	s->replies += replies;
+	s->sends++;
+	s->full += why == BATCH_FULL;
+	s->expired += why == BATCH_EXPIRED;
+	s->per_send[min(ilog2(replies), NFSD_BATCH_BUCKETS - 1)]++;
+	put_cpu_ptr(nb->nb_stats);
+}
+
+/* Find or take the slot of @xprt and count a request on it. */
+static int batch_claim(struct nfsd_batch *nb, struct svc_xprt *xprt)
+{
+	u32 hash = hash_ptr(xprt, ilog2(NFSD_BATCH_SLOTS));
+	struct nfsd_batch_conn *bc;
+	int i, slot, free = -1;
+
+	spin_lock(&nb->nb_lock);
+	for (i = 0; i < NFSD_BATCH_PROBES; i++) {
+		slot = (hash + i) % NFSD_BATCH_SLOTS;
+		bc = &nb->nb_conns[slot];
+		if (bc->bc_xprt == xprt)
+			goto found;
+		if (!bc->bc_xprt && free < 0)
+			free = slot;
+	}
+	if (free < 0) {
+		spin_unlock(&nb->nb_lock);
+		return -1;
+	}
+	slot = free;
+	bc = &nb->nb_conns[slot];
+	svc_xprt_get(xprt);
+	bc->bc_xprt = xprt;
+	bc->bc_corked = false;
+	bc->bc_replies = 0;
+found:
+	bc->bc_busy++;
+	spin_unlock(&nb->nb_lock);
+	return slot;
+}
+
+static int batch_due(struct nfsd_batch *nb, struct nfsd_batch_conn *bc)
+{
+	unsigned int usecs = READ_ONCE(nb->nb_usecs);
+
+	if (!usecs ||
+	    (!bc->bc_busy && !test_bit(XPT_DATA, &bc->bc_xprt->xpt_flags)))
+		return BATCH_IDLE;
+	if (bc->bc_replies >= READ_ONCE(nb->nb_replies))
+		return BATCH_FULL;
+	if (ktime_get_ns() - bc->bc_corked_at >= usecs * NSEC_PER_USEC)
+		return BATCH_EXPIRED;
+	return BATCH_HOLD;
+}
+
+/*
+ * Push out the replies held back on @xprt if it is time, or in any case
+ * with @all, and give up its slot once nothing is left in it.  With
+ * @done, a request of the connection has just been answered.  Returns
+ * whether the connection is still corked.
+ */
+static bool batch_settle(struct nfsd_batch *nb, struct nfsd_batch_conn *bc,
+			 struct svc_xprt *xprt, bool done, bool all)
+{
+	unsigned int replies = 0;
+	bool corked, release = false;
+	int why = BATCH_HOLD;
+
+	mutex_lock(&xprt->xpt_mutex);
+	spin_lock(&nb->nb_lock);
+	/* only the work item looks at slots it holds no request in */
+	if (bc->bc_xprt != xprt) {
+		spin_unlock(&nb->nb_lock);
+		mutex_unlock(&xprt->xpt_mutex);
+		return false;
+	}
+	if (done) {
+		bc->bc_busy--;
+		if (bc->bc_corked)
+			bc->bc_replies++;
+		else
+			replies = 1;
+	}
+	if (bc->bc_corked) {
+		why = all ? BATCH_IDLE : batch_due(nb, bc);
+		if (why != BATCH_HOLD) {
+			replies = bc->bc_replies;
+			bc->bc_replies = 0;
+			/* hold back the replies of the requests in progress */
+			bc->bc_corked = why != BATCH_IDLE && bc->bc_busy;
+			bc->bc_corked_at = ktime_get_ns();
+		}
+	}
+	corked = bc->bc_corked;
+	if (!bc->bc_busy && !corked) {
+		bc->bc_xprt = NULL;
+		release = true;
+	}
+	spin_unlock(&nb->nb_lock);
+	if (why != BATCH_HOLD) {
+		batch_cork(xprt, 0);
+		if (corked)
+			batch_cork(xprt, 1);
+	}
+	mutex_unlock(&xprt->xpt_mutex);
+
+	if (replies)
+		batch_account(nb, replies, why);
+	if (release)
+		svc_xprt_put(xprt);
+	return corked;
+}
+
+/* Push out the replies of every connection that is due, or of all. */
+static bool batch_settle_all(struct nfsd_batch *nb, bool all)
+{
+	struct nfsd_batch_conn *bc;
+	struct svc_xprt *xprt;
+	bool corked = false;
+	int i;
+
+	for (i = 0; i < NFSD_BATCH_SLOTS; i++) {
+		bc = &nb->nb_conns[i];
+		if (!READ_ONCE(bc->bc_xprt))
+			continue;
+		spin_lock(&nb->nb_lock);
+		xprt = bc->bc_xprt;
+		if (!xprt || (!bc->bc_corked && !all)) {
+			spin_unlock(&nb->nb_lock);
+			continue;
+		}
+		svc_xprt_get(xprt);
+		spin_unlock(&nb->nb_lock);
+		if (batch_settle(nb, bc, xprt, false, all))
+			corked = true;
+		svc_xprt_put(xprt);
+	}
+	return corked;
+}
+
+static void batch_worker(struct work_struct *work)
+{
+	struct nfsd_batch *nb = container_of(to_delayed_work(work),
+					     struct nfsd_batch, nb_work);
+
+	if (batch_settle_all(nb, false))
+		batch_schedule(nb);
+}
+
+/*
+ * Called by nfsd() before svc_process(); corks the connection of
+ * @rqstp if its reply is likely to be followed by another one.
+ */
+void
+nfsd_batch_begin(struct svc_rqst *rqstp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_batch *nb = batch(SVC_NET(rqstp));
+	struct svc_xprt *xprt = rqstp->rq_xprt;
+	struct nfsd_batch_conn *bc;
+	bool cork = false;
+	int slot;
+
+	ctx->tc_batch_slot = -1;
+	if (!nb || !READ_ONCE(nb->nb_usecs) || !batch_eligible(xprt))
+		return;
+	slot = batch_claim(nb, xprt);
+	if (slot < 0)
+		return;
+	ctx->tc_batch_slot = slot;
+	bc = &nb->nb_conns[slot];
+	if (READ_ONCE(bc->bc_corked))
+		return;
+
+	mutex_lock(&xprt->xpt_mutex);
+	spin_lock(&nb->nb_lock);
+	if (!bc->bc_corked &&
+	    (bc->bc_busy > 1 || test_bit(XPT_DATA, &xprt->xpt_flags))) {
+		bc->bc_corked = true;
+		bc->bc_replies = 0;
+		bc->bc_corked_at = ktime_get_ns();
+		cork = true;
+	}
+	spin_unlock(&nb->nb_lock);
+	if (cork)
+		batch_cork(xprt, 1);
+	mutex_unlock(&xprt->xpt_mutex);
+	if (cork)
+		batch_schedule(nb);
+}
+
+/*
+ * Called by nfsd() once svc_process() has sent the reply; uncorks the
+ * connection if nothing else is to follow soon.
+ */
+void
+nfsd_batch_end(struct svc_rqst *rqstp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_batch *nb = batch(SVC_NET(rqstp));
+	struct nfsd_batch_conn *bc;
+	int slot = ctx->tc_batch_slot;
+
+	if (slot < 0)
+		return;
+	ctx->tc_batch_slot = -1;
+	/* rq_xprt is gone by now; the slot holds on to the transport */
+	bc = &nb->nb_conns[slot];
+	batch_settle(nb, bc, READ_ONCE(bc->bc_xprt), true, false);
+}
+
+/*
+ * Push out everything held back and let go of the transports; called
+ * once the last thread is gone, and when batching is turned off.
+ */
+void
+nfsd_batch_flush(struct net *net)
+{
+	struct nfsd_batch *nb = batch(net);
+
+	if (nb)
+		batch_settle_all(nb, true);
+}
+
+/* Set the window, 0 for no batching, and the most replies held back. */
+int
+nfsd_batch_set(struct net *net, unsigned int usecs, unsigned int replies)
+{
+	struct nfsd_batch *nb = batch(net);
+
+	if (usecs > NFSD_BATCH_MAX_USECS || !replies ||
+	    replies > NFSD_BATCH_MAX_REPLIES)
+		return -EINVAL;
+	WRITE_ONCE(nb->nb_replies, replies);
+	WRITE_ONCE(nb->nb_usecs, usecs);
+	if (!usecs)
+		nfsd_batch_flush(net);
+	return 0;
+}
+
+/*
+ * Format the settings and counters into @buf for the reply_batch
+ * control file.
+ */
+int
+nfsd_batch_show(struct net *net, char *buf, int size)
+{
+	struct nfsd_batch *nb = batch(net);
+	struct nfsd_batch_stats sum = { 0 };
+	unsigned int conns = 0, corked = 0;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct nfsd_batch_stats *s = per_cpu_ptr(nb->nb_stats, cpu);
+
+		sum.replies += s->replies;
+		sum.sends += s->sends;
+		sum.full += s->full;
+		sum.expired += s->expired;
+		for (i = 0; i < NFSD_BATCH_BUCKETS; i++)
+			sum.per_send[i] += s->per_send[i];
+	}
+	for (i = 0; i < NFSD_BATCH_SLOTS; i++) {
+		conns += READ_ONCE(nb->nb_conns[i].bc_xprt) != NULL;
+		corked += READ_ONCE(nb->nb_conns[i].bc_corked);
+	}
+
+	return scnprintf(buf, size, "window_us %u\nmax_replies %u\n"
+			 "connections %u\ncorked %u\nreplies %lu\nsends %lu\n"
+			 "full %lu\nexpired %lu\n"
+			 "sends_by_replies 1:%lu 2:%lu 4:%lu 8:%lu 16:%lu\n",
+			 READ_ONCE(nb->nb_usecs), READ_ONCE(nb->nb_replies),
+			 conns, corked, sum.replies, sum.sends, sum.full,
+			 sum.expired, sum.per_send[0], sum.per_send[1],
+			 sum.per_send[2], sum.per_send[3], sum.per_send[4]);
+}
+
+int
+nfsd_batch_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_batch *nb;
+
+	nb = kzalloc(sizeof(*nb), GFP_KERNEL);
+	if (!nb)
+		return -ENOMEM;
+	nb->nb_stats = alloc_percpu(struct nfsd_batch_stats);
+	if (!nb->nb_stats) {
+		kfree(nb);
+		return -ENOMEM;
+	}
+	nb->nb_replies = NFSD_BATCH_DEFAULT_REPLIES;
+	spin_lock_init(&nb->nb_lock);
+	INIT_DELAYED_WORK(&nb->nb_work, batch_worker);
+	nn->batch = nb;
+	return 0;
+}
+
+void
+nfsd_batch_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_batch *nb = nn->batch;
+
+	if (!nb)
+		return;
+	cancel_delayed_work_sync(&nb->nb_work);
+	batch_settle_all(nb, true);
+	nn->batch = NULL;
+	free_percpu(nb->nb_stats);
+	kfree(nb);
+}
@@ -0,0 +1,25 @@
+/*
+ * Batched replies on TCP connections.
+ *
+ * The socket of a connection is corked while more of its requests are
+ * being served, so that their replies leave in as few packets as fit.
+ */
+
+#ifndef LINUX_NFSD_BATCH_H
+#define LINUX_NFSD_BATCH_H
+
+/* replies held back before they are pushed out regardless */
+#define NFSD_BATCH_DEFAULT_REPLIES	16
+
+struct net;
+struct svc_rqst;
+
+int	nfsd_batch_init(struct net *);
+void	nfsd_batch_shutdown(struct net *);
+void	nfsd_batch_begin(struct svc_rqst *);
+void	nfsd_batch_end(struct svc_rqst *);
+void	nfsd_batch_flush(struct net *);
+int	nfsd_batch_set(struct net *, unsigned int usecs, unsigned int replies);
+int	nfsd_batch_show(struct net *, char *, int);
+
+#endif /* LINUX_NFSD_BATCH_H */
@@ -0,0 +1,556 @@
+/*
+ * Dispatch microbenchmark.
+ *
+ * Socket and RPC overhead hide the CPU cost of our own code paths.  This
+ * builds requests in memory, the way svc_recv() and svc_process() would
+ * have left them, and hands them straight to nfsd_dispatch() on a few
+ * private kernel threads.  The per-stage cycle counters that nfsd_dispatch()
+ * and the code below it keep in the thread context (see stats.h) are
+ * collected after every call, but not added to the per-net totals.  The
+ * threads are marked with tc_bench, which keeps their calls out of the
+ * reply statistics, the traffic, hot handle and slow request tables,
+ * the capture ring, the lanes and the throttle as well.
+ *
+ * Each thread creates a file of its own in the benchmarked directory,
+ * then runs every procedure in nfsd_procedures3 a fixed number of times,
+ * in table order.  CREATE and MKDIR use a new name on every call; REMOVE
+ * and RMDIR, which come later in the table, delete those names again.
+ */
+
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/fs_struct.h>
+#include <linux/math64.h>
+#include <linux/sunrpc/svc_xprt.h>
+
+#include "nfsd.h"
+#include "xdr.h"
+#include "stats.h"
+#include "bench.h"
+#include "overload.h"
+
+#define BENCH_MAX_THREADS	64
+#define BENCH_MAX_ITERS		1000000
+#define BENCH_MAX_BLOCK		65536
+#define BENCH_NPROCS		NFSD3_NPROCS
+/* arguments, including WRITE data, are kept in one buffer */
+#define BENCH_ARGBUF_SIZE	(PAGE_SIZE + BENCH_MAX_BLOCK)
+
+struct bench_run {
+	struct auth_domain	*client;
+	struct knfsd_fh		dirfh;
+	unsigned int		iters;
+	unsigned int		blocksize;
+	struct svc_serv		serv;
+	struct svc_xprt		xprt;
+	atomic_t		running;
+	struct completion	done;
+};
+
+struct bench_thread {
+	struct bench_run	*run;
+	struct svc_rqst		*rqstp;
+	__be32			*argbuf;
+	char			name[32];
+	struct knfsd_fh		filefh;
+	int			error;
+	unsigned long		ops[BENCH_NPROCS];
+	unsigned long		errors[BENCH_NPROCS];
+	u64			cycles[BENCH_NPROCS][NFSD_NR_STAGES];
+};
+
+/* svc_max_payload() looks at both the transport class and the server */
+static struct svc_xprt_class bench_xprt_class = {
+	.xcl_name	 = "nfsd_bench",
+	.xcl_max_payload = RPCSVC_MAXPAYLOAD,
+};
+
+static DEFINE_MUTEX(bench_mutex);
+
+/* cache misses are not deferred; cache_check() waits for mountd instead */
+static struct cache_deferred_req *bench_defer(struct cache_req *req)
+{
+	return NULL;
+}
+
+static __be32 *bench_put_opaque(__be32 *p, const void *data, unsigned int len)
+{
+	*p++ = htonl(len);
+	if (len) {
+		p[XDR_QUADLEN(len) - 1] = 0;
+		memcpy(p, data, len);
+	}
+	return p + XDR_QUADLEN(len);
+}
+
+static __be32 *bench_put_fh(__be32 *p, struct knfsd_fh *fh)
+{
+	return bench_put_opaque(p, &fh->fh_base, fh->fh_size);
+}
+
+static __be32 *bench_put_name(__be32 *p, const char *name)
+{
+	return bench_put_opaque(p, name, strlen(name));
+}
+
+static __be32 *bench_put_sattr(__be32 *p, umode_t mode)
+{
+	*p++ = xdr_one;			/* set mode */
+	*p++ = htonl(mode);
+	*p++ = xdr_zero;		/* uid */
+	*p++ = xdr_zero;		/* gid */
+	*p++ = xdr_zero;		/* size */
+	*p++ = xdr_zero;		/* atime: don't change */
+	*p++ = xdr_zero;		/* mtime: don't change */
+	return p;
+}
+
+static __be32 *bench_put_write(struct bench_thread *bt, __be32 *p, int stable)
+{
+	unsigned int len = bt->run->blocksize;
+
+	p = bench_put_fh(p, &bt->filefh);
+	p = xdr_encode_hyper(p, 0);
+	*p++ = htonl(len);
+	*p++ = htonl(stable);
+	*p++ = htonl(len);
+	memset(p, 0x5a, XDR_QUADLEN(len) << 2);
+	return p + XDR_QUADLEN(len);
+}
+
+static __be32 *bench_put_tmpname(struct bench_thread *bt, __be32 *p,
+				 char kind, unsigned int iter)
+{
+	char name[48];
+
+	snprintf(name, sizeof(name), "%s.%c%u", bt->name, kind, iter);
+	return bench_put_name(p, name);
+}
+
+/*
+ * Build the arguments for call @iter of @procnum in the argument buffer.
+ * Returns the end of the arguments, or NULL for procedures that are not
+ * benchmarked.
+ */
+static __be32 *bench_encode(struct bench_thread *bt, u32 procnum,
+			    unsigned int iter)
+{
+	struct bench_run *run = bt->run;
+	__be32 *p = bt->argbuf;
+
+	switch (procnum) {
+	case NFS3PROC_NULL:
+		break;
+	case NFS3PROC_GETATTR:
+		p = bench_put_fh(p, &bt->filefh);
+		break;
+	case NFS3PROC_SETATTR:
+		p = bench_put_fh(p, &bt->filefh);
+		p = bench_put_sattr(p, 0644);
+		*p++ = xdr_zero;	/* no guard */
+		break;
+	case NFS3PROC_LOOKUP:
+		p = bench_put_fh(p, &run->dirfh);
+		p = bench_put_name(p, bt->name);
+		break;
+	case NFS3PROC_ACCESS:
+		p = bench_put_fh(p, &bt->filefh);
+		*p++ = htonl(0x3f);	/* all the access bits */
+		break;
+	case NFS3PROC_READ:
+		p = bench_put_fh(p, &bt->filefh);
+		p = xdr_encode_hyper(p, 0);
+		*p++ = htonl(run->blocksize);
+		break;
+	case NFS3PROC_WRITE:
+		p = bench_put_write(bt, p, NFS3_UNSTABLE);
+		break;
+	case NFS3PROC_CREATE:
+		p = bench_put_fh(p, &run->dirfh);
+		p = bench_put_tmpname(bt, p, 'f', iter);
+		*p++ = htonl(NFS3_CREATE_UNCHECKED);
+		p = bench_put_sattr(p, 0644);
+		break;
+	case NFS3PROC_MKDIR:
+		p = bench_put_fh(p, &run->dirfh);
+		p = bench_put_tmpname(bt, p, 'd', iter);
+		p = bench_put_sattr(p, 0755);
+		break;
+	case NFS3PROC_REMOVE:
+		p = bench_put_fh(p, &run->dirfh);
+		p = bench_put_tmpname(bt, p, 'f', iter);
+		break;
+	case NFS3PROC_RMDIR:
+		p = bench_put_fh(p, &run->dirfh);
+		p = bench_put_tmpname(bt, p, 'd', iter);
+		break;
+	case NFS3PROC_READDIR:
+		p = bench_put_fh(p, &run->dirfh);
+		p = xdr_encode_hyper(p, 0);	/* cookie */
+		*p++ = xdr_zero;		/* cookieverf */
+		*p++ = xdr_zero;
+		*p++ = htonl(4096);		/* count */
+		break;
+	case NFS3PROC_READDIRPLUS:
+		p = bench_put_fh(p, &run->dirfh);
+		p = xdr_encode_hyper(p, 0);
+		*p++ = xdr_zero;
+		*p++ = xdr_zero;
+		*p++ = htonl(4096);		/* dircount */
+		*p++ = htonl(32768);		/* maxcount */
+		break;
+	case NFS3PROC_FSSTAT:
+	case NFS3PROC_FSINFO:
+		p = bench_put_fh(p, &run->dirfh);
+		break;
+	default:
+		return NULL;
+	}
+	return p;
+}
+
+/*
+ * Run one call through nfsd_dispatch(), with its stage times added to
+ * @cycles if that is set.  Returns the NFS status of the reply, or a
+ * negative errno if the call did not produce one.
+ */
+static int bench_call(struct bench_thread *bt, u32 procnum, __be32 *end,
+		      u64 *cycles)
+{
+	struct svc_rqst *rqstp = bt->rqstp;
+	struct svc_procedure *proc = &nfsd_version3.vs_proc[procnum];
+	struct kvec *argv = &rqstp->rq_arg.head[0];
+	struct kvec *resv = &rqstp->rq_res.head[0];
+	__be32 stat = rpc_success;
+	int ok, s;
+
+	argv->iov_base = bt->argbuf;
+	argv->iov_len = (void *)end - (void *)bt->argbuf;
+	rqstp->rq_arg.len = argv->iov_len;
+	rqstp->rq_arg.page_len = 0;
+	rqstp->rq_arg.tail[0].iov_len = 0;
+
+	rqstp->rq_next_page = rqstp->rq_respages + 1;
+	resv->iov_base = page_address(rqstp->rq_respages[0]);
+	resv->iov_len = 0;
+	rqstp->rq_res.pages = rqstp->rq_respages + 1;
+	rqstp->rq_res.len = 0;
+	rqstp->rq_res.page_base = 0;
+	rqstp->rq_res.page_len = 0;
+	rqstp->rq_res.buflen = PAGE_SIZE;
+	rqstp->rq_res.tail[0].iov_base = NULL;
+	rqstp->rq_res.tail[0].iov_len = 0;
+	clear_bit(RQ_DROPME, &rqstp->rq_flags);
+
+	rqstp->rq_proc = procnum;
+	rqstp->rq_procinfo = proc;
+	memset(rqstp->rq_argp, 0, proc->pc_argsize);
+	memset(rqstp->rq_resp, 0, proc->pc_ressize);
+
+	nfsd_overload_note(rqstp);
+	nfsd_stage_begin(rqstp);
+	ok = nfsd_dispatch(rqstp, &stat);
+	if (proc->pc_release)
+		proc->pc_release(rqstp, NULL, rqstp->rq_resp);
+	nfsd_stage_end(rqstp);
+	nfsd_overload_end(rqstp);
+	if (cycles)
+		for (s = 0; s < NFSD_NR_STAGES; s++)
+			cycles[s] += nfsd_rqst_ctx(rqstp)->tc_stage_cycles[s];
+
+	if (!ok || stat != rpc_success)
+		return -EIO;
+	if (procnum == NFS3PROC_NULL)
+		return 0;
+	return ntohl(*(__be32 *)resv->iov_base);
+}
+
+/* create the thread's file and write a block, for READ to read */
+static int bench_setup(struct bench_thread *bt)
+{
+	__be32 *p = bt->argbuf;
+	u32 size;
+	int status;
+
+	p = bench_put_fh(p, &bt->run->dirfh);
+	p = bench_put_name(p, bt->name);
+	*p++ = htonl(NFS3_CREATE_UNCHECKED);
+	p = bench_put_sattr(p, 0644);
+	status = bench_call(bt, NFS3PROC_CREATE, p, NULL);
+	if (status)
+		return status < 0 ? status : -EIO;
+
+	/* status, then the post_op_fh3 */
+	p = page_address(bt->rqstp->rq_respages[0]);
+	size = ntohl(p[2]);
+	if (!p[1] || size > NFS3_FHSIZE)
+		return -EIO;
+	bt->filefh.fh_size = size;
+	memcpy(&bt->filefh.fh_base, p + 3, size);
+
+	p = bench_put_write(bt, bt->argbuf, NFS3_FILE_SYNC);
+	status = bench_call(bt, NFS3PROC_WRITE, p, NULL);
+	return status ? -EIO : 0;
+}
+
+static void bench_cleanup(struct bench_thread *bt)
+{
+	__be32 *p = bt->argbuf;
+
+	p = bench_put_fh(p, &bt->run->dirfh);
+	p = bench_put_name(p, bt->name);
+	bench_call(bt, NFS3PROC_REMOVE, p, NULL);
+}
+
+static int bench_thread(void *data)
+{
+	struct bench_thread *bt = data;
+	struct bench_run *run = bt->run;
+	unsigned int i;
+	u32 procnum;
+	__be32 *end;
+	int status;
+
+	/* as in nfsd(): create files with the modes we ask for */
+	if (unshare_fs_struct() < 0) {
+		bt->error = -ENOMEM;
+		goto out;
+	}
+	current->fs->umask = 0;
+
+	bt->error = bench_setup(bt);
+	if (bt->error)
+		goto out;
+
+	for (procnum = 0; procnum < nfsd_version3.vs_nproc; procnum++) {
+		if (!nfsd_version3.vs_proc[procnum].pc_func)
+			continue;
+		for (i = 0; i < run->iters; i++) {
+			end = bench_encode(bt, procnum, i);
+			if (!end)
+				break;
+			status = bench_call(bt, procnum, end,
+					    bt->cycles[procnum]);
+			if (status < 0) {
+				bt->error = status;
+				goto out_cleanup;
+			}
+			bt->ops[procnum]++;
+			if (status)
+				bt->errors[procnum]++;
+			cond_resched();
+		}
+	}
+
+out_cleanup:
+	bench_cleanup(bt);
+out:
+	if (atomic_dec_and_test(&run->running))
+		complete(&run->done);
+	return 0;
+}
+
+static void bench_free_rqst(struct svc_rqst *rqstp)
+{
+	unsigned int i;
+
+	if (!rqstp)
+		return;
+	for (i = 0; i < RPCSVC_MAXPAGES; i++)
+		if (rqstp->rq_pages[i])
+			put_page(rqstp->rq_pages[i]);
+	kfree(rqstp->rq_argp);
+	kfree(rqstp->rq_resp);
+	kfree(rqstp);
+}
+
+/* a request set up the way svc_prepare_thread() and svc_recv() would */
+static struct svc_rqst *bench_alloc_rqst(struct bench_run *run)
+{
+	struct svc_rqst *rqstp;
+	unsigned int i;
+
+	rqstp = kzalloc(sizeof(*rqstp), GFP_KERNEL);
+	if (!rqstp)
+		return NULL;
+	rqstp->rq_argp = kzalloc(NFSD_SVC_XDRSIZE, GFP_KERNEL);
+	rqstp->rq_resp = kzalloc(NFSD_SVC_XDRSIZE, GFP_KERNEL);
+	if (!rqstp->rq_argp || !rqstp->rq_resp)
+		goto out_free;
+	for (i = 0; i < RPCSVC_MAXPAGES; i++) {
+		rqstp->rq_pages[i] = alloc_page(GFP_KERNEL);
+		if (!rqstp->rq_pages[i])
+			goto out_free;
+	}
+	rqstp->rq_respages = rqstp->rq_pages;
+
+	rqstp->rq_server = &run->serv;
+	rqstp->rq_xprt = &run->xprt;
+	rqstp->rq_client = run->client;
+	rqstp->rq_prog = NFS_PROGRAM;
+	rqstp->rq_vers = 3;
+	rqstp->rq_cred.cr_flavor = RPC_AUTH_UNIX;
+	rqstp->rq_cred.cr_uid = GLOBAL_ROOT_UID;
+	rqstp->rq_cred.cr_gid = GLOBAL_ROOT_GID;
+	rqstp->rq_chandle.defer = bench_defer;
+	rqstp->rq_chandle.thread_wait = 5 * HZ;
+	nfsd_rqst_ctx(rqstp)->tc_rqstp = rqstp;
+	nfsd_rqst_ctx(rqstp)->tc_bench = true;
+	return rqstp;
+
+out_free:
+	bench_free_rqst(rqstp);
+	return NULL;
+}
+
+static int bench_report(struct bench_run *run, struct bench_thread *threads,
+			int nthreads, u64 elapsed_ns, char *buf, int size)
+{
+	unsigned long ops, errors;
+	u64 cycles[NFSD_NR_STAGES], total;
+	int len, i, t, s;
+	u32 procnum;
+
+	len = scnprintf(buf, size,
+			"threads %d iterations %u blocksize %u elapsed_ms %llu\n"
+			"%-12s %8s %6s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n",
+			nthreads, run->iters, run->blocksize,
+			(unsigned long long)div_u64(elapsed_ns, NSEC_PER_MSEC),
+			"proc", "ops", "errors", "decode", "fh_verify",
+			"setuser", "proc", "vfs", "commit", "getattr",
+			"encode", "total");
+	for (procnum = 0; procnum < nfsd_version3.vs_nproc; procnum++) {
+		ops = errors = 0;
+		memset(cycles, 0, sizeof(cycles));
+		for (t = 0; t < nthreads; t++) {
+			ops += threads[t].ops[procnum];
+			errors += threads[t].errors[procnum];
+			for (s = 0; s < NFSD_NR_STAGES; s++)
+				cycles[s] += threads[t].cycles[procnum][s];
+		}
+		if (!ops)
+			continue;
+		total = 0;
+		for (s = 0; s < NFSD_NR_STAGES; s++) {
+			total += cycles[s];
+			cycles[s] = div64_u64(cycles[s], ops);
+		}
+		len += scnprintf(buf + len, size - len,
+				 "%-12s %8lu %6lu %8llu %8llu %8llu %8llu %8llu"
+				 " %8llu %8llu %8llu %8llu\n",
+				 nfsd3_procname[procnum], ops, errors,
+				 (unsigned long long)cycles[NFSD_STAGE_DECODE],
+				 (unsigned long long)cycles[NFSD_STAGE_FH_VERIFY],
+				 (unsigned long long)cycles[NFSD_STAGE_SETUSER],
+				 (unsigned long long)cycles[NFSD_STAGE_PROC],
+				 (unsigned long long)cycles[NFSD_STAGE_VFS],
+				 (unsigned long long)cycles[NFSD_STAGE_COMMIT],
+				 (unsigned long long)cycles[NFSD_STAGE_GETATTR],
+				 (unsigned long long)cycles[NFSD_STAGE_ENCODE],
+				 (unsigned long long)div64_u64(total, ops));
+	}
+	for (i = 0; i < nthreads; i++)
+		if (threads[i].error)
+			len += scnprintf(buf + len, size - len,
+					 "thread %d failed: %d\n", i,
+					 threads[i].error);
+	return len;
+}
+
+/**
+ * nfsd_dispatch_bench - time nfsd_dispatch() on synthetic requests
+ * @net: network namespace whose export table is used
+ * @client: client domain the requests appear to come from
+ * @path: exported directory to work in
+ * @nthreads: number of benchmark threads
+ * @iters: calls per procedure per thread
+ * @blocksize: READ and WRITE size
+ * @buf: filled with the report; may hold @client and @path on entry
+ * @size: size of @buf
+ *
+ * Returns the length of the report, or a negative errno.
+ */
+int nfsd_dispatch_bench(struct net *net, char *client, char *path,
+			int nthreads, int iters, int blocksize,
+			char *buf, int size)
+{
+	struct bench_thread *threads = NULL;
+	struct bench_run *run;
+	struct task_struct *task;
+	ktime_t start;
+	u64 elapsed;
+	int i, err;
+
+	if (nthreads < 1 || nthreads > BENCH_MAX_THREADS ||
+	    iters < 1 || iters > BENCH_MAX_ITERS ||
+	    blocksize < 1 || blocksize > BENCH_MAX_BLOCK)
+		return -EINVAL;
+	if (!mutex_trylock(&bench_mutex))
+		return -EBUSY;
+
+	err = -ENOMEM;
+	run = kzalloc(sizeof(*run), GFP_KERNEL);
+	if (!run)
+		goto out_unlock;
+	run->iters = iters;
+	run->blocksize = blocksize;
+	run->serv.sv_max_payload = RPCSVC_MAXPAYLOAD;
+	run->xprt.xpt_class = &bench_xprt_class;
+	run->xprt.xpt_net = net;
+	init_completion(&run->done);
+
+	run->client = unix_domain_find(client);
+	if (!run->client)
+		goto out_free_run;
+	err = exp_rootfh(net, run->client, path, &run->dirfh, NFS3_FHSIZE);
+	if (err)
+		goto out_put_client;
+
+	err = -ENOMEM;
+	threads = kcalloc(nthreads, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		goto out_put_client;
+	for (i = 0; i < nthreads; i++) {
+		threads[i].run = run;
+		snprintf(threads[i].name, sizeof(threads[i].name),
+			 "nfsd_bench.%d", i);
+		threads[i].rqstp = bench_alloc_rqst(run);
+		threads[i].argbuf = kmalloc(BENCH_ARGBUF_SIZE, GFP_KERNEL);
+		if (!threads[i].rqstp || !threads[i].argbuf)
+			goto out_free_threads;
+	}
+
+	err = 0;
+	start = ktime_get();
+	atomic_set(&run->running, 1);
+	for (i = 0; i < nthreads; i++) {
+		atomic_inc(&run->running);
+		task = kthread_run(bench_thread, &threads[i], "nfsd_bench/%d", i);
+		if (IS_ERR(task)) {
+			atomic_dec(&run->running);
+			err = PTR_ERR(task);
+			break;
+		}
+	}
+	if (!atomic_dec_and_test(&run->running))
+		wait_for_completion(&run->done);
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	if (!err)
+		err = bench_report(run, threads, nthreads, elapsed, buf, size);
+
+out_free_threads:
+	for (i = 0; i < nthreads; i++) {
+		bench_free_rqst(threads[i].rqstp);
+		kfree(threads[i].argbuf);
+	}
+	kfree(threads);
+out_put_client:
+	auth_domain_put(run->client);
+out_free_run:
+	kfree(run);
+out_unlock:
+	mutex_unlock(&bench_mutex);
+	return err;
+}
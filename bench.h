@@ -0,0 +1,18 @@
+/*
+ * In-kernel dispatch microbenchmark.
+ *
+ * Runs the NFSv3 procedures through nfsd_dispatch() on private kernel
+ * threads, without a transport, and reports the cost of decoding, of
+ * the procedure itself and of encoding.
+ */
+
+#ifndef LINUX_NFSD_BENCH_H
+#define LINUX_NFSD_BENCH_H
+
+struct net;
+
+int	nfsd_dispatch_bench(struct net *, char *client, char *path,
+				int nthreads, int iters, int blocksize,
+				char *buf, int size);
+
+#endif /* LINUX_NFSD_BENCH_H */
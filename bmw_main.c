@@ -7,6 +7,7 @@
 #include <linux/slab.h>
 #include <linux/namei.h>
 #include <linux/ctype.h>
+#include <linux/seq_file.h>
 
 #include <linux/sunrpc/svcsock.h>
 #include <linux/lockd/lockd.h>
@@ -17,6 +18,24 @@
 #include "nfsd.h"
 #include "nfsfh.h"
 #include "netns.h"
+#include "negcache.h"
+#include "bench.h"
+#include "capture.h"
+#include "stats.h"
+#include "slowops.h"
+#include "inflight.h"
+#include "traffic.h"
+#include "hotfh.h"
+#include "statpage.h"
+#include "listener.h"
+#include "affinity.h"
+#include "busypoll.h"
+#include "sched.h"
+#include "lanes.h"
+#include "overload.h"
+#include "throttle.h"
+#include "payload.h"
+#include "batch.h"
 
 /*
  *	We have a single directory with several nodes in it.
@@ -25,6 +44,35 @@ enum {
 	NFSD_Root = 1,
 	NFSD_Fh,
 	NFSD_Threads,
+	NFSD_LookupCache,
+	NFSD_FhCache,
+	NFSD_ExportStats,
+	NFSD_DispatchBench,
+	NFSD_CaptureCtl,
+	NFSD_Capture,
+	NFSD_StageStats,
+	NFSD_SlowOpsCtl,
+	NFSD_SlowOps,
+	NFSD_Inflight,
+	NFSD_Watchdog,
+	NFSD_Clients,
+	NFSD_Exports,
+	NFSD_HotHandlesCtl,
+	NFSD_HotHandles,
+	NFSD_StatsPage,
+	NFSD_Listeners,
+	NFSD_PoolAffinity,
+	NFSD_BusyPoll,
+	NFSD_MaxBlkSize,
+	NFSD_FairShareCtl,
+	NFSD_FairShare,
+	NFSD_Lanes,
+	NFSD_Overload,
+	NFSD_OverloadClients,
+	NFSD_ThrottleCtl,
+	NFSD_Throttle,
+	NFSD_PayloadPages,
+	NFSD_ReplyBatch,
 	/*
 	 * The below MUST come last.  Otherwise we leave a hole in nfsd_files[]
 	 * with !CONFIG_NFSD_V4 and simple_fill_super() goes oops
@@ -38,10 +86,48 @@ int nfsd_max_blksize;
  */
 static ssize_t write_filehandle(struct file *file, char *buf, size_t size);
 static ssize_t write_threads(struct file *file, char *buf, size_t size);
+static ssize_t write_lookup_cache(struct file *file, char *buf, size_t size);
+static ssize_t write_fh_cache(struct file *file, char *buf, size_t size);
+static ssize_t write_export_stats(struct file *file, char *buf, size_t size);
+static ssize_t write_dispatch_bench(struct file *file, char *buf, size_t size);
+static ssize_t write_capture_ctl(struct file *file, char *buf, size_t size);
+static ssize_t write_stage_stats(struct file *file, char *buf, size_t size);
+static ssize_t write_slowops_ctl(struct file *file, char *buf, size_t size);
+static ssize_t write_watchdog(struct file *file, char *buf, size_t size);
+static ssize_t write_hot_handles_ctl(struct file *file, char *buf, size_t size);
+static ssize_t write_listeners(struct file *file, char *buf, size_t size);
+static ssize_t write_pool_affinity(struct file *file, char *buf, size_t size);
+static ssize_t write_busy_poll(struct file *file, char *buf, size_t size);
+static ssize_t write_maxblksize(struct file *file, char *buf, size_t size);
+static ssize_t write_fair_share_ctl(struct file *file, char *buf, size_t size);
+static ssize_t write_lanes(struct file *file, char *buf, size_t size);
+static ssize_t write_overload(struct file *file, char *buf, size_t size);
+static ssize_t write_throttle_ctl(struct file *file, char *buf, size_t size);
+static ssize_t write_payload_pages(struct file *file, char *buf, size_t size);
+static ssize_t write_reply_batch(struct file *file, char *buf, size_t size);
 
 static ssize_t (*write_op[])(struct file *, char *, size_t) = {
 	[NFSD_Fh] = write_filehandle,
 	[NFSD_Threads] = write_threads,
+	[NFSD_LookupCache] = write_lookup_cache,
+	[NFSD_FhCache] = write_fh_cache,
+	[NFSD_ExportStats] = write_export_stats,
+	[NFSD_DispatchBench] = write_dispatch_bench,
+	[NFSD_CaptureCtl] = write_capture_ctl,
+	[NFSD_StageStats] = write_stage_stats,
+	[NFSD_SlowOpsCtl] = write_slowops_ctl,
+	[NFSD_Watchdog] = write_watchdog,
+	[NFSD_HotHandlesCtl] = write_hot_handles_ctl,
+	[NFSD_Listeners] = write_listeners,
+	[NFSD_PoolAffinity] = write_pool_affinity,
+	[NFSD_BusyPoll] = write_busy_poll,
+	[NFSD_MaxBlkSize] = write_maxblksize,
+	[NFSD_FairShareCtl] = write_fair_share_ctl,
+	[NFSD_Lanes] = write_lanes,
+	[NFSD_Overload] = write_overload,
+	[NFSD_ThrottleCtl] = write_throttle_ctl,
+	[NFSD_PayloadPages] = write_payload_pages,
+	[NFSD_ReplyBatch] = write_reply_batch,
 };
 
 static ssize_t nfsctl_transaction_write(struct file *file, const char __user *buf, size_t size, loff_t *pos)
@@ -96,6 +182,128 @@ static inline struct net *netns(struct file *file)
 	return file_inode(file)->i_sb->s_fs_info;
 }
 
+/*
+ * The capture log is a stream of binary records rather than a
+ * transaction, see capture.c.
+ */
+static ssize_t capture_read(struct file *file, char __user *buf, size_t size,
+			    loff_t *pos)
+{
+	return nfsd_capture_read(netns(file), buf, size,
+				 file->f_flags & O_NONBLOCK);
+}
+
+static const struct file_operations capture_ops = {
+	.read		= capture_read,
+	.llseek		= noop_llseek,
+};
+
+/* the slow operation log can be longer than a transaction, see slowops.c */
+static int slowops_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nfsd_slowops_seq_show, inode->i_sb->s_fs_info);
+}
+
+static const struct file_operations slowops_ops = {
+	.open		= slowops_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int inflight_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nfsd_inflight_seq_show, inode->i_sb->s_fs_info);
+}
+
+static const struct file_operations inflight_ops = {
+	.open		= inflight_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int clients_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nfsd_traffic_clients_show,
+			   inode->i_sb->s_fs_info);
+}
+
+static const struct file_operations clients_ops = {
+	.open		= clients_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int exports_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nfsd_traffic_exports_show,
+			   inode->i_sb->s_fs_info);
+}
+
+static const struct file_operations exports_ops = {
+	.open		= exports_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int hot_handles_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nfsd_hotfh_seq_show, inode->i_sb->s_fs_info);
+}
+
+static const struct file_operations hot_handles_ops = {
+	.open		= hot_handles_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int fair_share_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nfsd_sched_seq_show, inode->i_sb->s_fs_info);
+}
+
+static const struct file_operations fair_share_ops = {
+	.open		= fair_share_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int overload_clients_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nfsd_overload_seq_show, inode->i_sb->s_fs_info);
+}
+
+static const struct file_operations overload_clients_ops = {
+	.open		= overload_clients_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int throttle_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nfsd_throttle_seq_show, inode->i_sb->s_fs_info);
+}
+
+static const struct file_operations throttle_ops = {
+	.open		= throttle_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* binary counters for monitoring agents to mmap, see statpage.c */
+static const struct file_operations stats_page_ops = {
+	.mmap		= nfsd_statpage_mmap,
+	.read		= nfsd_statpage_read,
+	.llseek		= default_llseek,
+};
+
 /**
  * write_filehandle - Get a variable-length NFS file handle by path
  *
@@ -221,84 +429,1179 @@ static ssize_t write_threads(struct file *file, char *buf, size_t size)
 	return scnprintf(buf, SIMPLE_TRANSACTION_LIMIT, "%d\n", rv);
 }
 
-/*----------------------------------------------------------------------------*/
-/*
- *	populating the filesystem.
+/**
+ * write_lookup_cache - Report or flush the negative LOOKUP cache
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			"name value" lines: hits, misses, stale, inserts
+ *			and the number of cache slots;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		"flush"
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	all cached entries are dropped, and the counters
+ *			are reported as above
+ *	On error:	return code is a negative errno value
  */
-
-static int nfsd_fill_super(struct super_block * sb, void * data, int silent)
+static ssize_t write_lookup_cache(struct file *file, char *buf, size_t size)
 {
-	static struct tree_descr nfsd_files[] = {
-		[NFSD_Fh] = {"filehandle", &transaction_ops, S_IWUSR|S_IRUSR},
-		[NFSD_Threads] = {"threads", &transaction_ops, S_IWUSR|S_IRUSR},
-		/* last one */ {""}
-	};
-	get_net(sb->s_fs_info);
-	return simple_fill_super(sb, 0x6e667364, nfsd_files);
+	char *mesg = buf;
+	struct net *net = netns(file);
+
+	if (size > 0) {
+		int len = qword_get(&mesg, buf, size);
+
+		if (len <= 0 || strcmp(buf, "flush"))
+			return -EINVAL;
+		nfsd_negcache_flush(net);
+	}
+
+	return nfsd_negcache_show(net, buf, SIMPLE_TRANSACTION_LIMIT);
 }
 
-static struct dentry *nfsd_mount(struct file_system_type *fs_type,
-	int flags, const char *dev_name, void *data)
+/**
+ * write_fh_cache - Report or flush the file handle encode cache
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			"name value" lines: hits, misses, inserts, purged
+ *			and the number of cache slots;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		"flush"
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	all cached handles are dropped, and the counters
+ *			are reported as above
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_fh_cache(struct file *file, char *buf, size_t size)
 {
-	struct net *net = current->nsproxy->net_ns;
-	return mount_ns(fs_type, flags, data, net, net->user_ns, nfsd_fill_super);
+	char *mesg = buf;
+
+	if (size > 0) {
+		int len = qword_get(&mesg, buf, size);
+
+		if (len <= 0 || strcmp(buf, "flush"))
+			return -EINVAL;
+		fh_cache_purge(NULL);
+	}
+
+	return fh_cache_show(buf, SIMPLE_TRANSACTION_LIMIT);
 }
 
-static void nfsd_umount(struct super_block *sb)
+/**
+ * write_export_stats - Report export cache hash statistics
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with two '\n'-terminated
+ *			lines per cache: the number of hash buckets,
+ *			entries, non-empty buckets, the longest and average
+ *			chain and a histogram of chain lengths; then the
+ *			number of entries in the lookup index and its hit
+ *			and miss counts; last, the hit and miss counts of
+ *			the per-thread export memo;
+ *			return code is the size in bytes of the string
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_export_stats(struct file *file, char *buf, size_t size)
 {
-	struct net *net = sb->s_fs_info;
+	if (size > 0)
+		return -EINVAL;
 
-	kill_litter_super(sb);
-	put_net(net);
+	return nfsd_export_stats(netns(file), buf, SIMPLE_TRANSACTION_LIMIT);
 }
 
-static struct file_system_type nfsd_fs_type = {
-	.owner		= THIS_MODULE,
-	.name		= "nfsd",
-	.mount		= nfsd_mount,
-	.kill_sb	= nfsd_umount,
-};
-MODULE_ALIAS_FS("nfsd");
+/**
+ * write_dispatch_bench - Time nfsd_dispatch() without a transport
+ *
+ * On input, the buffer contains a '\n'-terminated C string comprised of
+ * four or five words separated by whitespace.  The calls are made on
+ * private kernel threads, each of which creates and removes files of
+ * its own in the export.
+ *
+ * Input:
+ *			buf:
+ *				domain:		client domain name
+ *				path:		exported directory to use
+ *				threads:	number of threads to run
+ *				iterations:	calls per procedure per
+ *						thread
+ *				blocksize:	optional READ and WRITE
+ *						size, default 4096
+ *			size:	length of C string in @buf
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			lines: the run parameters and elapsed time, then
+ *			one line per procedure with the number of calls,
+ *			the number that returned an NFS error, and the
+ *			average cycles per call spent in each stage of
+ *			nfsd_dispatch() (see stats.h) and in total;
+ *			return code is the size in bytes of the string
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_dispatch_bench(struct file *file, char *buf, size_t size)
+{
+	char *dname, *path;
+	char *mesg = buf;
+	int nthreads, iters, blocksize;
+	int len;
 
-int nfsd_net_id;
+	if (size == 0 || buf[size-1] != '\n')
+		return -EINVAL;
+	buf[size-1] = 0;
 
-static __net_init int nfsd_init_net(struct net *net)
-{
-	int retval;
-	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	dname = mesg;
+	len = qword_get(&mesg, dname, size);
+	if (len <= 0)
+		return -EINVAL;
 
-	retval = nfsd_export_init(net);
-	if (retval)
-		goto out_export_error;
+	path = dname+len+1;
+	len = qword_get(&mesg, path, size);
+	if (len <= 0)
+		return -EINVAL;
 
-	atomic_set(&nn->ntf_refcnt, 0);
-	init_waitqueue_head(&nn->ntf_wq);
-	return 0;
+	len = get_int(&mesg, &nthreads);
+	if (len)
+		return len;
+	len = get_int(&mesg, &iters);
+	if (len)
+		return len;
+	len = get_int(&mesg, &blocksize);
+	if (len == -ENOENT)
+		blocksize = 4096;
+	else if (len)
+		return len;
 
-out_export_error:
-	return retval;
+	return nfsd_dispatch_bench(netns(file), dname, path, nthreads, iters,
+				   blocksize, buf, SIMPLE_TRANSACTION_LIMIT);
 }
 
-static __net_exit void nfsd_exit_net(struct net *net)
+/**
+ * write_capture_ctl - Start, stop or report RPC capture
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			"name value" lines: whether capture is on, the
+ *			ring size, the unread bytes in it and the number
+ *			of records logged and dropped;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		"start", optionally followed by the
+ *					ring size in kilobytes (default
+ *					4096), or "stop"
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	capture is started with an empty ring, or
+ *			stopped; the counters are reported as above.
+ *			Records are read from the "capture" file
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_capture_ctl(struct file *file, char *buf, size_t size)
 {
-	nfsd_export_shutdown(net);
+	char *mesg = buf;
+	struct net *net = netns(file);
+	int kbytes, rv;
+
+	if (size > 0) {
+		int len = qword_get(&mesg, buf, size);
+
+		if (len <= 0)
+			return -EINVAL;
+		if (!strcmp(buf, "start")) {
+			rv = get_int(&mesg, &kbytes);
+			if (rv == -ENOENT)
+				kbytes = 4096;
+			else if (rv)
+				return rv;
+			rv = nfsd_capture_start(net, kbytes);
+			if (rv)
+				return rv;
+		} else if (!strcmp(buf, "stop"))
+			nfsd_capture_stop(net);
+		else
+			return -EINVAL;
+	}
+
+	return nfsd_capture_show(net, buf, SIMPLE_TRANSACTION_LIMIT);
 }
 
-static struct pernet_operations nfsd_net_ops = {
-	.init = nfsd_init_net,
-	.exit = nfsd_exit_net,
-	.id   = &nfsd_net_id,
-	.size = sizeof(struct nfsd_net),
-};
+/**
+ * write_stage_stats - Report or reset per-stage request timing
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			lines: a header naming the stages, then one line
+ *			per NFSv3 procedure that has been called, with
+ *			the number of calls and the average cycles per
+ *			call spent in each stage;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		"reset"
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	the totals are cleared, and reported as above
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_stage_stats(struct file *file, char *buf, size_t size)
+{
+	char *mesg = buf;
+	struct net *net = netns(file);
 
-static int __init init_nfsd(void)
+	if (size > 0) {
+		int len = qword_get(&mesg, buf, size);
+
+		if (len <= 0 || strcmp(buf, "reset"))
+			return -EINVAL;
+		nfsd_stats_reset(net);
+	}
+
+	return nfsd_stage_show(net, buf, SIMPLE_TRANSACTION_LIMIT);
+}
+
+/**
+ * write_slowops_ctl - Set or report the slow operation threshold
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			"name value" lines: the threshold in milliseconds,
+ *			the number of requests logged and the number the
+ *			ring keeps;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		"threshold" followed by a time in
+ *					milliseconds, 0 to turn the log
+ *					off; or "clear"
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	the threshold is set, or the ring emptied, and
+ *			the settings are reported as above.  Logged
+ *			requests are read from the "slowops" file
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_slowops_ctl(struct file *file, char *buf, size_t size)
 {
-	int retval;
-	printk(KERN_INFO "Installing knfsd (copyright (C) 1996 okir@monad.swb.de).\n");
+	char *mesg = buf;
+	struct net *net = netns(file);
+	int msecs, rv;
 
-	retval = register_pernet_subsys(&nfsd_net_ops);
-	if (retval < 0)
-		return retval;
+	if (size > 0) {
+		int len = qword_get(&mesg, buf, size);
+
+		if (len <= 0)
+			return -EINVAL;
+		if (!strcmp(buf, "threshold")) {
+			rv = get_int(&mesg, &msecs);
+			if (rv)
+				return rv;
+			if (msecs < 0)
+				return -EINVAL;
+			rv = nfsd_slowops_set_threshold(net, msecs);
+			if (rv)
+				return rv;
+		} else if (!strcmp(buf, "clear"))
+			nfsd_slowops_clear(net);
+		else
+			return -EINVAL;
+	}
+
+	return nfsd_slowops_show(net, buf, SIMPLE_TRANSACTION_LIMIT);
+}
+
+/**
+ * write_watchdog - Set or report the stuck request watchdog threshold
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			"name value" lines: the threshold in seconds and
+ *			the number of reports logged so far;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		C string containing the number of
+ *					seconds a request may be in flight
+ *					before it is reported, 0 to turn
+ *					the watchdog off
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	the threshold is set, and reported as above.
+ *			Requests in flight are listed by the "inflight"
+ *			file
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_watchdog(struct file *file, char *buf, size_t size)
+{
+	char *mesg = buf;
+	struct net *net = netns(file);
+	int secs, rv;
+
+	if (size > 0) {
+		rv = get_int(&mesg, &secs);
+		if (rv)
+			return rv;
+		if (secs < 0)
+			return -EINVAL;
+		rv = nfsd_watchdog_set_threshold(net, secs);
+		if (rv)
+			return rv;
+	}
+
+	return nfsd_watchdog_show(net, buf, SIMPLE_TRANSACTION_LIMIT);
+}
+
+/**
+ * write_hot_handles_ctl - Report or clear the hot file handle sketch
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			"name value" lines: the sketch depth and width,
+ *			how many handles it keeps and how many it has;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		"clear"
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	all counts are dropped and the settings are
+ *			reported as above.  The handles themselves are
+ *			read from the "hot_handles" file
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_hot_handles_ctl(struct file *file, char *buf, size_t size)
+{
+	char *mesg = buf;
+	struct net *net = netns(file);
+
+	if (size > 0) {
+		int len = qword_get(&mesg, buf, size);
+
+		if (len <= 0 || strcmp(buf, "clear"))
+			return -EINVAL;
+		nfsd_hotfh_clear(net);
+	}
+
+	return nfsd_hotfh_show(net, buf, SIMPLE_TRANSACTION_LIMIT);
+}
+
+static ssize_t __write_listeners(struct file *file, char *buf, size_t size)
+{
+	char *mesg = buf;
+	struct net *net = netns(file);
+	char cmd[8], proto[8], addr[64];
+	struct sockaddr_storage ss;
+	struct sockaddr *sap = (struct sockaddr *)&ss;
+	int fd, port, rv;
+
+	if (size > 0) {
+		if (qword_get(&mesg, cmd, sizeof(cmd)) <= 0)
+			return -EINVAL;
+		if (!strcmp(cmd, "fd")) {
+			rv = get_int(&mesg, &fd);
+			if (rv)
+				return rv;
+			if (fd < 0)
+				return -EINVAL;
+			rv = nfsd_listener_addfd(net, fd);
+			if (rv)
+				return rv;
+			goto out;
+		}
+		if (qword_get(&mesg, proto, sizeof(proto)) <= 0 ||
+		    qword_get(&mesg, addr, sizeof(addr)) <= 0)
+			return -EINVAL;
+		rv = get_int(&mesg, &port);
+		if (rv)
+			return rv;
+		if (port <= 0 || port > USHRT_MAX)
+			return -EINVAL;
+		if (!rpc_pton(net, addr, strlen(addr), sap, sizeof(ss)))
+			return -EINVAL;
+		rpc_set_port(sap, port);
+
+		if (!strcmp(cmd, "add"))
+			rv = nfsd_listener_add(net, proto, sap);
+		else if (!strcmp(cmd, "del"))
+			rv = nfsd_listener_del(net, proto, sap);
+		else
+			return -EINVAL;
+		if (rv)
+			return rv;
+	}
+
+out:
+	return nfsd_listener_show(net, buf, SIMPLE_TRANSACTION_LIMIT);
+}
+
+/**
+ * write_listeners - Add, remove or list listening sockets
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with one '\n'-terminated
+ *			line per listening address: the transport, the
+ *			address and port, and the number of sockets on it;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		"add", a transport ("tcp" or "udp"),
+ *					the IPv4 or IPv6 wildcard address
+ *					(0.0.0.0 or ::) and a port; or "fd"
+ *					and the descriptor of a bound socket
+ *					of the writing process, listening if
+ *					it is a TCP socket; or "del", a
+ *					transport, an address and a port
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	the listeners are opened, or closed, and listed
+ *			as above.  Listeners added before the threads are
+ *			started replace the default ones
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_listeners(struct file *file, char *buf, size_t size)
+{
+	ssize_t rv;
+
+	mutex_lock(&nfsd_mutex);
+	rv = __write_listeners(file, buf, size);
+	mutex_unlock(&nfsd_mutex);
+	return rv;
+}
+
+/**
+ * write_pool_affinity - Turn receive affinity on or off, or report it
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			"name value" lines: whether affinity is on, the
+ *			number of pools, and how many transports went to
+ *			a thread of their home pool, to an idle thread
+ *			of another pool, or were queued;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		1 to turn affinity on, 0 to turn it off
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	the mode is set and reported as above
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_pool_affinity(struct file *file, char *buf, size_t size)
+{
+	char *mesg = buf;
+	struct net *net = netns(file);
+	int enabled, rv;
+
+	if (size > 0) {
+		rv = get_int(&mesg, &enabled);
+		if (rv)
+			return rv;
+		if (enabled != 0 && enabled != 1)
+			return -EINVAL;
+		nfsd_affinity_set(net, enabled);
+	}
+
+	return nfsd_affinity_show(net, buf, SIMPLE_TRANSACTION_LIMIT);
+}
+
+/**
+ * write_busy_poll - Set the busy-poll window of idle threads, or report it
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			"name value" lines: the window in microseconds
+ *			(0 when busy-polling is off), the most threads
+ *			that may spin per pool, how many times a thread
+ *			spun, how many of those found work, and how many
+ *			transports were handed to a spinning thread;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		"USECS [MAX_SPINNERS]", USECS at most
+ *					1000, 0 to turn busy-polling off
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	the settings are changed and reported as above
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_busy_poll(struct file *file, char *buf, size_t size)
+{
+	char *mesg = buf;
+	struct net *net = netns(file);
+	int usecs, spinners, rv;
+
+	if (size > 0) {
+		rv = get_int(&mesg, &usecs);
+		if (rv)
+			return rv;
+		rv = get_int(&mesg, &spinners);
+		if (rv == -ENOENT)
+			spinners = NFSD_BUSYPOLL_DEFAULT_SPINNERS;
+		else if (rv)
+			return rv;
+		if (usecs < 0 || spinners < 0)
+			return -EINVAL;
+		rv = nfsd_busypoll_set(net, usecs, spinners);
+		if (rv)
+			return rv;
+	}
+
+	return nfsd_busypoll_show(net, buf, SIMPLE_TRANSACTION_LIMIT);
+}
+
+/**
+ * write_maxblksize - Set or report the largest READ/WRITE payload
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated C
+ *			string containing the largest READ or WRITE
+ *			payload, in bytes, the service is created with;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		C string containing an unsigned
+ *					integer value: the new size in bytes
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	the size, rounded down to a multiple of 1024 and
+ *			clamped to [1024, NFSSVC_MAXBLKSIZE], is used for
+ *			the next start of the service and reported as
+ *			above
+ *	On error:	return code is a negative errno value; -EBUSY
+ *			while the service is running
+ */
+static ssize_t write_maxblksize(struct file *file, char *buf, size_t size)
+{
+	char *mesg = buf;
+	struct net *net = netns(file);
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	int bsize, rv;
+
+	if (size > 0) {
+		rv = get_int(&mesg, &bsize);
+		if (rv)
+			return rv;
+		if (bsize <= 0)
+			return -EINVAL;
+		bsize = max_t(int, bsize, NFSSVC_MINBLKSIZE);
+		bsize = min_t(int, bsize, NFSSVC_MAXBLKSIZE);
+		bsize &= ~(NFSSVC_MINBLKSIZE - 1);
+		mutex_lock(&nfsd_mutex);
+		/* the pages of every thread are sized when it is created */
+		if (nn->nfsd_serv) {
+			mutex_unlock(&nfsd_mutex);
+			return -EBUSY;
+		}
+		nfsd_max_blksize = bsize;
+		mutex_unlock(&nfsd_mutex);
+	}
+
+	return scnprintf(buf, SIMPLE_TRANSACTION_LIMIT, "%d\n",
+			 nfsd_max_blksize ?: nfsd_get_default_max_blksize());
+}
+
+/**
+ * write_fair_share_ctl - Set up fair share across clients, or report it
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			"name value" lines: whether fair share is on, the
+ *			number and total weight of the active clients, how
+ *			many clients have connections held back, and how
+ *			many requests were served and connections held
+ *			back in all;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		"enable 1" or "enable 0"; or
+ *					"weight", an IPv4 or IPv6 client
+ *					address and a weight from 1 to
+ *					NFSD_SCHED_MAX_WEIGHT
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	the change is made and reported as above.  The
+ *			clients themselves are read from the
+ *			"fair_share" file
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_fair_share_ctl(struct file *file, char *buf, size_t size)
+{
+	char *mesg = buf;
+	struct net *net = netns(file);
+	char cmd[8], addr[64];
+	struct sockaddr_storage ss;
+	struct sockaddr *sap = (struct sockaddr *)&ss;
+	int value, rv;
+
+	if (size > 0) {
+		if (qword_get(&mesg, cmd, sizeof(cmd)) <= 0)
+			return -EINVAL;
+		if (!strcmp(cmd, "enable")) {
+			rv = get_int(&mesg, &value);
+			if (rv)
+				return rv;
+			if (value != 0 && value != 1)
+				return -EINVAL;
+			nfsd_sched_set(net, value);
+		} else if (!strcmp(cmd, "weight")) {
+			if (qword_get(&mesg, addr, sizeof(addr)) <= 0)
+				return -EINVAL;
+			if (!rpc_pton(net, addr, strlen(addr), sap, sizeof(ss)))
+				return -EINVAL;
+			rv = get_int(&mesg, &value);
+			if (rv)
+				return rv;
+			if (value <= 0)
+				return -EINVAL;
+			rv = nfsd_sched_set_weight(net, sap, value);
+			if (rv)
+				return rv;
+		} else
+			return -EINVAL;
+	}
+
+	return nfsd_sched_show(net, buf, SIMPLE_TRANSACTION_LIMIT);
+}
+
+/**
+ * write_lanes - Set the threads kept for metadata procedures, or report
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			"name value" lines: the threads kept for metadata,
+ *			the metadata and data procedures in progress, the
+ *			data procedures put off and waiting, the calls in
+ *			each lane, and how many data procedures ran on the
+ *			reserve, were put off, or could not be put off;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		C string containing an unsigned
+ *					integer value: the number of threads
+ *					to keep for metadata, 0 for none
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	the reserve is set and reported as above
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_lanes(struct file *file, char *buf, size_t size)
+{
+	char *mesg = buf;
+	struct net *net = netns(file);
+	int reserve, rv;
+
+	if (size > 0) {
+		rv = get_int(&mesg, &reserve);
+		if (rv)
+			return rv;
+		if (reserve < 0)
+			return -EINVAL;
+		rv = nfsd_lanes_set_reserve(net, reserve);
+		if (rv)
+			return rv;
+	}
+
+	return nfsd_lanes_show(net, buf, SIMPLE_TRANSACTION_LIMIT);
+}
+
+/**
+ * write_overload - Set the thresholds for shedding requests, or report
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			"name value" lines: the wait target, the per-client
+ *			quota and whether duplicates are dropped, how many
+ *			requests were admitted, answered with JUKEBOX for
+ *			waiting too long or for being over quota, or
+ *			dropped as duplicates, and the number, average
+ *			and longest of the queue waits measured;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		"target" and the longest wait in
+ *					milliseconds before a request is
+ *					shed; "quota" and the most requests
+ *					a client may have in progress; or
+ *					"duplicates 1" to drop retransmitted
+ *					calls still in progress.  0 turns
+ *					any of them off, which is the default
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	the change is made and reported as above.  The
+ *			counters per client are read from the
+ *			"overload_clients" file
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_overload(struct file *file, char *buf, size_t size)
+{
+	char *mesg = buf;
+	struct net *net = netns(file);
+	char name[12];
+	int value, rv;
+
+	if (size > 0) {
+		if (qword_get(&mesg, name, sizeof(name)) <= 0)
+			return -EINVAL;
+		rv = get_int(&mesg, &value);
+		if (rv)
+			return rv;
+		if (value < 0)
+			return -EINVAL;
+		rv = nfsd_overload_set(net, name, value);
+		if (rv)
+			return rv;
+	}
+
+	return nfsd_overload_show(net, buf, SIMPLE_TRANSACTION_LIMIT);
+}
+
+/**
+ * write_throttle_ctl - Set a rate limit for a client or an export, or
+ *			report
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			"name value" lines: the number of rules, the
+ *			requests put off and waiting now, and how many were
+ *			put off or had to wait in their thread in all;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		"client" and the name of an auth
+ *					domain, or "export" and an exported
+ *					path, followed by the calls and the
+ *					bytes per second allowed, 0 for no
+ *					limit.  Both 0 removes the rule
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	the rule is set and reported as above.  The
+ *			rules themselves are read from the "throttle" file
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_throttle_ctl(struct file *file, char *buf, size_t size)
+{
+	char *mesg = buf;
+	struct net *net = netns(file);
+	char kind[8], name[64], num[24];
+	u64 ops, bytes;
+	int rv;
+
+	if (size > 0) {
+		if (qword_get(&mesg, kind, sizeof(kind)) <= 0 ||
+		    qword_get(&mesg, name, sizeof(name)) <= 0)
+			return -EINVAL;
+		if (qword_get(&mesg, num, sizeof(num)) <= 0 ||
+		    kstrtoull(num, 10, &ops))
+			return -EINVAL;
+		if (qword_get(&mesg, num, sizeof(num)) <= 0 ||
+		    kstrtoull(num, 10, &bytes))
+			return -EINVAL;
+		rv = nfsd_throttle_set(net, kind, name, ops, bytes);
+		if (rv)
+			return rv;
+	}
+
+	return nfsd_throttle_show(net, buf, SIMPLE_TRANSACTION_LIMIT);
+}
+
+/**
+ * write_payload_pages - Set how many idle threads keep their payload
+ *			pages, or report
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			"name value" lines: the warm threads per pool, the
+ *			pages kept in reserve per node, the threads waiting
+ *			for work and parked, the pages in reserve now, and
+ *			how many times threads parked, how many pages they
+ *			gave back and how many were taken from the reserve;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		C string containing an unsigned
+ *					integer value: the threads per pool
+ *					that wait for work with their pages,
+ *					0 for all of them; optionally
+ *					followed by the pages to keep in
+ *					reserve per NUMA node, by default
+ *					NFSD_PAYLOAD_DEFAULT_RESERVE
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	the settings are made and reported as above
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_payload_pages(struct file *file, char *buf, size_t size)
+{
+	char *mesg = buf;
+	struct net *net = netns(file);
+	int warm, reserve, rv;
+
+	if (size > 0) {
+		rv = get_int(&mesg, &warm);
+		if (rv)
+			return rv;
+		rv = get_int(&mesg, &reserve);
+		if (rv == -ENOENT)
+			reserve = NFSD_PAYLOAD_DEFAULT_RESERVE;
+		else if (rv)
+			return rv;
+		if (warm < 0 || reserve < 0)
+			return -EINVAL;
+		rv = nfsd_payload_set(net, warm, reserve);
+		if (rv)
+			return rv;
+	}
+
+	return nfsd_payload_show(net, buf, SIMPLE_TRANSACTION_LIMIT);
+}
+
+/**
+ * write_reply_batch - Set the window replies on a TCP connection may be
+ *			held back in to be sent together, or report it
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated
+ *			"name value" lines: the window in microseconds
+ *			(0 when batching is off), the most replies held
+ *			back, the connections batched and corked now, the
+ *			replies and sends counted, the sends made at the
+ *			reply limit and at the end of the window, and a
+ *			"sends_by_replies" line counting the sends of 1,
+ *			2-3, 4-7, 8-15 and 16 or more replies;
+ *			return code is the size in bytes of the string
+ *
+ * OR
+ *
+ * Input:
+ *			buf:		"USECS [MAX_REPLIES]", USECS at most
+ *					10000, 0 to turn batching off
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	the settings are changed and reported as above
+ *	On error:	return code is a negative errno value
+ */
+static ssize_t write_reply_batch(struct file *file, char *buf, size_t size)
+{
+	char *mesg = buf;
+	struct net *net = netns(file);
+	int usecs, replies, rv;
+
+	if (size > 0) {
+		rv = get_int(&mesg, &usecs);
+		if (rv)
+			return rv;
+		rv = get_int(&mesg, &replies);
+		if (rv == -ENOENT)
+			replies = NFSD_BATCH_DEFAULT_REPLIES;
+		else if (rv)
+			return rv;
+		if (usecs < 0 || replies < 0)
+			return -EINVAL;
+		rv = nfsd_batch_set(net, usecs, replies);
+		if (rv)
+			return rv;
+	}
+
+	return nfsd_batch_show(net, buf, SIMPLE_TRANSACTION_LIMIT);
+}
+
+/*----------------------------------------------------------------------------*/
+/*
+ *	populating the filesystem.
+ */
+
+static int nfsd_fill_super(struct super_block * sb, void * data, int silent)
+{
+	static struct tree_descr nfsd_files[] = {
+		[NFSD_Fh] = {"filehandle", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_Threads] = {"threads", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_LookupCache] = {"lookup_cache", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_FhCache] = {"fh_cache", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_ExportStats] = {"export_stats", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_DispatchBench] = {"dispatch_bench", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_CaptureCtl] = {"capture_ctl", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_Capture] = {"capture", &capture_ops, S_IRUSR},
+		[NFSD_StageStats] = {"stage_stats", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_SlowOpsCtl] = {"slowops_ctl", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_SlowOps] = {"slowops", &slowops_ops, S_IRUSR},
+		[NFSD_Inflight] = {"inflight", &inflight_ops, S_IRUSR},
+		[NFSD_Watchdog] = {"watchdog", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_Clients] = {"clients", &clients_ops, S_IRUSR},
+		[NFSD_Exports] = {"exports", &exports_ops, S_IRUSR},
+		[NFSD_HotHandlesCtl] = {"hot_handles_ctl", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_HotHandles] = {"hot_handles", &hot_handles_ops, S_IRUSR},
+		[NFSD_StatsPage] = {"stats_page", &stats_page_ops, S_IRUSR},
+		[NFSD_Listeners] = {"listeners", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_PoolAffinity] = {"pool_affinity", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_BusyPoll] = {"busy_poll", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_MaxBlkSize] = {"max_block_size", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_FairShareCtl] = {"fair_share_ctl", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_FairShare] = {"fair_share", &fair_share_ops, S_IRUSR},
+		[NFSD_Lanes] = {"lanes", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_Overload] = {"overload", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_OverloadClients] = {"overload_clients", &overload_clients_ops, S_IRUSR},
+		[NFSD_ThrottleCtl] = {"throttle_ctl", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_Throttle] = {"throttle", &throttle_ops, S_IRUSR},
+		[NFSD_PayloadPages] = {"payload_pages", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_ReplyBatch] = {"reply_batch", &transaction_ops, S_IWUSR|S_IRUSR},
+		/* last one */ {""}
+	};
+	get_net(sb->s_fs_info);
+	return simple_fill_super(sb, 0x6e667364, nfsd_files);
+}
+
+static struct dentry *nfsd_mount(struct file_system_type *fs_type,
+	int flags, const char *dev_name, void *data)
+{
+	struct net *net = current->nsproxy->net_ns;
+	return mount_ns(fs_type, flags, data, net, net->user_ns, nfsd_fill_super);
+}
+
+static void nfsd_umount(struct super_block *sb)
+{
+	struct net *net = sb->s_fs_info;
+
+	kill_litter_super(sb);
+	put_net(net);
+}
+
+static struct file_system_type nfsd_fs_type = {
+	.owner		= THIS_MODULE,
+	.name		= "nfsd",
+	.mount		= nfsd_mount,
+	.kill_sb	= nfsd_umount,
+};
+MODULE_ALIAS_FS("nfsd");
+
+int nfsd_net_id;
+
+static __net_init int nfsd_init_net(struct net *net)
+{
+	int retval;
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+
+	retval = nfsd_export_init(net);
+	if (retval)
+		goto out_export_error;
+	retval = nfsd_negcache_init(net);
+	if (retval)
+		goto out_negcache_error;
+	retval = nfsd_capture_init(net);
+	if (retval)
+		goto out_capture_error;
+	retval = nfsd_stats_init(net);
+	if (retval)
+		goto out_stats_error;
+	retval = nfsd_slowops_init(net);
+	if (retval)
+		goto out_slowops_error;
+	retval = nfsd_inflight_init(net);
+	if (retval)
+		goto out_inflight_error;
+	retval = nfsd_traffic_init(net);
+	if (retval)
+		goto out_traffic_error;
+	retval = nfsd_hotfh_init(net);
+	if (retval)
+		goto out_hotfh_error;
+	retval = nfsd_statpage_init(net);
+	if (retval)
+		goto out_statpage_error;
+	retval = nfsd_affinity_init(net);
+	if (retval)
+		goto out_affinity_error;
+	retval = nfsd_busypoll_init(net);
+	if (retval)
+		goto out_busypoll_error;
+	retval = nfsd_sched_init(net);
+	if (retval)
+		goto out_sched_error;
+	retval = nfsd_lanes_init(net);
+	if (retval)
+		goto out_lanes_error;
+	retval = nfsd_overload_init(net);
+	if (retval)
+		goto out_overload_error;
+	retval = nfsd_throttle_init(net);
+	if (retval)
+		goto out_throttle_error;
+	retval = nfsd_payload_init(net);
+	if (retval)
+		goto out_payload_error;
+	retval = nfsd_batch_init(net);
+	if (retval)
+		goto out_batch_error;
+
+	atomic_set(&nn->ntf_refcnt, 0);
+	init_waitqueue_head(&nn->ntf_wq);
+	return 0;
+
+out_batch_error:
+	nfsd_payload_shutdown(net);
+out_payload_error:
+	nfsd_throttle_shutdown(net);
+out_throttle_error:
+	nfsd_overload_shutdown(net);
+out_overload_error:
+	nfsd_lanes_shutdown(net);
+out_lanes_error:
+	nfsd_sched_shutdown(net);
+out_sched_error:
+	nfsd_busypoll_shutdown(net);
+out_busypoll_error:
+	nfsd_affinity_shutdown(net);
+out_affinity_error:
+	nfsd_statpage_shutdown(net);
+out_statpage_error:
+	nfsd_hotfh_shutdown(net);
+out_hotfh_error:
+	nfsd_traffic_shutdown(net);
+out_traffic_error:
+	nfsd_inflight_shutdown(net);
+out_inflight_error:
+	nfsd_slowops_shutdown(net);
+out_slowops_error:
+	nfsd_stats_shutdown(net);
+out_stats_error:
+	nfsd_capture_shutdown(net);
+out_capture_error:
+	nfsd_negcache_shutdown(net);
+out_negcache_error:
+	nfsd_export_shutdown(net);
+out_export_error:
+	return retval;
+}
+
+static __net_exit void nfsd_exit_net(struct net *net)
+{
+	nfsd_batch_shutdown(net);
+	nfsd_payload_shutdown(net);
+	nfsd_throttle_shutdown(net);
+	nfsd_overload_shutdown(net);
+	nfsd_lanes_shutdown(net);
+	nfsd_sched_shutdown(net);
+	nfsd_busypoll_shutdown(net);
+	nfsd_affinity_shutdown(net);
+	nfsd_statpage_shutdown(net);
+	nfsd_hotfh_shutdown(net);
+	nfsd_traffic_shutdown(net);
+	nfsd_inflight_shutdown(net);
+	nfsd_slowops_shutdown(net);
+	nfsd_stats_shutdown(net);
+	nfsd_capture_shutdown(net);
+	nfsd_negcache_shutdown(net);
+	nfsd_export_shutdown(net);
+}
+
+static struct pernet_operations nfsd_net_ops = {
+	.init = nfsd_init_net,
+	.exit = nfsd_exit_net,
+	.id   = &nfsd_net_id,
+	.size = sizeof(struct nfsd_net),
+};
+
+static int __init init_nfsd(void)
+{
+	int retval;
+	printk(KERN_INFO "Installing knfsd (copyright (C) 1996 okir@monad.swb.de).\n");
+
+	retval = fh_cache_init();
+	if (retval)
+		return retval;
+	retval = register_pernet_subsys(&nfsd_net_ops);
+	if (retval < 0)
+		goto out_free_fh_cache;
 	retval = register_cld_notifier();
 	if (retval)
 		goto out_unregister_pernet;
@@ -310,6 +1613,8 @@ out_unregister_notifier:
 	unregister_cld_notifier();
 out_unregister_pernet:
 	unregister_pernet_subsys(&nfsd_net_ops);
+out_free_fh_cache:
+	fh_cache_shutdown();
 	return retval;
 }
 
@@ -318,6 +1623,9 @@ static void __exit exit_nfsd(void)
 	unregister_filesystem(&nfsd_fs_type);
 	unregister_cld_notifier();
 	unregister_pernet_subsys(&nfsd_net_ops);
+	/* export entries are freed with kfree_rcu() */
+	rcu_barrier();
+	fh_cache_shutdown();
 }
 
 MODULE_AUTHOR("Olaf Kirch <okir@monad.swb.de>");
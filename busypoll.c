@@ -0,0 +1,277 @@
+/*
+ * Busy-poll receive mode.
+ *
+ * An idle nfsd thread sleeps in svc_recv() until a transport is
+ * enqueued, so every request that finds the server idle pays for a
+ * wakeup and a context switch, tens of microseconds that dominate a
+ * GETATTR on a fast network.  In busy-poll mode a thread that has
+ * finished a request first spins, for up to bp_usecs, watching its
+ * pool's transport queue, and polls the NIC queue its last request
+ * came in on through that request's socket (sk_busy_loop(), with
+ * CONFIG_NET_RX_BUSY_POLL and the socket's busy-poll time set by
+ * net.core.busy_read).  When a transport is queued it calls svc_recv(),
+ * which finds it without sleeping.  The thread holds a reference to
+ * the socket from the request until it goes idle again.
+ *
+ * A spinning thread is busy as far as the RPC layer is concerned, so
+ * svc_xprt_do_enqueue() would wake a sleeping one instead.  The
+ * enqueue policy (affinity.c) therefore asks nfsd_busypoll_claim()
+ * first: each spinner adds a credit to its pool, and an enqueue that
+ * takes one just queues the transport.  A spinner that stops spinning
+ * takes its credit back if it is still there and drops out of the
+ * spinner count before calling svc_recv(); an enqueue that took a
+ * credit checks the count after queueing and wakes a thread if it has
+ * dropped to zero, so the transport is never left without one.
+ *
+ * At most bp_max_spinners threads spin per pool; the others sleep as
+ * before.  Spinning burns the cpu the thread runs on, which is why the
+ * mode is off by default.
+ */
+
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/sunrpc/svc.h>
+#include <linux/sunrpc/svc_xprt.h>
+#include <linux/sunrpc/svcsock.h>
+#include <linux/sunrpc/xprtsock.h>
+#include <net/sock.h>
+#include <net/busy_poll.h>
+
+#include "nfsd.h"
+#include "xdr.h"
+#include "netns.h"
+#include "busypoll.h"
+
+struct nfsd_busypoll_pool {
+	atomic_t		bpp_spinning;
+	atomic_t		bpp_credits;
+} ____cacheline_aligned_in_smp;
+
+struct nfsd_busypoll_stats {
+	unsigned long		spins;
+	unsigned long		found;		/* spins that ended with work */
+	unsigned long		handoffs;	/* transports given to spinners */
+};
+
+struct nfsd_busypoll {
+	unsigned int				bp_usecs;	/* 0 when off */
+	unsigned int				bp_max_spinners;
+	struct nfsd_busypoll_pool		*bp_pools;	/* by sp_id */
+	struct nfsd_busypoll_stats __percpu	*bp_stats;
+};
+
+static struct nfsd_busypoll *busypoll(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+
+	return nn->busypoll;
+}
+
+static struct nfsd_busypoll_pool *busypoll_pool(struct nfsd_busypoll *bp,
+						struct svc_pool *pool)
+{
+	return &bp->bp_pools[pool->sp_id % nr_cpu_ids];
+}
+
+bool
+nfsd_busypoll_enabled(struct net *net)
+{
+	struct nfsd_busypoll *bp = busypoll(net);
+
+	return bp && READ_ONCE(bp->bp_usecs);
+}
+
+/* the socket of @xprt with a reference, if it can be busy-polled */
+static struct sock *busypoll_sock(struct svc_xprt *xprt)
+{
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	struct svc_sock *svsk;
+	struct sock *sk;
+
+	if (xprt && (xprt->xpt_class->xcl_ident == XPRT_TRANSPORT_TCP ||
+		     xprt->xpt_class->xcl_ident == XPRT_TRANSPORT_UDP)) {
+		svsk = container_of(xprt, struct svc_sock, sk_xprt);
+		sk = svsk->sk_sk;
+		if (sk_can_busy_loop(sk)) {
+			sock_hold(sk);
+			return sk;
+		}
+	}
+#endif
+	return NULL;
+}
+
+/*
+ * Called by nfsd() when svc_recv() has returned a request, to remember
+ * the socket whose NIC queue it arrived on.
+ */
+void
+nfsd_busypoll_note(struct svc_rqst *rqstp)
+{
+	if (nfsd_busypoll_enabled(SVC_NET(rqstp)))
+		nfsd_rqst_ctx(rqstp)->tc_busypoll_sk =
+			busypoll_sock(rqstp->rq_xprt);
+}
+
+/*
+ * Called by nfsd() before svc_recv(): spin until the pool has a
+ * transport queued, the window has passed, or something else wants the
+ * cpu.
+ */
+void
+nfsd_busypoll(struct net *net, struct svc_rqst *rqstp)
+{
+	struct nfsd_busypoll *bp = busypoll(net);
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct svc_pool *pool = rqstp->rq_pool;
+	struct sock *sk = ctx->tc_busypoll_sk;
+	struct nfsd_busypoll_pool *bpp;
+	unsigned int usecs;
+	bool found;
+	u64 end;
+
+	ctx->tc_busypoll_sk = NULL;
+	if (!bp)
+		goto out;
+	usecs = READ_ONCE(bp->bp_usecs);
+	if (!usecs || !list_empty(&pool->sp_sockets))
+		goto out;
+	bpp = busypoll_pool(bp, pool);
+	if (atomic_inc_return(&bpp->bpp_spinning) >
+	    READ_ONCE(bp->bp_max_spinners)) {
+		atomic_dec(&bpp->bpp_spinning);
+		goto out;
+	}
+	atomic_inc(&bpp->bpp_credits);
+
+	end = local_clock() + (u64)usecs * NSEC_PER_USEC;
+	while (!(found = !list_empty(&pool->sp_sockets))) {
+		if (local_clock() > end || need_resched() ||
+		    signal_pending(current))
+			break;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+		/* one pass over the NIC queue, without waiting for data */
+		if (sk && sk_can_busy_loop(sk))
+			sk_busy_loop(sk, 1);
+#endif
+		cpu_relax();
+	}
+
+	/*
+	 * Pairs with the barrier before nfsd_busypoll_spinning(): either
+	 * the enqueuer sees us gone and wakes a thread, or svc_recv() sees
+	 * its transport.
+	 */
+	atomic_dec_if_positive(&bpp->bpp_credits);
+	atomic_dec(&bpp->bpp_spinning);
+	smp_mb__after_atomic();
+
+	this_cpu_inc(bp->bp_stats->spins);
+	if (found)
+		this_cpu_inc(bp->bp_stats->found);
+out:
+	if (sk)
+		sock_put(sk);
+}
+
+/*
+ * Called by the enqueue policy with a transport for @pool.  Returns true
+ * if a spinning thread will pick it up from the pool's queue, without
+ * being woken.
+ */
+bool
+nfsd_busypoll_claim(struct net *net, struct svc_pool *pool)
+{
+	struct nfsd_busypoll *bp = busypoll(net);
+
+	if (atomic_dec_if_positive(&busypoll_pool(bp, pool)->bpp_credits) < 0)
+		return false;
+	this_cpu_inc(bp->bp_stats->handoffs);
+	return true;
+}
+
+/*
+ * Called, after a full barrier, by an enqueue that claimed a spinner
+ * and queued its transport: if no thread of @pool is spinning any more,
+ * the caller has to wake one.
+ */
+bool
+nfsd_busypoll_spinning(struct net *net, struct svc_pool *pool)
+{
+	return atomic_read(&busypoll_pool(busypoll(net), pool)->bpp_spinning);
+}
+
+int
+nfsd_busypoll_set(struct net *net, unsigned int usecs,
+		  unsigned int max_spinners)
+{
+	struct nfsd_busypoll *bp = busypoll(net);
+
+	if (usecs > NFSD_BUSYPOLL_MAX_USECS ||
+	    max_spinners > NFSD_BUSYPOLL_MAX_SPINNERS)
+		return -EINVAL;
+	WRITE_ONCE(bp->bp_max_spinners, max_spinners);
+	WRITE_ONCE(bp->bp_usecs, usecs);
+	return 0;
+}
+
+/*
+ * Format the settings and counters into @buf for the busy_poll control
+ * file.
+ */
+int
+nfsd_busypoll_show(struct net *net, char *buf, int size)
+{
+	struct nfsd_busypoll *bp = busypoll(net);
+	struct nfsd_busypoll_stats sum = { 0 };
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct nfsd_busypoll_stats *s = per_cpu_ptr(bp->bp_stats, cpu);
+
+		sum.spins += s->spins;
+		sum.found += s->found;
+		sum.handoffs += s->handoffs;
+	}
+	return scnprintf(buf, size, "usecs %u\nmax_spinners %u\nspins %lu\n"
+			 "found %lu\nhandoffs %lu\n", READ_ONCE(bp->bp_usecs),
+			 READ_ONCE(bp->bp_max_spinners), sum.spins, sum.found,
+			 sum.handoffs);
+}
+
+int
+nfsd_busypoll_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_busypoll *bp;
+
+	bp = kzalloc(sizeof(*bp), GFP_KERNEL);
+	if (!bp)
+		return -ENOMEM;
+	bp->bp_pools = kcalloc(nr_cpu_ids, sizeof(*bp->bp_pools), GFP_KERNEL);
+	bp->bp_stats = alloc_percpu(struct nfsd_busypoll_stats);
+	if (!bp->bp_pools || !bp->bp_stats) {
+		free_percpu(bp->bp_stats);
+		kfree(bp->bp_pools);
+		kfree(bp);
+		return -ENOMEM;
+	}
+	bp->bp_max_spinners = NFSD_BUSYPOLL_DEFAULT_SPINNERS;
+	nn->busypoll = bp;
+	return 0;
+}
+
+void
+nfsd_busypoll_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_busypoll *bp = nn->busypoll;
+
+	if (!bp)
+		return;
+	nn->busypoll = NULL;
+	free_percpu(bp->bp_stats);
+	kfree(bp->bp_pools);
+	kfree(bp);
+}
@@ -0,0 +1,33 @@
+/*
+ * Busy-poll receive mode.
+ *
+ * When enabled, a thread that has finished a request spins for a while
+ * on its pool's transport queue before going to sleep in svc_recv(),
+ * and transports are handed to spinning threads without a wakeup.
+ */
+
+#ifndef LINUX_NFSD_BUSYPOLL_H
+#define LINUX_NFSD_BUSYPOLL_H
+
+struct net;
+struct svc_rqst;
+struct svc_pool;
+
+/* longest window a thread may spin for */
+#define NFSD_BUSYPOLL_MAX_USECS		1000
+/* most spinners per pool, and how many when the control file does not say */
+#define NFSD_BUSYPOLL_MAX_SPINNERS	64
+#define NFSD_BUSYPOLL_DEFAULT_SPINNERS	2
+
+int	nfsd_busypoll_init(struct net *);
+void	nfsd_busypoll_shutdown(struct net *);
+bool	nfsd_busypoll_enabled(struct net *);
+void	nfsd_busypoll_note(struct svc_rqst *);
+void	nfsd_busypoll(struct net *, struct svc_rqst *);
+bool	nfsd_busypoll_claim(struct net *, struct svc_pool *);
+bool	nfsd_busypoll_spinning(struct net *, struct svc_pool *);
+int	nfsd_busypoll_set(struct net *, unsigned int usecs,
+			  unsigned int max_spinners);
+int	nfsd_busypoll_show(struct net *, char *, int);
+
+#endif /* LINUX_NFSD_BUSYPOLL_H */
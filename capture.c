@@ -0,0 +1,453 @@
+/*
+ * RPC capture.
+ *
+ * Performance problems often only show up under real client mixes.
+ * While capture is on, every request that nfsd_dispatch() processes is
+ * logged to a per-net ring as a struct nfsd_capture_rec: when it came,
+ * from whom, the procedure, its decoded arguments and the status of the
+ * reply.  The "capture" file reads the ring; tools/loadgen/nfsreplay
+ * plays a log back against a server.
+ *
+ * Requests are dropped, and counted, rather than waited for when the
+ * reader falls behind and the ring is full.
+ */
+
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/log2.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+
+#include "nfsd.h"
+#include "xdr.h"
+#include "netns.h"
+#include "capture.h"
+
+#define NFSD_CAPTURE_MIN_KB	64
+#define NFSD_CAPTURE_MAX_KB	(256 * 1024)
+
+struct nfsd_capture {
+	spinlock_t		nc_lock;	/* ring contents and counters */
+	struct mutex		nc_mutex;	/* the reader; ring replacement */
+	wait_queue_head_t	nc_wait;
+	bool			nc_active;
+	char			*nc_ring;
+	u32			nc_size;	/* a power of two */
+	u64			nc_head;	/* next byte written */
+	u64			nc_tail;	/* next byte read */
+	u64			nc_start;	/* ktime at start, in ns */
+	unsigned long		nc_records;
+	unsigned long		nc_dropped;
+};
+
+static void capture_copy_in(struct nfsd_capture *nc, u64 pos,
+			    const void *src, size_t len)
+{
+	u32 off = pos & (nc->nc_size - 1);
+	size_t first = min_t(size_t, len, nc->nc_size - off);
+
+	memcpy(nc->nc_ring + off, src, first);
+	memcpy(nc->nc_ring, src + first, len - first);
+}
+
+static void capture_copy_out(struct nfsd_capture *nc, u64 pos,
+			     void *dst, size_t len)
+{
+	u32 off = pos & (nc->nc_size - 1);
+	size_t first = min_t(size_t, len, nc->nc_size - off);
+
+	memcpy(dst, nc->nc_ring + off, first);
+	memcpy(dst + first, nc->nc_ring, len - first);
+}
+
+static int capture_copy_to_user(struct nfsd_capture *nc, u64 pos,
+				char __user *dst, size_t len)
+{
+	u32 off = pos & (nc->nc_size - 1);
+	size_t first = min_t(size_t, len, nc->nc_size - off);
+
+	if (copy_to_user(dst, nc->nc_ring + off, first) ||
+	    copy_to_user(dst + first, nc->nc_ring, len - first))
+		return -EFAULT;
+	return 0;
+}
+
+static void capture_addr(struct svc_rqst *rqstp, struct nfsd_capture_rec *rec)
+{
+	struct sockaddr *sap = svc_addr(rqstp);
+
+	switch (sap->sa_family) {
+	case AF_INET:
+		rec->cr_family = AF_INET;
+		memcpy(rec->cr_addr, &((struct sockaddr_in *)sap)->sin_addr, 4);
+		break;
+	case AF_INET6:
+		rec->cr_family = AF_INET6;
+		memcpy(rec->cr_addr, &((struct sockaddr_in6 *)sap)->sin6_addr, 16);
+		break;
+	}
+}
+
+/*
+ * Fill in the argument fields of @rec from the decoded arguments, and
+ * point @fh, @resfh and @name at the variable-length parts.
+ */
+static void nfsd_describe_args(struct svc_rqst *rqstp, __be32 nfserr,
+			       struct nfsd_capture_rec *rec,
+			       struct knfsd_fh **fh, struct knfsd_fh **resfh,
+			       const char **name)
+{
+	struct nfsd3_diropres *diropres = rqstp->rq_resp;
+
+	switch (rqstp->rq_proc) {
+	case NFS3PROC_GETATTR:
+	case NFS3PROC_FSSTAT:
+	case NFS3PROC_FSINFO: {
+		struct nfsd_fhandle *argp = rqstp->rq_argp;
+
+		*fh = &argp->fh.fh_handle;
+		break;
+	}
+	case NFS3PROC_SETATTR: {
+		struct nfsd3_sattrargs *argp = rqstp->rq_argp;
+
+		*fh = &argp->fh.fh_handle;
+		if (argp->attrs.ia_valid & ATTR_MODE) {
+			rec->cr_arg = argp->attrs.ia_mode & S_IALLUGO;
+			rec->cr_arg2 |= NFSD_CAPTURE_SET_MODE;
+		}
+		if (argp->attrs.ia_valid & ATTR_SIZE) {
+			rec->cr_offset = argp->attrs.ia_size;
+			rec->cr_arg2 |= NFSD_CAPTURE_SET_SIZE;
+		}
+		break;
+	}
+	case NFS3PROC_LOOKUP:
+	case NFS3PROC_REMOVE:
+	case NFS3PROC_RMDIR: {
+		struct nfsd3_diropargs *argp = rqstp->rq_argp;
+
+		*fh = &argp->fh.fh_handle;
+		*name = argp->name;
+		rec->cr_namelen = argp->len;
+		if (rqstp->rq_proc == NFS3PROC_LOOKUP && !nfserr)
+			*resfh = &diropres->fh.fh_handle;
+		break;
+	}
+	case NFS3PROC_ACCESS: {
+		struct nfsd3_accessargs *argp = rqstp->rq_argp;
+
+		*fh = &argp->fh.fh_handle;
+		rec->cr_arg = argp->access;
+		break;
+	}
+	case NFS3PROC_READ: {
+		struct nfsd3_readargs *argp = rqstp->rq_argp;
+
+		*fh = &argp->fh.fh_handle;
+		rec->cr_offset = argp->offset;
+		rec->cr_count = argp->count;
+		break;
+	}
+	case NFS3PROC_WRITE: {
+		struct nfsd3_writeargs *argp = rqstp->rq_argp;
+
+		*fh = &argp->fh.fh_handle;
+		rec->cr_offset = argp->offset;
+		rec->cr_count = argp->count;
+		rec->cr_arg = argp->stable;
+		break;
+	}
+	case NFS3PROC_CREATE:
+	case NFS3PROC_MKDIR: {
+		struct nfsd3_createargs *argp = rqstp->rq_argp;
+
+		*fh = &argp->fh.fh_handle;
+		*name = argp->name;
+		rec->cr_namelen = argp->len;
+		if (argp->attrs.ia_valid & ATTR_MODE)
+			rec->cr_arg = argp->attrs.ia_mode & S_IALLUGO;
+		if (rqstp->rq_proc == NFS3PROC_CREATE)
+			rec->cr_arg2 = argp->createmode;
+		if (!nfserr)
+			*resfh = &diropres->fh.fh_handle;
+		break;
+	}
+	case NFS3PROC_READDIR:
+	case NFS3PROC_READDIRPLUS: {
+		struct nfsd3_readdirargs *argp = rqstp->rq_argp;
+
+		*fh = &argp->fh.fh_handle;
+		rec->cr_offset = argp->cookie;
+		rec->cr_count = argp->count;
+		rec->cr_arg2 = argp->dircount;
+		break;
+	}
+	}
+}
+
+/**
+ * nfsd_capture_describe - fill in a capture record for a request
+ * @rqstp: the request, with its arguments and results still decoded
+ * @nfserr: the NFS status of the reply
+ * @rec: the record; cr_len and cr_time are left to the caller
+ * @fh: set to the argument handle, if any
+ * @resfh: set to the handle returned by LOOKUP, CREATE or MKDIR, if any
+ * @name: set to the name argument, if any; cr_namelen is its length
+ *
+ * Also used by the slow operation log, see slowops.c.
+ */
+void nfsd_capture_describe(struct svc_rqst *rqstp, __be32 nfserr,
+			   struct nfsd_capture_rec *rec, struct knfsd_fh **fh,
+			   struct knfsd_fh **resfh, const char **name)
+{
+	*fh = *resfh = NULL;
+	*name = NULL;
+	memset(rec, 0, sizeof(*rec));
+	rec->cr_version = NFSD_CAPTURE_VERSION;
+	rec->cr_xid = ntohl(rqstp->rq_xid);
+	rec->cr_vers = rqstp->rq_vers;
+	rec->cr_proc = rqstp->rq_proc;
+	rec->cr_status = ntohl(nfserr);
+	capture_addr(rqstp, rec);
+	nfsd_describe_args(rqstp, nfserr, rec, fh, resfh, name);
+	if (!*name)
+		rec->cr_namelen = 0;
+}
+
+/**
+ * nfsd_capture_rqst - log a request that has been processed
+ * @rqstp: the request, with its arguments and results still decoded
+ * @nfserr: the NFS status of the reply
+ */
+void nfsd_capture_rqst(struct svc_rqst *rqstp, __be32 nfserr)
+{
+	static const char zeroes[8];
+	struct nfsd_net *nn = net_generic(SVC_NET(rqstp), nfsd_net_id);
+	struct nfsd_capture *nc = nn->capture;
+	struct knfsd_fh *fh, *resfh;
+	struct nfsd_capture_rec rec;
+	const char *name;
+	unsigned int len;
+	u64 pos;
+
+	if (!READ_ONCE(nc->nc_active))
+		return;
+
+	nfsd_capture_describe(rqstp, nfserr, &rec, &fh, &resfh, &name);
+	if (fh)
+		rec.cr_fhlen = min_t(unsigned int, fh->fh_size,
+				     NFSD_CAPTURE_FHSIZE);
+	if (resfh)
+		rec.cr_resfhlen = min_t(unsigned int, resfh->fh_size,
+					NFSD_CAPTURE_FHSIZE);
+	rec.cr_namelen = min_t(unsigned int, rec.cr_namelen,
+			       NFSD_CAPTURE_NAMELEN);
+	len = sizeof(rec) + rec.cr_fhlen + rec.cr_resfhlen + rec.cr_namelen;
+	rec.cr_len = ALIGN(len, 8);
+
+	spin_lock(&nc->nc_lock);
+	if (!nc->nc_active) {
+		spin_unlock(&nc->nc_lock);
+		return;
+	}
+	if (nc->nc_head - nc->nc_tail + rec.cr_len > nc->nc_size) {
+		nc->nc_dropped++;
+		spin_unlock(&nc->nc_lock);
+		return;
+	}
+	/* taken under the lock, so that times never go backwards in the log */
+	rec.cr_time = ktime_to_ns(ktime_get()) - nc->nc_start;
+	pos = nc->nc_head;
+	capture_copy_in(nc, pos, &rec, sizeof(rec));
+	pos += sizeof(rec);
+	if (fh) {
+		capture_copy_in(nc, pos, &fh->fh_base, rec.cr_fhlen);
+		pos += rec.cr_fhlen;
+	}
+	if (resfh) {
+		capture_copy_in(nc, pos, &resfh->fh_base, rec.cr_resfhlen);
+		pos += rec.cr_resfhlen;
+	}
+	if (name) {
+		capture_copy_in(nc, pos, name, rec.cr_namelen);
+		pos += rec.cr_namelen;
+	}
+	capture_copy_in(nc, pos, zeroes, rec.cr_len - len);
+	nc->nc_head += rec.cr_len;
+	nc->nc_records++;
+	spin_unlock(&nc->nc_lock);
+
+	if (waitqueue_active(&nc->nc_wait))
+		wake_up_interruptible(&nc->nc_wait);
+}
+
+static bool capture_readable(struct nfsd_capture *nc)
+{
+	bool ret;
+
+	spin_lock(&nc->nc_lock);
+	ret = nc->nc_head != nc->nc_tail || !nc->nc_active;
+	spin_unlock(&nc->nc_lock);
+	return ret;
+}
+
+/**
+ * nfsd_capture_read - read whole records from the capture ring
+ * @net: network namespace
+ * @buf: user buffer
+ * @count: size of @buf
+ * @nonblock: return -EAGAIN instead of waiting for records
+ *
+ * Waits while capture is on and the ring is empty.  Returns the number
+ * of bytes read, 0 once capture is off and the ring has been drained,
+ * or a negative errno.
+ */
+ssize_t nfsd_capture_read(struct net *net, char __user *buf, size_t count,
+			  bool nonblock)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_capture *nc = nn->capture;
+	struct nfsd_capture_rec rec;
+	size_t copied = 0;
+	u64 head, tail;
+	ssize_t ret;
+
+	if (mutex_lock_interruptible(&nc->nc_mutex))
+		return -ERESTARTSYS;
+	while (!capture_readable(nc)) {
+		mutex_unlock(&nc->nc_mutex);
+		if (nonblock)
+			return -EAGAIN;
+		if (wait_event_interruptible(nc->nc_wait,
+					     capture_readable(nc)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&nc->nc_mutex))
+			return -ERESTARTSYS;
+	}
+
+	spin_lock(&nc->nc_lock);
+	head = nc->nc_head;
+	tail = nc->nc_tail;
+	spin_unlock(&nc->nc_lock);
+
+	/* records between tail and head are not touched by writers */
+	while (tail + copied < head) {
+		capture_copy_out(nc, tail + copied, &rec, sizeof(rec));
+		if (copied + rec.cr_len > count)
+			break;
+		ret = capture_copy_to_user(nc, tail + copied, buf + copied,
+					   rec.cr_len);
+		if (ret)
+			goto out;
+		copied += rec.cr_len;
+	}
+	ret = copied;
+	if (!copied && tail != head)
+		ret = -EINVAL;		/* too small for the next record */
+
+	spin_lock(&nc->nc_lock);
+	nc->nc_tail += copied;
+	spin_unlock(&nc->nc_lock);
+out:
+	mutex_unlock(&nc->nc_mutex);
+	return ret;
+}
+
+/*
+ * Start capturing into a new ring of @kbytes (rounded up to a power of
+ * two).  Anything still unread in the old ring is discarded.
+ */
+int nfsd_capture_start(struct net *net, unsigned int kbytes)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_capture *nc = nn->capture;
+	char *ring, *old;
+	u32 size;
+
+	if (kbytes < NFSD_CAPTURE_MIN_KB || kbytes > NFSD_CAPTURE_MAX_KB)
+		return -EINVAL;
+	size = roundup_pow_of_two(kbytes) * 1024;
+	ring = vmalloc(size);
+	if (!ring)
+		return -ENOMEM;
+
+	mutex_lock(&nc->nc_mutex);
+	spin_lock(&nc->nc_lock);
+	old = nc->nc_ring;
+	nc->nc_ring = ring;
+	nc->nc_size = size;
+	nc->nc_head = nc->nc_tail = 0;
+	nc->nc_records = nc->nc_dropped = 0;
+	nc->nc_start = ktime_to_ns(ktime_get());
+	nc->nc_active = true;
+	spin_unlock(&nc->nc_lock);
+	mutex_unlock(&nc->nc_mutex);
+
+	vfree(old);
+	return 0;
+}
+
+/* stop capturing; what is in the ring can still be read */
+void nfsd_capture_stop(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_capture *nc = nn->capture;
+
+	spin_lock(&nc->nc_lock);
+	nc->nc_active = false;
+	spin_unlock(&nc->nc_lock);
+	wake_up_interruptible(&nc->nc_wait);
+}
+
+int nfsd_capture_show(struct net *net, char *buf, int size)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_capture *nc = nn->capture;
+	unsigned long records, dropped;
+	u64 used;
+	u32 ringsize;
+	bool active;
+
+	spin_lock(&nc->nc_lock);
+	active = nc->nc_active;
+	ringsize = nc->nc_size;
+	used = nc->nc_head - nc->nc_tail;
+	records = nc->nc_records;
+	dropped = nc->nc_dropped;
+	spin_unlock(&nc->nc_lock);
+
+	return scnprintf(buf, size,
+			 "active %d\nsize %u\nunread %llu\nrecords %lu\n"
+			 "dropped %lu\n",
+			 active, ringsize, (unsigned long long)used,
+			 records, dropped);
+}
+
+int nfsd_capture_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_capture *nc;
+
+	nc = kzalloc(sizeof(*nc), GFP_KERNEL);
+	if (!nc)
+		return -ENOMEM;
+	spin_lock_init(&nc->nc_lock);
+	mutex_init(&nc->nc_mutex);
+	init_waitqueue_head(&nc->nc_wait);
+	nn->capture = nc;
+	return 0;
+}
+
+void nfsd_capture_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_capture *nc = nn->capture;
+
+	if (!nc)
+		return;
+	nn->capture = NULL;
+	vfree(nc->nc_ring);
+	kfree(nc);
+}
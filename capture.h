@@ -0,0 +1,73 @@
+/*
+ * RPC capture log format.
+ *
+ * While capture is on, nfsd_dispatch() appends one record per request
+ * to a per-net ring, which is read from the "capture" file.  The format
+ * is shared with the userspace replay tool (tools/loadgen/nfsreplay), so
+ * it only uses fixed-width types.  Fields are in host byte order.
+ */
+
+#ifndef LINUX_NFSD_CAPTURE_H
+#define LINUX_NFSD_CAPTURE_H
+
+#include <linux/types.h>
+
+#define NFSD_CAPTURE_VERSION	1
+#define NFSD_CAPTURE_FHSIZE	64
+#define NFSD_CAPTURE_NAMELEN	255
+#define NFSD_CAPTURE_MAXREC	(sizeof(struct nfsd_capture_rec) + \
+				 2 * NFSD_CAPTURE_FHSIZE + \
+				 NFSD_CAPTURE_NAMELEN + 7)
+
+/* cr_arg2 for SETATTR: which of the attributes are set */
+#define NFSD_CAPTURE_SET_MODE	0x1
+#define NFSD_CAPTURE_SET_SIZE	0x2
+
+/*
+ * One request.  The fixed part is followed by cr_fhlen bytes of the
+ * argument handle, cr_resfhlen bytes of the handle returned by LOOKUP,
+ * CREATE or MKDIR, and cr_namelen bytes of the name, if any; the whole
+ * record is padded to cr_len, a multiple of 8.  Handles are kept as
+ * they were on the wire, so a replay can map them to those of the
+ * server it runs against.
+ */
+struct nfsd_capture_rec {
+	__u16	cr_len;		/* of the whole record */
+	__u8	cr_version;	/* NFSD_CAPTURE_VERSION */
+	__u8	cr_family;	/* of cr_addr: AF_INET or AF_INET6 */
+	__u32	cr_xid;
+	__u64	cr_time;	/* ns since capture was started */
+	__u8	cr_addr[16];	/* client address */
+	__u8	cr_vers;	/* NFS version */
+	__u8	cr_proc;	/* NFS procedure */
+	__u8	cr_fhlen;
+	__u8	cr_resfhlen;
+	__u16	cr_namelen;
+	__u16	cr_pad;
+	__u32	cr_status;	/* NFS status of the reply */
+	__u32	cr_count;	/* READ, WRITE, READDIR(PLUS) count */
+	__u32	cr_arg;		/* ACCESS mask, WRITE stable, new mode */
+	__u32	cr_arg2;	/* READDIRPLUS dircount, CREATE mode,
+				 * SETATTR NFSD_CAPTURE_SET_* */
+	__u64	cr_offset;	/* READ/WRITE offset, READDIR cookie,
+				 * SETATTR size */
+};
+
+#ifdef __KERNEL__
+struct net;
+struct svc_rqst;
+struct knfsd_fh;
+
+int	nfsd_capture_init(struct net *);
+void	nfsd_capture_shutdown(struct net *);
+int	nfsd_capture_start(struct net *, unsigned int kbytes);
+void	nfsd_capture_stop(struct net *);
+int	nfsd_capture_show(struct net *, char *, int);
+ssize_t	nfsd_capture_read(struct net *, char __user *, size_t, bool nonblock);
+void	nfsd_capture_rqst(struct svc_rqst *, __be32 nfserr);
+void	nfsd_capture_describe(struct svc_rqst *, __be32 nfserr,
+				struct nfsd_capture_rec *, struct knfsd_fh **fh,
+				struct knfsd_fh **resfh, const char **name);
+#endif
+
+#endif /* LINUX_NFSD_CAPTURE_H */
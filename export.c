@@ -15,11 +15,15 @@
 #include <linux/namei.h>
 #include <linux/module.h>
 #include <linux/exportfs.h>
+#include <linux/jhash.h>
+#include <linux/percpu.h>
 #include <linux/sunrpc/svc_xprt.h>
 
 #include "nfsd.h"
 #include "nfsfh.h"
+#include "xdr.h"
 #include "netns.h"
+#include "statpage.h"
 
 /*
  * We have two caches.
@@ -28,21 +32,32 @@
  *
  * The export options are actually stored in the first map, and the
  * second map contains a reference to the entry in the first map.
+ *
+ * The sunrpc cache core keeps both maps in fixed-size tables whose
+ * chains are walked under cd->hash_lock.  Every request looks up one
+ * entry in each, so each map also has a resizable rhashtable index
+ * (see "lockless lookup index" below) that lets the common case find
+ * a valid entry under RCU alone.  Entries are freed with kfree_rcu()
+ * so that index readers never see freed memory.
  */
 
-#define	EXPKEY_HASHBITS		8
+#define	EXPKEY_HASHBITS		10
 #define	EXPKEY_HASHMAX		(1 << EXPKEY_HASHBITS)
-#define	EXPKEY_HASHMASK		(EXPKEY_HASHMAX -1)
+
+static void expkey_index_del(struct svc_expkey *ek);
 
 static void expkey_put(struct kref *ref)
 {
 	struct svc_expkey *key = container_of(ref, struct svc_expkey, h.ref);
+	struct nfsd_net *nn = net_generic(key->cd->net, nfsd_net_id);
 
+	atomic_inc(&nn->svc_export_gen);
+	expkey_index_del(key);
 	if (test_bit(CACHE_VALID, &key->h.flags) &&
 	    !test_bit(CACHE_NEGATIVE, &key->h.flags))
 		path_put(&key->ek_path);
 	auth_domain_put(key->ek_client);
-	kfree(key);
+	kfree_rcu(key, ek_rcu);
 }
 
 static void expkey_request(struct cache_detail *cd,
@@ -118,6 +133,7 @@ static int expkey_parse(struct cache_detail *cd, char *mesg, int mlen)
 
 	key.ek_client = dom;	
 	key.ek_fsidtype = fsidtype;
+	key.cd = cd;
 	memcpy(key.ek_fsid, buf, len);
 
 	ek = svc_expkey_lookup(cd, &key);
@@ -205,6 +221,8 @@ static inline void expkey_init(struct cache_head *cnew,
 	kref_get(&item->ek_client->ref);
 	new->ek_client = item->ek_client;
 	new->ek_fsidtype = item->ek_fsidtype;
+	new->cd = item->cd;
+	new->ek_indexed = false;
 
 	memcpy(new->ek_fsid, item->ek_fsid, sizeof(new->ek_fsid));
 }
@@ -242,17 +260,25 @@ static struct cache_detail svc_expkey_cache_template = {
 	.alloc		= expkey_alloc,
 };
 
+/*
+ * Mix the whole key, rather than XOR-ing separately hashed parts:
+ * clients and fsids are both allocated in runs, and XOR lets their
+ * low bits cancel.  The same value seeds the rhashtable index.
+ */
+static u32
+expkey_hashval(const struct svc_expkey *item, u32 seed)
+{
+	u32 hash;
+
+	hash = jhash(item->ek_fsid, key_len(item->ek_fsidtype),
+		     seed ^ item->ek_fsidtype);
+	return jhash_1word(hash32_ptr(item->ek_client), hash);
+}
+
 static int
 svc_expkey_hash(struct svc_expkey *item)
 {
-	int hash = item->ek_fsidtype;
-	char * cp = (char*)item->ek_fsid;
-	int len = key_len(item->ek_fsidtype);
-
-	hash ^= hash_mem(cp, len, EXPKEY_HASHBITS);
-	hash ^= hash_ptr(item->ek_client, EXPKEY_HASHBITS);
-	hash &= EXPKEY_HASHMASK;
-	return hash;
+	return hash_32(expkey_hashval(item, 0), EXPKEY_HASHBITS);
 }
 
 static struct svc_expkey *
@@ -283,15 +309,22 @@ svc_expkey_update(struct cache_detail *cd, struct svc_expkey *new,
 }
 
 
-#define	EXPORT_HASHBITS		8
+#define	EXPORT_HASHBITS		10
 #define	EXPORT_HASHMAX		(1<< EXPORT_HASHBITS)
 
+static void export_index_del(struct svc_export *exp);
+
 static void svc_export_put(struct kref *ref)
 {
 	struct svc_export *exp = container_of(ref, struct svc_export, h.ref);
+	struct nfsd_net *nn = net_generic(exp->cd->net, nfsd_net_id);
+
+	atomic_inc(&nn->svc_export_gen);
+	export_index_del(exp);
+	fh_cache_purge(exp);
 	path_put(&exp->ex_path);
 	auth_domain_put(exp->ex_client);
-	kfree(exp);
+	kfree_rcu(exp, ex_rcu);
 }
 
 static void svc_export_request(struct cache_detail *cd,
@@ -349,7 +382,13 @@ static int check_export(struct inode *inode, int *flags)
 
 static int svc_export_parse(struct cache_detail *cd, char *mesg, int mlen)
 {
-	/* client path expiry [flags anonuid anongid fsid] */
+	/*
+	 * client path expiry [flags anonuid anongid fsid
+	 *		       [rtpref bytes] [wtpref bytes] ...]
+	 *
+	 * rpc.mountd appends secinfo, uuid and fsloc after fsid, which
+	 * are ignored like anything else after the FSINFO preferences.
+	 */
 	char *buf;
 	int len;
 	int err;
@@ -424,6 +463,25 @@ static int svc_export_parse(struct cache_detail *cd, char *mesg, int mlen)
 		printk(KERN_INFO "fsid: an_int is %d\n", an_int);
 		exp.ex_fsid = an_int;
 
+		/* optional FSINFO preferences, up to the first other word */
+		while ((len = qword_get(&mesg, buf, PAGE_SIZE)) > 0) {
+			u32 *pref;
+
+			if (strcmp(buf, "rtpref") == 0)
+				pref = &exp.ex_rtpref;
+			else if (strcmp(buf, "wtpref") == 0)
+				pref = &exp.ex_wtpref;
+			else
+				break;
+			err = get_int(&mesg, &an_int);
+			if (err)
+				goto out3;
+			err = -EINVAL;
+			if (an_int < 0)
+				goto out3;
+			*pref = an_int;
+		}
+
 		err = check_export(exp.ex_path.dentry->d_inode, &exp.ex_flags);
 		if (err)
 			goto out3;
@@ -465,6 +523,7 @@ out:
 }
 
 static void exp_flags(struct seq_file *m, int flag, int fsid);
+static void exp_prefs(struct seq_file *m, struct svc_export *exp);
 
 static int svc_export_show(struct seq_file *m,
 			   struct cache_detail *cd,
@@ -484,6 +543,7 @@ static int svc_export_show(struct seq_file *m,
 	if (test_bit(CACHE_VALID, &h->flags) && 
 	    !test_bit(CACHE_NEGATIVE, &h->flags)) {
 		exp_flags(m, exp->ex_flags, exp->ex_fsid);
+		exp_prefs(m, exp);
 	}
 	seq_puts(m, ")\n");
 	return 0;
@@ -506,6 +566,8 @@ static void svc_export_init(struct cache_head *cnew, struct cache_head *citem)
 	new->ex_path = item->ex_path;
 	path_get(&item->ex_path);
 	new->cd = item->cd;
+	new->ex_indexed = false;
+	new->ex_traffic_slot = -1;
 }
 
 static void export_update(struct cache_head *cnew, struct cache_head *citem)
@@ -516,6 +578,8 @@ static void export_update(struct cache_head *cnew, struct cache_head *citem)
 
 	new->ex_flags = item->ex_flags;
 	new->ex_fsid = item->ex_fsid;
+	new->ex_rtpref = item->ex_rtpref;
+	new->ex_wtpref = item->ex_wtpref;
 	new->ex_nflavors = item->ex_nflavors;
 	for (i = 0; i < MAX_SECINFO_LIST; i++) {
 		new->ex_flavors[i] = item->ex_flavors[i];
@@ -545,15 +609,18 @@ static struct cache_detail svc_export_cache_template = {
 	.alloc		= svc_export_alloc,
 };
 
+static u32
+export_hashval(const struct svc_export *exp, u32 seed)
+{
+	return jhash_3words(hash32_ptr(exp->ex_client),
+			    hash32_ptr(exp->ex_path.dentry),
+			    hash32_ptr(exp->ex_path.mnt), seed);
+}
+
 static int
 svc_export_hash(struct svc_export *exp)
 {
-	int hash;
-
-	hash = hash_ptr(exp->ex_client, EXPORT_HASHBITS);
-	hash ^= hash_ptr(exp->ex_path.dentry, EXPORT_HASHBITS);
-	hash ^= hash_ptr(exp->ex_path.mnt, EXPORT_HASHBITS);
-	return hash;
+	return hash_32(export_hashval(exp, 0), EXPORT_HASHBITS);
 }
 
 static struct svc_export *
@@ -582,11 +649,247 @@ svc_export_update(struct svc_export *new, struct svc_export *old)
 		return NULL;
 }
 
+/*
+ * Lockless lookup index.
+ *
+ * Each map has a per-net rhashtable holding the entries that most
+ * recently passed cache_check().  A lookup that finds an entry there
+ * which is valid, positive and not yet due for a refresh takes a
+ * reference and skips both the sunrpc hash chain and cache_check().
+ * Anything else falls back to the sunrpc cache as before, and the
+ * entry it returns then replaces whatever the index held for that key.
+ *
+ * Entries leave the index when their last reference is dropped.  An
+ * entry that is unhashed from the sunrpc cache but still referenced
+ * is caught by the expiry test, except after cache_purge(), which
+ * leaves expiry alone; nfsd_export_flush() bumps svc_index_gen
+ * instead, which retires everything indexed so far.
+ */
+
+struct nfsd_index_stats {
+	unsigned long		expkey_hits;
+	unsigned long		expkey_misses;
+	unsigned long		export_hits;
+	unsigned long		export_misses;
+	unsigned long		memo_hits;
+	unsigned long		memo_misses;
+};
+
+static u32 expkey_index_hashfn(const void *data, u32 len, u32 seed)
+{
+	return expkey_hashval(data, seed);
+}
+
+static u32 expkey_index_obj_hashfn(const void *data, u32 len, u32 seed)
+{
+	return expkey_hashval(data, seed);
+}
+
+static int expkey_index_cmpfn(struct rhashtable_compare_arg *arg,
+			      const void *obj)
+{
+	const struct svc_expkey *key = arg->key;
+	const struct svc_expkey *ek = obj;
+
+	return ek->ek_fsidtype != key->ek_fsidtype ||
+		ek->ek_client != key->ek_client ||
+		memcmp(ek->ek_fsid, key->ek_fsid, key_len(key->ek_fsidtype));
+}
+
+static const struct rhashtable_params expkey_index_params = {
+	.head_offset		= offsetof(struct svc_expkey, ek_index),
+	.hashfn			= expkey_index_hashfn,
+	.obj_hashfn		= expkey_index_obj_hashfn,
+	.obj_cmpfn		= expkey_index_cmpfn,
+	.automatic_shrinking	= true,
+};
+
+static u32 export_index_hashfn(const void *data, u32 len, u32 seed)
+{
+	return export_hashval(data, seed);
+}
+
+static u32 export_index_obj_hashfn(const void *data, u32 len, u32 seed)
+{
+	return export_hashval(data, seed);
+}
+
+static int export_index_cmpfn(struct rhashtable_compare_arg *arg,
+			      const void *obj)
+{
+	const struct svc_export *key = arg->key;
+	const struct svc_export *exp = obj;
+
+	return exp->ex_client != key->ex_client ||
+		!path_equal(&exp->ex_path, &key->ex_path);
+}
+
+static const struct rhashtable_params export_index_params = {
+	.head_offset		= offsetof(struct svc_export, ex_index),
+	.hashfn			= export_index_hashfn,
+	.obj_hashfn		= export_index_obj_hashfn,
+	.obj_cmpfn		= export_index_cmpfn,
+	.automatic_shrinking	= true,
+};
+
+/*
+ * Can @h be handed out without going through cache_check()?  Entries
+ * in the second half of their lifetime are left to cache_check(), so
+ * that it gets to start the refresh upcall before they expire.
+ */
+static bool index_entry_fresh(struct cache_detail *cd, struct cache_head *h)
+{
+	time_t now = seconds_since_boot();
+
+	if (!test_bit(CACHE_VALID, &h->flags) ||
+	    test_bit(CACHE_NEGATIVE, &h->flags))
+		return false;
+	if (cache_is_expired(cd, h))
+		return false;
+	return now - h->last_refresh <= (h->expiry_time - h->last_refresh) / 2;
+}
+
+static struct svc_expkey *
+expkey_index_find(struct nfsd_net *nn, struct cache_detail *cd,
+		  struct svc_expkey *key)
+{
+	struct svc_expkey *ek;
+
+	rcu_read_lock();
+	ek = rhashtable_lookup_fast(&nn->svc_expkey_index, key,
+				    expkey_index_params);
+	if (ek && (ek->ek_index_gen != atomic_read(&nn->svc_index_gen) ||
+		   !index_entry_fresh(cd, &ek->h) ||
+		   !kref_get_unless_zero(&ek->h.ref)))
+		ek = NULL;
+	rcu_read_unlock();
+
+	if (ek)
+		this_cpu_inc(nn->svc_index_stats->expkey_hits);
+	else
+		this_cpu_inc(nn->svc_index_stats->expkey_misses);
+	return ek;
+}
+
+static void
+expkey_index_add(struct nfsd_net *nn, struct svc_expkey *ek)
+{
+	struct svc_expkey *old;
+	int err;
+
+	if (ek->ek_indexed || !index_entry_fresh(ek->cd, &ek->h))
+		return;
+
+	spin_lock(&nn->svc_index_lock);
+	if (ek->ek_indexed)
+		goto out;
+	ek->ek_index_gen = atomic_read(&nn->svc_index_gen);
+	old = rhashtable_lookup_fast(&nn->svc_expkey_index, ek,
+				     expkey_index_params);
+	if (old)
+		err = rhashtable_replace_fast(&nn->svc_expkey_index,
+					      &old->ek_index, &ek->ek_index,
+					      expkey_index_params);
+	else
+		err = rhashtable_insert_fast(&nn->svc_expkey_index,
+					     &ek->ek_index,
+					     expkey_index_params);
+	if (!err) {
+		if (old)
+			old->ek_indexed = false;
+		ek->ek_indexed = true;
+	}
+out:
+	spin_unlock(&nn->svc_index_lock);
+}
+
+static void
+expkey_index_del(struct svc_expkey *ek)
+{
+	struct nfsd_net *nn = net_generic(ek->cd->net, nfsd_net_id);
+
+	spin_lock(&nn->svc_index_lock);
+	if (ek->ek_indexed) {
+		rhashtable_remove_fast(&nn->svc_expkey_index, &ek->ek_index,
+				       expkey_index_params);
+		ek->ek_indexed = false;
+	}
+	spin_unlock(&nn->svc_index_lock);
+}
+
+static struct svc_export *
+export_index_find(struct nfsd_net *nn, struct cache_detail *cd,
+		  struct svc_export *key)
+{
+	struct svc_export *exp;
+
+	rcu_read_lock();
+	exp = rhashtable_lookup_fast(&nn->svc_export_index, key,
+				     export_index_params);
+	if (exp && (exp->ex_index_gen != atomic_read(&nn->svc_index_gen) ||
+		    !index_entry_fresh(cd, &exp->h) ||
+		    !kref_get_unless_zero(&exp->h.ref)))
+		exp = NULL;
+	rcu_read_unlock();
+
+	if (exp)
+		this_cpu_inc(nn->svc_index_stats->export_hits);
+	else
+		this_cpu_inc(nn->svc_index_stats->export_misses);
+	return exp;
+}
+
+static void
+export_index_add(struct nfsd_net *nn, struct svc_export *exp)
+{
+	struct svc_export *old;
+	int err;
+
+	if (exp->ex_indexed || !index_entry_fresh(exp->cd, &exp->h))
+		return;
+
+	spin_lock(&nn->svc_index_lock);
+	if (exp->ex_indexed)
+		goto out;
+	exp->ex_index_gen = atomic_read(&nn->svc_index_gen);
+	old = rhashtable_lookup_fast(&nn->svc_export_index, exp,
+				     export_index_params);
+	if (old)
+		err = rhashtable_replace_fast(&nn->svc_export_index,
+					      &old->ex_index, &exp->ex_index,
+					      export_index_params);
+	else
+		err = rhashtable_insert_fast(&nn->svc_export_index,
+					     &exp->ex_index,
+					     export_index_params);
+	if (!err) {
+		if (old)
+			old->ex_indexed = false;
+		exp->ex_indexed = true;
+	}
+out:
+	spin_unlock(&nn->svc_index_lock);
+}
+
+static void
+export_index_del(struct svc_export *exp)
+{
+	struct nfsd_net *nn = net_generic(exp->cd->net, nfsd_net_id);
+
+	spin_lock(&nn->svc_index_lock);
+	if (exp->ex_indexed) {
+		rhashtable_remove_fast(&nn->svc_export_index, &exp->ex_index,
+				       export_index_params);
+		exp->ex_indexed = false;
+	}
+	spin_unlock(&nn->svc_index_lock);
+}
 
 static struct svc_expkey *
 exp_find_key(struct cache_detail *cd, struct auth_domain *clp, int fsid_type,
 	     u32 *fsidv, struct cache_req *reqp)
 {
+	struct nfsd_net *nn = net_generic(cd->net, nfsd_net_id);
 	struct svc_expkey key, *ek;
 	int err;
 	
@@ -595,15 +898,21 @@ exp_find_key(struct cache_detail *cd, struct auth_domain *clp, int fsid_type,
 
 	key.ek_client = clp;
 	key.ek_fsidtype = fsid_type;
+	key.cd = cd;
 	printk(KERN_INFO "the fsid type is %d\n", fsid_type);
 	memcpy(key.ek_fsid, fsidv, key_len(fsid_type));
 
+	ek = expkey_index_find(nn, cd, &key);
+	if (ek)
+		return ek;
+
 	ek = svc_expkey_lookup(cd, &key);
 	if (ek == NULL)
 		return ERR_PTR(-ENOMEM);
 	err = cache_check(cd, &ek->h, reqp);
 	if (err)
 		return ERR_PTR(err);
+	expkey_index_add(nn, ek);
 	return ek;
 }
 
@@ -611,6 +920,7 @@ static struct svc_export *
 exp_get_by_name(struct cache_detail *cd, struct auth_domain *clp,
 		const struct path *path, struct cache_req *reqp)
 {
+	struct nfsd_net *nn = net_generic(cd->net, nfsd_net_id);
 	struct svc_export *exp, key;
 	int err;
 
@@ -621,12 +931,17 @@ exp_get_by_name(struct cache_detail *cd, struct auth_domain *clp,
 	key.ex_path = *path;
 	key.cd = cd;
 
+	exp = export_index_find(nn, cd, &key);
+	if (exp)
+		return exp;
+
 	exp = svc_export_lookup(&key);
 	if (exp == NULL)
 		return ERR_PTR(-ENOMEM);
 	err = cache_check(cd, &exp->h, reqp);
 	if (err)
 		return ERR_PTR(err);
+	export_index_add(nn, exp);
 	return exp;
 }
 
@@ -702,17 +1017,91 @@ out:
 	return err;
 }
 
+/*
+ * Per-thread memo of recent fsid resolutions.
+ *
+ * A thread usually serves a run of requests from the same client on the
+ * same export, so rqst_exp_find() first checks the last few results it
+ * produced.  Memo entries hold no references.  Instead the per-net
+ * svc_export_gen is sampled before the lookup that produced an entry,
+ * and is bumped by the put callbacks before an expkey or export is
+ * freed (with kfree_rcu()).  Inside rcu_read_lock(), an unchanged
+ * generation therefore means both entries are still in memory, and
+ * kref_get_unless_zero() turns that into a reference.  Replaced or
+ * flushed entries are caught by the same freshness test the lookup
+ * index uses.
+ */
+static struct svc_export *
+exp_memo_find(struct svc_rqst *rqstp, struct nfsd_net *nn, int fsid_type,
+	      u32 *fsidv)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_exp_memo *em;
+	struct svc_export *exp = NULL;
+	unsigned int gen;
+	int i;
+
+	rcu_read_lock();
+	gen = atomic_read(&nn->svc_export_gen);
+	for (i = 0; i < NFSD_EXP_MEMO_SIZE; i++) {
+		em = &ctx->tc_exp_memo[i];
+		if (!em->em_exp || em->em_client != rqstp->rq_client ||
+		    em->em_fsidtype != fsid_type ||
+		    memcmp(em->em_fsid, fsidv, key_len(fsid_type)))
+			continue;
+		if (em->em_gen == gen &&
+		    index_entry_fresh(nn->svc_expkey_cache, &em->em_ek->h) &&
+		    index_entry_fresh(nn->svc_export_cache, &em->em_exp->h) &&
+		    kref_get_unless_zero(&em->em_exp->h.ref))
+			exp = em->em_exp;
+		else
+			em->em_exp = NULL;
+		break;
+	}
+	rcu_read_unlock();
+
+	if (exp)
+		this_cpu_inc(nn->svc_index_stats->memo_hits);
+	else
+		this_cpu_inc(nn->svc_index_stats->memo_misses);
+	return exp;
+}
+
+static void
+exp_memo_add(struct svc_rqst *rqstp, unsigned int gen, struct svc_expkey *ek,
+	     struct svc_export *exp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_exp_memo *em;
+
+	em = &ctx->tc_exp_memo[ctx->tc_exp_memo_next++ % NFSD_EXP_MEMO_SIZE];
+	em->em_client = ek->ek_client;
+	em->em_fsidtype = ek->ek_fsidtype;
+	memcpy(em->em_fsid, ek->ek_fsid, key_len(ek->ek_fsidtype));
+	em->em_gen = gen;
+	em->em_ek = ek;
+	em->em_exp = exp;
+}
+
+/*
+ * If @rqstp is given, the result is also recorded in its thread's memo.
+ */
 static struct svc_export *exp_find(struct cache_detail *cd,
 				   struct auth_domain *clp, int fsid_type,
-				   u32 *fsidv, struct cache_req *reqp)
+				   u32 *fsidv, struct cache_req *reqp,
+				   struct svc_rqst *rqstp)
 {
 	struct svc_export *exp;
 	struct nfsd_net *nn = net_generic(cd->net, nfsd_net_id);
+	/* sampled first, so a free during the lookups invalidates the memo */
+	unsigned int gen = atomic_read(&nn->svc_export_gen);
 	struct svc_expkey *ek = exp_find_key(nn->svc_expkey_cache, clp, fsid_type, fsidv, reqp);
 	if (IS_ERR(ek))
 		return ERR_CAST(ek);
 
 	exp = exp_get_by_name(cd, clp, &ek->ek_path, reqp);
+	if (rqstp && !IS_ERR(exp))
+		exp_memo_add(rqstp, gen, ek, exp);
 	cache_put(&ek->h, nn->svc_expkey_cache);
 
 	if (IS_ERR(exp))
@@ -747,9 +1136,15 @@ rqst_exp_find(struct svc_rqst *rqstp, int fsid_type, u32 *fsidv)
 	struct nfsd_net *nn = net_generic(SVC_NET(rqstp), nfsd_net_id);
 	struct cache_detail *cd = nn->svc_export_cache;
 
+	if (rqstp->rq_client) {
+		exp = exp_memo_find(rqstp, nn, fsid_type, fsidv);
+		if (exp)
+			return exp;
+	}
+
 	/* First try the auth_unix client: */
 	exp = exp_find(cd, rqstp->rq_client, fsid_type,
-		       fsidv, &rqstp->rq_chandle);
+		       fsidv, &rqstp->rq_chandle, rqstp);
 	return exp;
 }
 
@@ -786,6 +1181,7 @@ static struct flags {
 	{ NFSEXP_READONLY, {"ro", "rw"}},
 	{ NFSEXP_ROOTSQUASH, {"root_squash", "no_root_squash"}},
 	{ NFSEXP_ASYNC, {"async", "sync"}},
+	{ NFSEXP_NOSUBTREECHECK, {"no_subtree_check", ""}},
 	{ 0, {"", ""}}
 };
 
@@ -806,6 +1202,16 @@ static void show_expflags(struct seq_file *m, int flags, int mask)
 static void exp_flags(struct seq_file *m, int flag, int fsid)
 {
 	show_expflags(m, flag, NFSEXP_ALLFLAGS);
+	if (flag & NFSEXP_FSID)
+		seq_printf(m, ",fsid=%d", fsid);
+}
+
+static void exp_prefs(struct seq_file *m, struct svc_export *exp)
+{
+	if (exp->ex_rtpref)
+		seq_printf(m, ",rtpref=%u", exp->ex_rtpref);
+	if (exp->ex_wtpref)
+		seq_printf(m, ",wtpref=%u", exp->ex_wtpref);
 }
 
 /*
@@ -819,9 +1225,24 @@ nfsd_export_init(struct net *net)
 
 	printk(KERN_INFO "nfsd: initializing export module (net: %p).\n", net);
 
+	spin_lock_init(&nn->svc_index_lock);
+	atomic_set(&nn->svc_index_gen, 0);
+	atomic_set(&nn->svc_export_gen, 0);
+	nn->svc_index_stats = alloc_percpu(struct nfsd_index_stats);
+	if (!nn->svc_index_stats)
+		return -ENOMEM;
+	rv = rhashtable_init(&nn->svc_expkey_index, &expkey_index_params);
+	if (rv)
+		goto free_index_stats;
+	rv = rhashtable_init(&nn->svc_export_index, &export_index_params);
+	if (rv)
+		goto destroy_expkey_index;
+
 	nn->svc_export_cache = cache_create_net(&svc_export_cache_template, net);
-	if (IS_ERR(nn->svc_export_cache))
-		return PTR_ERR(nn->svc_export_cache);
+	if (IS_ERR(nn->svc_export_cache)) {
+		rv = PTR_ERR(nn->svc_export_cache);
+		goto destroy_export_index;
+	}
 	rv = cache_register_net(nn->svc_export_cache, net);
 	if (rv)
 		goto destroy_export_cache;
@@ -842,6 +1263,12 @@ unregister_export_cache:
 	cache_unregister_net(nn->svc_export_cache, net);
 destroy_export_cache:
 	cache_destroy_net(nn->svc_export_cache, net);
+destroy_export_index:
+	rhashtable_destroy(&nn->svc_export_index);
+destroy_expkey_index:
+	rhashtable_destroy(&nn->svc_expkey_index);
+free_index_stats:
+	free_percpu(nn->svc_index_stats);
 	return rv;
 }
 
@@ -855,6 +1282,121 @@ nfsd_export_flush(struct net *net)
 
 	cache_purge(nn->svc_expkey_cache);
 	cache_purge(nn->svc_export_cache);
+	atomic_inc(&nn->svc_index_gen);
+	atomic_inc(&nn->svc_export_gen);
+}
+
+struct cache_chain_stats {
+	unsigned int	entries;
+	unsigned int	used;
+	unsigned int	longest;
+	unsigned int	hist[5];	/* chains of length 1, 2, 3-4, 5-8, >8 */
+};
+
+static void cache_chain_stats(struct cache_detail *cd,
+			      struct cache_chain_stats *cs)
+{
+	struct cache_head *h;
+	unsigned int len;
+	int i;
+
+	memset(cs, 0, sizeof(*cs));
+	read_lock(&cd->hash_lock);
+	for (i = 0; i < cd->hash_size; i++) {
+		len = 0;
+		hlist_for_each_entry(h, &cd->hash_table[i], cache_list)
+			len++;
+		if (!len)
+			continue;
+		cs->entries += len;
+		cs->used++;
+		cs->longest = max(cs->longest, len);
+		if (len <= 2)
+			cs->hist[len - 1]++;
+		else if (len <= 4)
+			cs->hist[2]++;
+		else if (len <= 8)
+			cs->hist[3]++;
+		else
+			cs->hist[4]++;
+	}
+	read_unlock(&cd->hash_lock);
+}
+
+static int cache_chain_show(struct cache_detail *cd, struct rhashtable *ht,
+			    unsigned long hits, unsigned long misses,
+			    char *buf, int size)
+{
+	struct cache_chain_stats cs;
+	unsigned int avg;
+
+	cache_chain_stats(cd, &cs);
+	/* average length of the non-empty chains, in hundredths */
+	avg = cs.used ? cs.entries * 100 / cs.used : 0;
+	return scnprintf(buf, size,
+			 "%s: buckets %d entries %u used %u longest %u "
+			 "avg %u.%02u chains 1:%u 2:%u 3-4:%u 5-8:%u >8:%u\n"
+			 "%s: index entries %d hits %lu misses %lu\n",
+			 cd->name, cd->hash_size, cs.entries, cs.used,
+			 cs.longest, avg / 100, avg % 100, cs.hist[0],
+			 cs.hist[1], cs.hist[2], cs.hist[3], cs.hist[4],
+			 cd->name, atomic_read(&ht->nelems), hits, misses);
+}
+
+/* Sum the per-cpu lookup index and memo counters into @sum. */
+static void index_stats_sum(struct nfsd_net *nn, struct nfsd_index_stats *sum)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct nfsd_index_stats *s = per_cpu_ptr(nn->svc_index_stats, cpu);
+
+		sum->expkey_hits += s->expkey_hits;
+		sum->expkey_misses += s->expkey_misses;
+		sum->export_hits += s->export_hits;
+		sum->export_misses += s->export_misses;
+		sum->memo_hits += s->memo_hits;
+		sum->memo_misses += s->memo_misses;
+	}
+}
+
+/* Copy the counters to the binary statistics page, see statpage.c. */
+void
+nfsd_export_statpage(struct net *net, struct nfsd_statpage *sp)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_index_stats sum = { 0 };
+
+	index_stats_sum(nn, &sum);
+	sp->sp_expkey.hits = sum.expkey_hits;
+	sp->sp_expkey.misses = sum.expkey_misses;
+	sp->sp_export.hits = sum.export_hits;
+	sp->sp_export.misses = sum.export_misses;
+	sp->sp_exp_memo.hits = sum.memo_hits;
+	sp->sp_exp_memo.misses = sum.memo_misses;
+}
+
+/*
+ * Format hash chain and lookup index statistics for both caches into
+ * @buf, for the export_stats control file.
+ */
+int
+nfsd_export_stats(struct net *net, char *buf, int size)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_index_stats sum = { 0 };
+	int len;
+
+	index_stats_sum(nn, &sum);
+	len = cache_chain_show(nn->svc_expkey_cache, &nn->svc_expkey_index,
+			       sum.expkey_hits, sum.expkey_misses, buf, size);
+	len += cache_chain_show(nn->svc_export_cache, &nn->svc_export_index,
+				sum.export_hits, sum.export_misses,
+				buf + len, size - len);
+	len += scnprintf(buf + len, size - len,
+			 "thread memo: hits %lu misses %lu\n",
+			 sum.memo_hits, sum.memo_misses);
+	return len;
 }
 
 /*
@@ -872,6 +1414,10 @@ nfsd_export_shutdown(struct net *net)
 	cache_destroy_net(nn->svc_expkey_cache, net);
 	cache_destroy_net(nn->svc_export_cache, net);
 	svcauth_unix_purge(net);
+	/* both caches were purged above, so nothing is indexed any more */
+	rhashtable_destroy(&nn->svc_expkey_index);
+	rhashtable_destroy(&nn->svc_export_index);
+	free_percpu(nn->svc_index_stats);
 
 	printk(KERN_INFO "nfsd: export shutdown complete (net: %p).\n", net);
 }
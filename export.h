@@ -5,11 +5,13 @@
 #define NFSD_EXPORT_H
 
 #include <linux/sunrpc/cache.h>
+#include <linux/rhashtable.h>
 #include <uapi/linux/nfsd/export.h>
 
 struct knfsd_fh;
 struct svc_fh;
 struct svc_rqst;
+struct nfsd_statpage;
 
 /*
  * We keep an array of pseudoflavors with the export, in order from most
@@ -33,6 +35,17 @@ struct svc_export {
 	uint32_t		ex_nflavors;
 	struct exp_flavor_info	ex_flavors[MAX_SECINFO_LIST];
 	struct cache_detail	*cd;
+	/* FSINFO rtpref/wtpref in bytes, 0 for the largest payload */
+	u32			ex_rtpref;
+	u32			ex_wtpref;
+	/* slot in the exports traffic table, -1 until looked up */
+	int			ex_traffic_slot;
+
+	/* lockless lookup index, see export.c */
+	struct rhash_head	ex_index;
+	bool			ex_indexed;
+	unsigned int		ex_index_gen;
+	struct rcu_head		ex_rcu;
 };
 
 /* an "export key" (expkey) maps a filehandlefragement to an
@@ -47,16 +60,43 @@ struct svc_expkey {
 	u32			ek_fsid[6];
 
 	struct path		ek_path;
+	struct cache_detail	*cd;
+
+	/* lockless lookup index, see export.c */
+	struct rhash_head	ek_index;
+	bool			ek_indexed;
+	unsigned int		ek_index_gen;
+	struct rcu_head		ek_rcu;
 };
 
 #define EX_ISSYNC(exp)		(!((exp)->ex_flags & NFSEXP_ASYNC))
 
+/*
+ * A thread's memo of a recent (client, fsid) -> export resolution.  It
+ * holds no references; em_gen is checked against the per-net
+ * svc_export_gen, which changes whenever an entry of either cache is
+ * freed, before any pointer in here is followed.
+ */
+#define NFSD_EXP_MEMO_SIZE	4
+
+struct nfsd_exp_memo {
+	struct auth_domain *	em_client;
+	int			em_fsidtype;
+	u32			em_fsid[6];
+	unsigned int		em_gen;
+	struct svc_expkey *	em_ek;
+	struct svc_export *	em_exp;
+};
+
 /*
  * Function declarations
  */
 int			nfsd_export_init(struct net *);
 void			nfsd_export_shutdown(struct net *);
 void			nfsd_export_flush(struct net *);
+int			nfsd_export_stats(struct net *, char *, int);
+void			nfsd_export_statpage(struct net *,
+					     struct nfsd_statpage *);
 struct svc_export *	rqst_exp_get_by_name(struct svc_rqst *,
 					     struct path *);
 struct svc_export *	rqst_exp_parent(struct svc_rqst *,
@@ -0,0 +1,351 @@
+/*
+ * Hottest file handles.
+ *
+ * A few files (a shared library, a config file every job reads) can
+ * carry most of the load, and finding them should not take a trace of
+ * every call.  The first handle fh_verify() finds for a request is
+ * counted in a count-min sketch: NFSD_HOTFH_DEPTH rows of counters,
+ * each indexed by a different hash of the handle, so that the smallest
+ * of a handle's counters bounds its count from above, and is exact
+ * unless every row has a collision.  A second sketch of the same shape
+ * counts the bytes READ and WRITE move.
+ *
+ * The sketch cannot list its handles, so next to it is a min-heap of
+ * the NFSD_HOTFH_TOP handles with the highest estimates, each with the
+ * path it was found at.  A handle whose estimate passes the smallest
+ * one in the heap replaces it.  Memory is fixed however many files are
+ * touched.
+ *
+ * The counters are updated without a lock; an increment lost to a race
+ * makes the estimates a little low, which a hot handle shrugs off.  The
+ * heap lock is only tried, and once a handle's estimate is above the
+ * heap's minimum only every NFSD_HOTFH_STRIDE calls, so that the hot
+ * handles do not all queue on it.
+ */
+
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/jhash.h>
+#include <linux/sort.h>
+#include <linux/seq_file.h>
+
+#include "nfsd.h"
+#include "xdr.h"
+#include "netns.h"
+#include "stats.h"
+#include "hotfh.h"
+
+#define NFSD_HOTFH_DEPTH	4
+#define NFSD_HOTFH_WIDTH	1024	/* a power of two */
+#define NFSD_HOTFH_TOP		32
+#define NFSD_HOTFH_STRIDE	8	/* a power of two */
+#define NFSD_HOTFH_PATHLEN	96
+
+struct nfsd_hotfh_entry {
+	u32			he_hash;
+	u32			he_ops;		/* estimate when last updated */
+	unsigned int		he_fhlen;
+	u8			he_fh[NFS3_FHSIZE];
+	char			he_path[NFSD_HOTFH_PATHLEN];
+};
+
+struct nfsd_hotfh {
+	u32			hf_ops[NFSD_HOTFH_DEPTH][NFSD_HOTFH_WIDTH];
+	u64			hf_bytes[NFSD_HOTFH_DEPTH][NFSD_HOTFH_WIDTH];
+	spinlock_t		hf_lock;	/* the heap and hf_pathbuf */
+	unsigned int		hf_ntop;
+	struct nfsd_hotfh_entry	hf_top[NFSD_HOTFH_TOP];
+	char			hf_pathbuf[PATH_MAX];
+};
+
+static struct nfsd_hotfh *hotfh(struct svc_rqst *rqstp)
+{
+	struct nfsd_net *nn = net_generic(SVC_NET(rqstp), nfsd_net_id);
+
+	return nn->hotfh;
+}
+
+/* the counter of each row that @hash maps to */
+static void hotfh_cells(u32 hash, unsigned int *cell)
+{
+	u32 step = jhash_1word(hash, 0) | 1;
+	int i;
+
+	for (i = 0; i < NFSD_HOTFH_DEPTH; i++)
+		cell[i] = (hash + i * step) & (NFSD_HOTFH_WIDTH - 1);
+}
+
+static u32 hotfh_ops(struct nfsd_hotfh *hf, u32 hash)
+{
+	unsigned int cell[NFSD_HOTFH_DEPTH];
+	u32 est = U32_MAX;
+	int i;
+
+	hotfh_cells(hash, cell);
+	for (i = 0; i < NFSD_HOTFH_DEPTH; i++)
+		est = min(est, READ_ONCE(hf->hf_ops[i][cell[i]]));
+	return est;
+}
+
+static u64 hotfh_bytes(struct nfsd_hotfh *hf, u32 hash)
+{
+	unsigned int cell[NFSD_HOTFH_DEPTH];
+	u64 est = U64_MAX;
+	int i;
+
+	hotfh_cells(hash, cell);
+	for (i = 0; i < NFSD_HOTFH_DEPTH; i++)
+		est = min(est, READ_ONCE(hf->hf_bytes[i][cell[i]]));
+	return est;
+}
+
+static void hotfh_swap(struct nfsd_hotfh *hf, unsigned int a, unsigned int b)
+{
+	swap(hf->hf_top[a], hf->hf_top[b]);
+}
+
+static void hotfh_sift_up(struct nfsd_hotfh *hf, unsigned int i)
+{
+	unsigned int parent;
+
+	while (i) {
+		parent = (i - 1) / 2;
+		if (hf->hf_top[parent].he_ops <= hf->hf_top[i].he_ops)
+			break;
+		hotfh_swap(hf, i, parent);
+		i = parent;
+	}
+}
+
+static void hotfh_sift_down(struct nfsd_hotfh *hf, unsigned int i)
+{
+	unsigned int child;
+
+	while ((child = 2 * i + 1) < hf->hf_ntop) {
+		if (child + 1 < hf->hf_ntop &&
+		    hf->hf_top[child + 1].he_ops < hf->hf_top[child].he_ops)
+			child++;
+		if (hf->hf_top[i].he_ops <= hf->hf_top[child].he_ops)
+			break;
+		hotfh_swap(hf, i, child);
+		i = child;
+	}
+}
+
+static void hotfh_fill(struct nfsd_hotfh *hf, struct nfsd_hotfh_entry *he,
+		       u32 hash, u32 ops, struct svc_fh *fhp)
+{
+	struct knfsd_fh *fh = &fhp->fh_handle;
+	struct path path = {
+		.mnt	= fhp->fh_export->ex_path.mnt,
+		.dentry	= fhp->fh_dentry,
+	};
+	char *name;
+	size_t len;
+
+	he->he_hash = hash;
+	he->he_ops = ops;
+	he->he_fhlen = min_t(unsigned int, fh->fh_size, NFS3_FHSIZE);
+	memcpy(he->he_fh, &fh->fh_base, he->he_fhlen);
+
+	name = d_path(&path, hf->hf_pathbuf, PATH_MAX);
+	if (IS_ERR(name))
+		name = "?";
+	/* the end of a long path says more than its start */
+	len = strlen(name);
+	if (len >= NFSD_HOTFH_PATHLEN)
+		name += len - (NFSD_HOTFH_PATHLEN - 1);
+	strlcpy(he->he_path, name, NFSD_HOTFH_PATHLEN);
+}
+
+/* called with hf_lock held */
+static void hotfh_update(struct nfsd_hotfh *hf, u32 hash, u32 ops,
+			 struct svc_fh *fhp)
+{
+	struct knfsd_fh *fh = &fhp->fh_handle;
+	struct nfsd_hotfh_entry *he;
+	unsigned int i;
+
+	for (i = 0; i < hf->hf_ntop; i++) {
+		he = &hf->hf_top[i];
+		if (he->he_hash == hash && he->he_fhlen == fh->fh_size &&
+		    !memcmp(he->he_fh, &fh->fh_base, he->he_fhlen)) {
+			he->he_ops = max(he->he_ops, ops);
+			hotfh_sift_down(hf, i);
+			return;
+		}
+	}
+
+	if (hf->hf_ntop < NFSD_HOTFH_TOP) {
+		i = hf->hf_ntop;
+		hotfh_fill(hf, &hf->hf_top[i], hash, ops, fhp);
+		WRITE_ONCE(hf->hf_ntop, i + 1);
+		hotfh_sift_up(hf, i);
+	} else if (ops > hf->hf_top[0].he_ops) {
+		hotfh_fill(hf, &hf->hf_top[0], hash, ops, fhp);
+		hotfh_sift_down(hf, 0);
+	}
+}
+
+/*
+ * Called by fh_verify() once it has found the dentry and export of
+ * @fhp.  Only the first handle of a request is counted.
+ */
+void
+nfsd_hotfh_record(struct svc_rqst *rqstp, struct svc_fh *fhp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_hotfh *hf = hotfh(rqstp);
+	struct knfsd_fh *fh = &fhp->fh_handle;
+	unsigned int cell[NFSD_HOTFH_DEPTH];
+	u32 hash, ops, est = U32_MAX;
+	int i;
+
+	if (!hf || ctx->tc_hotfh_hash || ctx->tc_bench)
+		return;
+	hash = jhash(&fh->fh_base, fh->fh_size, 0) ?: 1;
+	ctx->tc_hotfh_hash = hash;
+
+	hotfh_cells(hash, cell);
+	for (i = 0; i < NFSD_HOTFH_DEPTH; i++) {
+		ops = READ_ONCE(hf->hf_ops[i][cell[i]]) + 1;
+		WRITE_ONCE(hf->hf_ops[i][cell[i]], ops);
+		est = min(est, ops);
+	}
+
+	if (READ_ONCE(hf->hf_ntop) == NFSD_HOTFH_TOP &&
+	    (est <= READ_ONCE(hf->hf_top[0].he_ops) ||
+	     (est & (NFSD_HOTFH_STRIDE - 1))))
+		return;
+	/* if someone else has the lock, a later call will catch up */
+	if (!spin_trylock(&hf->hf_lock))
+		return;
+	hotfh_update(hf, hash, est, fhp);
+	spin_unlock(&hf->hf_lock);
+}
+
+/*
+ * Called by nfsd_dispatch() once the reply has been encoded, to count
+ * the bytes moved against the handle fh_verify() recorded.
+ */
+void
+nfsd_hotfh_account(struct svc_rqst *rqstp, __be32 nfserr)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_hotfh *hf = hotfh(rqstp);
+	unsigned int cell[NFSD_HOTFH_DEPTH];
+	u64 bytes;
+	int i;
+
+	if (!hf || !ctx->tc_hotfh_hash || nfserr ||
+	    rqstp->rq_prog != NFS_PROGRAM || rqstp->rq_vers != 3)
+		return;
+	if (rqstp->rq_proc == NFS3PROC_READ)
+		bytes = ((struct nfsd3_readres *)rqstp->rq_resp)->count;
+	else if (rqstp->rq_proc == NFS3PROC_WRITE)
+		bytes = ((struct nfsd3_writeres *)rqstp->rq_resp)->count;
+	else
+		return;
+
+	hotfh_cells(ctx->tc_hotfh_hash, cell);
+	for (i = 0; i < NFSD_HOTFH_DEPTH; i++)
+		WRITE_ONCE(hf->hf_bytes[i][cell[i]],
+			   READ_ONCE(hf->hf_bytes[i][cell[i]]) + bytes);
+}
+
+static int hotfh_cmp(const void *a, const void *b)
+{
+	const struct nfsd_hotfh_entry *x = a, *y = b;
+
+	if (x->he_ops != y->he_ops)
+		return x->he_ops < y->he_ops ? 1 : -1;
+	return 0;
+}
+
+/*
+ * The "hot_handles" file: the handles in the heap, hottest first, with
+ * their current estimates.  m->private is the net.
+ */
+int
+nfsd_hotfh_seq_show(struct seq_file *m, void *v)
+{
+	struct nfsd_net *nn = net_generic(m->private, nfsd_net_id);
+	struct nfsd_hotfh *hf = nn->hotfh;
+	struct nfsd_hotfh_entry *top, *he;
+	unsigned int n, i;
+
+	top = kmalloc_array(NFSD_HOTFH_TOP, sizeof(*top), GFP_KERNEL);
+	if (!top)
+		return -ENOMEM;
+	spin_lock(&hf->hf_lock);
+	n = hf->hf_ntop;
+	memcpy(top, hf->hf_top, n * sizeof(*top));
+	spin_unlock(&hf->hf_lock);
+
+	for (i = 0; i < n; i++)
+		top[i].he_ops = hotfh_ops(hf, top[i].he_hash);
+	sort(top, n, sizeof(*top), hotfh_cmp, NULL);
+
+	seq_printf(m, "%10s %14s %-32s %s\n", "ops", "bytes", "path", "fh");
+	for (i = 0; i < n; i++) {
+		he = &top[i];
+		seq_printf(m, "%10u %14llu %-32s %*phN\n", he->he_ops,
+			   (unsigned long long)hotfh_bytes(hf, he->he_hash),
+			   he->he_path, he->he_fhlen, he->he_fh);
+	}
+	kfree(top);
+	return 0;
+}
+
+void
+nfsd_hotfh_clear(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_hotfh *hf = nn->hotfh;
+
+	spin_lock(&hf->hf_lock);
+	memset(hf->hf_ops, 0, sizeof(hf->hf_ops));
+	memset(hf->hf_bytes, 0, sizeof(hf->hf_bytes));
+	WRITE_ONCE(hf->hf_ntop, 0);
+	spin_unlock(&hf->hf_lock);
+}
+
+/*
+ * Format the sketch dimensions into @buf for the hot_handles_ctl
+ * control file.
+ */
+int
+nfsd_hotfh_show(struct net *net, char *buf, int size)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+
+	return scnprintf(buf, size, "depth %d\nwidth %d\ntop %d\nlisted %u\n",
+			 NFSD_HOTFH_DEPTH, NFSD_HOTFH_WIDTH, NFSD_HOTFH_TOP,
+			 READ_ONCE(nn->hotfh->hf_ntop));
+}
+
+int
+nfsd_hotfh_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_hotfh *hf;
+
+	hf = vzalloc(sizeof(*hf));
+	if (!hf)
+		return -ENOMEM;
+	spin_lock_init(&hf->hf_lock);
+	nn->hotfh = hf;
+	return 0;
+}
+
+void
+nfsd_hotfh_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_hotfh *hf = nn->hotfh;
+
+	if (!hf)
+		return;
+	nn->hotfh = NULL;
+	vfree(hf);
+}
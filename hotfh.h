@@ -0,0 +1,25 @@
+/*
+ * Hottest file handles.
+ *
+ * fh_verify() feeds the handle of every request into a fixed-size
+ * sketch that keeps the most used handles; the "hot_handles" file
+ * lists them with their paths and their call and byte counts.
+ */
+
+#ifndef LINUX_NFSD_HOTFH_H
+#define LINUX_NFSD_HOTFH_H
+
+struct net;
+struct svc_rqst;
+struct svc_fh;
+struct seq_file;
+
+int	nfsd_hotfh_init(struct net *);
+void	nfsd_hotfh_shutdown(struct net *);
+void	nfsd_hotfh_record(struct svc_rqst *, struct svc_fh *);
+void	nfsd_hotfh_account(struct svc_rqst *, __be32 nfserr);
+void	nfsd_hotfh_clear(struct net *);
+int	nfsd_hotfh_show(struct net *, char *, int);
+int	nfsd_hotfh_seq_show(struct seq_file *, void *);
+
+#endif /* LINUX_NFSD_HOTFH_H */
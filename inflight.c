@@ -0,0 +1,289 @@
+/*
+ * In-flight request tracking and stuck thread watchdog.
+ *
+ * When the server stalls (a hung backing disk, a lease break, a slow
+ * commit) the question is what each nfsd thread is doing.  Every thread
+ * is on a per-net list from start to exit, and nfsd() stamps the thread
+ * context with the time it picked up its current request.  Together
+ * with the stage the request is in (stats.h) and what svc_process() has
+ * already filled in, that is enough to say, for every busy thread,
+ * which procedure it is running for which client on which handle, in
+ * which stage, and for how long.
+ *
+ * Readers look at the other threads' requests without stopping them,
+ * so a line may mix two consecutive requests of a thread that is
+ * moving quickly.  Stuck threads, the interesting ones, are not moving.
+ *
+ * The watchdog looks at the list periodically and logs one report
+ * listing the requests that have been in flight longer than the
+ * threshold, at most once per threshold interval.
+ */
+
+#include <linux/slab.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+#include <linux/sched.h>
+#include <linux/sunrpc/svc_xprt.h>
+
+#include "nfsd.h"
+#include "xdr.h"
+#include "netns.h"
+#include "stats.h"
+#include "inflight.h"
+#include "statpage.h"
+
+#define NFSD_WATCHDOG_PERIOD		(5 * HZ)
+#define NFSD_WATCHDOG_DEFAULT_SECS	60
+/* requests listed in one report; the rest are only counted */
+#define NFSD_WATCHDOG_LINES		8
+
+struct nfsd_inflight_info {
+	pid_t			ii_pid;
+	unsigned long		ii_age;		/* jiffies */
+	int			ii_stage;
+	int			ii_proc;	/* -1 if not known yet */
+	u32			ii_xid;
+	struct sockaddr_storage	ii_addr;
+	unsigned int		ii_fhlen;
+	u8			ii_fh[NFS3_FHSIZE];
+};
+
+struct nfsd_inflight {
+	spinlock_t		if_lock;	/* if_threads */
+	struct list_head	if_threads;
+	struct delayed_work	if_watchdog;
+	unsigned int		if_threshold;	/* seconds, 0 when off */
+	unsigned long		if_last_report;	/* jiffies */
+	unsigned long		if_reports;
+	/* only used by the watchdog, which does not run concurrently */
+	struct nfsd_inflight_info if_scratch;
+	struct nfsd_inflight_info if_info[NFSD_WATCHDOG_LINES];
+};
+
+/*
+ * Take a snapshot of what the thread owning @ctx is doing.  Returns
+ * false if it is idle.
+ */
+static bool inflight_get(struct nfsd_thread_ctx *ctx,
+			 struct nfsd_inflight_info *ii)
+{
+	struct svc_rqst *rqstp = ctx->tc_rqstp;
+	unsigned long since = READ_ONCE(ctx->tc_busy_since);
+	struct svc_fh *fhp;
+
+	if (!since)
+		return false;
+	ii->ii_pid = ctx->tc_pid;
+	ii->ii_age = jiffies - since;
+	ii->ii_stage = READ_ONCE(ctx->tc_stage);
+	ii->ii_xid = ntohl(rqstp->rq_xid);
+	memcpy(&ii->ii_addr, &rqstp->rq_addr,
+	       min_t(size_t, rqstp->rq_addrlen, sizeof(ii->ii_addr)));
+	if (rqstp->rq_addrlen < sizeof(sa_family_t))
+		ii->ii_addr.ss_family = AF_UNSPEC;
+
+	/*
+	 * Until svc_process() has parsed the call header, rq_proc is left
+	 * over from the previous request; until the arguments are decoded,
+	 * so is the handle.  All NFSv3 arguments but NULL's start with it.
+	 */
+	ii->ii_proc = -1;
+	ii->ii_fhlen = 0;
+	if (ii->ii_stage == NFSD_STAGE_RPC || rqstp->rq_prog != NFS_PROGRAM ||
+	    rqstp->rq_vers != 3 || rqstp->rq_proc >= NFSD3_NPROCS)
+		return true;
+	ii->ii_proc = rqstp->rq_proc;
+	if (ii->ii_stage <= NFSD_STAGE_DECODE || !ii->ii_proc)
+		return true;
+	fhp = rqstp->rq_argp;
+	ii->ii_fhlen = min_t(unsigned int, fhp->fh_handle.fh_size,
+			     NFS3_FHSIZE);
+	memcpy(ii->ii_fh, &fhp->fh_handle.fh_base, ii->ii_fhlen);
+	return true;
+}
+
+static int inflight_format(struct nfsd_inflight_info *ii, char *buf, int size)
+{
+	return scnprintf(buf, size,
+			 "pid %d %s xid %08x client %pISpc stage %s "
+			 "age_ms %u fh %*phN",
+			 ii->ii_pid,
+			 ii->ii_proc < 0 ? "-" : nfsd3_procname[ii->ii_proc],
+			 ii->ii_xid, &ii->ii_addr,
+			 nfsd_stage_name[ii->ii_stage],
+			 jiffies_to_msecs(ii->ii_age),
+			 ii->ii_fhlen, ii->ii_fh);
+}
+
+/*
+ * The "inflight" file: one line per busy thread.  m->private is the
+ * net.
+ */
+int
+nfsd_inflight_seq_show(struct seq_file *m, void *v)
+{
+	struct nfsd_net *nn = net_generic(m->private, nfsd_net_id);
+	struct nfsd_inflight *inf = nn->inflight;
+	struct nfsd_inflight_info *ii;
+	struct nfsd_thread_ctx *ctx;
+	char line[256];
+
+	ii = kmalloc(sizeof(*ii), GFP_KERNEL);
+	if (!ii)
+		return -ENOMEM;
+	spin_lock(&inf->if_lock);
+	list_for_each_entry(ctx, &inf->if_threads, tc_inflight) {
+		if (!inflight_get(ctx, ii))
+			continue;
+		inflight_format(ii, line, sizeof(line));
+		seq_printf(m, "%s\n", line);
+	}
+	spin_unlock(&inf->if_lock);
+	kfree(ii);
+	return 0;
+}
+
+static void nfsd_watchdog(struct work_struct *work)
+{
+	struct nfsd_inflight *inf = container_of(to_delayed_work(work),
+						 struct nfsd_inflight,
+						 if_watchdog);
+	struct nfsd_inflight_info *ii = &inf->if_scratch;
+	struct nfsd_thread_ctx *ctx;
+	unsigned long threshold, oldest = 0;
+	unsigned int stuck = 0, listed = 0, i;
+	char line[256];
+
+	threshold = READ_ONCE(inf->if_threshold) * HZ;
+	if (!threshold || (inf->if_reports &&
+	    time_before(jiffies, inf->if_last_report + threshold)))
+		goto out;
+
+	spin_lock(&inf->if_lock);
+	list_for_each_entry(ctx, &inf->if_threads, tc_inflight) {
+		if (!inflight_get(ctx, ii) || ii->ii_age < threshold)
+			continue;
+		stuck++;
+		oldest = max(oldest, ii->ii_age);
+		if (listed < NFSD_WATCHDOG_LINES)
+			inf->if_info[listed++] = *ii;
+	}
+	spin_unlock(&inf->if_lock);
+	if (!stuck)
+		goto out;
+
+	printk(KERN_WARNING "nfsd: %u request%s in flight for more than %us, "
+	       "oldest %ums\n", stuck, stuck == 1 ? "" : "s",
+	       inf->if_threshold, jiffies_to_msecs(oldest));
+	for (i = 0; i < listed; i++) {
+		inflight_format(&inf->if_info[i], line, sizeof(line));
+		printk(KERN_WARNING "nfsd:   %s\n", line);
+	}
+	if (stuck > listed)
+		printk(KERN_WARNING "nfsd:   and %u more\n", stuck - listed);
+	inf->if_last_report = jiffies;
+	inf->if_reports++;
+out:
+	schedule_delayed_work(&inf->if_watchdog, NFSD_WATCHDOG_PERIOD);
+}
+
+void
+nfsd_inflight_register(struct net *net, struct svc_rqst *rqstp)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_inflight *inf = nn->inflight;
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+
+	ctx->tc_rqstp = rqstp;
+	ctx->tc_pid = task_pid_nr(current);
+	ctx->tc_busy_since = 0;
+	spin_lock(&inf->if_lock);
+	list_add_tail(&ctx->tc_inflight, &inf->if_threads);
+	spin_unlock(&inf->if_lock);
+}
+
+void
+nfsd_inflight_unregister(struct net *net, struct svc_rqst *rqstp)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_inflight *inf = nn->inflight;
+
+	spin_lock(&inf->if_lock);
+	list_del(&nfsd_rqst_ctx(rqstp)->tc_inflight);
+	spin_unlock(&inf->if_lock);
+}
+
+/* Count the threads and the busy ones for the binary statistics page. */
+void
+nfsd_inflight_statpage(struct net *net, struct nfsd_statpage *sp)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_inflight *inf = nn->inflight;
+	struct nfsd_thread_ctx *ctx;
+
+	if (!inf)
+		return;
+	spin_lock(&inf->if_lock);
+	list_for_each_entry(ctx, &inf->if_threads, tc_inflight) {
+		sp->sp_threads++;
+		if (READ_ONCE(ctx->tc_busy_since))
+			sp->sp_busy++;
+	}
+	spin_unlock(&inf->if_lock);
+}
+
+int
+nfsd_watchdog_set_threshold(struct net *net, unsigned int secs)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+
+	if (secs > 24 * 3600)
+		return -EINVAL;
+	WRITE_ONCE(nn->inflight->if_threshold, secs);
+	return 0;
+}
+
+/*
+ * Format the settings into @buf for the watchdog control file.
+ */
+int
+nfsd_watchdog_show(struct net *net, char *buf, int size)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_inflight *inf = nn->inflight;
+
+	return scnprintf(buf, size, "threshold_secs %u\nreports %lu\n",
+			 READ_ONCE(inf->if_threshold),
+			 READ_ONCE(inf->if_reports));
+}
+
+int
+nfsd_inflight_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_inflight *inf;
+
+	inf = kzalloc(sizeof(*inf), GFP_KERNEL);
+	if (!inf)
+		return -ENOMEM;
+	spin_lock_init(&inf->if_lock);
+	INIT_LIST_HEAD(&inf->if_threads);
+	inf->if_threshold = NFSD_WATCHDOG_DEFAULT_SECS;
+	INIT_DELAYED_WORK(&inf->if_watchdog, nfsd_watchdog);
+	nn->inflight = inf;
+	schedule_delayed_work(&inf->if_watchdog, NFSD_WATCHDOG_PERIOD);
+	return 0;
+}
+
+void
+nfsd_inflight_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_inflight *inf = nn->inflight;
+
+	if (!inf)
+		return;
+	cancel_delayed_work_sync(&inf->if_watchdog);
+	nn->inflight = NULL;
+	kfree(inf);
+}
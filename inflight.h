@@ -0,0 +1,40 @@
+/*
+ * In-flight request tracking.
+ *
+ * nfsd threads register with their net at start, and mark themselves
+ * busy while they process a request.  The "inflight" file lists the
+ * busy ones, and a watchdog logs those that have been busy too long.
+ */
+
+#ifndef LINUX_NFSD_INFLIGHT_H
+#define LINUX_NFSD_INFLIGHT_H
+
+#include <linux/jiffies.h>
+#include "nfsd.h"
+#include "xdr.h"
+
+struct seq_file;
+struct nfsd_statpage;
+
+/* called by nfsd() when svc_recv() has returned a request */
+static inline void nfsd_inflight_begin(struct svc_rqst *rqstp)
+{
+	WRITE_ONCE(nfsd_rqst_ctx(rqstp)->tc_busy_since, jiffies ?: 1);
+}
+
+/* called by nfsd() when svc_process() has returned */
+static inline void nfsd_inflight_end(struct svc_rqst *rqstp)
+{
+	WRITE_ONCE(nfsd_rqst_ctx(rqstp)->tc_busy_since, 0);
+}
+
+int	nfsd_inflight_init(struct net *);
+void	nfsd_inflight_shutdown(struct net *);
+void	nfsd_inflight_register(struct net *, struct svc_rqst *);
+void	nfsd_inflight_unregister(struct net *, struct svc_rqst *);
+int	nfsd_inflight_seq_show(struct seq_file *, void *);
+int	nfsd_watchdog_set_threshold(struct net *, unsigned int secs);
+int	nfsd_watchdog_show(struct net *, char *, int);
+void	nfsd_inflight_statpage(struct net *, struct nfsd_statpage *);
+
+#endif /* LINUX_NFSD_INFLIGHT_H */
@@ -0,0 +1,319 @@
+/*
+ * Metadata and bulk data lanes.
+ *
+ * A READ, WRITE or COMMIT may hold its thread for as long as the disk
+ * takes, and with enough of them in progress a GETATTR or LOOKUP finds
+ * no thread at all: an "ls" on a busy server takes seconds.  Every NFSv3
+ * procedure is put in one of two lanes by nfsd3_lanes[], which sits
+ * next to nfsd_procedures3, and a number of threads, ln_reserve, is
+ * kept for the metadata lane.  Bulk data procedures may have at most
+ * the other threads busy at a time.
+ *
+ * The reserve is only kept while metadata is going on, that is while
+ * a metadata procedure is in progress or has finished within the last
+ * NFSD_LANES_LINGER; a server that only streams data lends it to the
+ * data lane and loses nothing.
+ *
+ * A data procedure that finds its lane full after decoding is put off
+ * the way a request waiting for an export upcall is: svc_defer() takes
+ * a copy of it and the thread drops it, and when a data procedure
+ * finishes the oldest put-off one is revisited, which queues it on its
+ * transport again.  It then goes ahead of new data procedures; the copy
+ * is marked (nfsd_defer_mark()) so that it is not mistaken for a request
+ * coming back from an upcall, which has not waited for the lane.  No
+ * data procedure, borrowing or not, is admitted while older ones wait.
+ * svc_defer() only copies requests whose arguments fit in the head, so
+ * a WRITE whose data came in pages cannot be put off; it runs anyway,
+ * and is counted as an overflow.
+ *
+ * Lane accounting is not done with no reserve, which is the default.
+ */
+
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/sunrpc/svc.h>
+#include <linux/sunrpc/cache.h>
+
+#include "nfsd.h"
+#include "netns.h"
+#include "lanes.h"
+
+#define NFSD_LANES_LINGER	(HZ / 10)
+#define NFSD_LANES_MAX_RESERVE	1024
+
+struct nfsd_lanes_stats {
+	unsigned long		calls[NFSD_NR_LANES];
+	unsigned long		borrowed;	/* data on the metadata reserve */
+	unsigned long		deferred;	/* data put off for room */
+	unsigned long		overflow;	/* data that could not be */
+};
+
+struct nfsd_lanes {
+	unsigned int		ln_reserve;	/* threads kept for metadata */
+	atomic_t		ln_meta_busy;
+	unsigned long		ln_meta_last;	/* jiffies */
+	spinlock_t		ln_lock;
+	unsigned int		ln_data_busy;
+	struct list_head	ln_deferred;	/* cache_deferred_req, by recent */
+	unsigned int		ln_ndeferred;
+	struct nfsd_lanes_stats __percpu *ln_stats;
+};
+
+static struct nfsd_lanes *lanes(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+
+	return nn->lanes;
+}
+
+static int lanes_of(struct svc_rqst *rqstp)
+{
+	if (rqstp->rq_prog != NFS_PROGRAM || rqstp->rq_vers != 3 ||
+	    rqstp->rq_proc >= NFSD3_NPROCS)
+		return NFSD_LANE_META;
+	return nfsd3_lanes[rqstp->rq_proc];
+}
+
+/* the threads of the data lane proper */
+static unsigned int lanes_data_share(struct nfsd_lanes *ln,
+				     unsigned int nthreads)
+{
+	unsigned int reserve = READ_ONCE(ln->ln_reserve);
+
+	if (reserve >= nthreads)
+		return 1;
+	return nthreads - reserve;
+}
+
+/* how many data procedures may be in progress, borrowing included */
+static unsigned int lanes_data_limit(struct nfsd_lanes *ln,
+				     unsigned int nthreads)
+{
+	if (!atomic_read(&ln->ln_meta_busy) &&
+	    time_after(jiffies, READ_ONCE(ln->ln_meta_last) + NFSD_LANES_LINGER))
+		return nthreads;
+	return lanes_data_share(ln, nthreads);
+}
+
+/* the oldest put-off data procedure, if there is room for it */
+static struct cache_deferred_req *lanes_next(struct nfsd_lanes *ln,
+					     unsigned int nthreads)
+{
+	struct cache_deferred_req *dreq;
+
+	if (list_empty(&ln->ln_deferred) ||
+	    ln->ln_data_busy >= lanes_data_limit(ln, nthreads))
+		return NULL;
+	dreq = list_first_entry(&ln->ln_deferred, struct cache_deferred_req,
+				recent);
+	list_del_init(&dreq->recent);
+	ln->ln_ndeferred--;
+	return dreq;
+}
+
+/*
+ * Called by nfsd_dispatch() with a decoded request.  Returns false if
+ * the request has been put off and is to be dropped for now.
+ */
+bool
+nfsd_lane_enter(struct svc_rqst *rqstp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_lanes *ln = lanes(SVC_NET(rqstp));
+	unsigned int nthreads = rqstp->rq_server->sv_nrthreads;
+	struct cache_deferred_req *dreq;
+	bool revisit;
+	int lane;
+
+	ctx->tc_lane = -1;
+	if (!ln || ctx->tc_bench)
+		return true;
+	lane = lanes_of(rqstp);
+	this_cpu_inc(ln->ln_stats->calls[lane]);
+	if (!READ_ONCE(ln->ln_reserve))
+		return true;
+
+	if (lane == NFSD_LANE_META) {
+		atomic_inc(&ln->ln_meta_busy);
+		WRITE_ONCE(ln->ln_meta_last, jiffies);
+		ctx->tc_lane = NFSD_LANE_META;
+		return true;
+	}
+
+	/* a request revisited from here has waited its turn already */
+	revisit = nfsd_defer_marked(rqstp, NFSD_DEFER_LANES);
+	spin_lock_bh(&ln->ln_lock);
+	if (!revisit && !list_empty(&ln->ln_deferred))
+		goto out_defer;
+	if (ln->ln_data_busy < lanes_data_share(ln, nthreads))
+		goto out_admit;
+	if (ln->ln_data_busy < lanes_data_limit(ln, nthreads)) {
+		this_cpu_inc(ln->ln_stats->borrowed);
+		goto out_admit;
+	}
+out_defer:
+	spin_unlock_bh(&ln->ln_lock);
+
+	/* svc_defer() allocates */
+	dreq = rqstp->rq_chandle.defer(&rqstp->rq_chandle);
+	if (!dreq) {
+		this_cpu_inc(ln->ln_stats->overflow);
+		spin_lock_bh(&ln->ln_lock);
+		goto out_admit;
+	}
+	this_cpu_inc(ln->ln_stats->deferred);
+	nfsd_defer_mark(rqstp, dreq, NFSD_DEFER_LANES);
+	spin_lock_bh(&ln->ln_lock);
+	if (revisit)
+		list_add(&dreq->recent, &ln->ln_deferred);
+	else
+		list_add_tail(&dreq->recent, &ln->ln_deferred);
+	ln->ln_ndeferred++;
+	/* room may have been made while the lock was dropped */
+	dreq = lanes_next(ln, nthreads);
+	spin_unlock_bh(&ln->ln_lock);
+	if (dreq)
+		dreq->revisit(dreq, 0);
+	return false;
+
+out_admit:
+	ln->ln_data_busy++;
+	spin_unlock_bh(&ln->ln_lock);
+	ctx->tc_lane = NFSD_LANE_DATA;
+	/* its turn is used up if it is put off again for something else */
+	if (revisit)
+		nfsd_defer_unmark(rqstp, NFSD_DEFER_LANES);
+	return true;
+}
+
+/* Called by nfsd_dispatch() when the procedure has returned. */
+void
+nfsd_lane_exit(struct svc_rqst *rqstp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_lanes *ln = lanes(SVC_NET(rqstp));
+	struct cache_deferred_req *dreq;
+
+	switch (ctx->tc_lane) {
+	case NFSD_LANE_META:
+		WRITE_ONCE(ln->ln_meta_last, jiffies);
+		atomic_dec(&ln->ln_meta_busy);
+		break;
+	case NFSD_LANE_DATA:
+		spin_lock_bh(&ln->ln_lock);
+		ln->ln_data_busy--;
+		dreq = lanes_next(ln, rqstp->rq_server->sv_nrthreads);
+		spin_unlock_bh(&ln->ln_lock);
+		if (dreq)
+			dreq->revisit(dreq, 0);
+		break;
+	}
+	ctx->tc_lane = -1;
+}
+
+/*
+ * Revisit every put-off request, or with @drop free them, which is
+ * what is done when the service goes away.
+ */
+void
+nfsd_lanes_flush(struct net *net, bool drop)
+{
+	struct nfsd_lanes *ln = lanes(net);
+	struct cache_deferred_req *dreq, *next;
+	LIST_HEAD(flush);
+
+	if (!ln)
+		return;
+	spin_lock_bh(&ln->ln_lock);
+	list_splice_init(&ln->ln_deferred, &flush);
+	ln->ln_ndeferred = 0;
+	spin_unlock_bh(&ln->ln_lock);
+
+	list_for_each_entry_safe(dreq, next, &flush, recent) {
+		list_del_init(&dreq->recent);
+		dreq->revisit(dreq, drop);
+	}
+}
+
+int
+nfsd_lanes_set_reserve(struct net *net, unsigned int reserve)
+{
+	struct nfsd_lanes *ln = lanes(net);
+
+	if (reserve > NFSD_LANES_MAX_RESERVE)
+		return -EINVAL;
+	WRITE_ONCE(ln->ln_reserve, reserve);
+	if (!reserve)
+		nfsd_lanes_flush(net, false);
+	return 0;
+}
+
+/*
+ * Format the reserve and counters into @buf for the lanes control
+ * file.
+ */
+int
+nfsd_lanes_show(struct net *net, char *buf, int size)
+{
+	struct nfsd_lanes *ln = lanes(net);
+	struct nfsd_lanes_stats sum = { { 0 } };
+	unsigned int data_busy, waiting;
+	int cpu, lane;
+
+	for_each_possible_cpu(cpu) {
+		struct nfsd_lanes_stats *s = per_cpu_ptr(ln->ln_stats, cpu);
+
+		for (lane = 0; lane < NFSD_NR_LANES; lane++)
+			sum.calls[lane] += s->calls[lane];
+		sum.borrowed += s->borrowed;
+		sum.deferred += s->deferred;
+		sum.overflow += s->overflow;
+	}
+	spin_lock_bh(&ln->ln_lock);
+	data_busy = ln->ln_data_busy;
+	waiting = ln->ln_ndeferred;
+	spin_unlock_bh(&ln->ln_lock);
+
+	return scnprintf(buf, size, "reserve %u\nmeta_busy %d\ndata_busy %u\n"
+			 "waiting %u\nmeta_calls %lu\ndata_calls %lu\n"
+			 "borrowed %lu\ndeferred %lu\noverflow %lu\n",
+			 READ_ONCE(ln->ln_reserve),
+			 atomic_read(&ln->ln_meta_busy), data_busy, waiting,
+			 sum.calls[NFSD_LANE_META], sum.calls[NFSD_LANE_DATA],
+			 sum.borrowed, sum.deferred, sum.overflow);
+}
+
+int
+nfsd_lanes_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_lanes *ln;
+
+	ln = kzalloc(sizeof(*ln), GFP_KERNEL);
+	if (!ln)
+		return -ENOMEM;
+	ln->ln_stats = alloc_percpu(struct nfsd_lanes_stats);
+	if (!ln->ln_stats) {
+		kfree(ln);
+		return -ENOMEM;
+	}
+	spin_lock_init(&ln->ln_lock);
+	INIT_LIST_HEAD(&ln->ln_deferred);
+	ln->ln_meta_last = jiffies - NFSD_LANES_LINGER - 1;
+	nn->lanes = ln;
+	return 0;
+}
+
+void
+nfsd_lanes_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_lanes *ln = nn->lanes;
+
+	if (!ln)
+		return;
+	nfsd_lanes_flush(net, true);
+	nn->lanes = NULL;
+	free_percpu(ln->ln_stats);
+	kfree(ln);
+}
@@ -0,0 +1,31 @@
+/*
+ * Metadata and bulk data lanes.
+ *
+ * Procedures that move file data may only take the threads that are not
+ * kept back for metadata procedures, unless no metadata is going on.
+ */
+
+#ifndef LINUX_NFSD_LANES_H
+#define LINUX_NFSD_LANES_H
+
+struct net;
+struct svc_rqst;
+
+enum {
+	NFSD_LANE_META = 0,
+	NFSD_LANE_DATA,
+	NFSD_NR_LANES
+};
+
+/* the lane of each NFSv3 procedure, next to nfsd_procedures3 in proc.c */
+extern const unsigned char	nfsd3_lanes[];
+
+int	nfsd_lanes_init(struct net *);
+void	nfsd_lanes_shutdown(struct net *);
+bool	nfsd_lane_enter(struct svc_rqst *);
+void	nfsd_lane_exit(struct svc_rqst *);
+void	nfsd_lanes_flush(struct net *, bool drop);
+int	nfsd_lanes_set_reserve(struct net *, unsigned int);
+int	nfsd_lanes_show(struct net *, char *, int);
+
+#endif /* LINUX_NFSD_LANES_H */
@@ -0,0 +1,179 @@
+/*
+ * Listening transports.
+ *
+ * nfsd_init_socks() only knows one UDP and one TCP listener on the
+ * IPv4 wildcard address.  Listeners on the wildcard address of either
+ * family are added here through svc_create_xprt(), like those.
+ * svc_create_xprt() cannot bind anything more specific, or set socket
+ * options, so any other listener is a socket opened, bound and put in
+ * the listening state by a process, which writes its descriptor to the
+ * listeners file the way rpc.nfsd hands over the sockets it opens.
+ * svc_addsock() takes its own reference to the socket, so the process
+ * may close the descriptor afterwards.
+ *
+ * Several sockets bound with SO_REUSEPORT to one address have the
+ * network stack spread connections (TCP) or flows (UDP) over them by
+ * hash, and each of them is enqueued and accepted from independently
+ * of the others instead of every connection going through one socket.
+ * tools/loadgen/nfslisten opens such a group, one socket per cpu or per
+ * pool, and hands them over.
+ *
+ * If listeners have been added before the first threads are started,
+ * the default ones are not created.
+ */
+
+#include <linux/net.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/sunrpc/svc_xprt.h>
+#include <linux/sunrpc/svcsock.h>
+#include <linux/sunrpc/addr.h>
+#include <net/ipv6.h>
+
+#include "nfsd.h"
+#include "netns.h"
+#include "listener.h"
+
+static bool listener_wildcard(struct sockaddr *sap)
+{
+	switch (sap->sa_family) {
+	case AF_INET:
+		return ((struct sockaddr_in *)sap)->sin_addr.s_addr ==
+		       htonl(INADDR_ANY);
+	case AF_INET6:
+		return ipv6_addr_any(&((struct sockaddr_in6 *)sap)->sin6_addr);
+	}
+	return false;
+}
+
+/*
+ * Add a listener for transport @proto ("tcp" or "udp") on @sap, which
+ * must be the wildcard address of its family.  The service is created
+ * if it is not running yet, without starting any threads.
+ */
+int
+nfsd_listener_add(struct net *net, const char *proto, struct sockaddr *sap)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	int err;
+
+	if (strcmp(proto, "tcp") && strcmp(proto, "udp"))
+		return -EPROTONOSUPPORT;
+	/* a specific address needs a socket of the caller's, see above */
+	if (!listener_wildcard(sap))
+		return -EINVAL;
+
+	err = nfsd_create_serv(net);
+	if (err)
+		return err;
+	err = svc_create_xprt(nn->nfsd_serv, proto, net, sap->sa_family,
+			      rpc_get_port(sap), SVC_SOCK_DEFAULTS);
+	if (err < 0 && list_empty(&nn->nfsd_serv->sv_permsocks)) {
+		nfsd_destroy(net);
+		return err;
+	}
+	/* keep the service, but not as a thread */
+	nn->nfsd_serv->sv_nrthreads--;
+	return err < 0 ? err : 0;
+}
+
+/*
+ * Add the listening socket the writing process has open as @fd.  The
+ * service is created if it is not running yet, without starting any
+ * threads.
+ */
+int
+nfsd_listener_addfd(struct net *net, int fd)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	char name[80];
+	int err;
+
+	err = nfsd_create_serv(net);
+	if (err)
+		return err;
+	err = svc_addsock(nn->nfsd_serv, fd, name, sizeof(name));
+	if (err < 0 && list_empty(&nn->nfsd_serv->sv_permsocks)) {
+		nfsd_destroy(net);
+		return err;
+	}
+	/* keep the service, but not as a thread */
+	nn->nfsd_serv->sv_nrthreads--;
+	return err < 0 ? err : 0;
+}
+
+static bool listener_match(struct svc_xprt *xprt, const char *proto,
+			   struct sockaddr *sap)
+{
+	return !strcmp(xprt->xpt_class->xcl_name, proto) &&
+	       rpc_cmp_addr_port(sap, (struct sockaddr *)&xprt->xpt_local);
+}
+
+/*
+ * Close every listener for transport @proto on @sap.  Connections that
+ * were accepted from them stay up.
+ */
+int
+nfsd_listener_del(struct net *net, const char *proto, struct sockaddr *sap)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct svc_serv *serv = nn->nfsd_serv;
+	struct svc_xprt *xprt;
+	int closed = 0;
+
+	if (!serv)
+		return -ENOENT;
+again:
+	spin_lock_bh(&serv->sv_lock);
+	list_for_each_entry(xprt, &serv->sv_permsocks, xpt_list) {
+		if (test_bit(XPT_CLOSE, &xprt->xpt_flags) ||
+		    !listener_match(xprt, proto, sap))
+			continue;
+		svc_xprt_get(xprt);
+		spin_unlock_bh(&serv->sv_lock);
+		svc_close_xprt(xprt);
+		svc_xprt_put(xprt);
+		closed++;
+		goto again;
+	}
+	spin_unlock_bh(&serv->sv_lock);
+	return closed ? 0 : -ENOENT;
+}
+
+/*
+ * Format the listeners into @buf for the listeners control file: one
+ * line per transport and address, with the number of sockets on it.
+ */
+int
+nfsd_listener_show(struct net *net, char *buf, int size)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct svc_serv *serv = nn->nfsd_serv;
+	struct svc_xprt *xprt, *other, *first;
+	struct sockaddr *sap;
+	const char *proto;
+	int len = 0, copies;
+
+	if (!serv)
+		return 0;
+	spin_lock_bh(&serv->sv_lock);
+	list_for_each_entry(xprt, &serv->sv_permsocks, xpt_list) {
+		proto = xprt->xpt_class->xcl_name;
+		sap = (struct sockaddr *)&xprt->xpt_local;
+		first = NULL;
+		copies = 0;
+		list_for_each_entry(other, &serv->sv_permsocks, xpt_list) {
+			if (!listener_match(other, proto, sap))
+				continue;
+			if (!first)
+				first = other;
+			copies++;
+		}
+		/* each address once, at its first socket */
+		if (first == xprt)
+			len += scnprintf(buf + len, size - len, "%s %pISpc %d\n",
+					 proto, sap, copies);
+	}
+	spin_unlock_bh(&serv->sv_lock);
+	return len;
+}
@@ -0,0 +1,24 @@
+/*
+ * Listening transports.
+ *
+ * The "listeners" control file adds and removes listening sockets by
+ * transport, address and port, for IPv4 and IPv6.  Sockets on specific
+ * addresses, or groups of SO_REUSEPORT sockets on one address so that
+ * accepting and receiving spread over several sockets, are opened by a
+ * process and handed over by descriptor.
+ */
+
+#ifndef LINUX_NFSD_LISTENER_H
+#define LINUX_NFSD_LISTENER_H
+
+struct net;
+struct sockaddr;
+
+int	nfsd_listener_add(struct net *, const char *proto,
+			  struct sockaddr *);
+int	nfsd_listener_addfd(struct net *, int fd);
+int	nfsd_listener_del(struct net *, const char *proto,
+			  struct sockaddr *);
+int	nfsd_listener_show(struct net *, char *, int);
+
+#endif /* LINUX_NFSD_LISTENER_H */
@@ -0,0 +1,362 @@
+/*
+ * Negative LOOKUP reply cache.
+ *
+ * $PATH searches, compiler include searches and interpreter imports
+ * produce long runs of LOOKUPs for names that do not exist.  Each of
+ * them would otherwise go through lookup_one_len() under the directory
+ * lock just to return NFS3ERR_NOENT and the directory attributes.
+ *
+ * Entries are keyed by the on-the-wire directory handle and the name,
+ * and are only trusted while the directory's ctime and i_version are
+ * unchanged, i.e. while nothing has been created, renamed or removed in
+ * it.  They are taken under the directory lock with the lookup that
+ * missed, so a name created right after the lookup changes them.  The
+ * directory attributes returned with the cached reply are the ones
+ * saved when the entry was created, which are still current for the
+ * same reason.
+ */
+
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/jhash.h>
+#include <linux/percpu.h>
+
+#include "nfsd.h"
+#include "vfs.h"
+#include "netns.h"
+#include "negcache.h"
+#include "stats.h"
+#include "statpage.h"
+
+#define NFSD_NEGCACHE_HASHBITS	9
+#define NFSD_NEGCACHE_HASHSIZE	(1 << NFSD_NEGCACHE_HASHBITS)
+#define NFSD_NEGCACHE_WAYS	4
+/* longer names are rare in search storms and are simply not cached */
+#define NFSD_NEGCACHE_NAMELEN	64
+/* upper bound on how long an entry is trusted, even if it still validates */
+#define NFSD_NEGCACHE_TIMEOUT	(30 * HZ)
+
+struct nfsd_negcache_entry {
+	u32			ne_hash;	/* 0 means unused */
+	unsigned long		ne_time;	/* jiffies when cached */
+	unsigned int		ne_fhsize;
+	u32			ne_fh[NFS3_FHSIZE / 4];
+	unsigned int		ne_namelen;
+	char			ne_name[NFSD_NEGCACHE_NAMELEN];
+	struct timespec		ne_ctime;	/* directory ctime ... */
+	u64			ne_version;	/* ... and i_version when cached */
+	struct kstat		ne_stat;	/* directory attributes */
+};
+
+struct nfsd_negcache_bucket {
+	spinlock_t			nb_lock;
+	struct nfsd_negcache_entry	nb_entry[NFSD_NEGCACHE_WAYS];
+};
+
+struct nfsd_negcache_stats {
+	unsigned long		hits;
+	unsigned long		misses;
+	unsigned long		stale;
+	unsigned long		inserts;
+};
+
+struct nfsd_negcache {
+	struct nfsd_negcache_bucket		*nc_buckets;
+	struct nfsd_negcache_stats __percpu	*nc_stats;
+};
+
+static inline struct nfsd_negcache *negcache(struct svc_rqst *rqstp)
+{
+	struct nfsd_net *nn = net_generic(SVC_NET(rqstp), nfsd_net_id);
+
+	return nn->lookup_negcache;
+}
+
+static u32 nfsd_negcache_hash(struct knfsd_fh *fh, const char *name,
+			      unsigned int len)
+{
+	u32 hash = jhash(&fh->fh_base, fh->fh_size, len);
+
+	hash = jhash(name, len, hash);
+	/* keep 0 free to mark unused slots */
+	return hash ? hash : 1;
+}
+
+static bool nfsd_negcache_match(struct nfsd_negcache_entry *ne, u32 hash,
+				struct knfsd_fh *fh, const char *name,
+				unsigned int len)
+{
+	return ne->ne_hash == hash &&
+		ne->ne_fhsize == fh->fh_size &&
+		ne->ne_namelen == len &&
+		memcmp(ne->ne_fh, &fh->fh_base, fh->fh_size) == 0 &&
+		memcmp(ne->ne_name, name, len) == 0;
+}
+
+/*
+ * A cached entry is only good while the directory hasn't changed.
+ */
+static bool nfsd_negcache_valid(struct nfsd_negcache_entry *ne,
+				struct inode *dir)
+{
+	if (time_after(jiffies, ne->ne_time + NFSD_NEGCACHE_TIMEOUT))
+		return false;
+	if (!timespec_equal(&ne->ne_ctime, &dir->i_ctime))
+		return false;
+	return ne->ne_version == dir->i_version;
+}
+
+static bool nfsd_negcache_cacheable(struct svc_fh *fhp, unsigned int len)
+{
+	if (len > NFSD_NEGCACHE_NAMELEN)
+		return false;
+	if (fhp->fh_handle.fh_size > NFS3_FHSIZE)
+		return false;
+	return fhp->fh_dentry && fhp->fh_dentry->d_inode;
+}
+
+/*
+ * Look for a cached negative reply.  @fhp must already have been
+ * verified.  On a hit the saved directory attributes are attached to
+ * @fhp as post-op attributes and true is returned; the caller then
+ * answers NFS3ERR_NOENT without looking the name up.
+ */
+bool
+nfsd_negcache_lookup(struct svc_rqst *rqstp, struct svc_fh *fhp,
+		     const char *name, unsigned int len)
+{
+	struct nfsd_negcache *nc = negcache(rqstp);
+	struct nfsd_negcache_bucket *nb;
+	struct nfsd_negcache_entry *ne;
+	struct inode *dir;
+	bool found = false;
+	u32 hash;
+	int i;
+
+	if (!nc || !nfsd_negcache_cacheable(fhp, len) || isdotent(name, len))
+		return false;
+	dir = fhp->fh_dentry->d_inode;
+
+	hash = nfsd_negcache_hash(&fhp->fh_handle, name, len);
+	nb = &nc->nc_buckets[hash & (NFSD_NEGCACHE_HASHSIZE - 1)];
+
+	spin_lock(&nb->nb_lock);
+	for (i = 0; i < NFSD_NEGCACHE_WAYS; i++) {
+		ne = &nb->nb_entry[i];
+		if (!nfsd_negcache_match(ne, hash, &fhp->fh_handle, name, len))
+			continue;
+		if (!nfsd_negcache_valid(ne, dir)) {
+			ne->ne_hash = 0;
+			this_cpu_inc(nc->nc_stats->stale);
+			break;
+		}
+		fhp->fh_post_attr = ne->ne_stat;
+		found = true;
+		break;
+	}
+	spin_unlock(&nb->nb_lock);
+
+	/*
+	 * lookup_one_len() would have checked search permission on the
+	 * directory; don't let the cache tell anyone more than that would.
+	 */
+	if (found && inode_permission(dir, MAY_EXEC))
+		found = false;
+
+	if (found) {
+		fhp->fh_post_saved = true;
+		this_cpu_inc(nc->nc_stats->hits);
+	} else
+		this_cpu_inc(nc->nc_stats->misses);
+	return found;
+}
+
+/*
+ * Remember that @name does not exist in the directory @fhp, as found by
+ * a lookup made while the directory was as in @stamp.  The directory
+ * attributes are fetched here and also attached to @fhp, so the reply
+ * that triggered the insert doesn't have to fetch them again.
+ */
+void
+nfsd_negcache_insert(struct svc_rqst *rqstp, struct svc_fh *fhp,
+		     const char *name, unsigned int len,
+		     const struct nfsd_negcache_stamp *stamp)
+{
+	struct nfsd_negcache *nc = negcache(rqstp);
+	struct nfsd_negcache_bucket *nb;
+	struct nfsd_negcache_entry *ne, *victim = NULL;
+	struct inode *dir;
+	struct kstat stat;
+	struct timespec ctime;
+	u64 version;
+	u32 hash;
+	int i, stage;
+	__be32 err;
+
+	if (!nc || !nfsd_negcache_cacheable(fhp, len) || isdotent(name, len))
+		return;
+	dir = fhp->fh_dentry->d_inode;
+
+	ctime = stamp->ns_ctime;
+	version = stamp->ns_version;
+	stage = nfsd_stage_enter(rqstp, NFSD_STAGE_GETATTR);
+	err = fh_getattr(fhp, &stat);
+	nfsd_stage_exit(rqstp, stage);
+	if (err)
+		return;
+	/* the directory changed since the lookup; don't cache a mix */
+	if (!timespec_equal(&ctime, &dir->i_ctime) || version != dir->i_version)
+		return;
+	/*
+	 * Without i_version, two changes within one ctime tick look the
+	 * same to us.  Don't cache directories that changed that recently.
+	 */
+	if (!IS_I_VERSION(dir) && ctime.tv_sec >= get_seconds() - 1)
+		return;
+
+	lease_get_mtime(dir, &stat.mtime);
+	fhp->fh_post_attr = stat;
+	fhp->fh_post_saved = true;
+
+	hash = nfsd_negcache_hash(&fhp->fh_handle, name, len);
+	nb = &nc->nc_buckets[hash & (NFSD_NEGCACHE_HASHSIZE - 1)];
+
+	spin_lock(&nb->nb_lock);
+	for (i = 0; i < NFSD_NEGCACHE_WAYS; i++) {
+		ne = &nb->nb_entry[i];
+		if (nfsd_negcache_match(ne, hash, &fhp->fh_handle, name, len)) {
+			victim = ne;
+			break;
+		}
+		/* otherwise replace an unused slot, or the oldest entry */
+		if (!victim || !ne->ne_hash ||
+		    (victim->ne_hash && time_before(ne->ne_time, victim->ne_time)))
+			victim = ne;
+	}
+	victim->ne_hash = hash;
+	victim->ne_time = jiffies;
+	victim->ne_fhsize = fhp->fh_handle.fh_size;
+	memcpy(victim->ne_fh, &fhp->fh_handle.fh_base, fhp->fh_handle.fh_size);
+	victim->ne_namelen = len;
+	memcpy(victim->ne_name, name, len);
+	victim->ne_ctime = ctime;
+	victim->ne_version = version;
+	victim->ne_stat = stat;
+	spin_unlock(&nb->nb_lock);
+
+	this_cpu_inc(nc->nc_stats->inserts);
+}
+
+void
+nfsd_negcache_flush(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_negcache *nc = nn->lookup_negcache;
+	struct nfsd_negcache_bucket *nb;
+	int i, j;
+
+	if (!nc)
+		return;
+	for (i = 0; i < NFSD_NEGCACHE_HASHSIZE; i++) {
+		nb = &nc->nc_buckets[i];
+		spin_lock(&nb->nb_lock);
+		for (j = 0; j < NFSD_NEGCACHE_WAYS; j++)
+			nb->nb_entry[j].ne_hash = 0;
+		spin_unlock(&nb->nb_lock);
+	}
+}
+
+/* Sum the per-cpu counters into @sum. */
+static void negcache_sum(struct nfsd_negcache *nc,
+			 struct nfsd_negcache_stats *sum)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct nfsd_negcache_stats *s = per_cpu_ptr(nc->nc_stats, cpu);
+
+		sum->hits += s->hits;
+		sum->misses += s->misses;
+		sum->stale += s->stale;
+		sum->inserts += s->inserts;
+	}
+}
+
+/* Copy the counters to the binary statistics page, see statpage.c. */
+void
+nfsd_negcache_statpage(struct net *net, struct nfsd_statpage *sp)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_negcache_stats sum = { 0 };
+
+	if (!nn->lookup_negcache)
+		return;
+	negcache_sum(nn->lookup_negcache, &sum);
+	sp->sp_negcache.hits = sum.hits;
+	sp->sp_negcache.misses = sum.misses;
+	sp->sp_negcache.inserts = sum.inserts;
+	sp->sp_negcache.evictions = sum.stale;
+}
+
+/*
+ * Format the cache counters into @buf for the lookup_cache control file.
+ */
+int
+nfsd_negcache_show(struct net *net, char *buf, int size)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_negcache *nc = nn->lookup_negcache;
+	struct nfsd_negcache_stats sum = { 0 };
+
+	if (!nc)
+		return -ENODEV;
+	negcache_sum(nc, &sum);
+	return scnprintf(buf, size, "hits %lu\nmisses %lu\nstale %lu\n"
+			 "inserts %lu\nentries %d\n", sum.hits, sum.misses,
+			 sum.stale, sum.inserts,
+			 NFSD_NEGCACHE_HASHSIZE * NFSD_NEGCACHE_WAYS);
+}
+
+int
+nfsd_negcache_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_negcache *nc;
+	int i;
+
+	nc = kzalloc(sizeof(*nc), GFP_KERNEL);
+	if (!nc)
+		return -ENOMEM;
+	nc->nc_buckets = vzalloc(NFSD_NEGCACHE_HASHSIZE *
+				 sizeof(struct nfsd_negcache_bucket));
+	if (!nc->nc_buckets)
+		goto out_free;
+	nc->nc_stats = alloc_percpu(struct nfsd_negcache_stats);
+	if (!nc->nc_stats)
+		goto out_free_buckets;
+	for (i = 0; i < NFSD_NEGCACHE_HASHSIZE; i++)
+		spin_lock_init(&nc->nc_buckets[i].nb_lock);
+
+	nn->lookup_negcache = nc;
+	return 0;
+
+out_free_buckets:
+	vfree(nc->nc_buckets);
+out_free:
+	kfree(nc);
+	return -ENOMEM;
+}
+
+void
+nfsd_negcache_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_negcache *nc = nn->lookup_negcache;
+
+	if (!nc)
+		return;
+	nn->lookup_negcache = NULL;
+	free_percpu(nc->nc_stats);
+	vfree(nc->nc_buckets);
+	kfree(nc);
+}
@@ -0,0 +1,35 @@
+/*
+ * Negative LOOKUP reply cache.
+ *
+ * Remembers (directory handle, name) pairs for which a LOOKUP found
+ * nothing, together with the directory attributes at that time, so that
+ * repeated lookups of missing names can be answered without going
+ * through lookup_one_len().
+ */
+
+#ifndef LINUX_NFSD_NEGCACHE_H
+#define LINUX_NFSD_NEGCACHE_H
+
+#include "nfsfh.h"
+
+struct nfsd_negcache;
+struct nfsd_statpage;
+
+/* a directory's ctime and i_version, taken under its lock for a lookup */
+struct nfsd_negcache_stamp {
+	struct timespec		ns_ctime;
+	u64			ns_version;
+};
+
+int	nfsd_negcache_init(struct net *);
+void	nfsd_negcache_shutdown(struct net *);
+void	nfsd_negcache_flush(struct net *);
+bool	nfsd_negcache_lookup(struct svc_rqst *, struct svc_fh *,
+				const char *, unsigned int);
+void	nfsd_negcache_insert(struct svc_rqst *, struct svc_fh *,
+				const char *, unsigned int,
+				const struct nfsd_negcache_stamp *);
+int	nfsd_negcache_show(struct net *, char *, int);
+void	nfsd_negcache_statpage(struct net *, struct nfsd_statpage *);
+
+#endif /* LINUX_NFSD_NEGCACHE_H */
@@ -23,6 +23,28 @@
 
 #include <net/net_namespace.h>
 #include <net/netns/generic.h>
+#include <linux/rhashtable.h>
+
+struct nfsd_negcache;
+struct nfsd_index_stats;
+struct nfsd_capture;
+struct nfsd_stage_stats;
+struct nfsd_slowops;
+struct nfsd_inflight;
+struct nfsd_traffic;
+struct nfsd_hotfh;
+struct nfsd_statpage_ctl;
+struct nfsd_affinity;
+struct nfsd_busypoll;
+struct nfsd_sched;
+struct nfsd_lanes;
+struct nfsd_overload;
+struct nfsd_throttle;
+struct nfsd_payload;
+struct nfsd_batch;
+
+/* owners of the requests nfsd put off itself, see nfsd_defer_mark() */
+#define NFSD_DEFER_MARKS	4
 
 /*
  * Represents a nfsd "container". With respect to nfsv4 state tracking, the
@@ -35,6 +57,70 @@ struct nfsd_net {
 	struct cache_detail *svc_expkey_cache;
 	struct cache_detail *svc_export_cache;
 
+	/*
+	 * RCU lookup indexes in front of the two caches above.  Updates
+	 * are serialized by svc_index_lock; bumping svc_index_gen retires
+	 * every entry currently indexed.
+	 */
+	struct rhashtable svc_expkey_index;
+	struct rhashtable svc_export_index;
+	spinlock_t svc_index_lock;
+	atomic_t svc_index_gen;
+	/* bumped when an entry of either cache is freed; see nfsd_exp_memo */
+	atomic_t svc_export_gen;
+	struct nfsd_index_stats __percpu *svc_index_stats;
+
+	/* negative LOOKUP reply cache */
+	struct nfsd_negcache *lookup_negcache;
+
+	/* RPC capture ring, see capture.c */
+	struct nfsd_capture *capture;
+
+	/* per-procedure, per-stage request timing, see stats.c */
+	struct nfsd_stage_stats __percpu *stage_stats;
+
+	/* requests over the slow operation threshold, see slowops.c */
+	struct nfsd_slowops *slowops;
+
+	/* nfsd threads and what they are doing, see inflight.c */
+	struct nfsd_inflight *inflight;
+
+	/* per-client and per-export totals, see traffic.c */
+	struct nfsd_traffic *traffic;
+
+	/* sketch of the most used file handles, see hotfh.c */
+	struct nfsd_hotfh *hotfh;
+
+	/* the mmap-able binary statistics, see statpage.c */
+	struct nfsd_statpage_ctl *statpage;
+
+	/* steering transports to the pool of their receive cpu, see affinity.c */
+	struct nfsd_affinity *affinity;
+
+	/* spinning idle threads, see busypoll.c */
+	struct nfsd_busypoll *busypoll;
+
+	/* fair share of the threads across clients, see sched.c */
+	struct nfsd_sched *sched;
+
+	/* threads kept for metadata procedures, see lanes.c */
+	struct nfsd_lanes *lanes;
+
+	/* shedding requests under overload, see overload.c */
+	struct nfsd_overload *overload;
+
+	/* per-client and per-export rate limits, see throttle.c */
+	struct nfsd_throttle *throttle;
+
+	/* payload pages given back by idle threads, see payload.c */
+	struct nfsd_payload *payload;
+
+	/* replies batched on TCP connections, see batch.c */
+	struct nfsd_batch *batch;
+
+	/* owners of put-off requests, indexed by NFSD_DEFER_* flags */
+	char defer_marks[NFSD_DEFER_MARKS];
+
 	bool nfsd_net_up;
 
 	/* Time of server startup */
@@ -9,6 +9,7 @@
 #define LINUX_NFSD_NFSD_H
 
 #include <linux/types.h>
+#include <linux/timex.h>
 #include <linux/mount.h>
 
 #include <linux/nfs.h>
@@ -29,6 +30,8 @@
  * Maximum blocksizes supported by daemon under various circumstances.
  */
 #define NFSSVC_MAXBLKSIZE       RPCSVC_MAXPAYLOAD
+/* smallest max_block_size, which is also its granularity */
+#define NFSSVC_MINBLKSIZE       1024
 /* NFSv2 is limited by the protocol specification, see RFC 1094 */
 #define NFSSVC_MAXBLKSIZE_V2    (8*1024)
 
@@ -49,15 +52,93 @@ struct readdir_cd {
 	__be32			err;	/* 0, nfserr, or nfserr_eof */
 };
 
+/*
+ * Stages of request processing that are timed separately, see stats.c.
+ * Time spent in a nested stage is not counted in the enclosing one.
+ */
+enum {
+	NFSD_STAGE_RPC,		/* svc_process() outside of the below */
+	NFSD_STAGE_AUTH,	/* svc_set_client() */
+	NFSD_STAGE_DECODE,
+	NFSD_STAGE_FH_VERIFY,	/* export lookup, exportfs decode */
+	NFSD_STAGE_SETUSER,	/* nfsd_setuser() */
+	NFSD_STAGE_PROC,	/* the procedure, outside of the below */
+	NFSD_STAGE_VFS,
+	NFSD_STAGE_COMMIT,	/* commit_metadata(), stable writes */
+	NFSD_STAGE_GETATTR,	/* attributes for the reply */
+	NFSD_STAGE_ENCODE,
+	NFSD_STAGE_SEND,	/* svc_send(), releasing the request */
+	NFSD_NR_STAGES,
+};
+
+/*
+ * Per-thread state that outlives a single request.  It is kept in the
+ * rq_argp buffer, after the space reserved for the largest argument
+ * structure (see nfsd_rqst_ctx()); svc_process() only clears the part
+ * of that buffer it decodes into.  nfsd() zeroes it at thread start.
+ */
+struct nfsd_thread_ctx {
+	struct nfsd_exp_memo	tc_exp_memo[NFSD_EXP_MEMO_SIZE];
+	unsigned int		tc_exp_memo_next;
+	/* cycles per stage for the request in progress */
+	int			tc_stage;
+	cycles_t		tc_stage_mark;
+	u64			tc_stage_cycles[NFSD_NR_STAGES];
+	/* what the thread is doing, for the inflight file; see inflight.c */
+	struct list_head	tc_inflight;
+	struct svc_rqst		*tc_rqstp;
+	pid_t			tc_pid;
+	unsigned long		tc_busy_since;	/* jiffies, 0 when idle */
+	/* traffic.c slot of the first export fh_verify() found, or -1 */
+	int			tc_export_slot;
+	/* hash of the first handle fh_verify() found, or 0; see hotfh.c */
+	u32			tc_hotfh_hash;
+	/* socket of the last request, held for busy-polling until the
+	 * thread goes idle again; see busypoll.c */
+	struct sock		*tc_busypoll_sk;
+	/* sched.c client slot of the request in progress, or -1 */
+	int			tc_sched_slot;
+	/* lanes.c lane the request is counted in, or -1 */
+	int			tc_lane;
+	/* how long the request waited, its overload.c client slot or -1,
+	 * and its entry among the calls in progress; when the thread last
+	 * went into svc_recv() */
+	u64			tc_overload_wait;	/* ns */
+	u64			tc_overload_idle;	/* ns */
+	int			tc_overload_slot;
+	struct hlist_node	tc_overload_node;
+	/* whether throttle.c has seen the request's first export */
+	bool			tc_throttle_done;
+	/* counted as waiting in svc_recv() by payload.c */
+	bool			tc_payload_waiting;
+	/* slot of the request's connection in batch.c, or -1 */
+	int			tc_batch_slot;
+	/* a dispatch_bench thread, left out of the server's accounting */
+	bool			tc_bench;
+};
+
 
 extern struct svc_program	nfsd_program;
 extern struct svc_version	nfsd_version3;
+extern struct mutex		nfsd_mutex;
 /*
  * Function prototypes.
  */
 int		nfsd_svc(int nrservs, struct net *net);
 int		nfsd_dispatch(struct svc_rqst *rqstp, __be32 *statp);
 
+struct cache_deferred_req;
+
+/* why nfsd itself put off a request; see nfsd_defer_mark() */
+enum {
+	NFSD_DEFER_LANES	= 1,	/* waiting for room in its lane */
+	NFSD_DEFER_THROTTLED	= 2,	/* charged, waiting for its limits */
+};
+void		nfsd_defer_mark(struct svc_rqst *, struct cache_deferred_req *,
+				int flag);
+bool		nfsd_defer_marked(struct svc_rqst *, int flag);
+void		nfsd_defer_unmark(struct svc_rqst *, int flag);
+
 int		nfsd_nrpools(struct net *);
 
 void		nfsd_destroy(struct net *net);
@@ -66,6 +147,7 @@ enum vers_op {NFSD_SET, NFSD_CLEAR, NFSD_TEST, NFSD_AVAIL };
 int nfsd_vers(int vers, enum vers_op change);
 void nfsd_reset_versions(void);
 int nfsd_create_serv(struct net *net);
+int nfsd_get_default_max_blksize(void);
 
 extern int nfsd_max_blksize;
 
@@ -9,9 +9,62 @@
 
 #include <linux/exportfs.h>
 #include <linux/sched.h>
+#include <linux/vmalloc.h>
+#include <linux/jhash.h>
+#include <linux/percpu.h>
+#include <linux/seqlock.h>
 
 #include "nfsd.h"
 #include "vfs.h"
+#include "stats.h"
+#include "statpage.h"
+#include "traffic.h"
+#include "hotfh.h"
+#include "throttle.h"
+
+/*
+ * File handle encode cache.
+ *
+ * fh_compose() runs for every LOOKUP and CREATE result and for every
+ * READDIRPLUS entry, and each time it re-derives the fsid and calls
+ * exportfs_encode_fh().  For a given export and fsid type the resulting
+ * bytes only depend on the inode (number and generation) and, when
+ * subtree checking is on, on the parent directory too.  So we remember
+ * the finished handle, and composing a handle for a hot inode becomes a
+ * memcpy.
+ *
+ * Because the parent is part of the key, a rename simply stops matching
+ * the old entry.  Entries refer to exports by pointer only; they are
+ * purged when the export itself is freed.
+ */
+#define FHCACHE_HASHBITS	12
+#define FHCACHE_HASHSIZE	(1 << FHCACHE_HASHBITS)
+
+struct fh_cache_key {
+	struct svc_export *	exp;
+	int			fsid_type;
+	unsigned long		ino;
+	u32			gen;
+	unsigned long		parent_ino;	/* 0 without subtree check */
+	u32			parent_gen;
+};
+
+struct fh_cache_entry {
+	seqlock_t		fc_lock;
+	struct fh_cache_key	fc_key;		/* fc_key.exp NULL if unused */
+	unsigned int		fc_size;
+	u32			fc_fh[NFS3_FHSIZE / 4];	/* header, fsid and fid */
+};
+
+struct fh_cache_stats {
+	unsigned long		hits;
+	unsigned long		misses;
+	unsigned long		inserts;
+	unsigned long		purged;
+};
+
+static struct fh_cache_entry *fh_cache;
+static struct fh_cache_stats __percpu *fh_cache_stats;
 
 /*
  * our acceptability function.
@@ -57,6 +110,7 @@ static __be32 nfsd_set_fh_dentry(struct svc_rqst *rqstp, struct svc_fh *fhp)
 	struct svc_export *exp;
 	struct dentry *dentry;
 	int fileid_type;
+	int stage;
 	int data_left = fh->fh_size/4;
 	__be32 error;
 	int len;
@@ -84,7 +138,14 @@ static __be32 nfsd_set_fh_dentry(struct svc_rqst *rqstp, struct svc_fh *fhp)
 		return nfserrno(PTR_ERR(exp));
 
 	/* Set user creds for this exportpoint */
+	stage = nfsd_stage_enter(rqstp, NFSD_STAGE_SETUSER);
 	error = nfsd_setuser(rqstp, exp);
+	nfsd_stage_exit(rqstp, stage);
+	if (error)
+		goto out;
+
+	/* Tenants over their rate limits are put off, see throttle.c */
+	error = nfsd_throttle_check(rqstp, exp);
 	if (error)
 		goto out;
 
@@ -122,6 +183,8 @@ static __be32 nfsd_set_fh_dentry(struct svc_rqst *rqstp, struct svc_fh *fhp)
 
 	fhp->fh_dentry = dentry;
 	fhp->fh_export = exp;
+	nfsd_traffic_export(rqstp, exp);
+	nfsd_hotfh_record(rqstp, fhp);
 	return 0;
 out:
 	exp_put(exp);
@@ -155,13 +218,16 @@ __be32
 fh_verify(struct svc_rqst *rqstp, struct svc_fh *fhp)
 {
 	__be32		error=0;
+	int		stage;
 
 	printk(KERN_INFO "nfsd: fh_verify(%s)\n", SVCFH_fmt(fhp));
 
 	if (!fhp->fh_dentry) {
 		printk(KERN_INFO "fhp->fh_dentry is still NULL, let's set it to the right value.\n");
 		/* setting fhp->fh_dentry and fhp->fh_export */
+		stage = nfsd_stage_enter(rqstp, NFSD_STAGE_FH_VERIFY);
 		error = nfsd_set_fh_dentry(rqstp, fhp);
+		nfsd_stage_exit(rqstp, stage);
 	}
 	return error;
 }
@@ -174,6 +240,35 @@ fh_verify(struct svc_rqst *rqstp, struct svc_fh *fhp)
  * an inode.  In this case a call to fh_update should be made
  * before the fh goes out on the wire ...
  */
+/*
+ * Subtree checking makes exportfs_encode_fh() put the parent directory
+ * in every handle as well.  Exports can turn that off to get compact
+ * inode+generation handles.
+ */
+static inline int fh_subtree_check(struct svc_export *exp)
+{
+	return !(exp->ex_flags & NFSEXP_NOSUBTREECHECK);
+}
+
+/*
+ * Pick the fsid type for a new handle: keep the one the client already
+ * uses for this export if there is one, otherwise use the 4-byte export
+ * index if the export has one, and the 8-byte device/inode key if not.
+ */
+static int fh_fsid_type(struct svc_export *exp, struct svc_fh *ref_fh)
+{
+	if (ref_fh && ref_fh->fh_export == exp) {
+		int type = ref_fh->fh_handle.fh_fsid_type;
+
+		if (type == FSID_DEV ||
+		    (type == FSID_NUM && (exp->ex_flags & NFSEXP_FSID)))
+			return type;
+	}
+	if (exp->ex_flags & NFSEXP_FSID)
+		return FSID_NUM;
+	return FSID_DEV;
+}
+
 static void _fh_update(struct svc_fh *fhp, struct svc_export *exp,
 		struct dentry *dentry)
 {
@@ -181,7 +276,7 @@ static void _fh_update(struct svc_fh *fhp, struct svc_export *exp,
 		struct fid *fid = (struct fid *)
 			(fhp->fh_handle.fh_fsid + fhp->fh_handle.fh_size/4 - 1);
 		int maxsize = (fhp->fh_maxsize - fhp->fh_handle.fh_size)/4;
-		int subtreecheck = 1;
+		int subtreecheck = fh_subtree_check(exp);
 
 		fhp->fh_handle.fh_fileid_type =
 			exportfs_encode_fh(dentry, fid, &maxsize, subtreecheck);
@@ -196,6 +291,195 @@ static struct super_block *exp_sb(struct svc_export *exp)
 	return exp->ex_path.dentry->d_inode->i_sb;
 }
 
+static void fh_cache_make_key(struct fh_cache_key *key, struct svc_fh *fhp,
+			      struct svc_export *exp, struct dentry *dentry)
+{
+	struct inode *inode = dentry->d_inode;
+
+	memset(key, 0, sizeof(*key));
+	key->exp = exp;
+	key->fsid_type = fhp->fh_handle.fh_fsid_type;
+	key->ino = inode->i_ino;
+	key->gen = inode->i_generation;
+	/* exportfs_encode_fh() only adds the parent for non-directories */
+	if (fh_subtree_check(exp) && !S_ISDIR(inode->i_mode)) {
+		struct inode *parent;
+
+		spin_lock(&dentry->d_lock);
+		parent = dentry->d_parent->d_inode;
+		key->parent_ino = parent->i_ino;
+		key->parent_gen = parent->i_generation;
+		spin_unlock(&dentry->d_lock);
+	}
+}
+
+static struct fh_cache_entry *fh_cache_slot(struct fh_cache_key *key)
+{
+	u32 hash;
+
+	hash = jhash_3words((u32)key->ino, key->gen ^ key->fsid_type,
+			    (u32)key->parent_ino, hash_ptr(key->exp, 32));
+	return &fh_cache[hash & (FHCACHE_HASHSIZE - 1)];
+}
+
+/*
+ * Fill in fhp->fh_handle from the cache.  Returns true on a hit.
+ */
+static bool fh_cache_get(struct svc_fh *fhp, struct svc_export *exp,
+			 struct dentry *dentry)
+{
+	struct fh_cache_key key;
+	struct fh_cache_entry *fc;
+	unsigned int seq;
+	bool hit;
+
+	if (!fh_cache)
+		return false;
+	fh_cache_make_key(&key, fhp, exp, dentry);
+	fc = fh_cache_slot(&key);
+	do {
+		seq = read_seqbegin(&fc->fc_lock);
+		hit = !memcmp(&fc->fc_key, &key, sizeof(key)) &&
+			fc->fc_size <= fhp->fh_maxsize;
+		if (hit) {
+			fhp->fh_handle.fh_size = fc->fc_size;
+			memcpy(&fhp->fh_handle.fh_base, fc->fc_fh, fc->fc_size);
+		}
+	} while (read_seqretry(&fc->fc_lock, seq));
+
+	if (hit)
+		this_cpu_inc(fh_cache_stats->hits);
+	else
+		this_cpu_inc(fh_cache_stats->misses);
+	return hit;
+}
+
+/*
+ * Remember the handle just composed in fhp.
+ */
+static void fh_cache_put(struct svc_fh *fhp, struct svc_export *exp,
+			 struct dentry *dentry)
+{
+	struct fh_cache_key key;
+	struct fh_cache_entry *fc;
+
+	if (!fh_cache)
+		return;
+	if (fhp->fh_handle.fh_fileid_type == FILEID_ROOT ||
+	    fhp->fh_handle.fh_fileid_type == FILEID_INVALID ||
+	    fhp->fh_handle.fh_size > NFS3_FHSIZE)
+		return;
+	fh_cache_make_key(&key, fhp, exp, dentry);
+	fc = fh_cache_slot(&key);
+
+	write_seqlock(&fc->fc_lock);
+	memcpy(&fc->fc_key, &key, sizeof(key));
+	fc->fc_size = fhp->fh_handle.fh_size;
+	memcpy(fc->fc_fh, &fhp->fh_handle.fh_base, fc->fc_size);
+	write_sequnlock(&fc->fc_lock);
+
+	this_cpu_inc(fh_cache_stats->inserts);
+}
+
+/*
+ * Forget every cached handle of @exp, or of all exports if @exp is NULL.
+ * Called when an export is freed, so a later export allocated at the
+ * same address can't pick up its handles.
+ */
+void
+fh_cache_purge(struct svc_export *exp)
+{
+	struct fh_cache_entry *fc;
+	int i;
+
+	if (!fh_cache)
+		return;
+	for (i = 0; i < FHCACHE_HASHSIZE; i++) {
+		fc = &fh_cache[i];
+		if (!fc->fc_key.exp || (exp && fc->fc_key.exp != exp))
+			continue;
+		write_seqlock(&fc->fc_lock);
+		if (fc->fc_key.exp && (!exp || fc->fc_key.exp == exp)) {
+			memset(&fc->fc_key, 0, sizeof(fc->fc_key));
+			this_cpu_inc(fh_cache_stats->purged);
+		}
+		write_sequnlock(&fc->fc_lock);
+	}
+}
+
+/* Sum the per-cpu counters into @sum. */
+static void fh_cache_sum(struct fh_cache_stats *sum)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct fh_cache_stats *s = per_cpu_ptr(fh_cache_stats, cpu);
+
+		sum->hits += s->hits;
+		sum->misses += s->misses;
+		sum->inserts += s->inserts;
+		sum->purged += s->purged;
+	}
+}
+
+/* Copy the counters to the binary statistics page, see statpage.c. */
+void
+fh_cache_statpage(struct nfsd_statpage *sp)
+{
+	struct fh_cache_stats sum = { 0 };
+
+	if (!fh_cache)
+		return;
+	fh_cache_sum(&sum);
+	sp->sp_fhcache.hits = sum.hits;
+	sp->sp_fhcache.misses = sum.misses;
+	sp->sp_fhcache.inserts = sum.inserts;
+	sp->sp_fhcache.evictions = sum.purged;
+}
+
+/*
+ * Format the cache counters into @buf for the fh_cache control file.
+ */
+int
+fh_cache_show(char *buf, int size)
+{
+	struct fh_cache_stats sum = { 0 };
+
+	if (!fh_cache)
+		return -ENODEV;
+	fh_cache_sum(&sum);
+	return scnprintf(buf, size, "hits %lu\nmisses %lu\ninserts %lu\n"
+			 "purged %lu\nentries %d\n", sum.hits, sum.misses,
+			 sum.inserts, sum.purged, FHCACHE_HASHSIZE);
+}
+
+int
+fh_cache_init(void)
+{
+	int i;
+
+	fh_cache = vzalloc(FHCACHE_HASHSIZE * sizeof(struct fh_cache_entry));
+	if (!fh_cache)
+		return -ENOMEM;
+	fh_cache_stats = alloc_percpu(struct fh_cache_stats);
+	if (!fh_cache_stats) {
+		vfree(fh_cache);
+		fh_cache = NULL;
+		return -ENOMEM;
+	}
+	for (i = 0; i < FHCACHE_HASHSIZE; i++)
+		seqlock_init(&fh_cache[i].fc_lock);
+	return 0;
+}
+
+void
+fh_cache_shutdown(void)
+{
+	free_percpu(fh_cache_stats);
+	vfree(fh_cache);
+	fh_cache = NULL;
+}
+
 __be32
 fh_compose(struct svc_fh *fhp, struct svc_export *exp, struct dentry *dentry,
 	   struct svc_fh *ref_fh)
@@ -210,6 +494,7 @@ fh_compose(struct svc_fh *fhp, struct svc_export *exp, struct dentry *dentry,
 
 	struct inode * inode = dentry->d_inode;
 	dev_t ex_dev = exp_sb(exp)->s_dev;
+	int fsid_type = fh_fsid_type(exp, ref_fh);
 
 	printk(KERN_INFO "nfsd: fh_compose(exp %02x:%02x/%ld %pd2, ino=%ld)\n",
 		MAJOR(ex_dev), MINOR(ex_dev),
@@ -219,6 +504,7 @@ fh_compose(struct svc_fh *fhp, struct svc_export *exp, struct dentry *dentry,
 
 	/* for NFSv3, this seems to be 1, for NFSv2, this is 0xca. */
 	fhp->fh_handle.fh_version = 1;
+	fhp->fh_handle.fh_fsid_type = fsid_type;
 
 	if (ref_fh == fhp)
 		fh_put(ref_fh);
@@ -235,6 +521,9 @@ fh_compose(struct svc_fh *fhp, struct svc_export *exp, struct dentry *dentry,
 	fhp->fh_dentry = dget(dentry); /* our internal copy */
 	fhp->fh_export = exp_get(exp);
 
+	if (inode && fh_cache_get(fhp, exp, dentry))
+		return 0;
+
 	fhp->fh_handle.fh_size =
 		key_len(fhp->fh_handle.fh_fsid_type) + 4;
 	fhp->fh_handle.fh_auth_type = 0;
@@ -246,8 +535,10 @@ fh_compose(struct svc_fh *fhp, struct svc_export *exp, struct dentry *dentry,
 		exp->ex_path.dentry->d_inode->i_ino,
 		exp->ex_fsid);
 
-	if (inode)
+	if (inode) {
 		_fh_update(fhp, exp, dentry);
+		fh_cache_put(fhp, exp, dentry);
+	}
 	if (fhp->fh_handle.fh_fileid_type == FILEID_INVALID) {
 		fh_put(fhp);
 		return nfserr_opnotsupp;
@@ -300,6 +591,7 @@ fh_put(struct svc_fh *fhp)
 		dput(dentry);
 	}
 	fh_drop_write(fhp);
+	fhp->fh_post_saved = false;
 	if (exp) {
 		exp_put(exp);
 		fhp->fh_export = NULL;
@@ -8,9 +8,12 @@
 #define _LINUX_NFSD_NFSFH_H
 
 #include <linux/crc32.h>
+#include <linux/stat.h>
 #include <linux/sunrpc/svc.h>
 #include <uapi/linux/nfsd/nfsfh.h>
 
+struct nfsd_statpage;
+
 static inline __u32 ino_t_to_u32(ino_t ino)
 {
 	return (__u32) ino;
@@ -32,6 +35,10 @@ typedef struct svc_fh {
 	struct svc_export *	fh_export;	/* export pointer */
 
 	bool			fh_want_write;	/* remount protection taken */
+
+	/* Post-op attributes, if the operation already has them */
+	bool			fh_post_saved;	/* post-op attrs saved */
+	struct kstat		fh_post_attr;	/* full attrs after operation */
 } svc_fh;
 
 enum nfsd_fsid {
@@ -89,6 +96,12 @@ __be32	fh_compose(struct svc_fh *, struct svc_export *, struct dentry *, struct
 __be32	fh_update(struct svc_fh *);
 void	fh_put(struct svc_fh *);
 
+int	fh_cache_init(void);
+void	fh_cache_shutdown(void);
+void	fh_cache_purge(struct svc_export *);
+int	fh_cache_show(char *, int);
+void	fh_cache_statpage(struct nfsd_statpage *);
+
 static __inline__ struct svc_fh *
 fh_copy(struct svc_fh *dst, struct svc_fh *src)
 {
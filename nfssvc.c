@@ -24,7 +24,22 @@
 #include <net/net_namespace.h>
 #include "nfsd.h"
 #include "vfs.h"
+#include "xdr.h"
 #include "netns.h"
+#include "capture.h"
+#include "stats.h"
+#include "slowops.h"
+#include "inflight.h"
+#include "traffic.h"
+#include "hotfh.h"
+#include "affinity.h"
+#include "busypoll.h"
+#include "sched.h"
+#include "lanes.h"
+#include "overload.h"
+#include "throttle.h"
+#include "payload.h"
+#include "batch.h"
 
 extern struct svc_program	nfsd_program;
 struct svc_stat         nfsd_svcstats = {
@@ -32,6 +47,7 @@ struct svc_stat         nfsd_svcstats = {
 };
 
 static int			nfsd(void *vrqstp);
+static int			nfsd_authenticate(struct svc_rqst *rqstp);
 
 static struct svc_version *	nfsd_version[] = {
 	[3] = &nfsd_version3,
@@ -48,7 +64,7 @@ struct svc_program		nfsd_program = {
 	.pg_name		= "nfsd",		/* program name */
 	.pg_class		= "nfsd",		/* authentication class */
 	.pg_stats		= &nfsd_svcstats,	/* version table */
-	.pg_authenticate	= &svc_set_client,	/* export authentication */
+	.pg_authenticate	= &nfsd_authenticate,	/* export authentication */
 
 };
 
@@ -134,13 +150,103 @@ static struct notifier_block nfsd_inetaddr_notifier = {
 	.notifier_call = nfsd_inetaddr_event,
 };
 
+/*
+ * nfsd_mutex protects nn->nfsd_serv -- both the pointer itself and the
+ * members of the svc_serv struct, in particular ->sv_nrthreads, as
+ * well as nfsd_max_blksize, which sizes a service when it is created.
+ */
+DEFINE_MUTEX(nfsd_mutex);
+
 /* Only used under nfsd_mutex, so this atomic may be overkill: */
 static atomic_t nfsd_notifier_refcount = ATOMIC_INIT(0);
 
+/*
+ * Requests that nfsd itself puts off through svc_defer() (lanes.c,
+ * throttle.c) are revisited the way requests waiting for an upcall
+ * are, and come back with rq_deferred set like those.  They are told
+ * apart by the owner of their copy, which svc_defer() sets to the
+ * service only when it allocates the copy and leaves alone when the
+ * request is put off again: for a marked copy it points into
+ * nn->defer_marks, at the index of its NFSD_DEFER_* flags.  The marks
+ * go away with the copy, once the request has been answered.
+ */
+static int nfsd_defer_flags(struct nfsd_net *nn,
+			    struct cache_deferred_req *dreq)
+{
+	char *mark = dreq->owner;
+
+	if (mark < nn->defer_marks ||
+	    mark >= nn->defer_marks + NFSD_DEFER_MARKS)
+		return 0;
+	return mark - nn->defer_marks;
+}
+
+static void nfsd_defer_set(struct svc_rqst *rqstp,
+			   struct cache_deferred_req *dreq, int flags)
+{
+	struct nfsd_net *nn = net_generic(SVC_NET(rqstp), nfsd_net_id);
+
+	/* unmarked, the copy is dropped with the service again */
+	dreq->owner = flags ? (void *)&nn->defer_marks[flags] :
+			      (void *)rqstp->rq_server;
+}
+
+/* Mark @dreq, which svc_defer() just returned for @rqstp, with @flag. */
+void
+nfsd_defer_mark(struct svc_rqst *rqstp, struct cache_deferred_req *dreq,
+		int flag)
+{
+	struct nfsd_net *nn = net_generic(SVC_NET(rqstp), nfsd_net_id);
+
+	nfsd_defer_set(rqstp, dreq, nfsd_defer_flags(nn, dreq) | flag);
+}
+
+/* Whether @rqstp is a revisited request marked with @flag. */
+bool
+nfsd_defer_marked(struct svc_rqst *rqstp, int flag)
+{
+	struct nfsd_net *nn = net_generic(SVC_NET(rqstp), nfsd_net_id);
+
+	return rqstp->rq_deferred &&
+	       (nfsd_defer_flags(nn, &rqstp->rq_deferred->handle) & flag);
+}
+
+/* Take @flag off the revisited request @rqstp. */
+void
+nfsd_defer_unmark(struct svc_rqst *rqstp, int flag)
+{
+	struct nfsd_net *nn = net_generic(SVC_NET(rqstp), nfsd_net_id);
+	struct cache_deferred_req *dreq;
+
+	if (!rqstp->rq_deferred)
+		return;
+	dreq = &rqstp->rq_deferred->handle;
+	nfsd_defer_set(rqstp, dreq, nfsd_defer_flags(nn, dreq) & ~flag);
+}
+
+/*
+ * svc_destroy() only drops the copies waiting for an upcall that are
+ * owned by the service; marked ones that an export upcall put off
+ * again are dropped here.
+ */
+static void nfsd_defer_clean(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	int flags;
+
+	for (flags = 1; flags < NFSD_DEFER_MARKS; flags++)
+		cache_clean_deferred(&nn->defer_marks[flags]);
+}
+
 static void nfsd_last_thread(struct svc_serv *serv, struct net *net)
 {
 	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
 
+	/* put-off requests hold their transports, and with them the net */
+	nfsd_lanes_flush(net, true);
+	nfsd_throttle_flush(net, true);
+	nfsd_defer_clean(net);
+	nfsd_batch_flush(net);
 	atomic_dec(&nn->ntf_refcnt);
 	/* check if the notifier still has clients */
 	if (atomic_dec_return(&nfsd_notifier_refcount) == 0) {
@@ -169,7 +275,7 @@ void nfsd_reset_versions(void)
 	nfsd_program.pg_vers[3] = nfsd_version[3];
 }
 
-static int nfsd_get_default_max_blksize(void)
+int nfsd_get_default_max_blksize(void)
 {
 	struct sysinfo i;
 	unsigned long long target;
@@ -193,7 +299,7 @@ static int nfsd_get_default_max_blksize(void)
 static struct svc_serv_ops nfsd_thread_sv_ops = {
 	.svo_shutdown		= nfsd_last_thread,
 	.svo_function		= nfsd,
-	.svo_enqueue_xprt	= svc_xprt_do_enqueue,
+	.svo_enqueue_xprt	= nfsd_enqueue_xprt,
 	.svo_setup		= svc_set_num_threads,
 	.svo_module		= THIS_MODULE,
 };
@@ -267,6 +373,7 @@ nfsd_svc(int nrservs, struct net *net)
 
 	printk(KERN_INFO "nfsd: creating service\n");
 
+	mutex_lock(&nfsd_mutex);
 	nrservs = max(nrservs, 0);
 	nrservs = min(nrservs, NFSD_MAXSERVS);
 	error = 0;
@@ -298,6 +405,7 @@ out_shutdown:
 out_destroy:
 	nfsd_destroy(net);		/* Release server */
 out:
+	mutex_unlock(&nfsd_mutex);
 	return error;
 }
 
@@ -314,6 +422,7 @@ nfsd(void *vrqstp)
 	int err;
 
 	/* Lock module and set up kernel thread */
+	mutex_lock(&nfsd_mutex);
 
 	/* At this point, the thread shares current->fs
 	 * with the init process. We need to create files with the
@@ -336,6 +445,11 @@ nfsd(void *vrqstp)
 
 	set_freezable();
 
+	memset(nfsd_rqst_ctx(rqstp), 0, sizeof(struct nfsd_thread_ctx));
+	nfsd_inflight_register(net, rqstp);
+
+	mutex_unlock(&nfsd_mutex);
+
 	/*
 	 * The main request loop
 	 */
@@ -344,18 +458,37 @@ nfsd(void *vrqstp)
 		 * Find a socket with data available and call its
 		 * recvfrom routine.
 		 */
-		while ((err = svc_recv(rqstp, 60*60*HZ)) == -EAGAIN)
-			;
+		do {
+			nfsd_payload_idle(rqstp);
+			nfsd_sched_idle(rqstp);
+			nfsd_busypoll(net, rqstp);
+			nfsd_overload_idle(rqstp);
+		} while ((err = svc_recv(rqstp, 60*60*HZ)) == -EAGAIN);
+		nfsd_payload_busy(rqstp);
 		if (err == -EINTR)
 			break;
+		nfsd_busypoll_note(rqstp);
+		nfsd_overload_note(rqstp);
+		nfsd_sched_begin(rqstp);
+		nfsd_inflight_begin(rqstp);
+		nfsd_stage_begin(rqstp);
+		nfsd_batch_begin(rqstp);
 		validate_process_creds();
 		svc_process(rqstp);
 		validate_process_creds();
+		nfsd_batch_end(rqstp);
+		nfsd_stage_end(rqstp);
+		nfsd_stage_account(net, rqstp);
+		nfsd_inflight_end(rqstp);
+		nfsd_overload_end(rqstp);
+		nfsd_sched_end(rqstp);
 	}
+	nfsd_inflight_unregister(net, rqstp);
 
 	/* Clear signals before calling svc_exit_thread() */
 	flush_signals(current);
 
+	mutex_lock(&nfsd_mutex);
 out:
 	rqstp->rq_server = NULL;
 
@@ -365,10 +498,37 @@ out:
 	nfsd_destroy(net);
 
 	/* Release module */
+	mutex_unlock(&nfsd_mutex);
 	module_put_and_exit(0);
 	return 0;
 }
 
+/*
+ * svc_set_client(), with the time spent in it accounted separately.
+ */
+static int
+nfsd_authenticate(struct svc_rqst *rqstp)
+{
+	int stage, ret;
+
+	stage = nfsd_stage_enter(rqstp, NFSD_STAGE_AUTH);
+	ret = svc_set_client(rqstp);
+	nfsd_stage_exit(rqstp, stage);
+	return ret;
+}
+
+/*
+ * A request leaving nfsd_dispatch() without a reply to send, dropped,
+ * put off or not decodable, still goes to the slow request log.
+ */
+static void nfsd_dispatch_unanswered(struct svc_rqst *rqstp, u64 start,
+				     __be32 nfserr)
+{
+	nfsd_stage_enter(rqstp, NFSD_STAGE_SEND);
+	if (!nfsd_rqst_ctx(rqstp)->tc_bench)
+		nfsd_slowops_check(rqstp, ktime_get_ns() - start, nfserr);
+}
+
 static __be32 map_new_errors(__be32 nfserr)
 {
 	if (nfserr == nfserr_wrongsec)
@@ -383,17 +543,32 @@ nfsd_dispatch(struct svc_rqst *rqstp, __be32 *statp)
 	kxdrproc_t		xdr;
 	__be32			nfserr;
 	__be32			*nfserrp;
+	u64			start, elapsed;
 
 	printk(KERN_INFO "nfsd_dispatch: vers %d proc %d\n",
 				rqstp->rq_vers, rqstp->rq_proc);
 	proc = rqstp->rq_procinfo;
+	start = ktime_get_ns();
+	nfsd_rqst_ctx(rqstp)->tc_export_slot = -1;
+	nfsd_rqst_ctx(rqstp)->tc_hotfh_hash = 0;
+	nfsd_rqst_ctx(rqstp)->tc_throttle_done = false;
+
+	/* Shed the request before doing any work on it, see overload.c */
+	nfserr = nfsd_overload_check(rqstp);
+	if (nfserr == nfserr_dropit) {
+		nfsd_dispatch_unanswered(rqstp, start, nfserr);
+		return 0;
+	}
 
 	/* Decode arguments */
+	nfsd_stage_enter(rqstp, NFSD_STAGE_DECODE);
 	xdr = proc->pc_decode;
-	if (xdr && !xdr(rqstp, (__be32*)rqstp->rq_arg.head[0].iov_base,
+	if (!nfserr && xdr &&
+	    !xdr(rqstp, (__be32*)rqstp->rq_arg.head[0].iov_base,
 			rqstp->rq_argp)) {
 		printk(KERN_INFO "nfsd: failed to decode arguments!\n");
 		*statp = rpc_garbage_args;
+		nfsd_dispatch_unanswered(rqstp, start, nfserr_inval);
 		return 1;
 	}
 
@@ -404,28 +579,57 @@ nfsd_dispatch(struct svc_rqst *rqstp, __be32 *statp)
 		+ rqstp->rq_res.head[0].iov_len;
 	rqstp->rq_res.head[0].iov_len += sizeof(__be32);
 
+	/* A shed request: every NFSv3 result starts with its status */
+	if (nfserr) {
+		*(__be32 *)rqstp->rq_resp = nfserr;
+		goto out_status;
+	}
+
+	/* Bulk data waits for room in its lane, see lanes.c */
+	if (!nfsd_lane_enter(rqstp)) {
+		nfsd_dispatch_unanswered(rqstp, start, nfserr_dropit);
+		return 0;
+	}
+
 	/* Now call the procedure handler, and encode NFS status. */
+	nfsd_stage_enter(rqstp, NFSD_STAGE_PROC);
 	nfserr = proc->pc_func(rqstp, rqstp->rq_argp, rqstp->rq_resp);
+	nfsd_lane_exit(rqstp);
 	nfserr = map_new_errors(nfserr);
 	if (nfserr == nfserr_dropit || test_bit(RQ_DROPME, &rqstp->rq_flags)) {
 		printk(KERN_INFO "nfsd: Dropping request; may be revisited later\n");
+		nfsd_dispatch_unanswered(rqstp, start, nfserr_dropit);
 		return 0;
 	}
 
+out_status:
 	if (rqstp->rq_proc != 0)
 		*nfserrp++ = nfserr;
 
 	/* Encode result.
 	 * For NFSv2, additional info is never returned in case of an error.
 	 */
+	nfsd_stage_enter(rqstp, NFSD_STAGE_ENCODE);
 	xdr = proc->pc_encode;
 	if (xdr && !xdr(rqstp, nfserrp, rqstp->rq_resp)) {
 		/* Failed to encode result. Release cache entry */
 		printk(KERN_INFO "nfsd: failed to encode result!\n");
 		*statp = rpc_system_err;
+		nfsd_dispatch_unanswered(rqstp, start, nfserr_serverfault);
 		return 1;
 	}
 
+	/* what is left of svc_process() is sending the reply */
+	nfsd_stage_enter(rqstp, NFSD_STAGE_SEND);
+	/* dispatch_bench calls are not the server's traffic */
+	if (nfsd_rqst_ctx(rqstp)->tc_bench)
+		return 1;
+	elapsed = ktime_get_ns() - start;
+	nfsd_stats_reply(rqstp, elapsed, nfserr);
+	nfsd_slowops_check(rqstp, elapsed, nfserr);
+	nfsd_traffic_account(rqstp, elapsed, nfserr);
+	nfsd_hotfh_account(rqstp, nfserr);
+	nfsd_capture_rqst(rqstp, nfserr);
 	return 1;
 }
 
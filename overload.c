@@ -0,0 +1,512 @@
+/*
+ * Overload control.
+ *
+ * When requests come in faster than the threads get through them, they
+ * wait on their transports until the client gives up on them and
+ * retransmits, and the retransmissions add to the load that made them
+ * wait.  Rather than doing work whose reply nobody is waiting for any
+ * more, the server can shed some of it early, before decoding:
+ *
+ *  - with a wait target, an NFSv3 request that waited longer than the
+ *    target before a thread got to it is answered with NFS3ERR_JUKEBOX,
+ *    which asks the client to back off and try again later;
+ *
+ *  - with a quota, a client (a source address, all its connections
+ *    together) that already has that many requests in progress has any
+ *    more of them answered with NFS3ERR_JUKEBOX too;
+ *
+ *  - with duplicates on, a request whose xid, procedure and client are
+ *    those of a request still in progress, which can only be the client
+ *    retransmitting, is dropped.  The reply to the first one answers
+ *    both.
+ *
+ * The NULL procedure is never shed, nor is a request revisited after
+ * having been put off (lanes.c), which was admitted already.
+ *
+ * How long a request waited is taken from when its transport was
+ * queued: with a target set the enqueue is taken over (affinity.c) and
+ * nfsd_overload_stamp() notes the time a transport becomes XPT_BUSY,
+ * which is when it is handed to the RPC layer's queues, and that time
+ * is looked up again when a thread has read a request from it.  A TCP
+ * connection is queued again after each request, so this is the wait
+ * of every request on it.  A UDP socket is shared by all the clients
+ * and the time a datagram spent in its receive buffer is not known;
+ * only the time the socket itself was queued is counted.
+ *
+ * svc_recv() clears XPT_BUSY and queues the transport again, if it has
+ * more to read, before it returns the request to nfsd(), so by the time
+ * the thread looks its stamp up it may already be that of the next
+ * request.  Each stamp therefore keeps the one it replaced and which
+ * thread, if any, queued it: a stamp the thread itself took since it
+ * last went into svc_recv() is its own re-enqueue, and the wait is
+ * taken from the one before.  Data arriving on another cpu in the
+ * moment between the two can still take the stamp first; that request
+ * is then counted with the next one's wait, which is the shorter.
+ *
+ * The stamps are kept in a table hashed by transport; two transports
+ * that hash to the same entry at the same time lose a measurement, and
+ * their request is taken not to have waited.
+ */
+
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/percpu.h>
+#include <linux/hash.h>
+#include <linux/hardirq.h>
+#include <linux/sched.h>
+#include <linux/jhash.h>
+#include <linux/seq_file.h>
+#include <linux/sunrpc/svc.h>
+#include <linux/sunrpc/svc_xprt.h>
+#include <linux/sunrpc/addr.h>
+
+#include "nfsd.h"
+#include "netns.h"
+#include "overload.h"
+
+#define NFSD_OVERLOAD_CLIENTS		256
+#define NFSD_OVERLOAD_PROBES		16
+#define NFSD_OVERLOAD_STAMP_BITS	10
+#define NFSD_OVERLOAD_XID_BITS		8
+#define NFSD_OVERLOAD_MAX_TARGET	60000	/* ms */
+#define NFSD_OVERLOAD_MAX_QUOTA		1024
+
+struct nfsd_overload_stamp {
+	struct svc_xprt		*os_xprt;
+	u64			os_queued;	/* ns */
+	u64			os_prev;	/* the stamp before, or 0 */
+	/* the thread that queued it from process context, or NULL */
+	struct task_struct	*os_task;
+};
+
+struct nfsd_overload_client {
+	struct sockaddr_storage	oc_addr;
+	u32			oc_hash;	/* 0 while free */
+	atomic_t		oc_in_progress;
+	atomic_long_t		oc_admitted;
+	atomic_long_t		oc_shed_wait;	/* waited past the target */
+	atomic_long_t		oc_shed_quota;	/* over the quota */
+	atomic_long_t		oc_dropped;	/* duplicates in progress */
+};
+
+struct nfsd_overload_stats {
+	unsigned long		waits;
+	u64			wait_ns;
+	u64			max_wait_ns;
+};
+
+struct nfsd_overload {
+	unsigned int			ol_target;	/* ms, 0 for none */
+	unsigned int			ol_quota;	/* 0 for none */
+	bool				ol_duplicates;
+	struct nfsd_overload_stats __percpu *ol_stats;
+	struct nfsd_overload_stamp	ol_stamps[1 << NFSD_OVERLOAD_STAMP_BITS];
+	spinlock_t			ol_xid_lock;
+	struct hlist_head		ol_xids[1 << NFSD_OVERLOAD_XID_BITS];
+	spinlock_t			ol_client_lock;	/* claiming slots */
+	struct nfsd_overload_client	ol_clients[NFSD_OVERLOAD_CLIENTS];
+};
+
+static struct nfsd_overload *overload(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+
+	return nn->overload;
+}
+
+static u32 overload_hash(const struct sockaddr *sap)
+{
+	const struct sockaddr_in *sin = (const struct sockaddr_in *)sap;
+	const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)sap;
+
+	switch (sap->sa_family) {
+	case AF_INET:
+		return jhash_1word(sin->sin_addr.s_addr, 0) ?: 1;
+	case AF_INET6:
+		return jhash(&sin6->sin6_addr, sizeof(sin6->sin6_addr), 0) ?: 1;
+	}
+	return 0;
+}
+
+static bool overload_match(struct nfsd_overload_client *oc, u32 hash,
+			   const struct sockaddr *sap)
+{
+	return oc->oc_hash == hash &&
+	       rpc_cmp_addr((struct sockaddr *)&oc->oc_addr, sap);
+}
+
+/*
+ * The slot of the client at @sap, ignoring the port, claiming a free
+ * one if it has none yet; slot 0 if the table is full there.  Slots are
+ * never given back, so they are looked up without the lock.
+ */
+static unsigned int overload_client(struct nfsd_overload *ol,
+				    const struct sockaddr *sap)
+{
+	u32 hash = overload_hash(sap);
+	struct nfsd_overload_client *oc;
+	unsigned int i, idx;
+
+	if (!hash)
+		return 0;
+	for (i = 0; i < NFSD_OVERLOAD_PROBES; i++) {
+		idx = ((hash + i) & (NFSD_OVERLOAD_CLIENTS - 1)) ?: 1;
+		oc = &ol->ol_clients[idx];
+		/* pairs with smp_store_release() below */
+		if (!smp_load_acquire(&oc->oc_hash))
+			break;
+		if (overload_match(oc, hash, sap))
+			return idx;
+	}
+	if (i == NFSD_OVERLOAD_PROBES)
+		return 0;
+
+	spin_lock_bh(&ol->ol_client_lock);
+	for (i = 0; i < NFSD_OVERLOAD_PROBES; i++) {
+		idx = ((hash + i) & (NFSD_OVERLOAD_CLIENTS - 1)) ?: 1;
+		oc = &ol->ol_clients[idx];
+		if (!oc->oc_hash) {
+			memcpy(&oc->oc_addr, sap, sap->sa_family == AF_INET ?
+			       sizeof(struct sockaddr_in) :
+			       sizeof(struct sockaddr_in6));
+			rpc_set_port((struct sockaddr *)&oc->oc_addr, 0);
+			smp_store_release(&oc->oc_hash, hash);
+			break;
+		}
+		if (overload_match(oc, hash, sap))
+			break;
+	}
+	spin_unlock_bh(&ol->ol_client_lock);
+	return i == NFSD_OVERLOAD_PROBES ? 0 : idx;
+}
+
+static struct hlist_head *overload_xid_bucket(struct nfsd_overload *ol,
+					      struct svc_rqst *rqstp)
+{
+	return &ol->ol_xids[hash_32((__force u32)rqstp->rq_xid,
+				    NFSD_OVERLOAD_XID_BITS)];
+}
+
+/* whether @a and @b are the same call from the same client */
+static bool overload_same_call(struct svc_rqst *a, struct svc_rqst *b)
+{
+	return a->rq_xid == b->rq_xid && a->rq_prog == b->rq_prog &&
+	       a->rq_vers == b->rq_vers && a->rq_proc == b->rq_proc &&
+	       rpc_cmp_addr(svc_addr(a), svc_addr(b));
+}
+
+/*
+ * Add @rqstp to the requests in progress, unless the same call is in
+ * progress already; returns false then.
+ */
+static bool overload_xid_add(struct nfsd_overload *ol, struct svc_rqst *rqstp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp), *other;
+	struct hlist_head *head = overload_xid_bucket(ol, rqstp);
+
+	spin_lock_bh(&ol->ol_xid_lock);
+	hlist_for_each_entry(other, head, tc_overload_node) {
+		if (overload_same_call(other->tc_rqstp, rqstp)) {
+			spin_unlock_bh(&ol->ol_xid_lock);
+			return false;
+		}
+	}
+	hlist_add_head(&ctx->tc_overload_node, head);
+	spin_unlock_bh(&ol->ol_xid_lock);
+	return true;
+}
+
+bool
+nfsd_overload_enabled(struct net *net)
+{
+	struct nfsd_overload *ol = overload(net);
+
+	return ol && READ_ONCE(ol->ol_target);
+}
+
+/*
+ * Called by the enqueue policy when it has set XPT_BUSY on @xprt, to
+ * note when the transport started waiting for a thread.
+ */
+void
+nfsd_overload_stamp(struct svc_xprt *xprt)
+{
+	struct nfsd_overload *ol = overload(xprt->xpt_net);
+	struct nfsd_overload_stamp *os;
+	u64 prev = 0;
+
+	if (!ol || !READ_ONCE(ol->ol_target))
+		return;
+	os = &ol->ol_stamps[hash_ptr(xprt, NFSD_OVERLOAD_STAMP_BITS)];
+	if (READ_ONCE(os->os_xprt) == xprt)
+		prev = READ_ONCE(os->os_queued);
+	WRITE_ONCE(os->os_xprt, NULL);
+	WRITE_ONCE(os->os_prev, prev);
+	WRITE_ONCE(os->os_queued, ktime_get_ns());
+	WRITE_ONCE(os->os_task, in_interrupt() ? NULL : current);
+	/* pairs with smp_load_acquire() in nfsd_overload_note() */
+	smp_store_release(&os->os_xprt, xprt);
+}
+
+/*
+ * Called by nfsd() before svc_recv(), to tell its own re-enqueues from
+ * those of earlier requests.
+ */
+void
+nfsd_overload_idle(struct svc_rqst *rqstp)
+{
+	struct nfsd_overload *ol = overload(SVC_NET(rqstp));
+
+	if (ol && READ_ONCE(ol->ol_target))
+		nfsd_rqst_ctx(rqstp)->tc_overload_idle = ktime_get_ns();
+}
+
+/*
+ * Called by nfsd() with a request just read from rqstp->rq_xprt: work
+ * out how long it waited for the thread.
+ */
+void
+nfsd_overload_note(struct svc_rqst *rqstp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_overload *ol = overload(SVC_NET(rqstp));
+	struct svc_xprt *xprt = rqstp->rq_xprt;
+	struct nfsd_overload_stats *s;
+	struct nfsd_overload_stamp *os;
+	u64 queued, now;
+
+	ctx->tc_overload_wait = 0;
+	ctx->tc_overload_slot = -1;
+	if (!ol)
+		return;
+	os = &ol->ol_stamps[hash_ptr(xprt, NFSD_OVERLOAD_STAMP_BITS)];
+	if (smp_load_acquire(&os->os_xprt) != xprt)
+		return;
+	queued = READ_ONCE(os->os_queued);
+	/* queued again by svc_recv() after reading this request */
+	if (READ_ONCE(os->os_task) == current &&
+	    queued >= ctx->tc_overload_idle)
+		queued = READ_ONCE(os->os_prev);
+	/* the next request may still need the stamp, so it is left */
+	now = ktime_get_ns();
+	if (!queued || now <= queued)
+		return;
+	ctx->tc_overload_wait = now - queued;
+
+	s = get_cpu_ptr(ol->ol_stats);
+	s->waits++;
+	s->wait_ns += ctx->tc_overload_wait;
+	if (ctx->tc_overload_wait > s->max_wait_ns)
+		s->max_wait_ns = ctx->tc_overload_wait;
+	put_cpu_ptr(ol->ol_stats);
+}
+
+/*
+ * Called by nfsd_dispatch() before it decodes the request.  Returns
+ * nfserr_jukebox if the request is to be answered with that and not
+ * run, nfserr_dropit if it is to be dropped, nfs_ok otherwise.
+ */
+__be32
+nfsd_overload_check(struct svc_rqst *rqstp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_overload *ol = overload(SVC_NET(rqstp));
+	struct nfsd_overload_client *oc;
+	unsigned int target, quota, idx;
+	bool duplicates;
+
+	if (!ol || rqstp->rq_prog != NFS_PROGRAM || rqstp->rq_vers != 3 ||
+	    rqstp->rq_proc == 0)
+		return nfs_ok;
+	target = READ_ONCE(ol->ol_target);
+	quota = READ_ONCE(ol->ol_quota);
+	duplicates = READ_ONCE(ol->ol_duplicates);
+	if (!target && !quota && !duplicates)
+		return nfs_ok;
+
+	idx = overload_client(ol, svc_addr(rqstp));
+	oc = &ol->ol_clients[idx];
+	if (duplicates && !overload_xid_add(ol, rqstp)) {
+		atomic_long_inc(&oc->oc_dropped);
+		return nfserr_dropit;
+	}
+
+	atomic_inc(&oc->oc_in_progress);
+	ctx->tc_overload_slot = idx;
+	if (rqstp->rq_deferred)
+		goto out_admit;
+	if (target && ctx->tc_overload_wait > (u64)target * NSEC_PER_MSEC) {
+		atomic_long_inc(&oc->oc_shed_wait);
+		return nfserr_jukebox;
+	}
+	if (quota && atomic_read(&oc->oc_in_progress) > quota) {
+		atomic_long_inc(&oc->oc_shed_quota);
+		return nfserr_jukebox;
+	}
+out_admit:
+	atomic_long_inc(&oc->oc_admitted);
+	return nfs_ok;
+}
+
+/*
+ * Called by nfsd() when svc_process() has returned, whatever
+ * nfsd_overload_check() said.
+ */
+void
+nfsd_overload_end(struct svc_rqst *rqstp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_overload *ol = overload(SVC_NET(rqstp));
+
+	if (ctx->tc_overload_slot >= 0) {
+		atomic_dec(&ol->ol_clients[ctx->tc_overload_slot].oc_in_progress);
+		ctx->tc_overload_slot = -1;
+	}
+	if (!hlist_unhashed(&ctx->tc_overload_node)) {
+		spin_lock_bh(&ol->ol_xid_lock);
+		hlist_del_init(&ctx->tc_overload_node);
+		spin_unlock_bh(&ol->ol_xid_lock);
+	}
+}
+
+/*
+ * Set the threshold @name, one of "target" (ms), "quota" (requests in
+ * progress per client) or "duplicates" (0 or 1), to @value; 0 turns it
+ * off.
+ */
+int
+nfsd_overload_set(struct net *net, const char *name, unsigned int value)
+{
+	struct nfsd_overload *ol = overload(net);
+	unsigned int i;
+
+	if (!strcmp(name, "target")) {
+		if (value > NFSD_OVERLOAD_MAX_TARGET)
+			return -EINVAL;
+		/* forget stamps left from when it was last on */
+		if (value && !READ_ONCE(ol->ol_target))
+			for (i = 0; i < ARRAY_SIZE(ol->ol_stamps); i++)
+				WRITE_ONCE(ol->ol_stamps[i].os_xprt, NULL);
+		WRITE_ONCE(ol->ol_target, value);
+	} else if (!strcmp(name, "quota")) {
+		if (value > NFSD_OVERLOAD_MAX_QUOTA)
+			return -EINVAL;
+		WRITE_ONCE(ol->ol_quota, value);
+	} else if (!strcmp(name, "duplicates")) {
+		if (value > 1)
+			return -EINVAL;
+		WRITE_ONCE(ol->ol_duplicates, value);
+	} else
+		return -EINVAL;
+	return 0;
+}
+
+/*
+ * Format the thresholds, the totals of the per-client counters and the
+ * queue waits into @buf for the overload control file.
+ */
+int
+nfsd_overload_show(struct net *net, char *buf, int size)
+{
+	struct nfsd_overload *ol = overload(net);
+	unsigned long admitted = 0, shed_wait = 0, shed_quota = 0, dropped = 0;
+	struct nfsd_overload_stats sum = { 0 };
+	unsigned int i;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct nfsd_overload_stats *s = per_cpu_ptr(ol->ol_stats, cpu);
+
+		sum.waits += s->waits;
+		sum.wait_ns += s->wait_ns;
+		sum.max_wait_ns = max(sum.max_wait_ns, s->max_wait_ns);
+	}
+	for (i = 0; i < NFSD_OVERLOAD_CLIENTS; i++) {
+		struct nfsd_overload_client *oc = &ol->ol_clients[i];
+
+		admitted += atomic_long_read(&oc->oc_admitted);
+		shed_wait += atomic_long_read(&oc->oc_shed_wait);
+		shed_quota += atomic_long_read(&oc->oc_shed_quota);
+		dropped += atomic_long_read(&oc->oc_dropped);
+	}
+
+	return scnprintf(buf, size, "target %u\nquota %u\nduplicates %d\n"
+			 "admitted %lu\nshed_wait %lu\nshed_quota %lu\n"
+			 "dropped %lu\nwaits %lu\nwait_avg_us %llu\n"
+			 "wait_max_us %llu\n", READ_ONCE(ol->ol_target),
+			 READ_ONCE(ol->ol_quota), READ_ONCE(ol->ol_duplicates),
+			 admitted, shed_wait, shed_quota, dropped, sum.waits,
+			 sum.waits ? div64_u64(sum.wait_ns, sum.waits) /
+				     NSEC_PER_USEC : 0,
+			 div64_u64(sum.max_wait_ns, NSEC_PER_USEC));
+}
+
+/* The overload_clients file: what was shed, per client. */
+int
+nfsd_overload_seq_show(struct seq_file *m, void *v)
+{
+	struct nfsd_overload *ol = overload(m->private);
+	struct nfsd_overload_client *oc;
+	char addr[INET6_ADDRSTRLEN];
+	unsigned int i;
+
+	seq_printf(m, "%-40s %6s %12s %12s %12s %12s\n", "client", "busy",
+		   "admitted", "shed_wait", "shed_quota", "dropped");
+	for (i = 0; i < NFSD_OVERLOAD_CLIENTS; i++) {
+		oc = &ol->ol_clients[i];
+		if (i && !smp_load_acquire(&oc->oc_hash))
+			continue;
+		if (!i && !atomic_long_read(&oc->oc_admitted) &&
+		    !atomic_long_read(&oc->oc_shed_wait) &&
+		    !atomic_long_read(&oc->oc_shed_quota) &&
+		    !atomic_long_read(&oc->oc_dropped))
+			continue;
+		if (!i)
+			strlcpy(addr, "(other)", sizeof(addr));
+		else
+			snprintf(addr, sizeof(addr), "%pISc", &oc->oc_addr);
+		seq_printf(m, "%-40s %6d %12lu %12lu %12lu %12lu\n", addr,
+			   atomic_read(&oc->oc_in_progress),
+			   atomic_long_read(&oc->oc_admitted),
+			   atomic_long_read(&oc->oc_shed_wait),
+			   atomic_long_read(&oc->oc_shed_quota),
+			   atomic_long_read(&oc->oc_dropped));
+	}
+	return 0;
+}
+
+int
+nfsd_overload_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_overload *ol;
+	unsigned int i;
+
+	ol = vzalloc(sizeof(*ol));
+	if (!ol)
+		return -ENOMEM;
+	ol->ol_stats = alloc_percpu(struct nfsd_overload_stats);
+	if (!ol->ol_stats) {
+		vfree(ol);
+		return -ENOMEM;
+	}
+	spin_lock_init(&ol->ol_xid_lock);
+	spin_lock_init(&ol->ol_client_lock);
+	for (i = 0; i < ARRAY_SIZE(ol->ol_xids); i++)
+		INIT_HLIST_HEAD(&ol->ol_xids[i]);
+	nn->overload = ol;
+	return 0;
+}
+
+void
+nfsd_overload_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_overload *ol = nn->overload;
+
+	if (!ol)
+		return;
+	nn->overload = NULL;
+	free_percpu(ol->ol_stats);
+	vfree(ol);
+}
@@ -0,0 +1,30 @@
+/*
+ * Overload control.
+ *
+ * Requests that waited longer than a target before they were dispatched,
+ * or that would take a client over its quota of requests in progress,
+ * are answered with NFS3ERR_JUKEBOX without being run, and retransmitted
+ * requests that are still in progress are dropped.
+ */
+
+#ifndef LINUX_NFSD_OVERLOAD_H
+#define LINUX_NFSD_OVERLOAD_H
+
+struct net;
+struct svc_rqst;
+struct svc_xprt;
+struct seq_file;
+
+int	nfsd_overload_init(struct net *);
+void	nfsd_overload_shutdown(struct net *);
+bool	nfsd_overload_enabled(struct net *);
+void	nfsd_overload_stamp(struct svc_xprt *);
+void	nfsd_overload_idle(struct svc_rqst *);
+void	nfsd_overload_note(struct svc_rqst *);
+__be32	nfsd_overload_check(struct svc_rqst *);
+void	nfsd_overload_end(struct svc_rqst *);
+int	nfsd_overload_set(struct net *, const char *name, unsigned int value);
+int	nfsd_overload_show(struct net *, char *, int);
+int	nfsd_overload_seq_show(struct seq_file *, void *);
+
+#endif /* LINUX_NFSD_OVERLOAD_H */
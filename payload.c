@@ -0,0 +1,369 @@
+/*
+ * Payload pages of idle threads.
+ *
+ * Every thread holds enough pages in rq_pages for the largest request
+ * and reply, which with a 1MB nfsd_max_blksize is some 260 pages: a
+ * thousand threads pin a gigabyte, though most of them sit idle and
+ * most requests fit in a page.  The pages are allocated by the RPC
+ * layer, by svc_alloc_arg() at the top of every svc_recv(), before the
+ * thread waits for work, so a thread that is waiting in svc_recv()
+ * always has its full set.
+ *
+ * With a number of warm threads set, only that many threads per pool
+ * wait in svc_recv().  A thread that comes back from a request to find
+ * enough threads of its pool waiting already parks instead: it gives
+ * its pages back and sleeps outside svc_recv(), where the RPC layer
+ * does not look for it.  A thread that leaves svc_recv() with work
+ * while fewer than the warm threads are left waiting wakes a parked
+ * one, which then enters svc_recv() in its place.  So the pages are
+ * only held by threads that are working, plus the warm ones.
+ *
+ * Pages given back go to a reserve per NUMA node, up to a set number
+ * of pages per node, and the rest to the page allocator.  A thread
+ * that is woken takes what it can from the reserve of its own node
+ * before svc_alloc_arg() allocates the rest.  The reserve keeps a
+ * woken thread from waiting on memory: svc_alloc_arg() retries every
+ * half a second until it has all of its pages.
+ *
+ * Parking is off with no warm threads, which is the default.
+ */
+
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/mm.h>
+#include <linux/wait.h>
+#include <linux/freezer.h>
+#include <linux/kthread.h>
+#include <linux/sunrpc/svc.h>
+
+#include "nfsd.h"
+#include "netns.h"
+#include "payload.h"
+
+/* per pool; more would not save any pages */
+#define NFSD_PAYLOAD_MAX_WARM		1024
+/* per node */
+#define NFSD_PAYLOAD_MAX_RESERVE	65536
+
+struct nfsd_payload_stats {
+	unsigned long		parks;
+	unsigned long		released;	/* pages given back */
+	unsigned long		reused;		/* taken from the reserve */
+};
+
+struct nfsd_payload_pool {
+	atomic_t		pp_waiting;	/* threads in svc_recv() */
+	atomic_t		pp_parked;
+	atomic_t		pp_wakeups;
+	wait_queue_head_t	pp_wait;
+};
+
+struct nfsd_payload_node {
+	spinlock_t		pn_lock;
+	struct list_head	pn_pages;	/* by page->lru */
+	unsigned int		pn_count;
+};
+
+struct nfsd_payload {
+	unsigned int			pl_warm;	/* 0 for no parking */
+	unsigned int			pl_reserve;	/* pages per node */
+	struct nfsd_payload_pool	*pl_pools;	/* by sp_id */
+	struct nfsd_payload_node	*pl_nodes;	/* by node id */
+	struct nfsd_payload_stats __percpu *pl_stats;
+};
+
+static struct nfsd_payload *payload(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+
+	return nn->payload;
+}
+
+static struct nfsd_payload_pool *payload_pool(struct nfsd_payload *pl,
+					      struct svc_pool *pool)
+{
+	return &pl->pl_pools[pool->sp_id % nr_cpu_ids];
+}
+
+/* what svc_alloc_arg() fills in */
+static unsigned int payload_npages(struct svc_serv *serv)
+{
+	unsigned int pages = (serv->sv_max_mesg + 2 * PAGE_SIZE) >> PAGE_SHIFT;
+
+	return min_t(unsigned int, pages, RPCSVC_MAXPAGES);
+}
+
+/* Give back the pages of @rqstp, to the reserve of their node first. */
+static void payload_release(struct nfsd_payload *pl, struct svc_rqst *rqstp)
+{
+	unsigned int reserve = READ_ONCE(pl->pl_reserve), i, n = 0;
+	struct nfsd_payload_node *pn;
+	struct page *page;
+
+	for (i = 0; i < RPCSVC_MAXPAGES; i++) {
+		page = rqstp->rq_pages[i];
+		if (!page)
+			continue;
+		rqstp->rq_pages[i] = NULL;
+		n++;
+		pn = &pl->pl_nodes[page_to_nid(page)];
+		/* a page still referenced elsewhere is not ours to keep */
+		if (page_count(page) == 1 &&
+		    READ_ONCE(pn->pn_count) < reserve) {
+			spin_lock(&pn->pn_lock);
+			if (pn->pn_count < reserve) {
+				list_add(&page->lru, &pn->pn_pages);
+				pn->pn_count++;
+				page = NULL;
+			}
+			spin_unlock(&pn->pn_lock);
+		}
+		if (page)
+			put_page(page);
+	}
+	this_cpu_add(pl->pl_stats->released, n);
+}
+
+/* Fill in the pages of @rqstp from the reserve of the local node. */
+static void payload_refill(struct nfsd_payload *pl, struct svc_rqst *rqstp)
+{
+	struct nfsd_payload_node *pn = &pl->pl_nodes[numa_node_id()];
+	unsigned int pages = payload_npages(rqstp->rq_server), i, n = 0;
+	struct page *page;
+
+	if (!READ_ONCE(pn->pn_count))
+		return;
+	spin_lock(&pn->pn_lock);
+	for (i = 0; i < pages && pn->pn_count; i++) {
+		if (rqstp->rq_pages[i])
+			continue;
+		page = list_first_entry(&pn->pn_pages, struct page, lru);
+		list_del(&page->lru);
+		pn->pn_count--;
+		rqstp->rq_pages[i] = page;
+		n++;
+	}
+	spin_unlock(&pn->pn_lock);
+	this_cpu_add(pl->pl_stats->reused, n);
+}
+
+/* Free the pages of every reserve beyond @reserve. */
+static void payload_trim(struct nfsd_payload *pl, unsigned int reserve)
+{
+	struct nfsd_payload_node *pn;
+	struct page *page;
+	LIST_HEAD(free);
+	int node;
+
+	for (node = 0; node < nr_node_ids; node++) {
+		pn = &pl->pl_nodes[node];
+		spin_lock(&pn->pn_lock);
+		while (pn->pn_count > reserve) {
+			page = list_first_entry(&pn->pn_pages, struct page,
+						lru);
+			list_move(&page->lru, &free);
+			pn->pn_count--;
+		}
+		spin_unlock(&pn->pn_lock);
+	}
+	while (!list_empty(&free)) {
+		page = list_first_entry(&free, struct page, lru);
+		list_del(&page->lru);
+		put_page(page);
+	}
+}
+
+static void payload_wake(struct nfsd_payload_pool *pp)
+{
+	atomic_inc(&pp->pp_wakeups);
+	wake_up(&pp->pp_wait);
+}
+
+/*
+ * Park the thread of @rqstp until nfsd_payload_busy() wakes it, unless
+ * fewer than @warm threads are waiting by now.
+ */
+static void payload_park(struct nfsd_payload *pl,
+			 struct nfsd_payload_pool *pp, struct svc_rqst *rqstp,
+			 unsigned int warm)
+{
+	DEFINE_WAIT(wait);
+
+	atomic_inc(&pp->pp_parked);
+	/* pairs with atomic_dec_return() in nfsd_payload_busy() */
+	smp_mb__after_atomic();
+	if (atomic_read(&pp->pp_waiting) < warm) {
+		atomic_dec(&pp->pp_parked);
+		return;
+	}
+
+	payload_release(pl, rqstp);
+	this_cpu_inc(pl->pl_stats->parks);
+	for (;;) {
+		prepare_to_wait_exclusive(&pp->pp_wait, &wait,
+					  TASK_INTERRUPTIBLE);
+		if (atomic_add_unless(&pp->pp_wakeups, -1, 0) ||
+		    signal_pending(current) || kthread_should_stop())
+			break;
+		schedule();
+		finish_wait(&pp->pp_wait, &wait);
+		try_to_freeze();
+	}
+	finish_wait(&pp->pp_wait, &wait);
+	atomic_dec(&pp->pp_parked);
+	payload_refill(pl, rqstp);
+}
+
+/*
+ * Called by nfsd() before svc_recv(); parks the thread if enough
+ * threads of its pool are waiting for work already.
+ */
+void
+nfsd_payload_idle(struct svc_rqst *rqstp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_payload *pl = payload(SVC_NET(rqstp));
+	struct nfsd_payload_pool *pp;
+	unsigned int warm;
+
+	/* svc_recv() came back without work */
+	if (!pl || ctx->tc_payload_waiting)
+		return;
+	pp = payload_pool(pl, rqstp->rq_pool);
+	warm = READ_ONCE(pl->pl_warm);
+	if (warm && atomic_read(&pp->pp_waiting) >= warm)
+		payload_park(pl, pp, rqstp, warm);
+	atomic_inc(&pp->pp_waiting);
+	ctx->tc_payload_waiting = true;
+}
+
+/*
+ * Called by nfsd() when svc_recv() has returned with work, or for the
+ * thread to exit; wakes a parked thread to wait in its place if needed.
+ */
+void
+nfsd_payload_busy(struct svc_rqst *rqstp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_payload *pl = payload(SVC_NET(rqstp));
+	struct nfsd_payload_pool *pp;
+	int waiting;
+
+	if (!pl || !ctx->tc_payload_waiting)
+		return;
+	ctx->tc_payload_waiting = false;
+	pp = payload_pool(pl, rqstp->rq_pool);
+	waiting = atomic_dec_return(&pp->pp_waiting);
+	if (waiting < (int)READ_ONCE(pl->pl_warm) &&
+	    atomic_read(&pp->pp_parked))
+		payload_wake(pp);
+}
+
+/*
+ * Set the threads per pool that wait with their pages, 0 for all of
+ * them, and the pages kept in reserve per node.
+ */
+int
+nfsd_payload_set(struct net *net, unsigned int warm, unsigned int reserve)
+{
+	struct nfsd_payload *pl = payload(net);
+	struct nfsd_payload_pool *pp;
+	unsigned int i;
+
+	if (warm > NFSD_PAYLOAD_MAX_WARM || reserve > NFSD_PAYLOAD_MAX_RESERVE)
+		return -EINVAL;
+	WRITE_ONCE(pl->pl_warm, warm);
+	WRITE_ONCE(pl->pl_reserve, reserve);
+	payload_trim(pl, reserve);
+	/* let the parked threads find their place again */
+	for (i = 0; i < nr_cpu_ids; i++) {
+		pp = &pl->pl_pools[i];
+		if (!atomic_read(&pp->pp_parked))
+			continue;
+		atomic_add(atomic_read(&pp->pp_parked), &pp->pp_wakeups);
+		wake_up_all(&pp->pp_wait);
+	}
+	return 0;
+}
+
+/*
+ * Format the settings and counters into @buf for the payload_pages
+ * control file.
+ */
+int
+nfsd_payload_show(struct net *net, char *buf, int size)
+{
+	struct nfsd_payload *pl = payload(net);
+	struct nfsd_payload_stats sum = { 0 };
+	unsigned int waiting = 0, parked = 0, reserved = 0, i;
+	int cpu, node;
+
+	for_each_possible_cpu(cpu) {
+		struct nfsd_payload_stats *s = per_cpu_ptr(pl->pl_stats, cpu);
+
+		sum.parks += s->parks;
+		sum.released += s->released;
+		sum.reused += s->reused;
+	}
+	for (i = 0; i < nr_cpu_ids; i++) {
+		waiting += atomic_read(&pl->pl_pools[i].pp_waiting);
+		parked += atomic_read(&pl->pl_pools[i].pp_parked);
+	}
+	for (node = 0; node < nr_node_ids; node++)
+		reserved += READ_ONCE(pl->pl_nodes[node].pn_count);
+
+	return scnprintf(buf, size, "warm %u\nreserve %u\nwaiting %u\n"
+			 "parked %u\nreserved_pages %u\nparks %lu\n"
+			 "released_pages %lu\nreused_pages %lu\n",
+			 READ_ONCE(pl->pl_warm), READ_ONCE(pl->pl_reserve),
+			 waiting, parked, reserved, sum.parks, sum.released,
+			 sum.reused);
+}
+
+int
+nfsd_payload_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_payload *pl;
+	unsigned int i;
+	int node;
+
+	pl = kzalloc(sizeof(*pl), GFP_KERNEL);
+	if (!pl)
+		return -ENOMEM;
+	pl->pl_pools = kcalloc(nr_cpu_ids, sizeof(*pl->pl_pools), GFP_KERNEL);
+	pl->pl_nodes = kcalloc(nr_node_ids, sizeof(*pl->pl_nodes), GFP_KERNEL);
+	pl->pl_stats = alloc_percpu(struct nfsd_payload_stats);
+	pl->pl_reserve = NFSD_PAYLOAD_DEFAULT_RESERVE;
+	if (!pl->pl_pools || !pl->pl_nodes || !pl->pl_stats) {
+		free_percpu(pl->pl_stats);
+		kfree(pl->pl_nodes);
+		kfree(pl->pl_pools);
+		kfree(pl);
+		return -ENOMEM;
+	}
+	for (i = 0; i < nr_cpu_ids; i++)
+		init_waitqueue_head(&pl->pl_pools[i].pp_wait);
+	for (node = 0; node < nr_node_ids; node++) {
+		spin_lock_init(&pl->pl_nodes[node].pn_lock);
+		INIT_LIST_HEAD(&pl->pl_nodes[node].pn_pages);
+	}
+	nn->payload = pl;
+	return 0;
+}
+
+void
+nfsd_payload_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_payload *pl = nn->payload;
+
+	if (!pl)
+		return;
+	nn->payload = NULL;
+	payload_trim(pl, 0);
+	free_percpu(pl->pl_stats);
+	kfree(pl->pl_nodes);
+	kfree(pl->pl_pools);
+	kfree(pl);
+}
@@ -0,0 +1,24 @@
+/*
+ * Payload pages of idle threads.
+ *
+ * Threads beyond a few idle ones per pool give their pages back and
+ * wait outside svc_recv() until they are needed.
+ */
+
+#ifndef LINUX_NFSD_PAYLOAD_H
+#define LINUX_NFSD_PAYLOAD_H
+
+/* pages kept per NUMA node for threads that are woken, 1MB with 4K pages */
+#define NFSD_PAYLOAD_DEFAULT_RESERVE	256
+
+struct net;
+struct svc_rqst;
+
+int	nfsd_payload_init(struct net *);
+void	nfsd_payload_shutdown(struct net *);
+void	nfsd_payload_idle(struct svc_rqst *);
+void	nfsd_payload_busy(struct svc_rqst *);
+int	nfsd_payload_set(struct net *, unsigned int warm, unsigned int reserve);
+int	nfsd_payload_show(struct net *, char *, int);
+
+#endif /* LINUX_NFSD_PAYLOAD_H */
@@ -10,6 +10,8 @@
 
 #include "xdr.h"
 #include "vfs.h"
+#include "stats.h"
+#include "lanes.h"
 
 #define RETURN_STATUS(st)	{ resp->status = (st); return (st); }
 
@@ -30,6 +32,7 @@ nfsd3_proc_getattr(struct svc_rqst *rqstp, struct nfsd_fhandle  *argp,
 					   struct nfsd3_attrstat *resp)
 {
 	__be32	nfserr;
+	int	stage;
 
 	printk(KERN_INFO "nfsd: GETATTR(3)  %s\n",
 		SVCFH_fmt(&argp->fh));
@@ -39,7 +42,9 @@ nfsd3_proc_getattr(struct svc_rqst *rqstp, struct nfsd_fhandle  *argp,
 	if (nfserr)
 		RETURN_STATUS(nfserr);
 
+	stage = nfsd_stage_enter(rqstp, NFSD_STAGE_GETATTR);
 	nfserr = fh_getattr(&resp->fh, &resp->stat);
+	nfsd_stage_exit(rqstp, stage);
 
 	RETURN_STATUS(nfserr);
 }
@@ -389,6 +394,18 @@ nfsd3_proc_fsstat(struct svc_rqst * rqstp, struct nfsd_fhandle    *argp,
 	RETURN_STATUS(nfserr);
 }
 
+/*
+ * An export's preferred transfer size: a multiple of the page size no
+ * larger than what the service can take, or @max if it has none.
+ */
+static u32
+nfsd3_pref_size(u32 pref, u32 max)
+{
+	if (!pref || pref >= max)
+		return max;
+	return max_t(u32, pref & PAGE_MASK, PAGE_SIZE);
+}
+
 /*
  * get file system info. this will get called when the client mounts this nfs file system.
  */
@@ -425,6 +442,11 @@ nfsd3_proc_fsinfo(struct svc_rqst * rqstp, struct nfsd_fhandle    *argp,
 			resp->f_properties = NFS3_FSF_BILLYBOY;
 		}
 		resp->f_maxfilesize = sb->s_maxbytes;
+
+		resp->f_rtpref = nfsd3_pref_size(argp->fh.fh_export->ex_rtpref,
+						 max_blocksize);
+		resp->f_wtpref = nfsd3_pref_size(argp->fh.fh_export->ex_wtpref,
+						 max_blocksize);
 	}
 
 	fh_put(&argp->fh);
@@ -586,12 +608,22 @@ static struct svc_procedure		nfsd_procedures3[22] = {
 	},
 };
 
+/*
+ * The lane of each procedure above, see lanes.c: the ones that move
+ * file data, and may wait for the disk while they do, are bulk data.
+ */
+const unsigned char nfsd3_lanes[NFSD3_NPROCS] = {
+	[NFS3PROC_READ]		= NFSD_LANE_DATA,
+	[NFS3PROC_WRITE]	= NFSD_LANE_DATA,
+	[NFS3PROC_COMMIT]	= NFSD_LANE_DATA,
+};
+
 struct svc_version	nfsd_version3 = {
 		.vs_vers	= 3,
 		.vs_nproc	= 22,
 		.vs_proc	= nfsd_procedures3,
 		.vs_dispatch	= nfsd_dispatch,
-		.vs_xdrsize	= NFS3_SVC_XDRSIZE,
+		.vs_xdrsize	= NFSD_SVC_XDRSIZE,
 };
 
 /*
@@ -0,0 +1,494 @@
+/*
+ * Fair-share scheduling across clients.
+ *
+ * The RPC layer hands a transport with data to the first free thread,
+ * and a TCP connection is enqueued again as soon as one request has
+ * been read from it.  A client with a deep queue of requests on its
+ * connection therefore ends up with every thread, and a GETATTR from
+ * anyone else waits until one of them finishes.
+ *
+ * With fair share on, every client (a source address, so that all the
+ * connections of one host count together) has a weight, 1 unless set
+ * otherwise, and its share of the threads is
+ *
+ *	threads * weight / sum of the weights of the active clients
+ *
+ * but at least one.  A client is active while it has requests in
+ * progress or waiting, and for NFSD_SCHED_LINGER after that, so that a
+ * client sending one request at a time keeps its share between them.
+ * A single client is alone in the active set and has all the threads,
+ * as without the scheduler.
+ *
+ * The enqueue policy (affinity.c) asks nfsd_sched_admit() before
+ * handing a TCP connection with data to a thread.  If the client
+ * already has its share of requests in progress, the connection is
+ * parked on the client, with XPT_BUSY still set so that nothing else
+ * queues it.  Every thread about to wait in svc_recv() calls
+ * nfsd_sched_idle(), which takes the first waiting client, in
+ * round-robin order, that is below its share again and queues one of
+ * its connections.  A connection is only parked while its client has a
+ * request in progress, so some thread always comes back for it.
+ *
+ * Connections being closed are not parked, and one that is asked to
+ * close while parked is queued at once.  UDP is never held back since
+ * all clients share one transport.
+ *
+ * All the state is under one lock per net; the client table has a
+ * fixed number of slots, claimed the first time an address is seen and
+ * never given back, and addresses that find no slot share slot 0.
+ */
+
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/jhash.h>
+#include <linux/seq_file.h>
+#include <linux/sunrpc/svc.h>
+#include <linux/sunrpc/svc_xprt.h>
+#include <linux/sunrpc/addr.h>
+#include <linux/sunrpc/xprtsock.h>
+
+#include "nfsd.h"
+#include "netns.h"
+#include "affinity.h"
+#include "sched.h"
+
+#define NFSD_SCHED_CLIENTS	256
+#define NFSD_SCHED_PROBES	16
+/* how long a client keeps its share after its last request */
+#define NFSD_SCHED_LINGER	(HZ / 10)
+
+struct nfsd_sched_client {
+	struct sockaddr_storage	sc_addr;	/* AF_UNSPEC while free */
+	u32			sc_hash;
+	unsigned int		sc_weight;
+	unsigned int		sc_in_service;
+	unsigned int		sc_nparked;
+	bool			sc_active;
+	unsigned long		sc_last;	/* jiffies */
+	struct list_head	sc_active_link;	/* least recent first */
+	struct list_head	sc_waiting_link;
+	struct list_head	sc_parked;	/* transports, by xpt_ready */
+	unsigned long		sc_served;
+	unsigned long		sc_deferred;
+};
+
+struct nfsd_sched {
+	bool				ns_enabled;
+	spinlock_t			ns_lock;
+	unsigned int			ns_active_weight;
+	struct list_head		ns_active;
+	struct list_head		ns_waiting;	/* clients with parked
+							 * transports */
+	struct nfsd_sched_client	ns_clients[NFSD_SCHED_CLIENTS];
+};
+
+static struct nfsd_sched *sched(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+
+	return nn->sched;
+}
+
+static u32 sched_hash(const struct sockaddr *sap)
+{
+	const struct sockaddr_in *sin = (const struct sockaddr_in *)sap;
+	const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)sap;
+
+	switch (sap->sa_family) {
+	case AF_INET:
+		return jhash_1word(sin->sin_addr.s_addr, 0) ?: 1;
+	case AF_INET6:
+		return jhash(&sin6->sin6_addr, sizeof(sin6->sin6_addr), 0) ?: 1;
+	}
+	return 0;
+}
+
+/*
+ * The slot of the client at @sap, ignoring the port, claiming a free
+ * one if it has none yet; slot 0 if the table is full there.  Called
+ * with ns_lock held.
+ */
+static struct nfsd_sched_client *sched_client(struct nfsd_sched *ns,
+					      const struct sockaddr *sap)
+{
+	u32 hash = sched_hash(sap);
+	struct nfsd_sched_client *sc;
+	unsigned int i, idx;
+
+	if (!hash)
+		return &ns->ns_clients[0];
+	for (i = 0; i < NFSD_SCHED_PROBES; i++) {
+		idx = ((hash + i) & (NFSD_SCHED_CLIENTS - 1)) ?: 1;
+		sc = &ns->ns_clients[idx];
+		if (sc->sc_addr.ss_family == AF_UNSPEC) {
+			memcpy(&sc->sc_addr, sap, sap->sa_family == AF_INET ?
+			       sizeof(struct sockaddr_in) :
+			       sizeof(struct sockaddr_in6));
+			rpc_set_port((struct sockaddr *)&sc->sc_addr, 0);
+			sc->sc_hash = hash;
+			return sc;
+		}
+		if (sc->sc_hash == hash &&
+		    rpc_cmp_addr((struct sockaddr *)&sc->sc_addr, sap))
+			return sc;
+	}
+	return &ns->ns_clients[0];
+}
+
+/* @sc has work now */
+static void sched_touch(struct nfsd_sched *ns, struct nfsd_sched_client *sc)
+{
+	sc->sc_last = jiffies;
+	if (!sc->sc_active) {
+		sc->sc_active = true;
+		ns->ns_active_weight += sc->sc_weight;
+	}
+	list_move_tail(&sc->sc_active_link, &ns->ns_active);
+}
+
+/* Drop the clients that have been idle for NFSD_SCHED_LINGER. */
+static void sched_expire(struct nfsd_sched *ns)
+{
+	struct nfsd_sched_client *sc, *next;
+
+	list_for_each_entry_safe(sc, next, &ns->ns_active, sc_active_link) {
+		if (time_before(jiffies, sc->sc_last + NFSD_SCHED_LINGER))
+			break;
+		if (sc->sc_in_service || sc->sc_nparked) {
+			sched_touch(ns, sc);
+			continue;
+		}
+		list_del_init(&sc->sc_active_link);
+		sc->sc_active = false;
+		ns->ns_active_weight -= sc->sc_weight;
+	}
+}
+
+/* How many requests of @sc, which is active, may be in progress. */
+static unsigned int sched_share(struct nfsd_sched *ns,
+				struct nfsd_sched_client *sc,
+				unsigned int nthreads)
+{
+	unsigned int share;
+
+	share = nthreads * sc->sc_weight / max(ns->ns_active_weight, 1u);
+	return max(share, 1u);
+}
+
+/* whether holding back @xprt can only delay one client */
+static bool sched_parkable(struct svc_xprt *xprt)
+{
+	return xprt->xpt_class->xcl_ident == XPRT_TRANSPORT_TCP &&
+	       !test_bit(XPT_LISTENER, &xprt->xpt_flags) &&
+	       !test_bit(XPT_CLOSE, &xprt->xpt_flags) &&
+	       test_bit(XPT_DATA, &xprt->xpt_flags);
+}
+
+bool
+nfsd_sched_enabled(struct net *net)
+{
+	struct nfsd_sched *ns = sched(net);
+
+	return ns && READ_ONCE(ns->ns_enabled);
+}
+
+/*
+ * Called by the enqueue policy with a transport that has work and has
+ * XPT_BUSY set.  Returns false if the transport was parked, to be
+ * queued later by nfsd_sched_idle().
+ */
+bool
+nfsd_sched_admit(struct svc_xprt *xprt)
+{
+	struct nfsd_sched *ns = sched(xprt->xpt_net);
+	struct nfsd_sched_client *sc;
+	unsigned int share;
+
+	if (!sched_parkable(xprt))
+		return true;
+
+	spin_lock_bh(&ns->ns_lock);
+	if (!ns->ns_enabled)
+		goto out_admit;
+	sched_expire(ns);
+	sc = sched_client(ns, (struct sockaddr *)&xprt->xpt_remote);
+	sched_touch(ns, sc);
+	share = sched_share(ns, sc, xprt->xpt_server->sv_nrthreads);
+	if (sc->sc_in_service < share)
+		goto out_admit;
+	if (!sc->sc_nparked++)
+		list_add_tail(&sc->sc_waiting_link, &ns->ns_waiting);
+	list_add_tail(&xprt->xpt_ready, &sc->sc_parked);
+	sc->sc_deferred++;
+	spin_unlock_bh(&ns->ns_lock);
+	return false;
+
+out_admit:
+	spin_unlock_bh(&ns->ns_lock);
+	return true;
+}
+
+static void sched_unlink(struct nfsd_sched *ns, struct nfsd_sched_client *sc,
+			 struct svc_xprt *xprt)
+{
+	list_del_init(&xprt->xpt_ready);
+	list_del_init(&sc->sc_waiting_link);
+	/* to the back of the line if it has more */
+	if (--sc->sc_nparked)
+		list_add_tail(&sc->sc_waiting_link, &ns->ns_waiting);
+}
+
+/*
+ * Called by the enqueue policy for a transport with XPT_CLOSE that is
+ * already busy: if it is parked, queue it so that it gets closed.
+ */
+void
+nfsd_sched_unpark(struct svc_xprt *xprt)
+{
+	struct nfsd_sched *ns = sched(xprt->xpt_net);
+	struct nfsd_sched_client *sc;
+	struct svc_xprt *pos;
+	bool found = false;
+
+	spin_lock_bh(&ns->ns_lock);
+	sc = sched_client(ns, (struct sockaddr *)&xprt->xpt_remote);
+	list_for_each_entry(pos, &sc->sc_parked, xpt_ready) {
+		if (pos == xprt) {
+			sched_unlink(ns, sc, xprt);
+			found = true;
+			break;
+		}
+	}
+	spin_unlock_bh(&ns->ns_lock);
+	if (found)
+		nfsd_queue_xprt(xprt);
+}
+
+/* Called by nfsd() when svc_recv() has returned a request. */
+void
+nfsd_sched_begin(struct svc_rqst *rqstp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_sched *ns = sched(SVC_NET(rqstp));
+	struct nfsd_sched_client *sc;
+
+	ctx->tc_sched_slot = -1;
+	if (!ns || !READ_ONCE(ns->ns_enabled))
+		return;
+	spin_lock_bh(&ns->ns_lock);
+	sched_expire(ns);
+	sc = sched_client(ns, svc_addr(rqstp));
+	sched_touch(ns, sc);
+	sc->sc_in_service++;
+	sc->sc_served++;
+	ctx->tc_sched_slot = sc - ns->ns_clients;
+	spin_unlock_bh(&ns->ns_lock);
+}
+
+/* Called by nfsd() when the request is done. */
+void
+nfsd_sched_end(struct svc_rqst *rqstp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_sched *ns = sched(SVC_NET(rqstp));
+	struct nfsd_sched_client *sc;
+
+	if (ctx->tc_sched_slot < 0)
+		return;
+	spin_lock_bh(&ns->ns_lock);
+	sc = &ns->ns_clients[ctx->tc_sched_slot];
+	sc->sc_in_service--;
+	sc->sc_last = jiffies;
+	spin_unlock_bh(&ns->ns_lock);
+	ctx->tc_sched_slot = -1;
+}
+
+/*
+ * Called by nfsd() before it waits for work: queue a connection of the
+ * next waiting client that is below its share.
+ */
+void
+nfsd_sched_idle(struct svc_rqst *rqstp)
+{
+	struct nfsd_sched *ns = sched(SVC_NET(rqstp));
+	unsigned int nthreads = rqstp->rq_server->sv_nrthreads;
+	struct nfsd_sched_client *sc;
+	struct svc_xprt *xprt = NULL;
+
+	if (!ns || list_empty(&ns->ns_waiting))
+		return;
+	spin_lock_bh(&ns->ns_lock);
+	sched_expire(ns);
+	list_for_each_entry(sc, &ns->ns_waiting, sc_waiting_link) {
+		if (sc->sc_in_service >= sched_share(ns, sc, nthreads))
+			continue;
+		xprt = list_first_entry(&sc->sc_parked, struct svc_xprt,
+					xpt_ready);
+		sched_unlink(ns, sc, xprt);
+		break;
+	}
+	spin_unlock_bh(&ns->ns_lock);
+	if (xprt)
+		nfsd_queue_xprt(xprt);
+}
+
+/* Turn fair share on or off; off releases every parked transport. */
+void
+nfsd_sched_set(struct net *net, bool enabled)
+{
+	struct nfsd_sched *ns = sched(net);
+	struct nfsd_sched_client *sc, *next;
+	struct svc_xprt *xprt, *tmp;
+	LIST_HEAD(release);
+
+	spin_lock_bh(&ns->ns_lock);
+	ns->ns_enabled = enabled;
+	if (!enabled) {
+		list_for_each_entry_safe(sc, next, &ns->ns_waiting,
+					 sc_waiting_link) {
+			list_splice_tail_init(&sc->sc_parked, &release);
+			list_del_init(&sc->sc_waiting_link);
+			sc->sc_nparked = 0;
+		}
+	}
+	spin_unlock_bh(&ns->ns_lock);
+
+	list_for_each_entry_safe(xprt, tmp, &release, xpt_ready) {
+		list_del_init(&xprt->xpt_ready);
+		nfsd_queue_xprt(xprt);
+	}
+}
+
+int
+nfsd_sched_set_weight(struct net *net, struct sockaddr *sap,
+		      unsigned int weight)
+{
+	struct nfsd_sched *ns = sched(net);
+	struct nfsd_sched_client *sc;
+	int err = 0;
+
+	if (!weight || weight > NFSD_SCHED_MAX_WEIGHT)
+		return -EINVAL;
+	if (!sched_hash(sap))
+		return -EAFNOSUPPORT;
+	spin_lock_bh(&ns->ns_lock);
+	sc = sched_client(ns, sap);
+	if (sc == &ns->ns_clients[0])
+		err = -ENOSPC;
+	else {
+		if (sc->sc_active)
+			ns->ns_active_weight += weight - sc->sc_weight;
+		sc->sc_weight = weight;
+	}
+	spin_unlock_bh(&ns->ns_lock);
+	return err;
+}
+
+/*
+ * Format the mode and totals into @buf for the fair_share_ctl control
+ * file.
+ */
+int
+nfsd_sched_show(struct net *net, char *buf, int size)
+{
+	struct nfsd_sched *ns = sched(net);
+	unsigned long served = 0, deferred = 0;
+	unsigned int active = 0, waiting = 0, weight, i;
+	struct nfsd_sched_client *sc;
+	bool enabled;
+
+	spin_lock_bh(&ns->ns_lock);
+	enabled = ns->ns_enabled;
+	weight = ns->ns_active_weight;
+	for (i = 0; i < NFSD_SCHED_CLIENTS; i++) {
+		sc = &ns->ns_clients[i];
+		served += sc->sc_served;
+		deferred += sc->sc_deferred;
+		active += sc->sc_active;
+		waiting += sc->sc_nparked != 0;
+	}
+	spin_unlock_bh(&ns->ns_lock);
+
+	return scnprintf(buf, size, "enabled %d\nactive %u\nactive_weight %u\n"
+			 "waiting %u\nserved %lu\ndeferred %lu\n", enabled,
+			 active, weight, waiting, served, deferred);
+}
+
+/*
+ * The "fair_share" file: one line per client seen, with its weight and
+ * what it has now and has had.  m->private is the net.
+ */
+int
+nfsd_sched_seq_show(struct seq_file *m, void *v)
+{
+	struct nfsd_sched *ns = sched(m->private);
+	struct nfsd_sched_client *copy, *sc;
+	char addr[INET6_ADDRSTRLEN];
+	unsigned int i, n = 0;
+
+	copy = kmalloc_array(NFSD_SCHED_CLIENTS, sizeof(*copy), GFP_KERNEL);
+	if (!copy)
+		return -ENOMEM;
+	spin_lock_bh(&ns->ns_lock);
+	for (i = 0; i < NFSD_SCHED_CLIENTS; i++) {
+		sc = &ns->ns_clients[i];
+		if (i && sc->sc_addr.ss_family == AF_UNSPEC)
+			continue;
+		if (!i && !sc->sc_served && !sc->sc_deferred)
+			continue;
+		copy[n++] = *sc;
+	}
+	spin_unlock_bh(&ns->ns_lock);
+
+	seq_printf(m, "%-40s %6s %6s %6s %6s %12s %12s\n", "client", "weight",
+		   "active", "busy", "parked", "served", "deferred");
+	for (i = 0; i < n; i++) {
+		sc = &copy[i];
+		if (sc->sc_addr.ss_family == AF_UNSPEC)
+			strlcpy(addr, "(other)", sizeof(addr));
+		else
+			snprintf(addr, sizeof(addr), "%pISc", &sc->sc_addr);
+		seq_printf(m, "%-40s %6u %6d %6u %6u %12lu %12lu\n", addr,
+			   sc->sc_weight, sc->sc_active, sc->sc_in_service,
+			   sc->sc_nparked, sc->sc_served, sc->sc_deferred);
+	}
+	kfree(copy);
+	return 0;
+}
+
+int
+nfsd_sched_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_sched *ns;
+	unsigned int i;
+
+	ns = vzalloc(sizeof(*ns));
+	if (!ns)
+		return -ENOMEM;
+	spin_lock_init(&ns->ns_lock);
+	INIT_LIST_HEAD(&ns->ns_active);
+	INIT_LIST_HEAD(&ns->ns_waiting);
+	for (i = 0; i < NFSD_SCHED_CLIENTS; i++) {
+		struct nfsd_sched_client *sc = &ns->ns_clients[i];
+
+		sc->sc_weight = 1;
+		INIT_LIST_HEAD(&sc->sc_active_link);
+		INIT_LIST_HEAD(&sc->sc_waiting_link);
+		INIT_LIST_HEAD(&sc->sc_parked);
+	}
+	nn->sched = ns;
+	return 0;
+}
+
+void
+nfsd_sched_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_sched *ns = nn->sched;
+
+	if (!ns)
+		return;
+	nn->sched = NULL;
+	vfree(ns);
+}
@@ -0,0 +1,35 @@
+/*
+ * Fair-share scheduling across clients.
+ *
+ * When enabled, a client that has more than its weighted share of the
+ * threads busy has its connections held back, and the threads that
+ * become free serve the waiting clients in turn.
+ */
+
+#ifndef LINUX_NFSD_SCHED_H
+#define LINUX_NFSD_SCHED_H
+
+struct net;
+struct sockaddr;
+struct svc_rqst;
+struct svc_xprt;
+struct seq_file;
+
+/* largest weight a client can be given; the default is 1 */
+#define NFSD_SCHED_MAX_WEIGHT	1000
+
+int	nfsd_sched_init(struct net *);
+void	nfsd_sched_shutdown(struct net *);
+bool	nfsd_sched_enabled(struct net *);
+bool	nfsd_sched_admit(struct svc_xprt *);
+void	nfsd_sched_unpark(struct svc_xprt *);
+void	nfsd_sched_begin(struct svc_rqst *);
+void	nfsd_sched_end(struct svc_rqst *);
+void	nfsd_sched_idle(struct svc_rqst *);
+void	nfsd_sched_set(struct net *, bool);
+int	nfsd_sched_set_weight(struct net *, struct sockaddr *,
+			      unsigned int weight);
+int	nfsd_sched_show(struct net *, char *, int);
+int	nfsd_sched_seq_show(struct seq_file *, void *);
+
+#endif /* LINUX_NFSD_SCHED_H */
@@ -0,0 +1,262 @@
+/*
+ * Slow operation log.
+ *
+ * Aggregate stage times (stats.c) hide the outliers: a REMOVE that
+ * waited two seconds for the journal, a GETATTR stuck behind an export
+ * upcall.  When a request has spent longer than the threshold in
+ * nfsd_dispatch(), it is copied into a small ring that keeps the most
+ * recent such requests: when it finished, how long it took, the client,
+ * its arguments as the capture log describes them (see capture.c), and
+ * its cycles per stage.  The stage that took longest of those where a
+ * request can block (export lookup, the VFS, commits, ...) is reported
+ * as what it waited on.
+ *
+ * Requests that leave nfsd_dispatch() without an NFS reply are logged
+ * too: those dropped or put off (lanes, throttle, export upcalls) with
+ * the status nfserr_dropit (30000), those whose arguments could not be
+ * decoded as NFS3ERR_INVAL and those whose reply could not be encoded
+ * as NFS3ERR_SERVERFAULT.  A request that is put off and revisited is
+ * timed each time it goes through nfsd_dispatch().
+ *
+ * The fast path only compares against the threshold; the ring lock
+ * is taken for requests that are over the threshold, and by readers.
+ */
+
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+#include <linux/in.h>
+
+#include "nfsd.h"
+#include "xdr.h"
+#include "netns.h"
+#include "capture.h"
+#include "stats.h"
+#include "slowops.h"
+
+#define NFSD_SLOWOPS_ENTRIES	128
+#define NFSD_SLOWOPS_NAMELEN	64
+#define NFSD_SLOWOPS_DEFAULT_MS	1000
+
+struct nfsd_slowop {
+	u64			so_when;	/* wall clock at the end, in ns */
+	u64			so_ns;		/* time in nfsd_dispatch() */
+	struct nfsd_capture_rec	so_rec;
+	u8			so_fh[NFSD_CAPTURE_FHSIZE];
+	char			so_name[NFSD_SLOWOPS_NAMELEN];
+	u64			so_cycles[NFSD_NR_STAGES];
+};
+
+struct nfsd_slowops {
+	spinlock_t		sl_lock;	/* the ring and sl_head */
+	u64			sl_threshold;	/* in ns, 0 when off */
+	struct nfsd_slowop	*sl_ring;
+	unsigned long		sl_head;	/* requests logged so far */
+};
+
+/* the stages a request can spend a long time blocked in */
+static const int nfsd_slowops_wait_stages[] = {
+	NFSD_STAGE_AUTH, NFSD_STAGE_FH_VERIFY, NFSD_STAGE_SETUSER,
+	NFSD_STAGE_VFS, NFSD_STAGE_COMMIT, NFSD_STAGE_GETATTR,
+};
+
+static struct nfsd_slowops *slowops(struct svc_rqst *rqstp)
+{
+	struct nfsd_net *nn = net_generic(SVC_NET(rqstp), nfsd_net_id);
+
+	return nn->slowops;
+}
+
+/*
+ * Called when nfsd_dispatch() is done with @rqstp, with the time that
+ * took; logs the request if that is over the threshold.
+ */
+void
+nfsd_slowops_check(struct svc_rqst *rqstp, u64 elapsed, __be32 nfserr)
+{
+	struct nfsd_slowops *sl = slowops(rqstp);
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct knfsd_fh *fh, *resfh;
+	struct nfsd_slowop *so;
+	const char *name;
+	u64 threshold;
+
+	if (!sl)
+		return;
+	threshold = READ_ONCE(sl->sl_threshold);
+	if (!threshold || elapsed < threshold)
+		return;
+
+	spin_lock(&sl->sl_lock);
+	so = &sl->sl_ring[sl->sl_head % NFSD_SLOWOPS_ENTRIES];
+	so->so_when = ktime_get_real_ns();
+	so->so_ns = elapsed;
+	nfsd_capture_describe(rqstp, nfserr, &so->so_rec, &fh, &resfh, &name);
+	so->so_rec.cr_fhlen = 0;
+	if (fh) {
+		so->so_rec.cr_fhlen = min_t(unsigned int, fh->fh_size,
+					    NFSD_CAPTURE_FHSIZE);
+		memcpy(so->so_fh, &fh->fh_base, so->so_rec.cr_fhlen);
+	}
+	so->so_rec.cr_namelen = min_t(unsigned int, so->so_rec.cr_namelen,
+				      NFSD_SLOWOPS_NAMELEN);
+	if (name)
+		memcpy(so->so_name, name, so->so_rec.cr_namelen);
+	memcpy(so->so_cycles, ctx->tc_stage_cycles, sizeof(so->so_cycles));
+	sl->sl_head++;
+	spin_unlock(&sl->sl_lock);
+}
+
+static void slowop_show_one(struct seq_file *m, struct nfsd_slowop *so)
+{
+	struct nfsd_capture_rec *rec = &so->so_rec;
+	u32 usec;
+	u64 secs;
+	int i, s, wait;
+
+	wait = nfsd_slowops_wait_stages[0];
+	for (i = 1; i < ARRAY_SIZE(nfsd_slowops_wait_stages); i++) {
+		s = nfsd_slowops_wait_stages[i];
+		if (so->so_cycles[s] > so->so_cycles[wait])
+			wait = s;
+	}
+
+	secs = div_u64_rem(so->so_when, NSEC_PER_SEC, &usec);
+	usec /= NSEC_PER_USEC;
+	seq_printf(m, "%llu.%06u %s xid %08x client ",
+		   (unsigned long long)secs, usec,
+		   rec->cr_proc < NFSD3_NPROCS ?
+			nfsd3_procname[rec->cr_proc] : "?",
+		   rec->cr_xid);
+	if (rec->cr_family == AF_INET)
+		seq_printf(m, "%pI4", rec->cr_addr);
+	else
+		seq_printf(m, "%pI6c", rec->cr_addr);
+	seq_printf(m, " status %u usecs %llu waited %s fh %*phN",
+		   rec->cr_status,
+		   (unsigned long long)div_u64(so->so_ns, NSEC_PER_USEC),
+		   nfsd_stage_name[wait], rec->cr_fhlen, so->so_fh);
+	if (rec->cr_namelen)
+		seq_printf(m, " name %.*s", rec->cr_namelen, so->so_name);
+	if (rec->cr_count)
+		seq_printf(m, " offset %llu count %u",
+			   (unsigned long long)rec->cr_offset, rec->cr_count);
+	seq_puts(m, "\n\tcycles");
+	for (s = 0; s < NFSD_NR_STAGES; s++)
+		seq_printf(m, " %s %llu", nfsd_stage_name[s],
+			   (unsigned long long)so->so_cycles[s]);
+	seq_putc(m, '\n');
+}
+
+/*
+ * The "slowops" file: the logged requests, oldest first, two lines
+ * each.  m->private is the net.
+ */
+int
+nfsd_slowops_seq_show(struct seq_file *m, void *v)
+{
+	struct nfsd_net *nn = net_generic(m->private, nfsd_net_id);
+	struct nfsd_slowops *sl = nn->slowops;
+	struct nfsd_slowop *so;
+	unsigned long i, head;
+
+	so = kmalloc(sizeof(*so), GFP_KERNEL);
+	if (!so)
+		return -ENOMEM;
+
+	spin_lock(&sl->sl_lock);
+	head = sl->sl_head;
+	spin_unlock(&sl->sl_lock);
+
+	i = head > NFSD_SLOWOPS_ENTRIES ? head - NFSD_SLOWOPS_ENTRIES : 0;
+	for (; i < head; i++) {
+		spin_lock(&sl->sl_lock);
+		/* overwritten while we were printing the earlier ones */
+		if (sl->sl_head - i > NFSD_SLOWOPS_ENTRIES) {
+			spin_unlock(&sl->sl_lock);
+			continue;
+		}
+		*so = sl->sl_ring[i % NFSD_SLOWOPS_ENTRIES];
+		spin_unlock(&sl->sl_lock);
+		slowop_show_one(m, so);
+	}
+	kfree(so);
+	return 0;
+}
+
+int
+nfsd_slowops_set_threshold(struct net *net, unsigned int msecs)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+
+	if (msecs > 3600 * MSEC_PER_SEC)
+		return -EINVAL;
+	WRITE_ONCE(nn->slowops->sl_threshold, (u64)msecs * NSEC_PER_MSEC);
+	return 0;
+}
+
+void
+nfsd_slowops_clear(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_slowops *sl = nn->slowops;
+
+	spin_lock(&sl->sl_lock);
+	sl->sl_head = 0;
+	spin_unlock(&sl->sl_lock);
+}
+
+/*
+ * Format the settings into @buf for the slowops_ctl control file.
+ */
+int
+nfsd_slowops_show(struct net *net, char *buf, int size)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_slowops *sl = nn->slowops;
+	unsigned long logged;
+
+	spin_lock(&sl->sl_lock);
+	logged = sl->sl_head;
+	spin_unlock(&sl->sl_lock);
+
+	return scnprintf(buf, size, "threshold_ms %llu\nlogged %lu\n"
+			 "entries %d\n",
+			 (unsigned long long)div_u64(READ_ONCE(sl->sl_threshold),
+						     NSEC_PER_MSEC),
+			 logged, NFSD_SLOWOPS_ENTRIES);
+}
+
+int
+nfsd_slowops_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_slowops *sl;
+
+	sl = kzalloc(sizeof(*sl), GFP_KERNEL);
+	if (!sl)
+		return -ENOMEM;
+	sl->sl_ring = vzalloc(NFSD_SLOWOPS_ENTRIES * sizeof(struct nfsd_slowop));
+	if (!sl->sl_ring) {
+		kfree(sl);
+		return -ENOMEM;
+	}
+	spin_lock_init(&sl->sl_lock);
+	sl->sl_threshold = (u64)NFSD_SLOWOPS_DEFAULT_MS * NSEC_PER_MSEC;
+	nn->slowops = sl;
+	return 0;
+}
+
+void
+nfsd_slowops_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_slowops *sl = nn->slowops;
+
+	if (!sl)
+		return;
+	nn->slowops = NULL;
+	vfree(sl->sl_ring);
+	kfree(sl);
+}
@@ -0,0 +1,24 @@
+/*
+ * Slow operation log.
+ *
+ * Requests that spend longer than a threshold in nfsd_dispatch() are
+ * kept, with their arguments and stage times, in a small per-net ring
+ * that is read from the "slowops" file.
+ */
+
+#ifndef LINUX_NFSD_SLOWOPS_H
+#define LINUX_NFSD_SLOWOPS_H
+
+struct net;
+struct svc_rqst;
+struct seq_file;
+
+int	nfsd_slowops_init(struct net *);
+void	nfsd_slowops_shutdown(struct net *);
+void	nfsd_slowops_check(struct svc_rqst *, u64 elapsed_ns, __be32 nfserr);
+int	nfsd_slowops_set_threshold(struct net *, unsigned int msecs);
+void	nfsd_slowops_clear(struct net *);
+int	nfsd_slowops_show(struct net *, char *, int);
+int	nfsd_slowops_seq_show(struct seq_file *, void *);
+
+#endif /* LINUX_NFSD_SLOWOPS_H */
@@ -0,0 +1,169 @@
+/*
+ * Binary statistics page.
+ *
+ * A monitoring agent that polls every second should not have to parse
+ * text.  Once per NFSD_STATPAGE_PERIOD_MS a work item sums the per-cpu
+ * counters of the other modules into a scratch copy of struct
+ * nfsd_statpage (statpage.h), and then copies that into a vmalloc'd
+ * page, between two increments of sp_seq.  The page is mapped read-only
+ * into the processes that mmap the "stats_page" file, which then read it
+ * without any system call; read() returns a consistent copy for those
+ * that prefer it.
+ *
+ * The counters are as fresh as the last update, which is what a scraper
+ * polling at the same period sees anyway, and the request path pays
+ * nothing for the page.
+ */
+
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/workqueue.h>
+
+#include "nfsd.h"
+#include "netns.h"
+#include "nfsfh.h"
+#include "export.h"
+#include "negcache.h"
+#include "stats.h"
+#include "inflight.h"
+#include "statpage.h"
+
+struct nfsd_statpage_ctl {
+	struct nfsd_statpage	*sc_page;	/* what userspace maps */
+	struct nfsd_statpage	*sc_scratch;	/* the next update */
+	struct delayed_work	sc_work;
+	struct net		*sc_net;
+};
+
+/* the part of the page after sp_seq, which changes with each update */
+#define STATPAGE_BODY	offsetof(struct nfsd_statpage, sp_time)
+
+static void nfsd_statpage_update(struct work_struct *work)
+{
+	struct nfsd_statpage_ctl *sc = container_of(to_delayed_work(work),
+						    struct nfsd_statpage_ctl,
+						    sc_work);
+	struct nfsd_statpage *sp = sc->sc_scratch, *page = sc->sc_page;
+	struct net *net = sc->sc_net;
+	u32 seq;
+
+	memset(sp, 0, sizeof(*sp));
+	nfsd_inflight_statpage(net, sp);
+	nfsd_stats_statpage(net, sp);
+	nfsd_negcache_statpage(net, sp);
+	fh_cache_statpage(sp);
+	nfsd_export_statpage(net, sp);
+	sp->sp_time = ktime_get_real_ns();
+	sp->sp_updates = page->sp_updates + 1;
+
+	/* the only writer, so a plain increment is enough */
+	seq = page->sp_seq;
+	WRITE_ONCE(page->sp_seq, seq + 1);
+	smp_wmb();
+	memcpy((char *)page + STATPAGE_BODY, (char *)sp + STATPAGE_BODY,
+	       sizeof(*sp) - STATPAGE_BODY);
+	smp_wmb();
+	WRITE_ONCE(page->sp_seq, seq + 2);
+
+	schedule_delayed_work(&sc->sc_work,
+			      msecs_to_jiffies(NFSD_STATPAGE_PERIOD_MS));
+}
+
+static struct nfsd_statpage_ctl *statpage_ctl(struct file *file)
+{
+	struct nfsd_net *nn = net_generic(file_inode(file)->i_sb->s_fs_info,
+					  nfsd_net_id);
+
+	return nn->statpage;
+}
+
+/*
+ * mmap() for the "stats_page" file.  The mapping is read-only: the
+ * page is shared by every reader.
+ */
+int
+nfsd_statpage_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct nfsd_statpage_ctl *sc = statpage_ctl(file);
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return remap_vmalloc_range(vma, sc->sc_page, vma->vm_pgoff);
+}
+
+/*
+ * read() for the "stats_page" file: a copy of the page, taken with the
+ * same protocol userspace uses on the mapping.
+ */
+ssize_t
+nfsd_statpage_read(struct file *file, char __user *buf, size_t size,
+		   loff_t *pos)
+{
+	struct nfsd_statpage_ctl *sc = statpage_ctl(file);
+	struct nfsd_statpage *page = sc->sc_page, *copy;
+	ssize_t rv;
+	u32 seq;
+
+	copy = kmalloc(sizeof(*copy), GFP_KERNEL);
+	if (!copy)
+		return -ENOMEM;
+	for (;;) {
+		seq = READ_ONCE(page->sp_seq);
+		smp_rmb();
+		memcpy(copy, page, sizeof(*copy));
+		smp_rmb();
+		if (!(seq & 1) && seq == READ_ONCE(page->sp_seq))
+			break;
+		cond_resched();
+	}
+	rv = simple_read_from_buffer(buf, size, pos, copy, sizeof(*copy));
+	kfree(copy);
+	return rv;
+}
+
+int
+nfsd_statpage_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_statpage_ctl *sc;
+
+	sc = kzalloc(sizeof(*sc), GFP_KERNEL);
+	if (!sc)
+		return -ENOMEM;
+	/* zeroed, and set up to be mapped into userspace */
+	sc->sc_page = vmalloc_user(sizeof(struct nfsd_statpage));
+	sc->sc_scratch = kmalloc(sizeof(struct nfsd_statpage), GFP_KERNEL);
+	if (!sc->sc_page || !sc->sc_scratch) {
+		vfree(sc->sc_page);
+		kfree(sc->sc_scratch);
+		kfree(sc);
+		return -ENOMEM;
+	}
+	sc->sc_page->sp_magic = NFSD_STATPAGE_MAGIC;
+	sc->sc_page->sp_version = NFSD_STATPAGE_VERSION;
+	sc->sc_page->sp_size = sizeof(struct nfsd_statpage);
+	sc->sc_net = net;
+	INIT_DELAYED_WORK(&sc->sc_work, nfsd_statpage_update);
+	nn->statpage = sc;
+	schedule_delayed_work(&sc->sc_work, 0);
+	return 0;
+}
+
+void
+nfsd_statpage_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_statpage_ctl *sc = nn->statpage;
+
+	if (!sc)
+		return;
+	cancel_delayed_work_sync(&sc->sc_work);
+	nn->statpage = NULL;
+	/* mappings hold their own references to the pages */
+	vfree(sc->sc_page);
+	kfree(sc->sc_scratch);
+	kfree(sc);
+}
@@ -0,0 +1,79 @@
+/*
+ * Binary statistics page.
+ *
+ * The counters behind the text control files are also published, once
+ * per NFSD_STATPAGE_PERIOD_MS, in a fixed-layout structure that userspace
+ * maps from the "stats_page" file, so a monitoring agent can read them
+ * without a system call per scrape.  The layout is shared with userspace
+ * (see tools/loadgen/nfsstat.c), so it only uses fixed-width types.
+ *
+ * sp_seq is odd while the page is being updated.  A reader loads it,
+ * retries while it is odd, copies what it needs, and retries if sp_seq
+ * has changed by then, with read barriers after the first load and
+ * before the second.
+ *
+ * New fields are only added at the end, which sp_size tells; sp_version
+ * changes only if an existing field changes meaning.
+ */
+
+#ifndef LINUX_NFSD_STATPAGE_H
+#define LINUX_NFSD_STATPAGE_H
+
+#include <linux/types.h>
+
+#define NFSD_STATPAGE_MAGIC	0x6e667364	/* "nfsd" */
+#define NFSD_STATPAGE_VERSION	1
+#define NFSD_STATPAGE_PERIOD_MS	1000
+#define NFSD_STATPAGE_NPROCS	22		/* NFSv3 NULL to COMMIT */
+#define NFSD_STATPAGE_NSTAGES	11		/* NFSD_STAGE_* */
+#define NFSD_STATPAGE_NBUCKETS	20
+
+struct nfsd_statpage_cache {
+	__u64	hits;
+	__u64	misses;
+	__u64	inserts;
+	__u64	evictions;	/* stale or purged entries */
+};
+
+struct nfsd_statpage {
+	__u32	sp_magic;	/* NFSD_STATPAGE_MAGIC */
+	__u32	sp_version;	/* NFSD_STATPAGE_VERSION */
+	__u32	sp_size;	/* of this structure */
+	__u32	sp_seq;		/* odd while being updated */
+	__u64	sp_time;	/* of the last update, ns since the epoch */
+	__u64	sp_updates;
+
+	/* nfsd threads in this net, and how many are working on a request */
+	__u32	sp_threads;
+	__u32	sp_busy;
+
+	/* per NFSv3 procedure */
+	__u64	sp_ops[NFSD_STATPAGE_NPROCS];
+	__u64	sp_errors[NFSD_STATPAGE_NPROCS];
+	/* cycles spent in each stage, see the stage_stats file */
+	__u64	sp_cycles[NFSD_STATPAGE_NPROCS][NFSD_STATPAGE_NSTAGES];
+	/*
+	 * Time in nfsd_dispatch(): bucket 0 counts calls under 1us, bucket
+	 * i those under 2^i us, and the last one everything slower.
+	 */
+	__u64	sp_latency[NFSD_STATPAGE_NPROCS][NFSD_STATPAGE_NBUCKETS];
+
+	struct nfsd_statpage_cache sp_negcache;	/* negative LOOKUP cache */
+	struct nfsd_statpage_cache sp_fhcache;	/* encoded handle cache */
+	struct nfsd_statpage_cache sp_expkey;	/* expkey index */
+	struct nfsd_statpage_cache sp_export;	/* export index */
+	struct nfsd_statpage_cache sp_exp_memo;	/* per-thread export memo */
+};
+
+#ifdef __KERNEL__
+struct net;
+struct file;
+struct vm_area_struct;
+
+int	nfsd_statpage_init(struct net *);
+void	nfsd_statpage_shutdown(struct net *);
+int	nfsd_statpage_mmap(struct file *, struct vm_area_struct *);
+ssize_t	nfsd_statpage_read(struct file *, char __user *, size_t, loff_t *);
+#endif /* __KERNEL__ */
+
+#endif /* LINUX_NFSD_STATPAGE_H */
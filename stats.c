@@ -0,0 +1,206 @@
+/*
+ * Per-stage request timing.
+ *
+ * The cycle counter is read at every stage switch, and the result is
+ * added to per-cpu counters indexed by procedure and stage once the
+ * reply has been sent, so the cost is a few get_cycles() calls and
+ * additions per request, without any shared cache line.
+ *
+ * Only the time between svc_recv() returning and svc_process() returning
+ * is visible here; time a request spent queued on its transport before
+ * a thread picked it up is not.  The NFSD_STAGE_RPC counter covers
+ * RPC header processing and whatever else svc_process() does outside
+ * of the other stages.
+ */
+
+#include <linux/percpu.h>
+#include <linux/math64.h>
+
+#include "nfsd.h"
+#include "netns.h"
+#include "stats.h"
+#include "statpage.h"
+
+struct nfsd_stage_stats {
+	u64		ops[NFSD3_NPROCS];
+	u64		cycles[NFSD3_NPROCS][NFSD_NR_STAGES];
+	u64		errors[NFSD3_NPROCS];
+	u64		latency[NFSD3_NPROCS][NFSD_LAT_BUCKETS];
+};
+
+const char *const nfsd3_procname[NFSD3_NPROCS] = {
+	"null", "getattr", "setattr", "lookup", "access", "readlink",
+	"read", "write", "create", "mkdir", "symlink", "mknod", "remove",
+	"rmdir", "rename", "link", "readdir", "readdirplus", "fsstat",
+	"fsinfo", "pathconf", "commit",
+};
+
+const char *const nfsd_stage_name[NFSD_NR_STAGES] = {
+	[NFSD_STAGE_RPC]	= "rpc",
+	[NFSD_STAGE_AUTH]	= "auth",
+	[NFSD_STAGE_DECODE]	= "decode",
+	[NFSD_STAGE_FH_VERIFY]	= "fh_verify",
+	[NFSD_STAGE_SETUSER]	= "setuser",
+	[NFSD_STAGE_PROC]	= "proc",
+	[NFSD_STAGE_VFS]	= "vfs",
+	[NFSD_STAGE_COMMIT]	= "commit",
+	[NFSD_STAGE_GETATTR]	= "getattr",
+	[NFSD_STAGE_ENCODE]	= "encode",
+	[NFSD_STAGE_SEND]	= "send",
+};
+
+/*
+ * Add the stage counters of the request @rqstp has just finished to
+ * the totals of its procedure.
+ */
+void
+nfsd_stage_account(struct net *net, struct svc_rqst *rqstp)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_stage_stats *st;
+	int s;
+
+	if (!nn->stage_stats || rqstp->rq_prog != NFS_PROGRAM ||
+	    rqstp->rq_vers != 3 || rqstp->rq_proc >= NFSD3_NPROCS)
+		return;
+
+	st = get_cpu_ptr(nn->stage_stats);
+	st->ops[rqstp->rq_proc]++;
+	for (s = 0; s < NFSD_NR_STAGES; s++)
+		st->cycles[rqstp->rq_proc][s] += ctx->tc_stage_cycles[s];
+	put_cpu_ptr(nn->stage_stats);
+}
+
+/*
+ * Called by nfsd_dispatch() once the reply has been encoded, with the
+ * time that took, to count errors and fill in the latency histogram.
+ */
+void
+nfsd_stats_reply(struct svc_rqst *rqstp, u64 elapsed_ns, __be32 nfserr)
+{
+	struct nfsd_net *nn = net_generic(SVC_NET(rqstp), nfsd_net_id);
+	struct nfsd_stage_stats *st;
+	u32 proc = rqstp->rq_proc;
+	int bucket;
+
+	if (!nn->stage_stats || rqstp->rq_prog != NFS_PROGRAM ||
+	    rqstp->rq_vers != 3 || proc >= NFSD3_NPROCS)
+		return;
+
+	bucket = min(fls64(div_u64(elapsed_ns, NSEC_PER_USEC)),
+		     NFSD_LAT_BUCKETS - 1);
+	st = get_cpu_ptr(nn->stage_stats);
+	st->errors[proc] += nfserr != 0;
+	st->latency[proc][bucket]++;
+	put_cpu_ptr(nn->stage_stats);
+}
+
+/*
+ * Clear the totals.  Requests being accounted on other cpus at the same
+ * time may survive partly, which does not matter for statistics.
+ */
+void
+nfsd_stats_reset(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	int cpu;
+
+	if (!nn->stage_stats)
+		return;
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(nn->stage_stats, cpu), 0,
+		       sizeof(struct nfsd_stage_stats));
+}
+
+/*
+ * Format the totals into @buf for the stage_stats control file: one
+ * line per procedure that has been called, with the number of calls
+ * and the average cycles per call spent in each stage.
+ */
+int
+nfsd_stage_show(struct net *net, char *buf, int size)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	u64 ops, cycles[NFSD_NR_STAGES];
+	int len, cpu, s;
+	u32 proc;
+
+	if (!nn->stage_stats)
+		return -ENODEV;
+
+	len = scnprintf(buf, size, "%-12s %9s", "proc", "ops");
+	for (s = 0; s < NFSD_NR_STAGES; s++)
+		len += scnprintf(buf + len, size - len, " %9s",
+				 nfsd_stage_name[s]);
+	len += scnprintf(buf + len, size - len, "\n");
+
+	for (proc = 0; proc < NFSD3_NPROCS; proc++) {
+		ops = 0;
+		memset(cycles, 0, sizeof(cycles));
+		for_each_possible_cpu(cpu) {
+			struct nfsd_stage_stats *st;
+
+			st = per_cpu_ptr(nn->stage_stats, cpu);
+			ops += st->ops[proc];
+			for (s = 0; s < NFSD_NR_STAGES; s++)
+				cycles[s] += st->cycles[proc][s];
+		}
+		if (!ops)
+			continue;
+		len += scnprintf(buf + len, size - len, "%-12s %9llu",
+				 nfsd3_procname[proc], (unsigned long long)ops);
+		for (s = 0; s < NFSD_NR_STAGES; s++)
+			len += scnprintf(buf + len, size - len, " %9llu",
+				(unsigned long long)div64_u64(cycles[s], ops));
+		len += scnprintf(buf + len, size - len, "\n");
+	}
+	return len;
+}
+
+/* Add the totals to the binary statistics page, see statpage.c. */
+void
+nfsd_stats_statpage(struct net *net, struct nfsd_statpage *sp)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_stage_stats *st;
+	int cpu, proc, i;
+
+	BUILD_BUG_ON(NFSD3_NPROCS != NFSD_STATPAGE_NPROCS);
+	BUILD_BUG_ON(NFSD_NR_STAGES != NFSD_STATPAGE_NSTAGES);
+	BUILD_BUG_ON(NFSD_LAT_BUCKETS != NFSD_STATPAGE_NBUCKETS);
+
+	if (!nn->stage_stats)
+		return;
+	for_each_possible_cpu(cpu) {
+		st = per_cpu_ptr(nn->stage_stats, cpu);
+		for (proc = 0; proc < NFSD3_NPROCS; proc++) {
+			sp->sp_ops[proc] += st->ops[proc];
+			sp->sp_errors[proc] += st->errors[proc];
+			for (i = 0; i < NFSD_NR_STAGES; i++)
+				sp->sp_cycles[proc][i] += st->cycles[proc][i];
+			for (i = 0; i < NFSD_LAT_BUCKETS; i++)
+				sp->sp_latency[proc][i] += st->latency[proc][i];
+		}
+	}
+}
+
+int
+nfsd_stats_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+
+	nn->stage_stats = alloc_percpu(struct nfsd_stage_stats);
+	if (!nn->stage_stats)
+		return -ENOMEM;
+	return 0;
+}
+
+void
+nfsd_stats_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+
+	free_percpu(nn->stage_stats);
+	nn->stage_stats = NULL;
+}
@@ -0,0 +1,70 @@
+/*
+ * Per-stage request timing.
+ *
+ * Each nfsd thread keeps a cycle counter per stage (NFSD_STAGE_*) for
+ * the request it is working on.  Code that enters a stage calls
+ * nfsd_stage_enter(), which charges the time since the last switch to
+ * the stage being left, and nfsd_stage_exit() with the returned value
+ * when it is done, so nested stages are accounted exclusively.  When
+ * the request has been sent, nfsd() adds the counters to the per-cpu
+ * totals of the procedure.
+ */
+
+#ifndef LINUX_NFSD_STATS_H
+#define LINUX_NFSD_STATS_H
+
+#include <linux/timex.h>
+#include "nfsd.h"
+#include "xdr.h"
+
+static inline int nfsd_stage_enter(struct svc_rqst *rqstp, int stage)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	cycles_t now = get_cycles();
+	int prev = ctx->tc_stage;
+
+	ctx->tc_stage_cycles[prev] += now - ctx->tc_stage_mark;
+	ctx->tc_stage_mark = now;
+	ctx->tc_stage = stage;
+	return prev;
+}
+
+static inline void nfsd_stage_exit(struct svc_rqst *rqstp, int prev)
+{
+	nfsd_stage_enter(rqstp, prev);
+}
+
+/* start timing a new request, in NFSD_STAGE_RPC */
+static inline void nfsd_stage_begin(struct svc_rqst *rqstp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+
+	memset(ctx->tc_stage_cycles, 0, sizeof(ctx->tc_stage_cycles));
+	ctx->tc_stage = NFSD_STAGE_RPC;
+	ctx->tc_stage_mark = get_cycles();
+}
+
+/* charge the time since the last switch; the counters are then final */
+static inline void nfsd_stage_end(struct svc_rqst *rqstp)
+{
+	nfsd_stage_enter(rqstp, NFSD_STAGE_RPC);
+}
+
+#define NFSD3_NPROCS		(NFS3PROC_COMMIT + 1)
+/* log2 buckets of microseconds in nfsd_dispatch() */
+#define NFSD_LAT_BUCKETS	20
+
+struct nfsd_statpage;
+
+extern const char *const nfsd3_procname[NFSD3_NPROCS];
+extern const char *const nfsd_stage_name[NFSD_NR_STAGES];
+
+int	nfsd_stats_init(struct net *);
+void	nfsd_stats_shutdown(struct net *);
+void	nfsd_stats_reset(struct net *);
+void	nfsd_stage_account(struct net *, struct svc_rqst *);
+void	nfsd_stats_reply(struct svc_rqst *, u64 elapsed_ns, __be32 nfserr);
+int	nfsd_stage_show(struct net *, char *, int);
+void	nfsd_stats_statpage(struct net *, struct nfsd_statpage *);
+
+#endif /* LINUX_NFSD_STATS_H */
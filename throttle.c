@@ -0,0 +1,541 @@
+/*
+ * Per-client and per-export rate limits.
+ *
+ * On a server shared by several tenants one of them running a backup
+ * can take all of the disks and the network.  A rule limits the calls
+ * and the bytes per second of one client, named by its auth domain as
+ * in the "clients" file, or of one export, named by its path; a request
+ * is charged to every rule that matches its client or the export of
+ * its first file handle.  All NFSv3 procedures are calls, and READ and
+ * WRITE are charged the bytes they ask for as well.
+ *
+ * Each limit is a token bucket that fills at the given rate and holds
+ * one second's worth.  A request is charged when fh_verify() finds its
+ * first export, before the file is looked up, and always takes its
+ * tokens, so that a bucket may go into debt.  If a bucket it is charged
+ * to was in debt already, the request has to wait until the debt has
+ * been paid off, that is for as long as the requests before it were
+ * over the rate.
+ *
+ * Waiting requests are put off the way a request waiting for an export
+ * upcall is: svc_defer() takes a copy, the thread drops the request
+ * and goes on with other work, and a work item revisits the copy when
+ * its time has come.  It then runs without being charged again; other
+ * requests come back from svc_defer() too (lanes.c, export upcalls), so
+ * the copy is marked as charged (nfsd_defer_mark()), which stays with
+ * the request if it is put off again.
+ * svc_defer() does not copy requests whose arguments came in pages,
+ * which most WRITEs do, and no more than NFSD_THROTTLE_MAX_WAITING
+ * requests are put off at a time; other requests wait in their thread
+ * instead, for NFSD_THROTTLE_MAX_SLEEP at most.  No request is dropped.
+ *
+ * Rules are looked up under RCU; they are added and removed under a
+ * mutex, from the throttle_ctl file.  With no rules a request costs a
+ * single read.
+ */
+
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/namei.h>
+#include <linux/path.h>
+#include <linux/workqueue.h>
+#include <linux/math64.h>
+#include <linux/seq_file.h>
+#include <linux/sunrpc/svc.h>
+#include <linux/sunrpc/svcauth.h>
+#include <linux/sunrpc/cache.h>
+
+#include "nfsd.h"
+#include "xdr.h"
+#include "netns.h"
+#include "export.h"
+#include "traffic.h"
+#include "throttle.h"
+
+#define NFSD_THROTTLE_RULES		32
+#define NFSD_THROTTLE_NAMELEN		64
+/* per second; keeps the arithmetic below within 64 bits */
+#define NFSD_THROTTLE_MAX_RATE		(1ULL << 36)
+/* the most debt a bucket runs up, in seconds of its rate */
+#define NFSD_THROTTLE_MAX_DEBT		16
+#define NFSD_THROTTLE_MAX_WAITING	1024
+#define NFSD_THROTTLE_MAX_SLEEP		HZ
+
+enum {
+	NFSD_THROTTLE_OPS = 0,
+	NFSD_THROTTLE_BYTES,
+	NFSD_THROTTLE_NR
+};
+
+enum {
+	NFSD_THROTTLE_CLIENT = 1,
+	NFSD_THROTTLE_EXPORT,
+};
+
+static const char *throttle_kinds[] = {
+	[NFSD_THROTTLE_CLIENT] = "client",
+	[NFSD_THROTTLE_EXPORT] = "export",
+};
+
+struct nfsd_throttle_rule {
+	int			tr_kind;
+	char			tr_name[NFSD_THROTTLE_NAMELEN];
+	struct path		tr_path;	/* exports */
+	spinlock_t		tr_lock;
+	u64			tr_rate[NFSD_THROTTLE_NR];	/* 0 for none */
+	s64			tr_tokens[NFSD_THROTTLE_NR];	/* millionths */
+	u64			tr_last;	/* ns, when last filled */
+	unsigned long		tr_admitted;
+	unsigned long		tr_throttled;
+};
+
+struct nfsd_throttle_wait {
+	struct list_head		tw_link;
+	struct cache_deferred_req	*tw_dreq;
+	u64				tw_ready;	/* ns */
+};
+
+struct nfsd_throttle_stats {
+	unsigned long		deferred;
+	unsigned long		slept;
+};
+
+struct nfsd_throttle {
+	struct mutex			nt_mutex;	/* changing rules */
+	unsigned int			nt_nrules;
+	struct nfsd_throttle_rule __rcu	*nt_rules[NFSD_THROTTLE_RULES];
+	spinlock_t			nt_lock;	/* nt_waiting */
+	struct list_head		nt_waiting;
+	unsigned int			nt_nwaiting;
+	u64				nt_next;	/* ns, nt_work due */
+	struct delayed_work		nt_work;
+	struct nfsd_throttle_stats __percpu *nt_stats;
+};
+
+static struct nfsd_throttle *throttle(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+
+	return nn->throttle;
+}
+
+static u64 throttle_bytes(struct svc_rqst *rqstp)
+{
+	if (rqstp->rq_prog != NFS_PROGRAM || rqstp->rq_vers != 3)
+		return 0;
+	switch (rqstp->rq_proc) {
+	case NFS3PROC_READ:
+		return ((struct nfsd3_readargs *)rqstp->rq_argp)->count;
+	case NFS3PROC_WRITE:
+		return ((struct nfsd3_writeargs *)rqstp->rq_argp)->count;
+	}
+	return 0;
+}
+
+static bool throttle_match(struct nfsd_throttle_rule *tr,
+			   struct auth_domain *dom, struct svc_export *exp)
+{
+	if (tr->tr_kind == NFSD_THROTTLE_EXPORT)
+		return path_equal(&tr->tr_path, &exp->ex_path);
+	return dom && !strcmp(tr->tr_name, dom->name);
+}
+
+/*
+ * Fill the buckets of @tr for the time since they were last filled,
+ * then charge them @cost.  Returns how long, in ns, the request has to
+ * wait for the debt the buckets were in before.  Called with tr_lock
+ * held.
+ */
+static u64 throttle_charge(struct nfsd_throttle_rule *tr, u64 now,
+			   const u64 *cost)
+{
+	u64 elapsed, rate, wait = 0;
+	s64 burst, tokens;
+	int i;
+
+	elapsed = now > tr->tr_last ? now - tr->tr_last : 0;
+	if (elapsed >= NSEC_PER_SEC) {
+		elapsed = USEC_PER_SEC;
+		tr->tr_last = now;
+	} else {
+		elapsed /= NSEC_PER_USEC;
+		tr->tr_last += elapsed * NSEC_PER_USEC;
+	}
+
+	for (i = 0; i < NFSD_THROTTLE_NR; i++) {
+		rate = tr->tr_rate[i];
+		if (!rate)
+			continue;
+		burst = rate * USEC_PER_SEC;
+		tokens = min_t(s64, tr->tr_tokens[i] + (s64)(rate * elapsed),
+			       burst);
+		if (tokens < 0)
+			wait = max(wait,
+				   div64_u64(-tokens, rate) * NSEC_PER_USEC);
+		tokens -= (s64)(cost[i] * USEC_PER_SEC);
+		tr->tr_tokens[i] = max_t(s64, tokens,
+					 -burst * NFSD_THROTTLE_MAX_DEBT);
+	}
+	return wait;
+}
+
+/* Called with tr_lock held, or before @tr is published. */
+static void throttle_set_rates(struct nfsd_throttle_rule *tr, u64 ops,
+			       u64 bytes)
+{
+	u64 rates[NFSD_THROTTLE_NR] = { ops, bytes };
+	s64 burst;
+	int i;
+
+	for (i = 0; i < NFSD_THROTTLE_NR; i++) {
+		burst = rates[i] * USEC_PER_SEC;
+		if (!tr->tr_rate[i] || tr->tr_tokens[i] > burst)
+			tr->tr_tokens[i] = burst;
+		tr->tr_rate[i] = rates[i];
+	}
+}
+
+/*
+ * Put off @rqstp for @wait ns: returns nfserr_dropit if it has been
+ * deferred, or nfs_ok once it has waited in the thread.
+ */
+static __be32 throttle_defer(struct nfsd_throttle *nt,
+			     struct svc_rqst *rqstp, u64 now, u64 wait)
+{
+	unsigned long delay = max_t(unsigned long, nsecs_to_jiffies(wait), 1);
+	struct nfsd_throttle_wait *tw = NULL;
+
+	if (READ_ONCE(nt->nt_nwaiting) < NFSD_THROTTLE_MAX_WAITING)
+		tw = kmalloc(sizeof(*tw), GFP_KERNEL);
+	if (tw) {
+		/* svc_defer() allocates */
+		tw->tw_dreq = rqstp->rq_chandle.defer(&rqstp->rq_chandle);
+		if (!tw->tw_dreq) {
+			kfree(tw);
+			tw = NULL;
+		}
+	}
+	if (!tw) {
+		this_cpu_inc(nt->nt_stats->slept);
+		schedule_timeout_interruptible(min_t(unsigned long, delay,
+						     NFSD_THROTTLE_MAX_SLEEP));
+		return nfs_ok;
+	}
+
+	this_cpu_inc(nt->nt_stats->deferred);
+	nfsd_defer_mark(rqstp, tw->tw_dreq, NFSD_DEFER_THROTTLED);
+	tw->tw_ready = now + wait;
+	spin_lock(&nt->nt_lock);
+	list_add_tail(&tw->tw_link, &nt->nt_waiting);
+	nt->nt_nwaiting++;
+	if (tw->tw_ready < nt->nt_next) {
+		nt->nt_next = tw->tw_ready;
+		mod_delayed_work(system_wq, &nt->nt_work, delay);
+	}
+	spin_unlock(&nt->nt_lock);
+	return nfserr_dropit;
+}
+
+/*
+ * Called by fh_verify() with the export it found.  Returns nfserr_dropit
+ * if the request has been put off until it is within its limits again.
+ */
+__be32
+nfsd_throttle_check(struct svc_rqst *rqstp, struct svc_export *exp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_throttle *nt = throttle(SVC_NET(rqstp));
+	struct auth_domain *dom = rqstp->rq_client;
+	u64 cost[NFSD_THROTTLE_NR], now, wait = 0;
+	struct nfsd_throttle_rule *tr;
+	unsigned int i;
+
+	/* the first export of a request is the one it is charged to */
+	if (!nt || ctx->tc_throttle_done || ctx->tc_bench)
+		return nfs_ok;
+	ctx->tc_throttle_done = true;
+	/* a request put off by us was charged when it was */
+	if (nfsd_defer_marked(rqstp, NFSD_DEFER_THROTTLED))
+		return nfs_ok;
+	if (!READ_ONCE(nt->nt_nrules))
+		return nfs_ok;
+
+	cost[NFSD_THROTTLE_OPS] = 1;
+	cost[NFSD_THROTTLE_BYTES] = throttle_bytes(rqstp);
+	now = ktime_get_ns();
+	rcu_read_lock();
+	for (i = 0; i < NFSD_THROTTLE_RULES; i++) {
+		u64 w;
+
+		tr = rcu_dereference(nt->nt_rules[i]);
+		if (!tr || !throttle_match(tr, dom, exp))
+			continue;
+		spin_lock(&tr->tr_lock);
+		w = throttle_charge(tr, now, cost);
+		if (w)
+			tr->tr_throttled++;
+		else
+			tr->tr_admitted++;
+		spin_unlock(&tr->tr_lock);
+		wait = max(wait, w);
+	}
+	rcu_read_unlock();
+
+	if (!wait)
+		return nfs_ok;
+	nfsd_traffic_throttled(rqstp, exp);
+	return throttle_defer(nt, rqstp, now, wait);
+}
+
+/* Revisit the put-off requests whose time has come. */
+static void throttle_work(struct work_struct *work)
+{
+	struct nfsd_throttle *nt = container_of(to_delayed_work(work),
+						struct nfsd_throttle, nt_work);
+	struct nfsd_throttle_wait *tw, *next;
+	u64 now = ktime_get_ns(), first = U64_MAX;
+	LIST_HEAD(ready);
+
+	spin_lock(&nt->nt_lock);
+	list_for_each_entry_safe(tw, next, &nt->nt_waiting, tw_link) {
+		if (tw->tw_ready <= now) {
+			list_move_tail(&tw->tw_link, &ready);
+			nt->nt_nwaiting--;
+		} else
+			first = min(first, tw->tw_ready);
+	}
+	nt->nt_next = first;
+	if (first != U64_MAX)
+		mod_delayed_work(system_wq, &nt->nt_work,
+				 max_t(unsigned long,
+				       nsecs_to_jiffies(first - now), 1));
+	spin_unlock(&nt->nt_lock);
+
+	list_for_each_entry_safe(tw, next, &ready, tw_link) {
+		tw->tw_dreq->revisit(tw->tw_dreq, 0);
+		kfree(tw);
+	}
+}
+
+/*
+ * Revisit every put-off request now, or with @drop free them, which is
+ * what is done when the service goes away.
+ */
+void
+nfsd_throttle_flush(struct net *net, bool drop)
+{
+	struct nfsd_throttle *nt = throttle(net);
+	struct nfsd_throttle_wait *tw, *next;
+	LIST_HEAD(flush);
+
+	if (!nt)
+		return;
+	spin_lock(&nt->nt_lock);
+	list_splice_init(&nt->nt_waiting, &flush);
+	nt->nt_nwaiting = 0;
+	nt->nt_next = U64_MAX;
+	spin_unlock(&nt->nt_lock);
+
+	list_for_each_entry_safe(tw, next, &flush, tw_link) {
+		tw->tw_dreq->revisit(tw->tw_dreq, drop);
+		kfree(tw);
+	}
+}
+
+static void throttle_free_rule(struct nfsd_throttle_rule *tr)
+{
+	if (tr->tr_kind == NFSD_THROTTLE_EXPORT)
+		path_put(&tr->tr_path);
+	kfree(tr);
+}
+
+/*
+ * Limit the client or export (@kind) @name to @ops calls and @bytes
+ * bytes per second, 0 meaning no limit; with both 0 its rule is
+ * removed.
+ */
+int
+nfsd_throttle_set(struct net *net, const char *kind, const char *name,
+		  u64 ops, u64 bytes)
+{
+	struct nfsd_throttle *nt = throttle(net);
+	struct nfsd_throttle_rule *tr;
+	struct path path = { };
+	int type, free = -1, err = 0;
+	unsigned int i;
+
+	if (!strcmp(kind, "client"))
+		type = NFSD_THROTTLE_CLIENT;
+	else if (!strcmp(kind, "export"))
+		type = NFSD_THROTTLE_EXPORT;
+	else
+		return -EINVAL;
+	if (ops > NFSD_THROTTLE_MAX_RATE || bytes > NFSD_THROTTLE_MAX_RATE)
+		return -EINVAL;
+	if (!*name || strlen(name) >= NFSD_THROTTLE_NAMELEN)
+		return -EINVAL;
+	if (type == NFSD_THROTTLE_EXPORT) {
+		err = kern_path(name, LOOKUP_FOLLOW, &path);
+		if (err)
+			return err;
+	}
+
+	mutex_lock(&nt->nt_mutex);
+	for (i = 0; i < NFSD_THROTTLE_RULES; i++) {
+		tr = rcu_dereference_protected(nt->nt_rules[i],
+				lockdep_is_held(&nt->nt_mutex));
+		if (!tr) {
+			if (free < 0)
+				free = i;
+			continue;
+		}
+		if (tr->tr_kind != type)
+			continue;
+		if (type == NFSD_THROTTLE_EXPORT ?
+		    path_equal(&tr->tr_path, &path) :
+		    !strcmp(tr->tr_name, name))
+			break;
+	}
+
+	if (i < NFSD_THROTTLE_RULES) {
+		if (!ops && !bytes) {
+			RCU_INIT_POINTER(nt->nt_rules[i], NULL);
+			WRITE_ONCE(nt->nt_nrules, nt->nt_nrules - 1);
+			mutex_unlock(&nt->nt_mutex);
+			synchronize_rcu();
+			throttle_free_rule(tr);
+			goto out;
+		}
+		spin_lock(&tr->tr_lock);
+		throttle_set_rates(tr, ops, bytes);
+		spin_unlock(&tr->tr_lock);
+		goto out_unlock;
+	}
+	if (!ops && !bytes)
+		goto out_unlock;
+	err = -ENOSPC;
+	if (free < 0)
+		goto out_unlock;
+	err = -ENOMEM;
+	tr = kzalloc(sizeof(*tr), GFP_KERNEL);
+	if (!tr)
+		goto out_unlock;
+	err = 0;
+	tr->tr_kind = type;
+	strlcpy(tr->tr_name, name, sizeof(tr->tr_name));
+	if (type == NFSD_THROTTLE_EXPORT) {
+		tr->tr_path = path;
+		path.mnt = NULL;
+	}
+	spin_lock_init(&tr->tr_lock);
+	tr->tr_last = ktime_get_ns();
+	throttle_set_rates(tr, ops, bytes);
+	rcu_assign_pointer(nt->nt_rules[free], tr);
+	WRITE_ONCE(nt->nt_nrules, nt->nt_nrules + 1);
+out_unlock:
+	mutex_unlock(&nt->nt_mutex);
+out:
+	if (path.mnt)
+		path_put(&path);
+	return err;
+}
+
+/*
+ * Format the number of rules and the totals into @buf for the
+ * throttle_ctl file.
+ */
+int
+nfsd_throttle_show(struct net *net, char *buf, int size)
+{
+	struct nfsd_throttle *nt = throttle(net);
+	struct nfsd_throttle_stats sum = { 0 };
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct nfsd_throttle_stats *s = per_cpu_ptr(nt->nt_stats, cpu);
+
+		sum.deferred += s->deferred;
+		sum.slept += s->slept;
+	}
+	return scnprintf(buf, size, "rules %u\nwaiting %u\ndeferred %lu\n"
+			 "slept %lu\n", READ_ONCE(nt->nt_nrules),
+			 READ_ONCE(nt->nt_nwaiting), sum.deferred, sum.slept);
+}
+
+/* The throttle file: one line per rule. */
+int
+nfsd_throttle_seq_show(struct seq_file *m, void *v)
+{
+	struct nfsd_throttle *nt = throttle(m->private);
+	struct nfsd_throttle_rule *tr;
+	unsigned long admitted, throttled;
+	u64 ops, bytes;
+	unsigned int i;
+
+	seq_printf(m, "%-6s %-32s %12s %14s %12s %12s\n", "kind", "name",
+		   "ops/s", "bytes/s", "admitted", "throttled");
+	mutex_lock(&nt->nt_mutex);
+	for (i = 0; i < NFSD_THROTTLE_RULES; i++) {
+		tr = rcu_dereference_protected(nt->nt_rules[i],
+				lockdep_is_held(&nt->nt_mutex));
+		if (!tr)
+			continue;
+		spin_lock(&tr->tr_lock);
+		ops = tr->tr_rate[NFSD_THROTTLE_OPS];
+		bytes = tr->tr_rate[NFSD_THROTTLE_BYTES];
+		admitted = tr->tr_admitted;
+		throttled = tr->tr_throttled;
+		spin_unlock(&tr->tr_lock);
+		seq_printf(m, "%-6s %-32s %12llu %14llu %12lu %12lu\n",
+			   throttle_kinds[tr->tr_kind], tr->tr_name,
+			   (unsigned long long)ops, (unsigned long long)bytes,
+			   admitted, throttled);
+	}
+	mutex_unlock(&nt->nt_mutex);
+	return 0;
+}
+
+int
+nfsd_throttle_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_throttle *nt;
+
+	nt = kzalloc(sizeof(*nt), GFP_KERNEL);
+	if (!nt)
+		return -ENOMEM;
+	nt->nt_stats = alloc_percpu(struct nfsd_throttle_stats);
+	if (!nt->nt_stats) {
+		kfree(nt);
+		return -ENOMEM;
+	}
+	mutex_init(&nt->nt_mutex);
+	spin_lock_init(&nt->nt_lock);
+	INIT_LIST_HEAD(&nt->nt_waiting);
+	nt->nt_next = U64_MAX;
+	INIT_DELAYED_WORK(&nt->nt_work, throttle_work);
+	nn->throttle = nt;
+	return 0;
+}
+
+void
+nfsd_throttle_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_throttle *nt = nn->throttle;
+	struct nfsd_throttle_rule *tr;
+	unsigned int i;
+
+	if (!nt)
+		return;
+	cancel_delayed_work_sync(&nt->nt_work);
+	nfsd_throttle_flush(net, true);
+	nn->throttle = NULL;
+	for (i = 0; i < NFSD_THROTTLE_RULES; i++) {
+		tr = rcu_dereference_protected(nt->nt_rules[i], true);
+		if (tr)
+			throttle_free_rule(tr);
+	}
+	free_percpu(nt->nt_stats);
+	kfree(nt);
+}
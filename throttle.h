@@ -0,0 +1,25 @@
+/*
+ * Per-client and per-export rate limits.
+ *
+ * Token buckets on calls and bytes per second, for auth domains and
+ * exports, charged when a request's first file handle is verified.
+ */
+
+#ifndef LINUX_NFSD_THROTTLE_H
+#define LINUX_NFSD_THROTTLE_H
+
+struct net;
+struct svc_rqst;
+struct svc_export;
+struct seq_file;
+
+int	nfsd_throttle_init(struct net *);
+void	nfsd_throttle_shutdown(struct net *);
+__be32	nfsd_throttle_check(struct svc_rqst *, struct svc_export *);
+void	nfsd_throttle_flush(struct net *, bool drop);
+int	nfsd_throttle_set(struct net *, const char *kind, const char *name,
+			  u64 ops, u64 bytes);
+int	nfsd_throttle_show(struct net *, char *, int);
+int	nfsd_throttle_seq_show(struct seq_file *, void *);
+
+#endif /* LINUX_NFSD_THROTTLE_H */
@@ -0,0 +1,173 @@
+/*
+ * nfslisten: open listening sockets and hand them to bmw.
+ *
+ * The "listeners" file only opens sockets itself on the wildcard
+ * address of a family.  This opens one or more sockets on any address,
+ * as a group bound with SO_REUSEPORT when there are several, and writes
+ * "fd N" for each of them to the file.  The transports keep their own
+ * references, so the sockets are closed here once handed over.
+ *
+ *	nfslisten [-d DIR] [-n COUNT|cpus|pools] tcp|udp ADDRESS PORT
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* most sockets opened on one address */
+#define MAX_COPIES	256
+
+static const char *dir = "/proc/fs/nfsd";
+
+/* write @msg to the control file @name as one transaction */
+static int transact(const char *name, const char *msg, char *reply,
+		    size_t size)
+{
+	char path[256];
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_RDWR);
+	if (fd < 0)
+		return -1;
+	if (msg && write(fd, msg, strlen(msg)) < 0) {
+		close(fd);
+		return -1;
+	}
+	n = read(fd, reply, size - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	reply[n] = '\0';
+	return 0;
+}
+
+/* the number of thread pools, from the pool_affinity file */
+static int nr_pools(void)
+{
+	char reply[256], *p;
+
+	if (transact("pool_affinity", NULL, reply, sizeof(reply)))
+		return -1;
+	p = strstr(reply, "pools ");
+	return p ? atoi(p + 6) : -1;
+}
+
+static int open_listener(int type, struct sockaddr *sap, socklen_t salen,
+			 int reuseport)
+{
+	int one = 1, s;
+
+	s = socket(sap->sa_family, type, 0);
+	if (s < 0)
+		return -1;
+	/* let a separate IPv4 listener share the port */
+	if ((sap->sa_family == AF_INET6 &&
+	     setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof(one))) ||
+	    (type == SOCK_STREAM &&
+	     setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one))) ||
+	    (reuseport &&
+	     setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one))) ||
+	    bind(s, sap, salen) ||
+	    (type == SOCK_STREAM && listen(s, 64))) {
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+"usage: nfslisten [options] tcp|udp ADDRESS PORT\n"
+"  -d DIR       control files (default /proc/fs/nfsd)\n"
+"  -n COUNT     sockets to open with SO_REUSEPORT, or \"cpus\" for one\n"
+"               per online cpu, or \"pools\" for one per thread pool\n"
+"               (default 1)\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_storage ss;
+	struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+	const char *count = "1";
+	char msg[32], reply[4096];
+	socklen_t salen;
+	int copies, type, port, i, s, c;
+
+	while ((c = getopt(argc, argv, "d:n:h")) != -1) {
+		switch (c) {
+		case 'd': dir = optarg; break;
+		case 'n': count = optarg; break;
+		default: usage();
+		}
+	}
+	if (argc - optind != 3)
+		usage();
+
+	if (!strcmp(argv[optind], "tcp"))
+		type = SOCK_STREAM;
+	else if (!strcmp(argv[optind], "udp"))
+		type = SOCK_DGRAM;
+	else
+		usage();
+	port = atoi(argv[optind + 2]);
+	if (port <= 0 || port > 65535)
+		usage();
+	memset(&ss, 0, sizeof(ss));
+	if (inet_pton(AF_INET, argv[optind + 1], &sin->sin_addr) == 1) {
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port);
+		salen = sizeof(*sin);
+	} else if (inet_pton(AF_INET6, argv[optind + 1],
+			     &sin6->sin6_addr) == 1) {
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+		salen = sizeof(*sin6);
+	} else {
+		fprintf(stderr, "nfslisten: bad address %s\n",
+			argv[optind + 1]);
+		return 1;
+	}
+
+	if (!strcmp(count, "cpus"))
+		copies = sysconf(_SC_NPROCESSORS_ONLN);
+	else if (!strcmp(count, "pools"))
+		copies = nr_pools();
+	else
+		copies = atoi(count);
+	if (copies <= 0) {
+		fprintf(stderr, "nfslisten: bad count %s\n", count);
+		return 1;
+	}
+	if (copies > MAX_COPIES)
+		copies = MAX_COPIES;
+
+	for (i = 0; i < copies; i++) {
+		s = open_listener(type, (struct sockaddr *)&ss, salen,
+				  copies > 1);
+		if (s < 0) {
+			fprintf(stderr, "nfslisten: socket %d: %s\n", i,
+				strerror(errno));
+			return 1;
+		}
+		snprintf(msg, sizeof(msg), "fd %d\n", s);
+		if (transact("listeners", msg, reply, sizeof(reply))) {
+			fprintf(stderr, "nfslisten: %s/listeners: %s\n", dir,
+				strerror(errno));
+			return 1;
+		}
+		close(s);
+	}
+	fputs(reply, stdout);
+	return 0;
+}
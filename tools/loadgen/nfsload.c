@@ -0,0 +1,795 @@
+/*
+ * nfsload: drive an NFSv3 server with a configurable mix of procedures
+ * over N concurrent connections and report per-procedure throughput and
+ * latency percentiles.
+ *
+ * Each connection is served by one thread with one call outstanding.
+ * The thread creates its own file in the exported directory, fills it,
+ * and then issues calls picked at random from the mix until the run
+ * ends.  CREATE makes uniquely named scratch files, which REMOVE then
+ * deletes oldest first; everything is removed at the end unless -k is
+ * given.
+ *
+ * The root handle is given with -r, or obtained from the server's
+ * filehandle control file with -e (which needs to run on the server).
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "rpc.h"
+
+#define NFS3_OK			0
+#define NFS3_UNSTABLE		0
+#define NFS3_FILE_SYNC		2
+#define NFS3_UNCHECKED		0
+
+#define UDP_MAX_BLOCK		32768
+
+/*
+ * Latency histogram: exact below 2^SUB_BITS ns, then 2^SUB_BITS buckets
+ * per power of two (about 3% resolution) up to 2^HIST_MAX_BIT ns.
+ */
+#define SUB_BITS		5
+#define SUB_COUNT		(1u << SUB_BITS)
+#define HIST_MAX_BIT		40
+#define HIST_BUCKETS		((HIST_MAX_BIT - SUB_BITS + 2) * SUB_COUNT)
+
+enum {
+	OP_GETATTR,
+	OP_LOOKUP,
+	OP_READ,
+	OP_WRITE,
+	OP_CREATE,
+	OP_REMOVE,
+	OP_READDIRPLUS,
+	NR_OPS,
+	OP_SETUP = NR_OPS,	/* not recorded */
+};
+
+struct proc_stats {
+	uint64_t	ops;
+	uint64_t	errors;
+	uint64_t	bytes;		/* READ/WRITE payload */
+	uint64_t	sum_ns;
+	uint64_t	max_ns;
+	uint64_t	hist[HIST_BUCKETS];
+};
+
+struct worker {
+	pthread_t		thread;
+	int			id;
+	struct rpc_conn		conn;
+	struct nfs_fh		file;
+	char			name[64];
+	uint64_t		rand;
+	unsigned int		tmp_first;	/* oldest scratch file */
+	unsigned int		tmp_next;	/* next scratch file */
+	int			failed;
+	struct proc_stats	stats[NR_OPS];
+};
+
+struct op {
+	const char	*name;
+	int		(*fn)(struct worker *);
+};
+
+static struct sockaddr_in	server;
+static int			proto = IPPROTO_TCP;
+static struct nfs_fh		root_fh;
+static uint32_t			block_size = 65536;
+static uint64_t			file_blocks = 16;
+static unsigned int		weights[NR_OPS];
+static unsigned int		weight_total;
+static int			keep_files;
+static uint32_t			cred_uid, cred_gid;
+static uint64_t			payload_fill;
+
+static volatile int		recording;
+static volatile int		stopping;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+	uint64_t x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *s = x;
+}
+
+static unsigned int hist_bucket(uint64_t v)
+{
+	unsigned int msb;
+
+	if (v < SUB_COUNT)
+		return v;
+	msb = 63 - __builtin_clzll(v);
+	if (msb > HIST_MAX_BIT)
+		return HIST_BUCKETS - 1;
+	return (msb - SUB_BITS + 1) * SUB_COUNT +
+		((v >> (msb - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+/* the upper bound of a bucket */
+static uint64_t hist_value(unsigned int b)
+{
+	unsigned int shift;
+
+	if (b < SUB_COUNT)
+		return b;
+	shift = b / SUB_COUNT - 1;
+	return ((uint64_t)(SUB_COUNT + b % SUB_COUNT + 1) << shift) - 1;
+}
+
+static uint64_t hist_percentile(const struct proc_stats *ps, double pct)
+{
+	uint64_t want, seen = 0;
+	unsigned int b;
+
+	if (!ps->ops)
+		return 0;
+	want = (uint64_t)(ps->ops * pct / 100.0);
+	if (want >= ps->ops)
+		want = ps->ops - 1;
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		seen += ps->hist[b];
+		if (seen > want)
+			break;
+	}
+	if (b == HIST_BUCKETS)
+		b--;
+	return hist_value(b) < ps->max_ns ? hist_value(b) : ps->max_ns;
+}
+
+/*
+ * Send the call built in @x, and start decoding the reply: returns the
+ * NFS status, or -1 if the call failed at the RPC level.  The call is
+ * timed and recorded against @op while the run is being recorded.
+ */
+static int nfs_call(struct worker *w, int op, struct xdr *x, struct xdr *res,
+		    uint64_t bytes)
+{
+	struct proc_stats *ps;
+	uint64_t start, ns;
+	int status;
+
+	start = now_ns();
+	status = rpc_call(&w->conn, x, res);
+	ns = now_ns() - start;
+	if (status > 0) {
+		fprintf(stderr, "nfsload: %s: RPC error %#x\n",
+			op < NR_OPS ? "call" : "setup call", status);
+		status = -1;
+	} else if (status == 0) {
+		status = xdr_get_u32(res);
+		if (res->err)
+			status = -1;
+	}
+	if (status < 0 || op == OP_SETUP || !recording)
+		return status;
+
+	ps = &w->stats[op];
+	ps->ops++;
+	if (status != NFS3_OK)
+		ps->errors++;
+	else
+		ps->bytes += bytes;
+	ps->sum_ns += ns;
+	if (ns > ps->max_ns)
+		ps->max_ns = ns;
+	ps->hist[hist_bucket(ns)]++;
+	return status;
+}
+
+static void nfs_begin(struct worker *w, struct xdr *x, uint32_t proc)
+{
+	rpc_begin(&w->conn, x, NFS_PROGRAM, NFS_V3, proc);
+}
+
+static void put_payload(struct xdr *x, uint32_t len)
+{
+	uint64_t *p;
+	uint32_t i;
+
+	xdr_put_u32(x, len);
+	if (x->p + len / 4 > x->end) {
+		x->err = 1;
+		return;
+	}
+	p = (uint64_t *)x->p;
+	for (i = 0; i < len / 8; i++)
+		p[i] = payload_fill;
+	x->p += len / 4;
+}
+
+static void put_sattr_mode(struct xdr *x, uint32_t mode)
+{
+	xdr_put_u32(x, 1);		/* set mode */
+	xdr_put_u32(x, mode);
+	xdr_put_u32(x, 0);		/* uid */
+	xdr_put_u32(x, 0);		/* gid */
+	xdr_put_u32(x, 0);		/* size */
+	xdr_put_u32(x, 0);		/* atime: don't change */
+	xdr_put_u32(x, 0);		/* mtime: don't change */
+}
+
+static int do_create(struct worker *w, int op, const char *name,
+		     struct nfs_fh *fh)
+{
+	struct xdr x, res;
+	int status;
+
+	nfs_begin(w, &x, NFS3PROC_CREATE);
+	xdr_put_fh(&x, &root_fh);
+	xdr_put_string(&x, name);
+	xdr_put_u32(&x, NFS3_UNCHECKED);
+	put_sattr_mode(&x, 0644);
+	status = nfs_call(w, op, &x, &res, 0);
+	if (status == NFS3_OK && fh) {
+		if (!xdr_get_u32(&res) || xdr_get_fh(&res, fh) < 0) {
+			fprintf(stderr, "nfsload: CREATE %s returned no handle\n",
+				name);
+			return -1;
+		}
+	}
+	return status;
+}
+
+static int do_remove(struct worker *w, int op, const char *name)
+{
+	struct xdr x, res;
+
+	nfs_begin(w, &x, NFS3PROC_REMOVE);
+	xdr_put_fh(&x, &root_fh);
+	xdr_put_string(&x, name);
+	return nfs_call(w, op, &x, &res, 0);
+}
+
+static int do_write(struct worker *w, int op, uint64_t offset, uint32_t stable)
+{
+	struct xdr x, res;
+
+	nfs_begin(w, &x, NFS3PROC_WRITE);
+	xdr_put_fh(&x, &w->file);
+	xdr_put_u64(&x, offset);
+	xdr_put_u32(&x, block_size);
+	xdr_put_u32(&x, stable);
+	put_payload(&x, block_size);
+	return nfs_call(w, op, &x, &res, block_size);
+}
+
+static uint64_t random_offset(struct worker *w)
+{
+	return (xorshift(&w->rand) % file_blocks) * block_size;
+}
+
+static void tmp_name(struct worker *w, unsigned int n, char *buf, size_t len)
+{
+	snprintf(buf, len, "%s.%u", w->name, n);
+}
+
+static int op_getattr(struct worker *w)
+{
+	struct xdr x, res;
+
+	nfs_begin(w, &x, NFS3PROC_GETATTR);
+	xdr_put_fh(&x, &w->file);
+	return nfs_call(w, OP_GETATTR, &x, &res, 0);
+}
+
+static int op_lookup(struct worker *w)
+{
+	struct xdr x, res;
+
+	nfs_begin(w, &x, NFS3PROC_LOOKUP);
+	xdr_put_fh(&x, &root_fh);
+	xdr_put_string(&x, w->name);
+	return nfs_call(w, OP_LOOKUP, &x, &res, 0);
+}
+
+static int op_read(struct worker *w)
+{
+	struct xdr x, res;
+
+	nfs_begin(w, &x, NFS3PROC_READ);
+	xdr_put_fh(&x, &w->file);
+	xdr_put_u64(&x, random_offset(w));
+	xdr_put_u32(&x, block_size);
+	return nfs_call(w, OP_READ, &x, &res, block_size);
+}
+
+static int op_write(struct worker *w)
+{
+	return do_write(w, OP_WRITE, random_offset(w), NFS3_UNSTABLE);
+}
+
+static int op_create(struct worker *w)
+{
+	char name[80];
+
+	tmp_name(w, w->tmp_next++, name, sizeof(name));
+	return do_create(w, OP_CREATE, name, NULL);
+}
+
+/* removes the oldest scratch file, making one (unrecorded) if need be */
+static int op_remove(struct worker *w)
+{
+	char name[80];
+	int status;
+
+	if (w->tmp_first == w->tmp_next) {
+		tmp_name(w, w->tmp_next++, name, sizeof(name));
+		status = do_create(w, OP_SETUP, name, NULL);
+		if (status < 0)
+			return status;
+	}
+	tmp_name(w, w->tmp_first++, name, sizeof(name));
+	return do_remove(w, OP_REMOVE, name);
+}
+
+static int op_readdirplus(struct worker *w)
+{
+	struct xdr x, res;
+
+	nfs_begin(w, &x, NFS3PROC_READDIRPLUS);
+	xdr_put_fh(&x, &root_fh);
+	xdr_put_u64(&x, 0);		/* cookie */
+	xdr_put_u64(&x, 0);		/* cookieverf */
+	xdr_put_u32(&x, 4096);		/* dircount */
+	xdr_put_u32(&x, 32768);		/* maxcount */
+	return nfs_call(w, OP_READDIRPLUS, &x, &res, 0);
+}
+
+static const struct op ops[NR_OPS] = {
+	[OP_GETATTR]	 = { "getattr",		op_getattr },
+	[OP_LOOKUP]	 = { "lookup",		op_lookup },
+	[OP_READ]	 = { "read",		op_read },
+	[OP_WRITE]	 = { "write",		op_write },
+	[OP_CREATE]	 = { "create",		op_create },
+	[OP_REMOVE]	 = { "remove",		op_remove },
+	[OP_READDIRPLUS] = { "readdirplus",	op_readdirplus },
+};
+
+static int pick_op(struct worker *w)
+{
+	unsigned int r = xorshift(&w->rand) % weight_total;
+	int op;
+
+	for (op = 0; op < NR_OPS - 1; op++) {
+		if (r < weights[op])
+			break;
+		r -= weights[op];
+	}
+	return op;
+}
+
+/* create the worker's file and fill it, so that READs return data */
+static int worker_setup(struct worker *w)
+{
+	uint64_t b;
+	int status;
+
+	snprintf(w->name, sizeof(w->name), "nfsload.%d.%d", (int)getpid(),
+		 w->id);
+	status = do_create(w, OP_SETUP, w->name, &w->file);
+	if (status != NFS3_OK) {
+		fprintf(stderr, "nfsload: CREATE %s failed: %d\n",
+			w->name, status);
+		return -1;
+	}
+	for (b = 0; b < file_blocks; b++) {
+		status = do_write(w, OP_SETUP, b * block_size, NFS3_FILE_SYNC);
+		if (status != NFS3_OK) {
+			fprintf(stderr, "nfsload: WRITE %s failed: %d\n",
+				w->name, status);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void worker_cleanup(struct worker *w)
+{
+	char name[80];
+
+	if (keep_files)
+		return;
+	while (w->tmp_first != w->tmp_next) {
+		tmp_name(w, w->tmp_first++, name, sizeof(name));
+		if (do_remove(w, OP_SETUP, name) < 0)
+			return;
+	}
+	do_remove(w, OP_SETUP, w->name);
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	size_t bufsize = block_size + 8192;
+
+	if (rpc_connect(&w->conn, &server, proto, bufsize) < 0) {
+		fprintf(stderr, "nfsload: connection %d: %s\n", w->id,
+			strerror(errno));
+		w->failed = 1;
+		return NULL;
+	}
+	w->conn.uid = cred_uid;
+	w->conn.gid = cred_gid;
+	w->rand = now_ns() ^ ((uint64_t)w->id << 32) ^ 0x9e3779b97f4a7c15ull;
+
+	if (worker_setup(w) < 0) {
+		w->failed = 1;
+		goto out;
+	}
+	while (!stopping) {
+		if (ops[pick_op(w)].fn(w) < 0) {
+			fprintf(stderr, "nfsload: connection %d: call failed: %s\n",
+				w->id, strerror(errno));
+			w->failed = 1;
+			goto out;
+		}
+	}
+	worker_cleanup(w);
+out:
+	rpc_close(&w->conn);
+	return NULL;
+}
+
+/*
+ * Ask the server for the handle of @path as seen by @client, by way of
+ * the filehandle control file: write "client path maxsize", read back
+ * the handle.
+ */
+static int fh_from_ctlfile(const char *ctl, const char *client,
+			   const char *path, struct nfs_fh *fh)
+{
+	char buf[512];
+	ssize_t n;
+	int fd, len;
+
+	fd = open(ctl, O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "nfsload: %s: %s\n", ctl, strerror(errno));
+		return -1;
+	}
+	len = snprintf(buf, sizeof(buf), "%s %s %d\n", client, path,
+		       NFS3_FHSIZE);
+	if (write(fd, buf, len) != len) {
+		fprintf(stderr, "nfsload: %s %s: %s\n", client, path,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0) {
+		fprintf(stderr, "nfsload: %s: no handle returned\n", ctl);
+		return -1;
+	}
+	buf[n] = '\0';
+	if (nfs_parse_fh(buf, fh) < 0) {
+		fprintf(stderr, "nfsload: %s: bad handle \"%s\"\n", ctl, buf);
+		return -1;
+	}
+	return 0;
+}
+
+/* clamp the block size to what the server will transfer */
+static int check_fsinfo(void)
+{
+	struct worker w = { .id = -1 };
+	struct xdr x, res;
+	uint32_t rtmax, wtmax;
+	int status;
+
+	if (rpc_connect(&w.conn, &server, proto, 8192) < 0) {
+		fprintf(stderr, "nfsload: connect: %s\n", strerror(errno));
+		return -1;
+	}
+	w.conn.uid = cred_uid;
+	w.conn.gid = cred_gid;
+	nfs_begin(&w, &x, NFS3PROC_FSINFO);
+	xdr_put_fh(&x, &root_fh);
+	status = nfs_call(&w, OP_SETUP, &x, &res, 0);
+	if (status != NFS3_OK) {
+		fprintf(stderr, "nfsload: FSINFO failed: %d%s\n", status,
+			status < 0 ? "" : " (is the handle right?)");
+		rpc_close(&w.conn);
+		return -1;
+	}
+	xdr_skip_post_op_attr(&res);
+	rtmax = xdr_get_u32(&res);
+	xdr_get_u32(&res);		/* rtpref */
+	xdr_get_u32(&res);		/* rtmult */
+	wtmax = xdr_get_u32(&res);
+	rpc_close(&w.conn);
+	if (res.err)
+		return -1;
+
+	if (block_size > rtmax || block_size > wtmax) {
+		block_size = rtmax < wtmax ? rtmax : wtmax;
+		block_size &= ~7u;
+		fprintf(stderr, "nfsload: block size reduced to the server's "
+			"maximum, %u\n", block_size);
+	}
+	return 0;
+}
+
+static int parse_mix(char *mix)
+{
+	char *tok, *eq;
+	unsigned long v;
+	int op;
+
+	memset(weights, 0, sizeof(weights));
+	weight_total = 0;
+	for (tok = strtok(mix, ","); tok; tok = strtok(NULL, ",")) {
+		eq = strchr(tok, '=');
+		if (!eq)
+			return -1;
+		*eq = '\0';
+		for (op = 0; op < NR_OPS; op++)
+			if (!strcmp(tok, ops[op].name))
+				break;
+		if (op == NR_OPS) {
+			fprintf(stderr, "nfsload: unknown procedure %s\n", tok);
+			return -1;
+		}
+		v = strtoul(eq + 1, NULL, 0);
+		weights[op] = v;
+		weight_total += v;
+	}
+	return weight_total ? 0 : -1;
+}
+
+static void print_text(const struct proc_stats *tot, double secs, int conns)
+{
+	const struct proc_stats *ps;
+	uint64_t all_ops = 0, all_errs = 0, all_bytes = 0;
+	int op;
+
+	printf("nfsload: %s %s:%u, %d connections, %.1f s, %u-byte blocks\n",
+	       proto == IPPROTO_TCP ? "tcp" : "udp", inet_ntoa(server.sin_addr),
+	       ntohs(server.sin_port), conns, secs, block_size);
+	printf("%-12s %10s %10s %8s %8s %9s %9s %9s %9s %9s\n", "proc", "ops",
+	       "ops/s", "MB/s", "errors", "mean_us", "p50_us", "p99_us",
+	       "p999_us", "max_us");
+	for (op = 0; op < NR_OPS; op++) {
+		ps = &tot[op];
+		if (!weights[op])
+			continue;
+		printf("%-12s %10" PRIu64 " %10.1f %8.1f %8" PRIu64
+		       " %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+		       ops[op].name, ps->ops, ps->ops / secs,
+		       ps->bytes / secs / 1e6, ps->errors,
+		       ps->ops ? ps->sum_ns / 1e3 / ps->ops : 0.0,
+		       hist_percentile(ps, 50) / 1e3,
+		       hist_percentile(ps, 99) / 1e3,
+		       hist_percentile(ps, 99.9) / 1e3,
+		       ps->max_ns / 1e3);
+		all_ops += ps->ops;
+		all_errs += ps->errors;
+		all_bytes += ps->bytes;
+	}
+	printf("%-12s %10" PRIu64 " %10.1f %8.1f %8" PRIu64 "\n", "total",
+	       all_ops, all_ops / secs, all_bytes / secs / 1e6, all_errs);
+}
+
+static void print_json(const struct proc_stats *tot, double secs, int conns)
+{
+	const struct proc_stats *ps;
+	uint64_t all_ops = 0, all_errs = 0, all_bytes = 0;
+	const char *sep = "";
+	int op;
+
+	printf("{\"proto\":\"%s\",\"server\":\"%s\",\"port\":%u,"
+	       "\"connections\":%d,\"seconds\":%.3f,\"block_size\":%u,"
+	       "\"procs\":{",
+	       proto == IPPROTO_TCP ? "tcp" : "udp", inet_ntoa(server.sin_addr),
+	       ntohs(server.sin_port), conns, secs, block_size);
+	for (op = 0; op < NR_OPS; op++) {
+		ps = &tot[op];
+		if (!weights[op])
+			continue;
+		printf("%s\"%s\":{\"ops\":%" PRIu64 ",\"ops_per_sec\":%.1f,"
+		       "\"mb_per_sec\":%.3f,\"errors\":%" PRIu64 ","
+		       "\"mean_us\":%.2f,\"p50_us\":%.2f,\"p99_us\":%.2f,"
+		       "\"p999_us\":%.2f,\"max_us\":%.2f}",
+		       sep, ops[op].name, ps->ops, ps->ops / secs,
+		       ps->bytes / secs / 1e6, ps->errors,
+		       ps->ops ? ps->sum_ns / 1e3 / ps->ops : 0.0,
+		       hist_percentile(ps, 50) / 1e3,
+		       hist_percentile(ps, 99) / 1e3,
+		       hist_percentile(ps, 99.9) / 1e3,
+		       ps->max_ns / 1e3);
+		sep = ",";
+		all_ops += ps->ops;
+		all_errs += ps->errors;
+		all_bytes += ps->bytes;
+	}
+	printf("},\"total\":{\"ops\":%" PRIu64 ",\"ops_per_sec\":%.1f,"
+	       "\"mb_per_sec\":%.3f,\"errors\":%" PRIu64 "}}\n",
+	       all_ops, all_ops / secs, all_bytes / secs / 1e6, all_errs);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+"usage: nfsload [options] (-r HANDLE | -e PATH)\n"
+"  -s ADDR      server address (default 127.0.0.1)\n"
+"  -p PORT      server port (default 2049)\n"
+"  -P tcp|udp   transport (default tcp)\n"
+"  -r HANDLE    root directory handle, in hex\n"
+"  -e PATH      get the handle of exported PATH from the control file\n"
+"  -C CLIENT    client domain for -e (default *)\n"
+"  -F FILE      filehandle control file (default /proc/fs/nfsd/filehandle)\n"
+"  -c N         concurrent connections (default 4)\n"
+"  -d SECS      measured duration (default 10)\n"
+"  -w SECS      warm-up before measuring (default 1)\n"
+"  -m MIX       procedure weights, e.g. getattr=40,read=30,write=30\n"
+"               (getattr lookup read write create remove readdirplus)\n"
+"  -b BYTES     READ/WRITE block size (default 65536)\n"
+"  -S BLOCKS    blocks in each connection's file (default 16)\n"
+"  -u UID -g GID  AUTH_UNIX credentials (default: our own)\n"
+"  -k           keep the files created\n"
+"  -j           report in JSON\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	char default_mix[] = "getattr=30,lookup=20,read=20,write=10,"
+			     "create=5,remove=5,readdirplus=10";
+	const char *host = "127.0.0.1", *export = NULL, *handle = NULL;
+	const char *client = "*", *ctl = "/proc/fs/nfsd/filehandle";
+	char *mix = default_mix;
+	int conns = 4, duration = 10, warmup = 1, json = 0, failed = 0;
+	unsigned int port = 2049;
+	struct proc_stats *tot;
+	struct worker *workers;
+	struct hostent *he;
+	uint64_t start, end;
+	double secs;
+	int c, i, op;
+	unsigned int b;
+
+	cred_uid = getuid();
+	cred_gid = getgid();
+	while ((c = getopt(argc, argv, "s:p:P:r:e:C:F:c:d:w:m:b:S:u:g:kjh")) != -1) {
+		switch (c) {
+		case 's': host = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 'P':
+			if (!strcmp(optarg, "tcp"))
+				proto = IPPROTO_TCP;
+			else if (!strcmp(optarg, "udp"))
+				proto = IPPROTO_UDP;
+			else
+				usage();
+			break;
+		case 'r': handle = optarg; break;
+		case 'e': export = optarg; break;
+		case 'C': client = optarg; break;
+		case 'F': ctl = optarg; break;
+		case 'c': conns = atoi(optarg); break;
+		case 'd': duration = atoi(optarg); break;
+		case 'w': warmup = atoi(optarg); break;
+		case 'm': mix = optarg; break;
+		case 'b': block_size = strtoul(optarg, NULL, 0); break;
+		case 'S': file_blocks = strtoull(optarg, NULL, 0); break;
+		case 'u': cred_uid = atoi(optarg); break;
+		case 'g': cred_gid = atoi(optarg); break;
+		case 'k': keep_files = 1; break;
+		case 'j': json = 1; break;
+		default: usage();
+		}
+	}
+	if (optind != argc || !handle == !export || conns < 1 ||
+	    duration < 1 || warmup < 0 || !file_blocks || block_size < 8)
+		usage();
+	if (parse_mix(mix) < 0) {
+		fprintf(stderr, "nfsload: bad mix\n");
+		usage();
+	}
+	block_size &= ~7u;
+	if (proto == IPPROTO_UDP && block_size > UDP_MAX_BLOCK) {
+		block_size = UDP_MAX_BLOCK;
+		fprintf(stderr, "nfsload: block size reduced to %u for UDP\n",
+			block_size);
+	}
+	memset(&payload_fill, 0x5a, sizeof(payload_fill));
+
+	server.sin_family = AF_INET;
+	server.sin_port = htons(port);
+	if (!inet_aton(host, &server.sin_addr)) {
+		he = gethostbyname(host);
+		if (!he || he->h_addrtype != AF_INET) {
+			fprintf(stderr, "nfsload: unknown host %s\n", host);
+			return 1;
+		}
+		memcpy(&server.sin_addr, he->h_addr_list[0], 4);
+	}
+
+	if (handle ? nfs_parse_fh(handle, &root_fh) < 0 :
+		     fh_from_ctlfile(ctl, client, export, &root_fh) < 0) {
+		fprintf(stderr, "nfsload: no usable root handle\n");
+		return 1;
+	}
+	if (check_fsinfo() < 0)
+		return 1;
+
+	workers = calloc(conns, sizeof(*workers));
+	tot = calloc(NR_OPS, sizeof(*tot));
+	if (!workers || !tot) {
+		fprintf(stderr, "nfsload: out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < conns; i++) {
+		workers[i].id = i;
+		if (pthread_create(&workers[i].thread, NULL, worker_main,
+				   &workers[i])) {
+			fprintf(stderr, "nfsload: cannot start thread %d\n", i);
+			stopping = 1;
+			conns = i;
+			break;
+		}
+	}
+
+	if (!stopping) {
+		sleep(warmup);
+		recording = 1;
+		start = now_ns();
+		sleep(duration);
+		recording = 0;
+		end = now_ns();
+		stopping = 1;
+	} else {
+		start = end = 0;
+	}
+	for (i = 0; i < conns; i++) {
+		pthread_join(workers[i].thread, NULL);
+		failed |= workers[i].failed;
+	}
+	if (end == start)
+		return 1;
+
+	for (i = 0; i < conns; i++) {
+		for (op = 0; op < NR_OPS; op++) {
+			struct proc_stats *from = &workers[i].stats[op];
+
+			tot[op].ops += from->ops;
+			tot[op].errors += from->errors;
+			tot[op].bytes += from->bytes;
+			tot[op].sum_ns += from->sum_ns;
+			if (from->max_ns > tot[op].max_ns)
+				tot[op].max_ns = from->max_ns;
+			for (b = 0; b < HIST_BUCKETS; b++)
+				tot[op].hist[b] += from->hist[b];
+		}
+	}
+	secs = (end - start) / 1e9;
+	if (json)
+		print_json(tot, secs, conns);
+	else
+		print_text(tot, secs, conns);
+	return failed;
+}
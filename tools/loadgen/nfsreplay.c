@@ -0,0 +1,663 @@
+/*
+ * nfsreplay: play back a log read from bmw's "capture" file against an
+ * NFSv3 server.
+ *
+ * Requests are sent at the times they were captured, divided by the
+ * speed-up given with -x (0 sends them as fast as replies come back).
+ * Requests from one client keep their order: each client address is
+ * assigned to one of the -c connections, and each connection has one
+ * call outstanding.
+ *
+ * File handles in the log are those of the captured server.  They are
+ * sent unchanged unless the replay has learned a mapping for them: -R
+ * names the captured root handle, which is mapped to the live root
+ * given with -r or -e, and every handle a replayed LOOKUP, CREATE or
+ * MKDIR returns is mapped to the one the captured call returned.
+ * Replaying against the server (and file system) that was captured
+ * needs no mapping at all.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "rpc.h"
+#include "capture.h"
+
+#define NR_PROCS		(NFS3PROC_COMMIT + 1)
+#define MAP_BUCKETS		65536
+#define NFS3_UNCHECKED		0
+#define NFS3_EXCLUSIVE		2
+
+static const char *procname[NR_PROCS] = {
+	"null", "getattr", "setattr", "lookup", "access", "readlink",
+	"read", "write", "create", "mkdir", "symlink", "mknod", "remove",
+	"rmdir", "rename", "link", "readdir", "readdirplus", "fsstat",
+	"fsinfo", "pathconf", "commit",
+};
+
+struct proc_stats {
+	uint64_t	ops;
+	uint64_t	mismatches;	/* status differs from the capture */
+	uint64_t	sum_ns;
+	uint64_t	max_ns;
+};
+
+struct stream {
+	pthread_t			thread;
+	int				id;
+	struct rpc_conn			conn;
+	const struct nfsd_capture_rec	**recs;
+	size_t				nrecs;
+	size_t				alloc;
+	uint64_t			max_late_ns;
+	uint64_t			skipped;
+	int				failed;
+	struct proc_stats		stats[NR_PROCS];
+};
+
+struct fh_map {
+	struct fh_map	*next;
+	struct nfs_fh	from;
+	struct nfs_fh	to;
+};
+
+static struct sockaddr_in	server;
+static int			proto = IPPROTO_TCP;
+static double			speed = 1.0;
+static uint32_t			cred_uid, cred_gid;
+static size_t			max_count;
+static uint64_t			start_ns;
+static pthread_barrier_t	start_barrier;
+
+static struct fh_map		*fh_map[MAP_BUCKETS];
+static pthread_rwlock_t		fh_map_lock = PTHREAD_RWLOCK_INITIALIZER;
+static unsigned long		fh_mapped;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000,
+		.tv_nsec = ns % 1000000000,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static uint32_t fh_hash(const unsigned char *data, uint32_t len)
+{
+	uint32_t h = 2166136261u;
+
+	while (len--)
+		h = (h ^ *data++) * 16777619u;
+	return h & (MAP_BUCKETS - 1);
+}
+
+static void fh_map_add(const struct nfs_fh *from, const struct nfs_fh *to)
+{
+	uint32_t b = fh_hash(from->data, from->len);
+	struct fh_map *m;
+
+	pthread_rwlock_wrlock(&fh_map_lock);
+	for (m = fh_map[b]; m; m = m->next)
+		if (m->from.len == from->len &&
+		    !memcmp(m->from.data, from->data, from->len))
+			break;
+	if (!m) {
+		m = malloc(sizeof(*m));
+		if (!m)
+			goto out;
+		m->from = *from;
+		m->next = fh_map[b];
+		fh_map[b] = m;
+		fh_mapped++;
+	}
+	m->to = *to;
+out:
+	pthread_rwlock_unlock(&fh_map_lock);
+}
+
+/* the live handle for a captured one; unknown handles map to themselves */
+static void fh_map_find(const unsigned char *data, uint32_t len,
+			struct nfs_fh *fh)
+{
+	struct fh_map *m;
+
+	pthread_rwlock_rdlock(&fh_map_lock);
+	for (m = fh_map[fh_hash(data, len)]; m; m = m->next)
+		if (m->from.len == len && !memcmp(m->from.data, data, len))
+			break;
+	if (m) {
+		*fh = m->to;
+	} else {
+		fh->len = len;
+		memcpy(fh->data, data, len);
+	}
+	pthread_rwlock_unlock(&fh_map_lock);
+}
+
+static const unsigned char *rec_fh(const struct nfsd_capture_rec *rec)
+{
+	return (const unsigned char *)(rec + 1);
+}
+
+static const unsigned char *rec_resfh(const struct nfsd_capture_rec *rec)
+{
+	return rec_fh(rec) + rec->cr_fhlen;
+}
+
+static const char *rec_name(const struct nfsd_capture_rec *rec)
+{
+	return (const char *)rec_resfh(rec) + rec->cr_resfhlen;
+}
+
+static void put_fh(struct xdr *x, const struct nfsd_capture_rec *rec)
+{
+	struct nfs_fh fh;
+
+	fh_map_find(rec_fh(rec), rec->cr_fhlen, &fh);
+	xdr_put_fh(x, &fh);
+}
+
+static void put_name(struct xdr *x, const struct nfsd_capture_rec *rec)
+{
+	xdr_put_opaque(x, rec_name(rec), rec->cr_namelen);
+}
+
+static void put_sattr(struct xdr *x, int set_mode, uint32_t mode,
+		      int set_size, uint64_t size)
+{
+	xdr_put_u32(x, set_mode);
+	if (set_mode)
+		xdr_put_u32(x, mode);
+	xdr_put_u32(x, 0);		/* uid */
+	xdr_put_u32(x, 0);		/* gid */
+	xdr_put_u32(x, set_size);
+	if (set_size)
+		xdr_put_u64(x, size);
+	xdr_put_u32(x, 0);		/* atime: don't change */
+	xdr_put_u32(x, 0);		/* mtime: don't change */
+}
+
+static void put_payload(struct xdr *x, uint32_t len)
+{
+	uint32_t quads = (len + 3) / 4;
+
+	xdr_put_u32(x, len);
+	if (x->p + quads > x->end) {
+		x->err = 1;
+		return;
+	}
+	memset(x->p, 0x5a, quads * 4);
+	x->p += quads;
+}
+
+/* encode the arguments of @rec; returns -1 for procedures not replayed */
+static int encode_args(struct xdr *x, const struct nfsd_capture_rec *rec)
+{
+	switch (rec->cr_proc) {
+	case NFS3PROC_NULL:
+		break;
+	case NFS3PROC_GETATTR:
+	case NFS3PROC_FSSTAT:
+	case NFS3PROC_FSINFO:
+		put_fh(x, rec);
+		break;
+	case NFS3PROC_SETATTR:
+		put_fh(x, rec);
+		put_sattr(x, !!(rec->cr_arg2 & NFSD_CAPTURE_SET_MODE),
+			  rec->cr_arg,
+			  !!(rec->cr_arg2 & NFSD_CAPTURE_SET_SIZE),
+			  rec->cr_offset);
+		xdr_put_u32(x, 0);	/* no guard */
+		break;
+	case NFS3PROC_LOOKUP:
+	case NFS3PROC_REMOVE:
+	case NFS3PROC_RMDIR:
+		put_fh(x, rec);
+		put_name(x, rec);
+		break;
+	case NFS3PROC_ACCESS:
+		put_fh(x, rec);
+		xdr_put_u32(x, rec->cr_arg);
+		break;
+	case NFS3PROC_READ:
+		put_fh(x, rec);
+		xdr_put_u64(x, rec->cr_offset);
+		xdr_put_u32(x, rec->cr_count);
+		break;
+	case NFS3PROC_WRITE:
+		put_fh(x, rec);
+		xdr_put_u64(x, rec->cr_offset);
+		xdr_put_u32(x, rec->cr_count);
+		xdr_put_u32(x, rec->cr_arg);
+		put_payload(x, rec->cr_count);
+		break;
+	case NFS3PROC_CREATE:
+		put_fh(x, rec);
+		put_name(x, rec);
+		xdr_put_u32(x, rec->cr_arg2);
+		if (rec->cr_arg2 == NFS3_EXCLUSIVE) {
+			/* the verifier was not captured; any unique one will do */
+			xdr_put_u32(x, rec->cr_xid);
+			xdr_put_u32(x, (uint32_t)rec->cr_time);
+		} else {
+			put_sattr(x, 1, rec->cr_arg, 0, 0);
+		}
+		break;
+	case NFS3PROC_MKDIR:
+		put_fh(x, rec);
+		put_name(x, rec);
+		put_sattr(x, 1, rec->cr_arg, 0, 0);
+		break;
+	case NFS3PROC_READDIR:
+		put_fh(x, rec);
+		xdr_put_u64(x, rec->cr_offset);
+		xdr_put_u64(x, 0);	/* cookieverf */
+		xdr_put_u32(x, rec->cr_count);
+		break;
+	case NFS3PROC_READDIRPLUS:
+		put_fh(x, rec);
+		xdr_put_u64(x, rec->cr_offset);
+		xdr_put_u64(x, 0);
+		xdr_put_u32(x, rec->cr_arg2);
+		xdr_put_u32(x, rec->cr_count);
+		break;
+	default:
+		return -1;
+	}
+	return x->err ? -1 : 0;
+}
+
+/* learn the live handle for the one the captured call returned */
+static void learn_fh(struct xdr *res, const struct nfsd_capture_rec *rec)
+{
+	struct nfs_fh from, to;
+
+	if (!rec->cr_resfhlen)
+		return;
+	if (rec->cr_proc != NFS3PROC_LOOKUP && !xdr_get_u32(res))
+		return;			/* post_op_fh3 without a handle */
+	if (xdr_get_fh(res, &to) < 0)
+		return;
+	from.len = rec->cr_resfhlen;
+	memcpy(from.data, rec_resfh(rec), from.len);
+	fh_map_add(&from, &to);
+}
+
+static int replay_one(struct stream *s, const struct nfsd_capture_rec *rec)
+{
+	struct proc_stats *ps = &s->stats[rec->cr_proc];
+	struct xdr x, res;
+	uint64_t t, ns;
+	int status;
+
+	rpc_begin(&s->conn, &x, NFS_PROGRAM, NFS_V3, rec->cr_proc);
+	if (encode_args(&x, rec) < 0) {
+		s->skipped++;
+		return 0;
+	}
+
+	t = now_ns();
+	status = rpc_call(&s->conn, &x, &res);
+	ns = now_ns() - t;
+	if (status) {
+		fprintf(stderr, "nfsreplay: %s xid %#x: %s\n",
+			procname[rec->cr_proc], rec->cr_xid,
+			status < 0 ? strerror(errno) : "RPC error");
+		return -1;
+	}
+	status = rec->cr_proc == NFS3PROC_NULL ? 0 : xdr_get_u32(&res);
+	if (!status)
+		learn_fh(&res, rec);
+
+	ps->ops++;
+	if ((uint32_t)status != rec->cr_status)
+		ps->mismatches++;
+	ps->sum_ns += ns;
+	if (ns > ps->max_ns)
+		ps->max_ns = ns;
+	return 0;
+}
+
+static void *stream_main(void *arg)
+{
+	struct stream *s = arg;
+	const struct nfsd_capture_rec *rec;
+	uint64_t due, now;
+	size_t i;
+
+	if (rpc_connect(&s->conn, &server, proto, max_count + 8192) < 0) {
+		fprintf(stderr, "nfsreplay: connection %d: %s\n", s->id,
+			strerror(errno));
+		s->failed = 1;
+		pthread_barrier_wait(&start_barrier);
+		return NULL;
+	}
+	s->conn.uid = cred_uid;
+	s->conn.gid = cred_gid;
+	pthread_barrier_wait(&start_barrier);
+
+	for (i = 0; i < s->nrecs; i++) {
+		rec = s->recs[i];
+		if (speed > 0) {
+			due = start_ns + (uint64_t)(rec->cr_time / speed);
+			now = now_ns();
+			if (now < due)
+				sleep_until(due);
+			else if (now - due > s->max_late_ns)
+				s->max_late_ns = now - due;
+		}
+		if (replay_one(s, rec) < 0) {
+			s->failed = 1;
+			break;
+		}
+	}
+	rpc_close(&s->conn);
+	return NULL;
+}
+
+static uint32_t client_hash(const struct nfsd_capture_rec *rec)
+{
+	return fh_hash(rec->cr_addr, sizeof(rec->cr_addr)) ^ rec->cr_family;
+}
+
+static int stream_add(struct stream *s, const struct nfsd_capture_rec *rec)
+{
+	const struct nfsd_capture_rec **recs;
+
+	if (s->nrecs == s->alloc) {
+		s->alloc = s->alloc ? 2 * s->alloc : 1024;
+		recs = realloc(s->recs, s->alloc * sizeof(*recs));
+		if (!recs)
+			return -1;
+		s->recs = recs;
+	}
+	s->recs[s->nrecs++] = rec;
+	return 0;
+}
+
+static char *read_log(const char *path, size_t *len)
+{
+	struct stat st;
+	char *buf;
+	ssize_t n;
+	size_t got = 0;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "nfsreplay: %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	buf = malloc(st.st_size ? st.st_size : 1);
+	if (!buf) {
+		close(fd);
+		return NULL;
+	}
+	while (got < (size_t)st.st_size) {
+		n = read(fd, buf + got, st.st_size - got);
+		if (n <= 0)
+			break;
+		got += n;
+	}
+	close(fd);
+	*len = got;
+	return buf;
+}
+
+/* check the records and deal them out to the streams */
+static int split_log(char *log, size_t len, struct stream *streams, int nstreams,
+		     size_t *nrecs)
+{
+	const struct nfsd_capture_rec *rec;
+	size_t off;
+
+	*nrecs = 0;
+	for (off = 0; off + sizeof(*rec) <= len; off += rec->cr_len) {
+		rec = (const struct nfsd_capture_rec *)(log + off);
+		if (rec->cr_version != NFSD_CAPTURE_VERSION ||
+		    rec->cr_len < sizeof(*rec) || rec->cr_len % 8 ||
+		    off + rec->cr_len > len ||
+		    sizeof(*rec) + rec->cr_fhlen + rec->cr_resfhlen +
+		    rec->cr_namelen > rec->cr_len ||
+		    rec->cr_proc >= NR_PROCS) {
+			fprintf(stderr, "nfsreplay: bad record at offset %zu\n",
+				off);
+			return -1;
+		}
+		if (rec->cr_count > max_count)
+			max_count = rec->cr_count;
+		if (stream_add(&streams[client_hash(rec) % nstreams], rec) < 0)
+			return -1;
+		(*nrecs)++;
+	}
+	return 0;
+}
+
+static int fh_from_ctlfile(const char *ctl, const char *client,
+			   const char *path, struct nfs_fh *fh)
+{
+	char buf[512];
+	ssize_t n;
+	int fd, len;
+
+	fd = open(ctl, O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "nfsreplay: %s: %s\n", ctl, strerror(errno));
+		return -1;
+	}
+	len = snprintf(buf, sizeof(buf), "%s %s %d\n", client, path,
+		       NFS3_FHSIZE);
+	if (write(fd, buf, len) != len) {
+		fprintf(stderr, "nfsreplay: %s %s: %s\n", client, path,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+	return nfs_parse_fh(buf, fh);
+}
+
+static void report(struct stream *streams, int nstreams, size_t nrecs,
+		   double secs, int json)
+{
+	struct proc_stats tot[NR_PROCS];
+	uint64_t ops = 0, mism = 0, skipped = 0, late = 0;
+	const char *sep = "";
+	int i, p;
+
+	memset(tot, 0, sizeof(tot));
+	for (i = 0; i < nstreams; i++) {
+		for (p = 0; p < NR_PROCS; p++) {
+			tot[p].ops += streams[i].stats[p].ops;
+			tot[p].mismatches += streams[i].stats[p].mismatches;
+			tot[p].sum_ns += streams[i].stats[p].sum_ns;
+			if (streams[i].stats[p].max_ns > tot[p].max_ns)
+				tot[p].max_ns = streams[i].stats[p].max_ns;
+		}
+		skipped += streams[i].skipped;
+		if (streams[i].max_late_ns > late)
+			late = streams[i].max_late_ns;
+	}
+	for (p = 0; p < NR_PROCS; p++) {
+		ops += tot[p].ops;
+		mism += tot[p].mismatches;
+	}
+
+	if (json) {
+		printf("{\"records\":%zu,\"replayed\":%" PRIu64 ",\"skipped\":%"
+		       PRIu64 ",\"status_mismatches\":%" PRIu64 ","
+		       "\"handles_mapped\":%lu,\"seconds\":%.3f,"
+		       "\"ops_per_sec\":%.1f,\"max_late_ms\":%.3f,\"procs\":{",
+		       nrecs, ops, skipped, mism, fh_mapped, secs, ops / secs,
+		       late / 1e6);
+		for (p = 0; p < NR_PROCS; p++) {
+			if (!tot[p].ops)
+				continue;
+			printf("%s\"%s\":{\"ops\":%" PRIu64 ",\"mismatches\":%"
+			       PRIu64 ",\"mean_us\":%.2f,\"max_us\":%.2f}",
+			       sep, procname[p], tot[p].ops, tot[p].mismatches,
+			       tot[p].sum_ns / 1e3 / tot[p].ops,
+			       tot[p].max_ns / 1e3);
+			sep = ",";
+		}
+		printf("}}\n");
+		return;
+	}
+
+	printf("nfsreplay: %zu records, %" PRIu64 " replayed, %" PRIu64
+	       " skipped, %" PRIu64 " status mismatches, %lu handles mapped\n",
+	       nrecs, ops, skipped, mism, fh_mapped);
+	printf("%.3f s, %.1f ops/s, at most %.3f ms behind schedule\n",
+	       secs, ops / secs, late / 1e6);
+	printf("%-12s %10s %10s %10s %10s\n", "proc", "ops", "mismatch",
+	       "mean_us", "max_us");
+	for (p = 0; p < NR_PROCS; p++) {
+		if (!tot[p].ops)
+			continue;
+		printf("%-12s %10" PRIu64 " %10" PRIu64 " %10.1f %10.1f\n",
+		       procname[p], tot[p].ops, tot[p].mismatches,
+		       tot[p].sum_ns / 1e3 / tot[p].ops, tot[p].max_ns / 1e3);
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+"usage: nfsreplay [options] LOGFILE\n"
+"  -s ADDR      server address (default 127.0.0.1)\n"
+"  -p PORT      server port (default 2049)\n"
+"  -P tcp|udp   transport (default tcp)\n"
+"  -c N         connections; clients are spread over them (default 8)\n"
+"  -x FACTOR    speed-up over the captured pacing; 0 for none (default 1)\n"
+"  -R HANDLE    root handle of the captured server, in hex\n"
+"  -r HANDLE    root handle of the live server, in hex\n"
+"  -e PATH      get the live root handle from the control file\n"
+"  -C CLIENT    client domain for -e (default *)\n"
+"  -F FILE      filehandle control file (default /proc/fs/nfsd/filehandle)\n"
+"  -u UID -g GID  AUTH_UNIX credentials (default: our own)\n"
+"  -j           report in JSON\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *host = "127.0.0.1", *export = NULL, *live = NULL;
+	const char *captured = NULL, *client = "*";
+	const char *ctl = "/proc/fs/nfsd/filehandle";
+	struct nfs_fh from, to;
+	struct stream *streams;
+	struct hostent *he;
+	unsigned int port = 2049;
+	int nstreams = 8, json = 0, failed = 0;
+	size_t len, nrecs;
+	uint64_t end;
+	char *log;
+	int c, i;
+
+	cred_uid = getuid();
+	cred_gid = getgid();
+	while ((c = getopt(argc, argv, "s:p:P:c:x:R:r:e:C:F:u:g:jh")) != -1) {
+		switch (c) {
+		case 's': host = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 'P':
+			if (!strcmp(optarg, "tcp"))
+				proto = IPPROTO_TCP;
+			else if (!strcmp(optarg, "udp"))
+				proto = IPPROTO_UDP;
+			else
+				usage();
+			break;
+		case 'c': nstreams = atoi(optarg); break;
+		case 'x': speed = atof(optarg); break;
+		case 'R': captured = optarg; break;
+		case 'r': live = optarg; break;
+		case 'e': export = optarg; break;
+		case 'C': client = optarg; break;
+		case 'F': ctl = optarg; break;
+		case 'u': cred_uid = atoi(optarg); break;
+		case 'g': cred_gid = atoi(optarg); break;
+		case 'j': json = 1; break;
+		default: usage();
+		}
+	}
+	if (optind != argc - 1 || nstreams < 1 || speed < 0 ||
+	    (live && export) || (!captured != !(live || export)))
+		usage();
+
+	server.sin_family = AF_INET;
+	server.sin_port = htons(port);
+	if (!inet_aton(host, &server.sin_addr)) {
+		he = gethostbyname(host);
+		if (!he || he->h_addrtype != AF_INET) {
+			fprintf(stderr, "nfsreplay: unknown host %s\n", host);
+			return 1;
+		}
+		memcpy(&server.sin_addr, he->h_addr_list[0], 4);
+	}
+
+	if (captured) {
+		if (nfs_parse_fh(captured, &from) < 0 ||
+		    (live ? nfs_parse_fh(live, &to) :
+			    fh_from_ctlfile(ctl, client, export, &to)) < 0) {
+			fprintf(stderr, "nfsreplay: bad root handle\n");
+			return 1;
+		}
+		fh_map_add(&from, &to);
+	}
+
+	log = read_log(argv[optind], &len);
+	streams = calloc(nstreams, sizeof(*streams));
+	if (!log || !streams)
+		return 1;
+	if (split_log(log, len, streams, nstreams, &nrecs) < 0)
+		return 1;
+	if (proto == IPPROTO_UDP && max_count > 32768)
+		fprintf(stderr, "nfsreplay: warning: %zu-byte transfers over UDP\n",
+			max_count);
+
+	pthread_barrier_init(&start_barrier, NULL, nstreams + 1);
+	for (i = 0; i < nstreams; i++) {
+		streams[i].id = i;
+		if (pthread_create(&streams[i].thread, NULL, stream_main,
+				   &streams[i])) {
+			fprintf(stderr, "nfsreplay: cannot start thread %d\n", i);
+			return 1;
+		}
+	}
+	start_ns = now_ns();
+	pthread_barrier_wait(&start_barrier);
+	for (i = 0; i < nstreams; i++) {
+		pthread_join(streams[i].thread, NULL);
+		failed |= streams[i].failed;
+	}
+	end = now_ns();
+
+	report(streams, nstreams, nrecs, (end - start_ns) / 1e9, json);
+	return failed;
+}
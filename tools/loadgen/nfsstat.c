@@ -0,0 +1,156 @@
+/*
+ * nfsstat: print the counters of bmw's "stats_page" file.
+ *
+ * The page is mapped once and read with the sp_seq protocol described
+ * in statpage.h, so scraping costs no system call.  Every -i seconds
+ * the calls, errors and latency percentiles of each procedure over the
+ * interval are printed, with the thread and cache counters; without -i
+ * the totals since the module was loaded are printed once.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "statpage.h"
+
+#define NR_PROCS	NFSD_STATPAGE_NPROCS
+
+static const char *procname[NR_PROCS] = {
+	"null", "getattr", "setattr", "lookup", "access", "readlink",
+	"read", "write", "create", "mkdir", "symlink", "mknod", "remove",
+	"rmdir", "rename", "link", "readdir", "readdirplus", "fsstat",
+	"fsinfo", "pathconf", "commit",
+};
+
+/* take a consistent copy of the page */
+static void snapshot(const volatile struct nfsd_statpage *page,
+		     struct nfsd_statpage *copy)
+{
+	uint32_t seq;
+
+	for (;;) {
+		seq = page->sp_seq;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		memcpy(copy, (const void *)page, sizeof(*copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (!(seq & 1) && seq == page->sp_seq)
+			return;
+	}
+}
+
+/* upper bound, in microseconds, of the bucket holding the @pct'th call */
+static uint64_t percentile(const uint64_t *hist, uint64_t total, double pct)
+{
+	uint64_t seen = 0, want = total * pct / 100;
+	int i;
+
+	for (i = 0; i < NFSD_STATPAGE_NBUCKETS; i++) {
+		seen += hist[i];
+		if (seen > want)
+			return 1ULL << i;
+	}
+	return 1ULL << (NFSD_STATPAGE_NBUCKETS - 1);
+}
+
+static double ratio(const struct nfsd_statpage_cache *now,
+		    const struct nfsd_statpage_cache *then)
+{
+	uint64_t hits = now->hits - then->hits;
+	uint64_t misses = now->misses - then->misses;
+
+	return hits + misses ? 100.0 * hits / (hits + misses) : 0;
+}
+
+static void report(const struct nfsd_statpage *now,
+		   const struct nfsd_statpage *then)
+{
+	uint64_t hist[NFSD_STATPAGE_NBUCKETS], ops, errors;
+	int p, i;
+
+	printf("threads %u busy %u\n", now->sp_threads, now->sp_busy);
+	printf("%-12s %10s %8s %9s %9s %9s\n", "proc", "ops", "errors",
+	       "p50_us", "p99_us", "p999_us");
+	for (p = 0; p < NR_PROCS; p++) {
+		ops = now->sp_ops[p] - then->sp_ops[p];
+		if (!ops)
+			continue;
+		for (i = 0; i < NFSD_STATPAGE_NBUCKETS; i++)
+			hist[i] = now->sp_latency[p][i] - then->sp_latency[p][i];
+		errors = now->sp_errors[p] - then->sp_errors[p];
+		printf("%-12s %10" PRIu64 " %8" PRIu64 " %9" PRIu64 " %9" PRIu64
+		       " %9" PRIu64 "\n", procname[p], ops, errors,
+		       percentile(hist, ops, 50), percentile(hist, ops, 99),
+		       percentile(hist, ops, 99.9));
+	}
+	printf("hit%%: negcache %.1f fhcache %.1f expkey %.1f export %.1f "
+	       "exp_memo %.1f\n\n",
+	       ratio(&now->sp_negcache, &then->sp_negcache),
+	       ratio(&now->sp_fhcache, &then->sp_fhcache),
+	       ratio(&now->sp_expkey, &then->sp_expkey),
+	       ratio(&now->sp_export, &then->sp_export),
+	       ratio(&now->sp_exp_memo, &then->sp_exp_memo));
+	fflush(stdout);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+"usage: nfsstat [options]\n"
+"  -f FILE      statistics page (default /proc/fs/nfsd/stats_page)\n"
+"  -i SECS      report every SECS seconds instead of once\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = "/proc/fs/nfsd/stats_page";
+	static struct nfsd_statpage now, then;
+	const struct nfsd_statpage *page;
+	int interval = 0, fd, c;
+
+	while ((c = getopt(argc, argv, "f:i:h")) != -1) {
+		switch (c) {
+		case 'f': path = optarg; break;
+		case 'i': interval = atoi(optarg); break;
+		default: usage();
+		}
+	}
+	if (optind != argc || interval < 0)
+		usage();
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "nfsstat: %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+	if (page == MAP_FAILED) {
+		fprintf(stderr, "nfsstat: mmap %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	close(fd);
+	if (page->sp_magic != NFSD_STATPAGE_MAGIC ||
+	    page->sp_version != NFSD_STATPAGE_VERSION ||
+	    page->sp_size < sizeof(*page)) {
+		fprintf(stderr, "nfsstat: %s: unknown layout\n", path);
+		return 1;
+	}
+
+	snapshot(page, &now);
+	if (!interval) {
+		report(&now, &then);
+		return 0;
+	}
+	for (;;) {
+		then = now;
+		sleep(interval);
+		snapshot(page, &now);
+		report(&now, &then);
+	}
+}
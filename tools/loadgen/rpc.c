@@ -0,0 +1,372 @@
+/*
+ * Minimal ONC RPC (RFC 5531) client for the load tools.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "rpc.h"
+
+#define RPC_CALL		0
+#define RPC_REPLY		1
+#define RPC_VERSION		2
+#define RPC_MSG_ACCEPTED	0
+#define RPC_SUCCESS		0
+#define RPC_AUTH_NULL		0
+#define RPC_AUTH_UNIX		1
+#define RPC_LAST_FRAG		0x80000000u
+
+#define XDR_QUADLEN(l)		(((l) + 3) >> 2)
+
+void xdr_put_u32(struct xdr *x, uint32_t v)
+{
+	if (x->p + 1 > x->end) {
+		x->err = 1;
+		return;
+	}
+	*x->p++ = htonl(v);
+}
+
+void xdr_put_u64(struct xdr *x, uint64_t v)
+{
+	xdr_put_u32(x, v >> 32);
+	xdr_put_u32(x, (uint32_t)v);
+}
+
+void xdr_put_opaque(struct xdr *x, const void *data, uint32_t len)
+{
+	uint32_t quads = XDR_QUADLEN(len);
+
+	if (x->p + 1 + quads > x->end) {
+		x->err = 1;
+		return;
+	}
+	*x->p++ = htonl(len);
+	if (quads) {
+		x->p[quads - 1] = 0;
+		memcpy(x->p, data, len);
+	}
+	x->p += quads;
+}
+
+void xdr_put_string(struct xdr *x, const char *s)
+{
+	xdr_put_opaque(x, s, strlen(s));
+}
+
+void xdr_put_fh(struct xdr *x, const struct nfs_fh *fh)
+{
+	xdr_put_opaque(x, fh->data, fh->len);
+}
+
+uint32_t xdr_get_u32(struct xdr *x)
+{
+	if (x->p + 1 > x->end) {
+		x->err = 1;
+		return 0;
+	}
+	return ntohl(*x->p++);
+}
+
+uint64_t xdr_get_u64(struct xdr *x)
+{
+	uint64_t hi = xdr_get_u32(x);
+
+	return hi << 32 | xdr_get_u32(x);
+}
+
+void xdr_skip(struct xdr *x, uint32_t words)
+{
+	if (x->p + words > x->end) {
+		x->err = 1;
+		x->p = x->end;
+		return;
+	}
+	x->p += words;
+}
+
+void xdr_skip_opaque(struct xdr *x)
+{
+	uint32_t len = xdr_get_u32(x);
+
+	xdr_skip(x, XDR_QUADLEN(len));
+}
+
+int xdr_get_fh(struct xdr *x, struct nfs_fh *fh)
+{
+	uint32_t len = xdr_get_u32(x);
+
+	if (x->err || len > NFS3_FHSIZE || x->p + XDR_QUADLEN(len) > x->end) {
+		x->err = 1;
+		return -1;
+	}
+	fh->len = len;
+	memcpy(fh->data, x->p, len);
+	x->p += XDR_QUADLEN(len);
+	return 0;
+}
+
+void xdr_skip_post_op_attr(struct xdr *x)
+{
+	if (xdr_get_u32(x))
+		xdr_skip(x, 21);
+}
+
+int rpc_connect(struct rpc_conn *c, const struct sockaddr_in *sin, int proto,
+		size_t bufsize)
+{
+	int one = 1;
+
+	memset(c, 0, sizeof(*c));
+	c->proto = proto;
+	c->timeout_ms = 1000;
+	c->retries = 5;
+	c->xid = (uint32_t)random();
+	c->callsize = c->replysize = bufsize;
+	c->call = malloc(bufsize);
+	c->reply = malloc(bufsize);
+	if (!c->call || !c->reply)
+		goto out_free;
+
+	c->fd = socket(AF_INET, proto == IPPROTO_TCP ? SOCK_STREAM : SOCK_DGRAM,
+		       proto);
+	if (c->fd < 0)
+		goto out_free;
+	if (proto == IPPROTO_TCP)
+		setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(c->fd, (const struct sockaddr *)sin, sizeof(*sin)) < 0)
+		goto out_close;
+	return 0;
+
+out_close:
+	close(c->fd);
+out_free:
+	free(c->call);
+	free(c->reply);
+	return -1;
+}
+
+void rpc_close(struct rpc_conn *c)
+{
+	close(c->fd);
+	free(c->call);
+	free(c->reply);
+}
+
+/*
+ * Start a call: write the call header and credentials into the call
+ * buffer and leave @x positioned for the procedure's arguments.
+ */
+void rpc_begin(struct rpc_conn *c, struct xdr *x, uint32_t prog,
+	       uint32_t vers, uint32_t proc)
+{
+	uint32_t *cred;
+
+	x->p = c->call + 1;
+	x->end = c->call + c->callsize / 4;
+	x->err = 0;
+
+	xdr_put_u32(x, ++c->xid);
+	xdr_put_u32(x, RPC_CALL);
+	xdr_put_u32(x, RPC_VERSION);
+	xdr_put_u32(x, prog);
+	xdr_put_u32(x, vers);
+	xdr_put_u32(x, proc);
+
+	xdr_put_u32(x, RPC_AUTH_UNIX);
+	cred = x->p;
+	xdr_put_u32(x, 0);			/* length, filled in below */
+	xdr_put_u32(x, 0);			/* stamp */
+	xdr_put_string(x, "nfsload");
+	xdr_put_u32(x, c->uid);
+	xdr_put_u32(x, c->gid);
+	xdr_put_u32(x, 0);			/* no supplementary groups */
+	*cred = htonl((x->p - cred - 1) * 4);
+
+	xdr_put_u32(x, RPC_AUTH_NULL);
+	xdr_put_u32(x, 0);
+}
+
+static int send_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int recv_all(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = recv(fd, p, len, 0);
+		if (n == 0) {
+			errno = ECONNRESET;
+			return -1;
+		}
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Send a complete call message of @len bytes.  On TCP the record mark
+ * is added here.
+ */
+int rpc_send_raw(struct rpc_conn *c, const void *msg, size_t len)
+{
+	uint32_t mark = htonl(RPC_LAST_FRAG | len);
+
+	c->sent = len;
+	if (c->proto != IPPROTO_TCP)
+		return send(c->fd, msg, len, 0) == (ssize_t)len ? 0 : -1;
+	if (msg == c->call + 1) {
+		/* the call buffer has room for the mark in front */
+		c->call[0] = mark;
+		return send_all(c->fd, c->call, len + 4);
+	}
+	if (send_all(c->fd, &mark, 4) < 0)
+		return -1;
+	return send_all(c->fd, msg, len);
+}
+
+/* read one TCP record into the reply buffer; excess is discarded */
+static ssize_t recv_record(struct rpc_conn *c)
+{
+	size_t total = 0, frag, keep;
+	uint32_t mark;
+	char discard[4096];
+
+	do {
+		if (recv_all(c->fd, &mark, 4) < 0)
+			return -1;
+		mark = ntohl(mark);
+		frag = mark & ~RPC_LAST_FRAG;
+		keep = frag;
+		if (total + keep > c->replysize)
+			keep = c->replysize - total;
+		if (recv_all(c->fd, (char *)c->reply + total, keep) < 0)
+			return -1;
+		total += keep;
+		for (frag -= keep; frag; frag -= keep) {
+			keep = frag < sizeof(discard) ? frag : sizeof(discard);
+			if (recv_all(c->fd, discard, keep) < 0)
+				return -1;
+		}
+	} while (!(mark & RPC_LAST_FRAG));
+	return total;
+}
+
+/*
+ * Wait for the reply to @xid and check its header; on success @res is
+ * positioned at the procedure's results.  Returns 0, -1 on transport
+ * errors or timeouts, or the RPC accept_stat / reject status (> 0).
+ */
+int rpc_recv_raw(struct rpc_conn *c, uint32_t xid, struct xdr *res)
+{
+	struct pollfd pfd = { .fd = c->fd, .events = POLLIN };
+	ssize_t len;
+	uint32_t stat;
+
+	for (;;) {
+		if (c->proto == IPPROTO_TCP) {
+			len = recv_record(c);
+		} else {
+			if (poll(&pfd, 1, c->timeout_ms) <= 0)
+				return -1;
+			len = recv(c->fd, c->reply, c->replysize, 0);
+		}
+		if (len < 0)
+			return -1;
+		c->received = len;
+
+		res->p = c->reply;
+		res->end = c->reply + len / 4;
+		res->err = 0;
+		if (xdr_get_u32(res) == xid)
+			break;
+		/* a late reply to an earlier, retransmitted call */
+	}
+
+	if (xdr_get_u32(res) != RPC_REPLY)
+		return -1;
+	if (xdr_get_u32(res) != RPC_MSG_ACCEPTED)
+		return 0x100 | xdr_get_u32(res);
+	xdr_get_u32(res);		/* verifier flavor */
+	xdr_skip_opaque(res);
+	stat = xdr_get_u32(res);
+	if (res->err)
+		return -1;
+	return stat;
+}
+
+/*
+ * Send the call built with rpc_begin() and wait for its reply.  UDP
+ * calls are retransmitted every timeout_ms, up to retries times.
+ */
+int rpc_call(struct rpc_conn *c, struct xdr *args, struct xdr *res)
+{
+	size_t len = (args->p - (c->call + 1)) * 4;
+	uint32_t xid = c->xid;
+	int tries, rv;
+
+	if (args->err) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	for (tries = 0; tries <= c->retries; tries++) {
+		if (rpc_send_raw(c, c->call + 1, len) < 0)
+			return -1;
+		rv = rpc_recv_raw(c, xid, res);
+		if (rv >= 0 || c->proto == IPPROTO_TCP)
+			return rv;
+	}
+	errno = ETIMEDOUT;
+	return -1;
+}
+
+/*
+ * Parse a file handle as printed by the filehandle control file
+ * ("\x0100..."), or as plain hex.
+ */
+int nfs_parse_fh(const char *s, struct nfs_fh *fh)
+{
+	unsigned int byte;
+	size_t len;
+
+	if (s[0] == '\\' && s[1] == 'x')
+		s += 2;
+	len = strcspn(s, "\n \t");
+	if (len % 2 || len / 2 > NFS3_FHSIZE || len == 0)
+		return -1;
+	for (fh->len = 0; fh->len < len / 2; fh->len++) {
+		if (sscanf(s + 2 * fh->len, "%2x", &byte) != 1)
+			return -1;
+		fh->data[fh->len] = byte;
+	}
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * Minimal ONC RPC client for the load tools: one outstanding call per
+ * connection, AUTH_UNIX credentials, TCP (with record marking) or UDP
+ * (with retransmission).
+ */
+#ifndef LOADGEN_RPC_H
+#define LOADGEN_RPC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#define NFS_PROGRAM	100003
+#define NFS_V3		3
+#define NFS3_FHSIZE	64
+
+enum nfs3_proc {
+	NFS3PROC_NULL		= 0,
+	NFS3PROC_GETATTR	= 1,
+	NFS3PROC_SETATTR	= 2,
+	NFS3PROC_LOOKUP		= 3,
+	NFS3PROC_ACCESS		= 4,
+	NFS3PROC_READLINK	= 5,
+	NFS3PROC_READ		= 6,
+	NFS3PROC_WRITE		= 7,
+	NFS3PROC_CREATE		= 8,
+	NFS3PROC_MKDIR		= 9,
+	NFS3PROC_SYMLINK	= 10,
+	NFS3PROC_MKNOD		= 11,
+	NFS3PROC_REMOVE		= 12,
+	NFS3PROC_RMDIR		= 13,
+	NFS3PROC_RENAME		= 14,
+	NFS3PROC_LINK		= 15,
+	NFS3PROC_READDIR	= 16,
+	NFS3PROC_READDIRPLUS	= 17,
+	NFS3PROC_FSSTAT		= 18,
+	NFS3PROC_FSINFO		= 19,
+	NFS3PROC_PATHCONF	= 20,
+	NFS3PROC_COMMIT		= 21,
+};
+
+struct nfs_fh {
+	uint32_t	len;
+	unsigned char	data[NFS3_FHSIZE];
+};
+
+/* an XDR cursor; err is set, and the cursor stops, on overrun */
+struct xdr {
+	uint32_t	*p;
+	uint32_t	*end;
+	int		err;
+};
+
+void		xdr_put_u32(struct xdr *, uint32_t);
+void		xdr_put_u64(struct xdr *, uint64_t);
+void		xdr_put_opaque(struct xdr *, const void *, uint32_t);
+void		xdr_put_string(struct xdr *, const char *);
+void		xdr_put_fh(struct xdr *, const struct nfs_fh *);
+uint32_t	xdr_get_u32(struct xdr *);
+uint64_t	xdr_get_u64(struct xdr *);
+void		xdr_skip(struct xdr *, uint32_t words);
+void		xdr_skip_opaque(struct xdr *);
+int		xdr_get_fh(struct xdr *, struct nfs_fh *);
+void		xdr_skip_post_op_attr(struct xdr *);
+
+struct rpc_conn {
+	int		fd;
+	int		proto;		/* IPPROTO_TCP or IPPROTO_UDP */
+	uint32_t	xid;
+	uint32_t	uid;
+	uint32_t	gid;
+	int		timeout_ms;	/* UDP retransmit interval */
+	int		retries;	/* UDP retransmits before giving up */
+	uint32_t	*call;		/* call[0] is the TCP record mark */
+	size_t		callsize;	/* bytes, including the mark */
+	uint32_t	*reply;
+	size_t		replysize;
+	size_t		sent;		/* bytes on the wire for the last call */
+	size_t		received;	/* ... and its reply */
+};
+
+int	rpc_connect(struct rpc_conn *, const struct sockaddr_in *, int proto,
+		    size_t bufsize);
+void	rpc_close(struct rpc_conn *);
+void	rpc_begin(struct rpc_conn *, struct xdr *, uint32_t prog,
+		  uint32_t vers, uint32_t proc);
+int	rpc_call(struct rpc_conn *, struct xdr *args, struct xdr *res);
+int	rpc_send_raw(struct rpc_conn *, const void *, size_t);
+int	rpc_recv_raw(struct rpc_conn *, uint32_t xid, struct xdr *res);
+
+int	nfs_parse_fh(const char *, struct nfs_fh *);
+
+#endif /* LOADGEN_RPC_H */
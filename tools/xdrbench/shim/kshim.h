@@ -0,0 +1,572 @@
+/*
+ * Just enough of the kernel to compile xdr.c, and the headers it pulls
+ * in, as an ordinary userspace program.
+ *
+ * Every <linux/...>, <net/...> and <uapi/...> header the module's own
+ * headers include is a one-line file under shim/ that includes this
+ * one.  Types only carry the members the codecs touch; functions that
+ * live outside xdr.c are declared here and defined in stubs.c.
+ *
+ * Don't include <errno.h> (export.h has a parameter called errno) or
+ * <sys/stat.h> (it drags in the real <linux/stat.h>) after this.
+ */
+#ifndef XDRBENCH_KSHIM_H
+#define XDRBENCH_KSHIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+
+/* basic types */
+
+typedef uint8_t		u8;
+typedef uint16_t	u16;
+typedef uint32_t	u32;
+typedef uint64_t	u64;
+typedef int32_t		s32;
+typedef int64_t		s64;
+typedef uint8_t		__u8;
+typedef uint16_t	__u16;
+typedef uint32_t	__u32;
+typedef uint64_t	__u64;
+typedef int32_t		__s32;
+typedef int64_t		__s64;
+typedef uint32_t	__be32;
+typedef uint64_t	__be64;
+typedef unsigned short	umode_t;
+typedef s64		time64_t;
+
+#define __force
+#define __percpu
+#define __user
+#define __init
+#define __exit
+#define __inline__	inline
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+#define cpu_to_be32(x)	((__be32)htonl(x))
+#define be32_to_cpu(x)	((u32)ntohl(x))
+
+#define min(a, b)	({ typeof(a) _a = (a); typeof(b) _b = (b); \
+			   _a < _b ? _a : _b; })
+#define max(a, b)	({ typeof(a) _a = (a); typeof(b) _b = (b); \
+			   _a > _b ? _a : _b; })
+#define min_t(t, a, b)	({ t _a = (a); t _b = (b); _a < _b ? _a : _b; })
+#define max_t(t, a, b)	({ t _a = (a); t _b = (b); _a > _b ? _a : _b; })
+#define ALIGN(x, a)	(((x) + (a) - 1) & ~((typeof(x))(a) - 1))
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define BUG()		abort()
+#define BUG_ON(c)	do { if (c) abort(); } while (0)
+#define WARN_ON(c)	({ int _c = !!(c); if (_c) \
+			   fprintf(stderr, "WARN_ON(%s) at %s:%d\n", \
+				   #c, __FILE__, __LINE__); _c; })
+
+/* the module logs liberally; keep that out of the measurements */
+#define KERN_INFO	""
+#define KERN_WARNING	""
+#define KERN_ERR	""
+#define printk(fmt, ...)	((void)0)
+#define dprintk(fmt, ...)	((void)0)
+
+#define EPERM		1
+#define ENOENT		2
+#define EIO		5
+#define ENOMEM		12
+#define EACCES		13
+#define EEXIST		17
+#define ENOTDIR		20
+#define EINVAL		22
+#define ENOSPC		28
+#define EROFS		30
+#define ENAMETOOLONG	36
+#define ESTALE		116
+
+#define MAX_ERRNO	4095
+#define IS_ERR_VALUE(x)	((unsigned long)(void *)(x) >= (unsigned long)-MAX_ERRNO)
+static inline void *ERR_PTR(long error) { return (void *)error; }
+static inline long PTR_ERR(const void *ptr) { return (long)ptr; }
+static inline bool IS_ERR(const void *ptr) { return IS_ERR_VALUE(ptr); }
+#define ERR_CAST(p)	((void *)(p))
+
+/* atomics, locks and other things that only need to exist */
+
+typedef struct { int counter; } atomic_t;
+typedef struct { int dummy; } spinlock_t;
+typedef struct { int dummy; } wait_queue_head_t;
+struct kref { atomic_t refcount; };
+struct list_head { struct list_head *next, *prev; };
+struct hlist_node { struct hlist_node *next, **pprev; };
+struct rhash_head { struct rhash_head *next; };
+struct rcu_head { struct rcu_head *next; void (*func)(struct rcu_head *); };
+struct rhashtable { atomic_t nelems; };
+struct timespec64 { time64_t tv_sec; long tv_nsec; };
+
+/* credentials */
+
+typedef struct { uid_t val; } kuid_t;
+typedef struct { gid_t val; } kgid_t;
+struct user_namespace { int dummy; };
+extern struct user_namespace init_user_ns;
+
+static inline kuid_t make_kuid(struct user_namespace *ns, uid_t uid)
+{
+	return (kuid_t){ uid };
+}
+static inline kgid_t make_kgid(struct user_namespace *ns, gid_t gid)
+{
+	return (kgid_t){ gid };
+}
+static inline uid_t from_kuid(struct user_namespace *ns, kuid_t uid)
+{
+	return uid.val;
+}
+static inline gid_t from_kgid(struct user_namespace *ns, kgid_t gid)
+{
+	return gid.val;
+}
+static inline uid_t from_kuid_munged(struct user_namespace *ns, kuid_t uid)
+{
+	return uid.val;
+}
+static inline gid_t from_kgid_munged(struct user_namespace *ns, kgid_t gid)
+{
+	return gid.val;
+}
+static inline bool uid_valid(kuid_t uid) { return uid.val != (uid_t)-1; }
+static inline bool gid_valid(kgid_t gid) { return gid.val != (gid_t)-1; }
+
+/* pages: a page is its own address */
+
+#define PAGE_SHIFT	12
+#define PAGE_SIZE	(1UL << PAGE_SHIFT)
+struct page { unsigned char data[PAGE_SIZE]; } __attribute__((aligned(4096)));
+static inline void *page_address(struct page *page) { return page; }
+
+/* VFS */
+
+#define MINORBITS	20
+#define MINORMASK	((1U << MINORBITS) - 1)
+#define MAJOR(dev)	((unsigned int)((dev) >> MINORBITS))
+#define MINOR(dev)	((unsigned int)((dev) & MINORMASK))
+#define MKDEV(ma, mi)	(((ma) << MINORBITS) | (mi))
+
+#define S_IFMT		00170000
+#define S_IFSOCK	0140000
+#define S_IFLNK		0120000
+#define S_IFREG		0100000
+#define S_IFBLK		0060000
+#define S_IFDIR		0040000
+#define S_IFCHR		0020000
+#define S_IFIFO		0010000
+#define S_ISUID		0004000
+#define S_ISGID		0002000
+#define S_ISVTX		0001000
+#define S_ISLNK(m)	(((m) & S_IFMT) == S_IFLNK)
+#define S_ISREG(m)	(((m) & S_IFMT) == S_IFREG)
+#define S_ISDIR(m)	(((m) & S_IFMT) == S_IFDIR)
+#define S_ISCHR(m)	(((m) & S_IFMT) == S_IFCHR)
+#define S_ISBLK(m)	(((m) & S_IFMT) == S_IFBLK)
+#define S_ISFIFO(m)	(((m) & S_IFMT) == S_IFIFO)
+#define S_ISSOCK(m)	(((m) & S_IFMT) == S_IFSOCK)
+#define S_IRWXUGO	0777
+#define S_IALLUGO	(S_ISUID|S_ISGID|S_ISVTX|S_IRWXUGO)
+#define S_IWUSR		00200
+#define S_IRUSR		00400
+
+#define ATTR_MODE	(1 << 0)
+#define ATTR_UID	(1 << 1)
+#define ATTR_GID	(1 << 2)
+#define ATTR_SIZE	(1 << 3)
+#define ATTR_ATIME	(1 << 4)
+#define ATTR_MTIME	(1 << 5)
+#define ATTR_CTIME	(1 << 6)
+#define ATTR_ATIME_SET	(1 << 7)
+#define ATTR_MTIME_SET	(1 << 8)
+
+#define MAY_EXEC	0x00000001
+#define MAY_WRITE	0x00000002
+#define MAY_READ	0x00000004
+
+struct super_block {
+	dev_t			s_dev;
+	unsigned char		s_uuid[16];
+};
+
+struct inode {
+	umode_t			i_mode;
+	unsigned long		i_ino;
+	u32			i_generation;
+	struct timespec		i_ctime;
+	u64			i_version;
+	struct super_block *	i_sb;
+};
+
+struct dentry {
+	struct inode *		d_inode;
+	struct dentry *		d_parent;
+	struct super_block *	d_sb;
+};
+
+struct vfsmount {
+	struct dentry *		mnt_root;
+	struct super_block *	mnt_sb;
+};
+
+struct path {
+	struct vfsmount *	mnt;
+	struct dentry *		dentry;
+};
+
+struct file;
+struct kstat {
+	u64			ino;
+	dev_t			dev;
+	umode_t			mode;
+	unsigned int		nlink;
+	kuid_t			uid;
+	kgid_t			gid;
+	dev_t			rdev;
+	loff_t			size;
+	struct timespec		atime;
+	struct timespec		mtime;
+	struct timespec		ctime;
+	unsigned long		blksize;
+	unsigned long long	blocks;
+};
+
+struct kstatfs {
+	long			f_type;
+	long			f_bsize;
+	u64			f_blocks;
+	u64			f_bfree;
+	u64			f_bavail;
+	u64			f_files;
+	u64			f_ffree;
+	long			f_namelen;
+};
+
+struct iattr {
+	unsigned int		ia_valid;
+	umode_t			ia_mode;
+	kuid_t			ia_uid;
+	kgid_t			ia_gid;
+	loff_t			ia_size;
+	struct timespec		ia_atime;
+	struct timespec		ia_mtime;
+	struct timespec		ia_ctime;
+};
+
+typedef int (*filldir_t)(void *, const char *, int, loff_t, u64, unsigned);
+
+static inline bool path_equal(const struct path *a, const struct path *b)
+{
+	return a->mnt == b->mnt && a->dentry == b->dentry;
+}
+static inline bool timespec_equal(const struct timespec *a,
+				  const struct timespec *b)
+{
+	return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+int		vfs_getattr(const struct path *, struct kstat *);
+void		lease_get_mtime(struct inode *, struct timespec *);
+struct dentry *	lookup_one_len_unlocked(const char *, struct dentry *, int);
+struct dentry *	dget(struct dentry *);
+struct dentry *	dget_parent(struct dentry *);
+void		dput(struct dentry *);
+bool		d_mountpoint(struct dentry *);
+int		mnt_want_write(struct vfsmount *);
+void		mnt_drop_write(struct vfsmount *);
+
+/* cycle counter, for the stage timing in stats.h */
+
+typedef u64		cycles_t;
+#if defined(__x86_64__) || defined(__i386__)
+#define get_cycles()	((cycles_t)__builtin_ia32_rdtsc())
+#else
+#define get_cycles()	((cycles_t)0)
+#endif
+
+/* network namespaces */
+
+struct net { void *gen; };
+static inline void *net_generic(const struct net *net, int id)
+{
+	return net->gen;
+}
+
+/* sunrpc */
+
+#define XDR_UNIT		4
+#define XDR_QUADLEN(l)		(((l) + 3) >> 2)
+#define xdr_zero		cpu_to_be32(0)
+#define xdr_one			cpu_to_be32(1)
+#define RPCSVC_MAXPAYLOAD	(1*1024*1024u)
+#define RPCSVC_MAXPAGES		((RPCSVC_MAXPAYLOAD+PAGE_SIZE-1)/PAGE_SIZE + 2 + 1)
+#define RPC_MAX_AUTH_SIZE	400
+#define RPC_CALLHDRSIZE		6
+#define RPC_MAX_HEADER_WITH_AUTH \
+	(RPC_CALLHDRSIZE + 2*(2+RPC_MAX_AUTH_SIZE/4))
+
+struct kvec {
+	void *			iov_base;
+	size_t			iov_len;
+};
+
+struct xdr_buf {
+	struct kvec		head[1];
+	struct kvec		tail[1];
+	struct page **		pages;
+	unsigned int		page_base;
+	unsigned int		page_len;
+	unsigned int		buflen;
+	unsigned int		len;
+};
+
+struct auth_domain {
+	struct kref		ref;
+	char *			name;
+};
+
+struct cache_head {
+	struct hlist_node	cache_list;
+	time_t			expiry_time;
+	time_t			last_refresh;
+	struct kref		ref;
+	unsigned long		flags;
+};
+
+struct cache_detail {
+	struct net *		net;
+	int			hash_size;
+	char *			name;
+};
+
+struct cache_req { int dummy; };
+
+static inline struct cache_head *cache_get(struct cache_head *h)
+{
+	return h;
+}
+static inline void cache_put(struct cache_head *h, struct cache_detail *cd)
+{
+}
+
+struct svc_program;
+struct svc_version;
+struct svc_serv;
+
+/*
+ * Only what the codecs use.  rq_net and rq_max_payload stand in for
+ * rq_xprt->xpt_net and the transport/server payload limits.
+ */
+struct svc_rqst {
+	struct xdr_buf		rq_arg;
+	struct xdr_buf		rq_res;
+	struct page *		rq_pages[RPCSVC_MAXPAGES + 1];
+	struct page **		rq_respages;
+	struct page **		rq_next_page;
+	struct kvec		rq_vec[RPCSVC_MAXPAGES];
+	void *			rq_argp;
+	void *			rq_resp;
+	u32			rq_vers;
+	u32			rq_proc;
+	struct auth_domain *	rq_client;
+	struct cache_req	rq_chandle;
+	unsigned long		rq_flags;
+
+	struct net *		rq_net;
+	u32			rq_max_payload;
+};
+
+#define SVC_NET(rqstp)		((rqstp)->rq_net)
+
+static inline u32 svc_max_payload(const struct svc_rqst *rqstp)
+{
+	return rqstp->rq_max_payload;
+}
+
+static inline __be32 *xdr_encode_hyper(__be32 *p, u64 val)
+{
+	*p++ = htonl(val >> 32);
+	*p++ = htonl(val & 0xffffffff);
+	return p;
+}
+
+static inline __be32 *xdr_decode_hyper(__be32 *p, u64 *valp)
+{
+	*valp = ((u64)ntohl(*p++)) << 32;
+	*valp |= ntohl(*p++);
+	return p;
+}
+
+static inline __be32 *xdr_encode_opaque(__be32 *p, const void *ptr,
+					unsigned int nbytes)
+{
+	unsigned int quadlen = XDR_QUADLEN(nbytes);
+
+	*p++ = htonl(nbytes);
+	if (nbytes) {
+		p[quadlen - 1] = 0;
+		memcpy(p, ptr, nbytes);
+	}
+	return p + quadlen;
+}
+
+static inline __be32 *xdr_encode_array(__be32 *p, const void *array,
+				       unsigned int len)
+{
+	return xdr_encode_opaque(p, array, len);
+}
+
+static inline __be32 *xdr_decode_string_inplace(__be32 *p, char **sp,
+						unsigned int *lenp,
+						unsigned int maxlen)
+{
+	u32 len = ntohl(*p++);
+
+	if (len > maxlen)
+		return NULL;
+	*lenp = len;
+	*sp = (char *)p;
+	return p + XDR_QUADLEN(len);
+}
+
+static inline int xdr_argsize_check(struct svc_rqst *rqstp, __be32 *p)
+{
+	char *cp = (char *)p;
+	struct kvec *vec = &rqstp->rq_arg.head[0];
+
+	return cp >= (char *)vec->iov_base &&
+		cp <= (char *)vec->iov_base + vec->iov_len;
+}
+
+static inline int xdr_ressize_check(struct svc_rqst *rqstp, __be32 *p)
+{
+	struct kvec *vec = &rqstp->rq_res.head[0];
+	char *cp = (char *)p;
+
+	vec->iov_len = cp - (char *)vec->iov_base;
+	return vec->iov_len <= PAGE_SIZE;
+}
+
+/* NFS protocol constants, from <linux/nfs.h> and <linux/nfs3.h> */
+
+#define NFS_FHSIZE		32
+#define NFS4_FHSIZE		128
+#define NFS3_FHSIZE		64
+#define NFS3_MAXNAMLEN		255
+#define NFS3_MAXPATHLEN		1024
+#define NFS_OFFSET_MAX		((__s64)((~(__u64)0) >> 1))
+#define NFS3PROC_COMMIT		21
+
+enum nfs3_createmode {
+	NFS3_CREATE_UNCHECKED = 0,
+	NFS3_CREATE_GUARDED = 1,
+	NFS3_CREATE_EXCLUSIVE = 2
+};
+
+enum nfs3_ftype {
+	NF3NON = 0,
+	NF3REG = 1,
+	NF3DIR = 2,
+	NF3BLK = 3,
+	NF3CHR = 4,
+	NF3LNK = 5,
+	NF3SOCK = 6,
+	NF3FIFO = 7,
+	NF3BAD = 8
+};
+
+enum nfs_stat {
+	NFS_OK = 0,
+	NFSERR_PERM = 1,
+	NFSERR_NOENT = 2,
+	NFSERR_IO = 5,
+	NFSERR_NXIO = 6,
+	NFSERR_EAGAIN = 11,
+	NFSERR_ACCES = 13,
+	NFSERR_EXIST = 17,
+	NFSERR_XDEV = 18,
+	NFSERR_NODEV = 19,
+	NFSERR_NOTDIR = 20,
+	NFSERR_ISDIR = 21,
+	NFSERR_INVAL = 22,
+	NFSERR_FBIG = 27,
+	NFSERR_NOSPC = 28,
+	NFSERR_ROFS = 30,
+	NFSERR_MLINK = 31,
+	NFSERR_NAMETOOLONG = 63,
+	NFSERR_NOTEMPTY = 66,
+	NFSERR_DQUOT = 69,
+	NFSERR_STALE = 70,
+	NFSERR_REMOTE = 71,
+	NFSERR_WFLUSH = 99,
+	NFSERR_BADHANDLE = 10001,
+	NFSERR_NOT_SYNC = 10002,
+	NFSERR_BAD_COOKIE = 10003,
+	NFSERR_NOTSUPP = 10004,
+	NFSERR_TOOSMALL = 10005,
+	NFSERR_SERVERFAULT = 10006,
+	NFSERR_BADTYPE = 10007,
+	NFSERR_JUKEBOX = 10008,
+};
+
+/* export flags, from <uapi/linux/nfsd/export.h> */
+
+#define NFSEXP_READONLY		0x0001
+#define NFSEXP_INSECURE_PORT	0x0002
+#define NFSEXP_ROOTSQUASH	0x0004
+#define NFSEXP_ALLSQUASH	0x0008
+#define NFSEXP_ASYNC		0x0010
+#define NFSEXP_NOSUBTREECHECK	0x0400
+#define NFSEXP_FSID		0x2000
+#define NFSEXP_ALLFLAGS		0x3FEFF
+
+/* the on-the-wire handle, from <uapi/linux/nfsd/nfsfh.h> */
+
+struct nfs_fhbase_old {
+	__u32		fb_dcookie;
+	__u32		fb_ino;
+	__u32		fb_dirino;
+	__u32		fb_dev;
+	__u32		fb_xdev;
+	__u32		fb_xino;
+	__u32		fb_generation;
+};
+
+struct nfs_fhbase_new {
+	__u8		fb_version;
+	__u8		fb_auth_type;
+	__u8		fb_fsid_type;
+	__u8		fb_fileid_type;
+	__u32		fb_auth[1];
+};
+
+struct knfsd_fh {
+	unsigned int	fh_size;
+	union {
+		struct nfs_fhbase_old	fh_old;
+		__u32			fh_pad[NFS4_FHSIZE/4];
+		struct nfs_fhbase_new	fh_new;
+	} fh_base;
+};
+
+#define	fh_version		fh_base.fh_new.fb_version
+#define	fh_fsid_type		fh_base.fh_new.fb_fsid_type
+#define	fh_auth_type		fh_base.fh_new.fb_auth_type
+#define	fh_fileid_type		fh_base.fh_new.fb_fileid_type
+#define	fh_auth			fh_base.fh_new.fb_auth
+#define	fh_fsid			fh_base.fh_new.fb_auth
+
+#endif /* XDRBENCH_KSHIM_H */
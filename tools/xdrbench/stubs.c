@@ -0,0 +1,159 @@
+/*
+ * Userspace stand-ins for the kernel and module functions xdr.c calls.
+ *
+ * They do the least that lets the codecs run: no locking, no reference
+ * counting, and file handles are composed from the inode number alone.
+ */
+#include "stubs.h"
+
+struct user_namespace	init_user_ns;
+int			nfsd_net_id;
+
+struct super_block	xb_sb = { .s_dev = MKDEV(8, 1) };
+struct inode		xb_dir_inode = {
+	.i_mode		= S_IFDIR | 0755,
+	.i_ino		= 2,
+	.i_sb		= &xb_sb,
+};
+struct inode		xb_file_inode = {
+	.i_mode		= S_IFREG | 0644,
+	.i_ino		= 4242,
+	.i_sb		= &xb_sb,
+};
+struct dentry		xb_dir = {
+	.d_inode	= &xb_dir_inode,
+	.d_parent	= &xb_dir,
+	.d_sb		= &xb_sb,
+};
+struct dentry		xb_file = {
+	.d_inode	= &xb_file_inode,
+	.d_parent	= &xb_dir,
+	.d_sb		= &xb_sb,
+};
+struct vfsmount		xb_mnt = { .mnt_root = &xb_dir, .mnt_sb = &xb_sb };
+struct svc_export	xb_export = {
+	.ex_path	= { .mnt = &xb_mnt, .dentry = &xb_dir },
+	.ex_flags	= NFSEXP_NOSUBTREECHECK,
+};
+struct nfsd_net		xb_nn = {
+	.nfssvc_boot	= { .tv_sec = 1500000000, .tv_nsec = 123456789 },
+};
+struct net		xb_net = { .gen = &xb_nn };
+
+struct kstat		xb_attr = {
+	.ino		= 4242,
+	.dev		= MKDEV(8, 1),
+	.mode		= S_IFREG | 0644,
+	.nlink		= 1,
+	.size		= 8192,
+	.blksize	= 4096,
+	.blocks		= 16,
+	.atime		= { 1500000001, 1 },
+	.mtime		= { 1500000002, 2 },
+	.ctime		= { 1500000003, 3 },
+};
+u64			xb_lookup_ino = 4242;
+unsigned int		xb_fh_size = 28;
+
+/* lookups in any directory find this, with the inode number of the moment */
+static struct inode	xb_found_inode = {
+	.i_mode		= S_IFREG | 0644,
+	.i_sb		= &xb_sb,
+};
+static struct dentry	xb_found = {
+	.d_inode	= &xb_found_inode,
+	.d_parent	= &xb_dir,
+	.d_sb		= &xb_sb,
+};
+
+static void xb_fh_fill(struct svc_fh *fhp, struct dentry *dentry)
+{
+	struct knfsd_fh *fh = &fhp->fh_handle;
+	u32 ino = dentry->d_inode->i_ino;
+	unsigned int i;
+
+	memset(&fh->fh_base, 0, sizeof(fh->fh_base));
+	fh->fh_size = xb_fh_size;
+	fh->fh_version = 1;
+	fh->fh_fsid_type = FSID_DEV;
+	for (i = 1; i < xb_fh_size / 4; i++)
+		fh->fh_base.fh_pad[i] = ino + i;
+}
+
+void xb_fh_attach(struct svc_fh *fhp, struct dentry *dentry)
+{
+	fh_init(fhp, NFS3_FHSIZE);
+	fhp->fh_dentry = dentry;
+	fhp->fh_export = &xb_export;
+	xb_fh_fill(fhp, dentry);
+}
+
+__be32 nfserrno(int errno)
+{
+	return errno ? cpu_to_be32(NFSERR_IO) : 0;
+}
+
+int vfs_getattr(const struct path *path, struct kstat *stat)
+{
+	struct inode *inode = path->dentry->d_inode;
+
+	*stat = xb_attr;
+	stat->ino = inode->i_ino;
+	stat->mode = inode->i_mode;
+	return 0;
+}
+
+void lease_get_mtime(struct inode *inode, struct timespec *time)
+{
+}
+
+struct dentry *lookup_one_len_unlocked(const char *name, struct dentry *base,
+				       int len)
+{
+	xb_found_inode.i_ino = xb_lookup_ino;
+	return &xb_found;
+}
+
+struct dentry *dget(struct dentry *dentry)
+{
+	return dentry;
+}
+
+struct dentry *dget_parent(struct dentry *dentry)
+{
+	return dentry->d_parent;
+}
+
+void dput(struct dentry *dentry)
+{
+}
+
+bool d_mountpoint(struct dentry *dentry)
+{
+	return false;
+}
+
+int mnt_want_write(struct vfsmount *mnt)
+{
+	return 0;
+}
+
+void mnt_drop_write(struct vfsmount *mnt)
+{
+}
+
+__be32 fh_compose(struct svc_fh *fhp, struct svc_export *exp,
+		  struct dentry *dentry, struct svc_fh *ref_fh)
+{
+	fhp->fh_dentry = dentry;
+	fhp->fh_export = exp;
+	xb_fh_fill(fhp, dentry);
+	return 0;
+}
+
+void fh_put(struct svc_fh *fhp)
+{
+	fhp->fh_dentry = NULL;
+	fhp->fh_export = NULL;
+	fhp->fh_post_saved = false;
+}
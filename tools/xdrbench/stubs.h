@@ -0,0 +1,30 @@
+/*
+ * A tiny fake filesystem for the codecs to look at.
+ *
+ * xb_export exports xb_dir; xb_file is a regular file in it.  The
+ * stubs in stubs.c answer getattr from xb_attr, and a name lookup in
+ * any directory finds a file whose inode number is xb_lookup_ino, so
+ * that READDIRPLUS entries can be made to match.
+ */
+#ifndef XDRBENCH_STUBS_H
+#define XDRBENCH_STUBS_H
+
+#include "nfsd.h"
+#include "nfsfh.h"
+#include "netns.h"
+
+extern struct super_block	xb_sb;
+extern struct vfsmount		xb_mnt;
+extern struct inode		xb_dir_inode, xb_file_inode;
+extern struct dentry		xb_dir, xb_file;
+extern struct svc_export	xb_export;
+extern struct nfsd_net		xb_nn;
+extern struct net		xb_net;
+
+extern struct kstat		xb_attr;
+extern u64			xb_lookup_ino;
+extern unsigned int		xb_fh_size;
+
+void	xb_fh_attach(struct svc_fh *, struct dentry *);
+
+#endif /* XDRBENCH_STUBS_H */
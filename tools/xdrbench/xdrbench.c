@@ -0,0 +1,1140 @@
+/*
+ * xdrbench - userspace tests and microbenchmarks for the NFSv3 codecs.
+ *
+ * xdr.c is compiled straight into this program, against the kernel
+ * shims in shim/ and the stand-ins in stubs.c, so its static helpers
+ * (decode_file_handle(), encode_fattr3(), ...) can be called directly.
+ *
+ * The tests build arguments and check results word by word against the
+ * XDR layouts in RFC 1813.  The benchmarks run each codec in a loop and
+ * report the time per call and the number of XDR bytes it consumed or
+ * produced.
+ *
+ * Usage: xdrbench [-t | -b] [-n iterations] [name...]
+ *	-t	run the tests only
+ *	-b	run the benchmarks only
+ *	-n	fixed number of benchmark iterations (default: calibrate
+ *		to about 100ms per codec)
+ *	name	only run tests and benchmarks whose name contains this
+ *
+ * Exits with status 1 if any test failed.
+ */
+#include "xdr.c"
+#include "stubs.h"
+
+#include <getopt.h>
+
+/*
+ * Request fixture
+ */
+
+static struct svc_rqst		rq;
+static union nfsd3_xdrstore	xb_args, xb_res;
+static struct page *		argpage;
+
+/* a scratch buffer for building XDR arguments */
+struct xb_wire {
+	__be32			*start;
+	__be32			*p;
+};
+
+static void wire_begin(struct xb_wire *w)
+{
+	memset(argpage, 0xa5, PAGE_SIZE);
+	w->start = w->p = page_address(argpage);
+}
+
+static void put32(struct xb_wire *w, u32 v)
+{
+	*w->p++ = htonl(v);
+}
+
+static void put64(struct xb_wire *w, u64 v)
+{
+	w->p = xdr_encode_hyper(w->p, v);
+}
+
+static void putopaque(struct xb_wire *w, const void *data, unsigned int len)
+{
+	w->p = xdr_encode_opaque(w->p, data, len);
+}
+
+static void putfh(struct xb_wire *w, unsigned int size)
+{
+	unsigned char fh[NFS3_FHSIZE + 4];
+	unsigned int i;
+
+	for (i = 0; i < sizeof(fh); i++)
+		fh[i] = i + 1;
+	putopaque(w, fh, size);
+}
+
+/*
+ * Point rq_arg at what was built in @w, and give the request a fresh
+ * set of reply pages, as svc_recv() would.
+ */
+static void rq_args(struct xb_wire *w)
+{
+	rq.rq_arg.head[0].iov_base = w->start;
+	rq.rq_arg.head[0].iov_len = (w->p - w->start) * 4;
+	rq.rq_arg.page_len = 0;
+	rq.rq_arg.tail[0].iov_len = 0;
+	rq.rq_arg.len = rq.rq_arg.head[0].iov_len;
+	rq.rq_respages = rq.rq_pages + 1;
+	rq.rq_next_page = rq.rq_respages + 1;
+	memset(&xb_args, 0, sizeof(xb_args));
+}
+
+static __be32 *rq_res_begin(void)
+{
+	__be32 *p = page_address(rq.rq_respages[0]);
+
+	memset(p, 0xa5, PAGE_SIZE);
+	rq.rq_res.head[0].iov_base = p;
+	rq.rq_res.head[0].iov_len = 0;
+	rq.rq_res.page_len = 0;
+	rq.rq_res.tail[0].iov_base = NULL;
+	rq.rq_res.tail[0].iov_len = 0;
+	memset(&xb_res, 0, sizeof(xb_res));
+	return p;
+}
+
+static size_t rq_res_len(void)
+{
+	return rq.rq_res.head[0].iov_len;
+}
+
+static void fixture_init(void)
+{
+	unsigned int i;
+
+	argpage = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+	/* only the thread context after the argument area is used */
+	rq.rq_argp = calloc(1, NFSD_SVC_XDRSIZE);
+	for (i = 0; i < ARRAY_SIZE(rq.rq_pages) - 1; i++)
+		rq.rq_pages[i] = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+	rq.rq_pages[i] = NULL;
+	if (!argpage || !rq.rq_argp || !rq.rq_pages[0]) {
+		fprintf(stderr, "xdrbench: out of memory\n");
+		exit(2);
+	}
+	rq.rq_respages = rq.rq_pages + 1;
+	rq.rq_next_page = rq.rq_respages + 1;
+	rq.rq_net = &xb_net;
+	rq.rq_max_payload = RPCSVC_MAXPAYLOAD;
+	rq.rq_vers = 3;
+}
+
+/*
+ * Tests
+ */
+
+static int	checks_failed;
+
+#define CHECK(cond)							\
+	do {								\
+		if (!(cond)) {						\
+			checks_failed++;				\
+			printf("    %s:%d: %s\n", __func__, __LINE__,	\
+			       #cond);					\
+		}							\
+	} while (0)
+
+/* stop the current test if @cond fails; later checks would only cascade */
+#define REQUIRE(cond)							\
+	do {								\
+		if (!(cond)) {						\
+			CHECK(cond);					\
+			return;						\
+		}							\
+	} while (0)
+
+/* the word at index @i of an XDR stream, in host order */
+#define W(base, i)	ntohl((base)[i])
+
+static void test_decode_file_handle(void)
+{
+	struct xb_wire w;
+	struct svc_fh fh;
+	__be32 *p;
+
+	wire_begin(&w);
+	putfh(&w, 28);
+	put32(&w, 0xdeadbeef);
+	fh_init(&fh, NFS3_FHSIZE);
+	p = decode_file_handle(w.start, &fh);
+	REQUIRE(p != NULL);
+	CHECK(p == w.start + 1 + 7);
+	CHECK(fh.fh_handle.fh_size == 28);
+	CHECK(memcmp(&fh.fh_handle.fh_base, w.start + 1, 28) == 0);
+
+	/* not a multiple of four: the padding is skipped too */
+	wire_begin(&w);
+	putfh(&w, 30);
+	fh_init(&fh, NFS3_FHSIZE);
+	p = decode_file_handle(w.start, &fh);
+	REQUIRE(p != NULL);
+	CHECK(p == w.start + 1 + 8);
+	CHECK(fh.fh_handle.fh_size == 30);
+
+	/* nfs_fh3 is at most NFS3_FHSIZE bytes */
+	wire_begin(&w);
+	putfh(&w, NFS3_FHSIZE + 4);
+	fh_init(&fh, NFS3_FHSIZE);
+	CHECK(decode_file_handle(w.start, &fh) == NULL);
+}
+
+static void test_decode_file_name(void)
+{
+	struct xb_wire w;
+	char *name = NULL;
+	unsigned int len = 0;
+	char big[NFS3_MAXNAMLEN + 1];
+	__be32 *p;
+
+	wire_begin(&w);
+	putopaque(&w, "hello", 5);
+	p = decode_file_name(w.start, &name, &len);
+	REQUIRE(p != NULL);
+	CHECK(p == w.start + 1 + 2);
+	CHECK(len == 5);
+	CHECK(name && memcmp(name, "hello", 5) == 0);
+
+	/* a filename3 is a single path component */
+	wire_begin(&w);
+	putopaque(&w, "a/b", 3);
+	CHECK(decode_file_name(w.start, &name, &len) == NULL);
+
+	wire_begin(&w);
+	putopaque(&w, "a\0b", 3);
+	CHECK(decode_file_name(w.start, &name, &len) == NULL);
+
+	memset(big, 'x', sizeof(big));
+	wire_begin(&w);
+	putopaque(&w, big, sizeof(big));
+	CHECK(decode_file_name(w.start, &name, &len) == NULL);
+}
+
+static void test_decode_sattr3(void)
+{
+	struct xb_wire w;
+	struct iattr ia;
+	__be32 *p;
+
+	/* every set_it true; atime from the client, mtime from the server */
+	wire_begin(&w);
+	put32(&w, 1); put32(&w, 0640);
+	put32(&w, 1); put32(&w, 1000);
+	put32(&w, 1); put32(&w, 100);
+	put32(&w, 1); put64(&w, 12345678901ULL);
+	put32(&w, 2); put32(&w, 1500000000); put32(&w, 500);
+	put32(&w, 1);
+	p = decode_sattr3(w.start, &ia);
+	CHECK(p == w.p);
+	CHECK(ia.ia_valid == (ATTR_MODE | ATTR_UID | ATTR_GID | ATTR_SIZE |
+			      ATTR_ATIME | ATTR_ATIME_SET | ATTR_MTIME));
+	CHECK(ia.ia_mode == 0640);
+	CHECK(ia.ia_uid.val == 1000);
+	CHECK(ia.ia_gid.val == 100);
+	CHECK(ia.ia_size == 12345678901LL);
+	CHECK(ia.ia_atime.tv_sec == 1500000000);
+	CHECK(ia.ia_atime.tv_nsec == 500);
+
+	/* nothing set: six discriminants */
+	wire_begin(&w);
+	put32(&w, 0); put32(&w, 0); put32(&w, 0);
+	put32(&w, 0); put32(&w, 0); put32(&w, 0);
+	p = decode_sattr3(w.start, &ia);
+	CHECK(p == w.p);
+	CHECK(ia.ia_valid == 0);
+}
+
+static void test_decode_sattrargs(void)
+{
+	struct nfsd3_sattrargs *args = &xb_args.sattrargs;
+	struct xb_wire w;
+
+	wire_begin(&w);
+	putfh(&w, 28);
+	put32(&w, 1); put32(&w, 0600);
+	put32(&w, 0); put32(&w, 0); put32(&w, 0); put32(&w, 0); put32(&w, 0);
+	put32(&w, 1); put32(&w, 1500000009); put32(&w, 0);	/* guard */
+	rq_args(&w);
+	REQUIRE(nfs3svc_decode_sattrargs(&rq, w.start, args));
+	CHECK(args->fh.fh_handle.fh_size == 28);
+	CHECK(args->attrs.ia_valid == ATTR_MODE);
+	CHECK(args->attrs.ia_mode == 0600);
+	CHECK(args->check_guard == 1);
+	CHECK(args->guardtime == 1500000009);
+}
+
+static void test_decode_diropargs(void)
+{
+	struct nfsd3_diropargs *args = &xb_args.diropargs;
+	struct xb_wire w;
+
+	wire_begin(&w);
+	putfh(&w, 28);
+	putopaque(&w, "Makefile", 8);
+	rq_args(&w);
+	REQUIRE(nfs3svc_decode_diropargs(&rq, w.start, args));
+	CHECK(args->fh.fh_handle.fh_size == 28);
+	CHECK(args->len == 8);
+	CHECK(args->name && memcmp(args->name, "Makefile", 8) == 0);
+}
+
+static void test_decode_accessargs(void)
+{
+	struct nfsd3_accessargs *args = (void *)&xb_args;
+	struct xb_wire w;
+
+	wire_begin(&w);
+	putfh(&w, 28);
+	put32(&w, 0x1f);
+	rq_args(&w);
+	REQUIRE(nfs3svc_decode_accessargs(&rq, w.start, args));
+	CHECK(args->access == 0x1f);
+}
+
+static void test_decode_readargs(void)
+{
+	struct nfsd3_readargs *args = &xb_args.readargs;
+	struct xb_wire w;
+
+	wire_begin(&w);
+	putfh(&w, 28);
+	put64(&w, 1ULL << 33);
+	put32(&w, 10000);
+	rq_args(&w);
+	REQUIRE(nfs3svc_decode_readargs(&rq, w.start, args));
+	CHECK(args->offset == 1ULL << 33);
+	CHECK(args->count == 10000);
+	CHECK(args->vlen == 3);
+	CHECK(rq.rq_vec[0].iov_len == PAGE_SIZE);
+	CHECK(rq.rq_vec[2].iov_len == 10000 - 2 * PAGE_SIZE);
+
+	/* counts are clamped to the transport's maximum payload */
+	wire_begin(&w);
+	putfh(&w, 28);
+	put64(&w, 0);
+	put32(&w, 0x7fffffff);
+	rq_args(&w);
+	REQUIRE(nfs3svc_decode_readargs(&rq, w.start, args));
+	CHECK(args->vlen == RPCSVC_MAXPAYLOAD / PAGE_SIZE);
+}
+
+static void test_decode_writeargs(void)
+{
+	struct nfsd3_writeargs *args = &xb_args.writeargs;
+	char data[100];
+	struct xb_wire w;
+	__be32 *payload;
+
+	memset(data, 'd', sizeof(data));
+	wire_begin(&w);
+	putfh(&w, 28);
+	put64(&w, 4096);
+	put32(&w, sizeof(data));
+	put32(&w, 2);				/* FILE_SYNC */
+	payload = w.p + 1;
+	putopaque(&w, data, sizeof(data));
+	rq_args(&w);
+	REQUIRE(nfs3svc_decode_writeargs(&rq, w.start, args));
+	CHECK(args->offset == 4096);
+	CHECK(args->count == sizeof(data));
+	CHECK(args->len == sizeof(data));
+	CHECK(args->stable == 2);
+	CHECK(args->first.iov_base == payload);
+	CHECK(args->first.iov_len ==
+	      rq.rq_arg.head[0].iov_len - (size_t)((char *)payload - (char *)w.start));
+
+	/* count and the opaque length must agree */
+	wire_begin(&w);
+	putfh(&w, 28);
+	put64(&w, 0);
+	put32(&w, sizeof(data));
+	put32(&w, 0);
+	putopaque(&w, data, sizeof(data) - 1);
+	rq_args(&w);
+	CHECK(!nfs3svc_decode_writeargs(&rq, w.start, args));
+
+	/* and the data must actually be there */
+	wire_begin(&w);
+	putfh(&w, 28);
+	put64(&w, 0);
+	put32(&w, sizeof(data));
+	put32(&w, 0);
+	put32(&w, sizeof(data));
+	rq_args(&w);
+	CHECK(!nfs3svc_decode_writeargs(&rq, w.start, args));
+}
+
+static void test_decode_createargs(void)
+{
+	struct nfsd3_createargs *args = &xb_args.createargs;
+	struct xb_wire w;
+	__be32 *verf;
+
+	wire_begin(&w);
+	putfh(&w, 28);
+	putopaque(&w, "new", 3);
+	put32(&w, NFS3_CREATE_GUARDED);
+	put32(&w, 1); put32(&w, 0600);
+	put32(&w, 0); put32(&w, 0); put32(&w, 0); put32(&w, 0); put32(&w, 0);
+	rq_args(&w);
+	REQUIRE(nfs3svc_decode_createargs(&rq, w.start, args));
+	CHECK(args->len == 3);
+	CHECK(args->createmode == NFS3_CREATE_GUARDED);
+	CHECK(args->attrs.ia_valid == ATTR_MODE);
+	CHECK(args->attrs.ia_mode == 0600);
+
+	wire_begin(&w);
+	putfh(&w, 28);
+	putopaque(&w, "excl", 4);
+	put32(&w, NFS3_CREATE_EXCLUSIVE);
+	verf = w.p;
+	put32(&w, 0x01020304); put32(&w, 0x05060708);
+	rq_args(&w);
+	REQUIRE(nfs3svc_decode_createargs(&rq, w.start, args));
+	CHECK(args->createmode == NFS3_CREATE_EXCLUSIVE);
+	CHECK(args->verf == verf);
+
+	wire_begin(&w);
+	putfh(&w, 28);
+	putopaque(&w, "bad", 3);
+	put32(&w, 3);
+	rq_args(&w);
+	CHECK(!nfs3svc_decode_createargs(&rq, w.start, args));
+}
+
+static void test_decode_readdirplusargs(void)
+{
+	struct nfsd3_readdirargs *args = &xb_args.readdirargs;
+	struct xb_wire w;
+	struct page **first;
+
+	wire_begin(&w);
+	putfh(&w, 28);
+	put64(&w, 77);
+	put32(&w, 0xaaaaaaaa); put32(&w, 0xbbbbbbbb);
+	put32(&w, 512);
+	put32(&w, 8192);
+	rq_args(&w);
+	first = rq.rq_next_page;
+	REQUIRE(nfs3svc_decode_readdirplusargs(&rq, w.start, args));
+	CHECK(args->cookie == 77);
+	CHECK(args->verf && W(args->verf, 0) == 0xaaaaaaaa);
+	CHECK(args->dircount == 512);
+	CHECK(args->count == 8192);
+	CHECK(args->buffer == page_address(*first));
+	CHECK(rq.rq_next_page == first + 2);
+}
+
+static void test_encode_fh(void)
+{
+	struct svc_fh fh;
+	__be32 buf[32], *p;
+
+	xb_fh_attach(&fh, &xb_file);
+	memset(buf, 0xff, sizeof(buf));
+	p = encode_fh(buf, &fh);
+	CHECK(p == buf + 1 + 7);
+	CHECK(W(buf, 0) == 28);
+	CHECK(memcmp(buf + 1, &fh.fh_handle.fh_base, 28) == 0);
+
+	/* padding bytes are zero */
+	fh.fh_handle.fh_size = 30;
+	memset(buf, 0xff, sizeof(buf));
+	p = encode_fh(buf, &fh);
+	CHECK(p == buf + 1 + 8);
+	CHECK(((unsigned char *)(buf + 1))[30] == 0);
+	CHECK(((unsigned char *)(buf + 1))[31] == 0);
+}
+
+/*
+ * Check a fattr3 (RFC 1813, section 2.6) against @stat.  The fsid
+ * depends on the export's fsid type and isn't checked.
+ */
+static void check_fattr3(__be32 *p, struct kstat *stat, u32 type)
+{
+	CHECK(W(p, 0) == type);
+	CHECK(W(p, 1) == (stat->mode & S_IALLUGO));
+	CHECK(W(p, 2) == stat->nlink);
+	CHECK(W(p, 3) == stat->uid.val);
+	CHECK(W(p, 4) == stat->gid.val);
+	CHECK(W(p, 5) == (u32)((u64)stat->size >> 32));
+	CHECK(W(p, 6) == (u32)stat->size);
+	CHECK(W(p, 7) == (u32)((stat->blocks << 9) >> 32));
+	CHECK(W(p, 8) == (u32)(stat->blocks << 9));
+	CHECK(W(p, 9) == MAJOR(stat->rdev));
+	CHECK(W(p, 10) == MINOR(stat->rdev));
+	CHECK(W(p, 13) == (u32)(stat->ino >> 32));
+	CHECK(W(p, 14) == (u32)stat->ino);
+	CHECK(W(p, 15) == (u32)stat->atime.tv_sec);
+	CHECK(W(p, 16) == (u32)stat->atime.tv_nsec);
+	CHECK(W(p, 17) == (u32)stat->mtime.tv_sec);
+	CHECK(W(p, 18) == (u32)stat->mtime.tv_nsec);
+	CHECK(W(p, 19) == (u32)stat->ctime.tv_sec);
+	CHECK(W(p, 20) == (u32)stat->ctime.tv_nsec);
+}
+
+static void test_encode_fattr3(void)
+{
+	struct kstat stat = {
+		.ino	= 0x100001092ULL,
+		.mode	= S_IFREG | 04755,
+		.nlink	= 2,
+		.uid	= { 1000 },
+		.gid	= { 100 },
+		.rdev	= MKDEV(8, 1),
+		.size	= 5000000000LL,
+		.blocks	= 9765632,
+		.atime	= { 1, 2 },
+		.mtime	= { 3, 4 },
+		.ctime	= { 5, 6 },
+	};
+	struct svc_fh fh;
+	__be32 buf[32], *p;
+
+	xb_fh_attach(&fh, &xb_file);
+	p = encode_fattr3(&rq, buf, &fh, &stat);
+	REQUIRE(p == buf + 21);
+	check_fattr3(buf, &stat, NF3REG);
+
+	stat.mode = S_IFDIR | 0755;
+	p = encode_fattr3(&rq, buf, &fh, &stat);
+	REQUIRE(p == buf + 21);
+	CHECK(W(buf, 0) == NF3DIR);
+}
+
+static void test_encode_attrstat(void)
+{
+	struct nfsd3_attrstat *resp = (void *)&xb_res;
+	__be32 *p;
+
+	p = rq_res_begin();
+	xb_fh_attach(&resp->fh, &xb_file);
+	resp->stat = xb_attr;
+	REQUIRE(nfs3svc_encode_attrstat(&rq, p, resp));
+	CHECK(rq_res_len() == 21 * 4);
+	check_fattr3(p, &xb_attr, NF3REG);
+}
+
+static void test_encode_diropres(void)
+{
+	struct nfsd3_diropres *resp = &xb_res.diropres;
+	__be32 *p;
+
+	/* LOOKUP3resok: object, obj_attributes, dir_attributes */
+	p = rq_res_begin();
+	xb_fh_attach(&resp->fh, &xb_file);
+	xb_fh_attach(&resp->dirfh, &xb_dir);
+	REQUIRE(nfs3svc_encode_diropres(&rq, p, resp));
+	CHECK(rq_res_len() == (1 + 7 + 1 + 21 + 1 + 21) * 4);
+	CHECK(W(p, 0) == 28);
+	CHECK(W(p, 8) == 1);
+	CHECK(W(p, 9) == NF3REG);
+	CHECK(W(p, 30) == 1);
+	CHECK(W(p, 31) == NF3DIR);
+
+	/* LOOKUP3resfail: dir_attributes only */
+	p = rq_res_begin();
+	resp->status = nfserr_noent;
+	xb_fh_attach(&resp->dirfh, &xb_dir);
+	REQUIRE(nfs3svc_encode_diropres(&rq, p, resp));
+	CHECK(rq_res_len() == (1 + 21) * 4);
+}
+
+static void test_encode_writeres(void)
+{
+	struct nfsd3_writeres *resp = &xb_res.writeres;
+	__be32 *p;
+
+	/* WRITE3resok: wcc_data, count, committed, verf */
+	p = rq_res_begin();
+	xb_fh_attach(&resp->fh, &xb_file);
+	resp->count = 4096;
+	resp->committed = 1;
+	REQUIRE(nfs3svc_encode_writeres(&rq, p, resp));
+	CHECK(rq_res_len() == (1 + 1 + 21 + 4) * 4);
+	CHECK(W(p, 0) == 0);
+	CHECK(W(p, 1) == 1);
+	CHECK(W(p, 23) == 4096);
+	CHECK(W(p, 24) == 1);
+	CHECK(W(p, 25) == (u32)xb_nn.nfssvc_boot.tv_sec);
+	CHECK(W(p, 26) == (u32)xb_nn.nfssvc_boot.tv_nsec);
+}
+
+static void test_encode_readres(void)
+{
+	struct nfsd3_readres *resp = &xb_res.readres;
+	__be32 *p;
+
+	p = rq_res_begin();
+	xb_fh_attach(&resp->fh, &xb_file);
+	resp->count = 5;
+	resp->eof = 1;
+	REQUIRE(nfs3svc_encode_readres(&rq, p, resp));
+	CHECK(rq_res_len() == (1 + 21 + 3) * 4);
+	CHECK(W(p, 22) == 5);
+	CHECK(W(p, 23) == 1);
+	CHECK(W(p, 24) == 5);
+	CHECK(rq.rq_res.page_len == 5);
+	CHECK(rq.rq_res.tail[0].iov_len == 3);
+}
+
+static void test_encode_fsstatres(void)
+{
+	struct nfsd3_fsstatres *resp = &xb_res.fsstatres;
+	__be32 *p;
+
+	p = rq_res_begin();
+	resp->stats.f_bsize = 4096;
+	resp->stats.f_blocks = 1000;
+	resp->stats.f_bfree = 500;
+	resp->stats.f_bavail = 400;
+	resp->stats.f_files = 300;
+	resp->stats.f_ffree = 200;
+	resp->invarsec = 0;
+	REQUIRE(nfs3svc_encode_fsstatres(&rq, p, resp));
+	CHECK(rq_res_len() == (1 + 13) * 4);
+	CHECK(W(p, 2) == 4096 * 1000);
+	CHECK(W(p, 4) == 4096 * 500);
+	CHECK(W(p, 6) == 4096 * 400);
+	CHECK(W(p, 8) == 300);
+	CHECK(W(p, 10) == 200);
+}
+
+static void test_encode_fsinfores(void)
+{
+	struct nfsd3_fsinfores *resp = &xb_res.fsinfores;
+	__be32 *p;
+
+	p = rq_res_begin();
+	resp->f_rtmax = resp->f_wtmax = 1048576;
+	resp->f_rtpref = resp->f_wtpref = 1048576;
+	resp->f_rtmult = resp->f_wtmult = PAGE_SIZE;
+	resp->f_dtpref = PAGE_SIZE;
+	resp->f_maxfilesize = ~0ULL;
+	resp->f_properties = 0x1b;
+	REQUIRE(nfs3svc_encode_fsinfores(&rq, p, resp));
+	CHECK(rq_res_len() == (1 + 12) * 4);
+	CHECK(W(p, 1) == 1048576);
+	CHECK(W(p, 3) == PAGE_SIZE);
+	CHECK(W(p, 8) == 0xffffffff);
+	CHECK(W(p, 10) == 1);
+	CHECK(W(p, 12) == 0x1b);
+}
+
+/* set up a READDIR(PLUS) reply whose entries go into reply page 1 */
+static struct nfsd3_readdirres *readdir_begin(int buflen)
+{
+	struct nfsd3_readdirres *cd = &xb_res.readdirres;
+
+	rq_res_begin();
+	rq.rq_next_page = rq.rq_respages + 2;
+	memset(page_address(rq.rq_respages[1]), 0xa5, PAGE_SIZE);
+	xb_fh_attach(&cd->fh, &xb_dir);
+	cd->rqstp = &rq;
+	cd->buffer = page_address(rq.rq_respages[1]);
+	cd->buflen = buflen;
+	cd->offset = NULL;
+	cd->offset1 = NULL;
+	return cd;
+}
+
+static const char *xb_names[] = { "alpha", "beta", "gamma.c" };
+
+/*
+ * entry3 and entryplus3 (RFC 1813, sections 3.3.16 and 3.3.17): the
+ * cookie of each entry is the offset passed with the next one, and the
+ * last entry's is left at NFS_OFFSET_MAX until another entry follows.
+ */
+static void check_entries(__be32 *p, __be32 *end, int plus)
+{
+	unsigned int i, len;
+
+	for (i = 0; i < ARRAY_SIZE(xb_names); i++) {
+		REQUIRE(p < end);
+		CHECK(W(p, 0) == 1);
+		CHECK(W(p, 1) == 0);
+		CHECK(W(p, 2) == 100 + i);
+		len = W(p, 3);
+		REQUIRE(len == strlen(xb_names[i]));
+		CHECK(memcmp(p + 4, xb_names[i], len) == 0);
+		p += 4 + XDR_QUADLEN(len);
+		if (i + 1 < ARRAY_SIZE(xb_names)) {
+			CHECK(W(p, 0) == 0);
+			CHECK(W(p, 1) == i + 2);
+		} else {
+			CHECK(W(p, 0) == 0x7fffffff);
+			CHECK(W(p, 1) == 0xffffffff);
+		}
+		p += 2;
+		if (!plus)
+			continue;
+		CHECK(W(p, 0) == 1);		/* name_attributes */
+		CHECK(W(p, 1) == NF3REG);
+		CHECK(W(p, 15) == 100 + i);
+		p += 1 + 21;
+		CHECK(W(p, 0) == 1);		/* name_handle */
+		CHECK(W(p, 1) == xb_fh_size);
+		p += 2 + XDR_QUADLEN(xb_fh_size);
+	}
+	CHECK(p == end);
+}
+
+static void encode_entries(struct nfsd3_readdirres *cd, int plus)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(xb_names); i++) {
+		xb_lookup_ino = 100 + i;
+		if (plus)
+			nfs3svc_encode_entry_plus(&cd->common, xb_names[i],
+						  strlen(xb_names[i]), i + 1,
+						  100 + i, 0);
+		else
+			nfs3svc_encode_entry(&cd->common, xb_names[i],
+					     strlen(xb_names[i]), i + 1,
+					     100 + i, 0);
+		CHECK(cd->common.err == nfs_ok);
+	}
+}
+
+static void test_encode_entry(void)
+{
+	struct nfsd3_readdirres *cd = readdir_begin(PAGE_SIZE / 4);
+	__be32 *start = cd->buffer;
+
+	encode_entries(cd, 0);
+	check_entries(start, cd->buffer, 0);
+	CHECK(cd->buflen == PAGE_SIZE / 4 - (cd->buffer - start));
+}
+
+static void test_encode_entry_plus(void)
+{
+	struct nfsd3_readdirres *cd = readdir_begin(PAGE_SIZE / 4);
+	__be32 *start = cd->buffer;
+
+	encode_entries(cd, 1);
+	check_entries(start, cd->buffer, 1);
+	CHECK(cd->buflen == PAGE_SIZE / 4 - (cd->buffer - start));
+
+	/* an entry that doesn't fit is refused, and nothing is written */
+	cd = readdir_begin(10);
+	start = cd->buffer;
+	xb_lookup_ino = 100;
+	CHECK(nfs3svc_encode_entry_plus(&cd->common, "x", 1, 1, 100, 0) < 0);
+	CHECK(cd->common.err == nfserr_toosmall);
+	CHECK(cd->buffer == start);
+	CHECK(cd->buflen == 10);
+}
+
+struct xb_test {
+	const char	*name;
+	void		(*fn)(void);
+};
+
+#define XB_TEST(n)	{ #n, test_##n }
+
+static const struct xb_test xb_tests[] = {
+	XB_TEST(decode_file_handle),
+	XB_TEST(decode_file_name),
+	XB_TEST(decode_sattr3),
+	XB_TEST(decode_sattrargs),
+	XB_TEST(decode_diropargs),
+	XB_TEST(decode_accessargs),
+	XB_TEST(decode_readargs),
+	XB_TEST(decode_writeargs),
+	XB_TEST(decode_createargs),
+	XB_TEST(decode_readdirplusargs),
+	XB_TEST(encode_fh),
+	XB_TEST(encode_fattr3),
+	XB_TEST(encode_attrstat),
+	XB_TEST(encode_diropres),
+	XB_TEST(encode_writeres),
+	XB_TEST(encode_readres),
+	XB_TEST(encode_fsstatres),
+	XB_TEST(encode_fsinfores),
+	XB_TEST(encode_entry),
+	XB_TEST(encode_entry_plus),
+};
+
+/*
+ * Benchmarks
+ *
+ * Each bench_* function performs one call and returns the number of
+ * XDR bytes it consumed or produced.  Their arguments are built once by
+ * the matching setup, outside the timed loop.
+ */
+
+static struct xb_wire	bw;
+static struct svc_fh	bfh;
+
+static void setup_fh(void)
+{
+	wire_begin(&bw);
+	putfh(&bw, 28);
+	rq_args(&bw);
+}
+
+static void setup_name(void)
+{
+	wire_begin(&bw);
+	putopaque(&bw, "libxyz.so.1", 11);
+	rq_args(&bw);
+}
+
+static void setup_sattr3(void)
+{
+	wire_begin(&bw);
+	put32(&bw, 1); put32(&bw, 0644);
+	put32(&bw, 1); put32(&bw, 1000);
+	put32(&bw, 1); put32(&bw, 100);
+	put32(&bw, 1); put64(&bw, 4096);
+	put32(&bw, 1);
+	put32(&bw, 1);
+	rq_args(&bw);
+}
+
+static void setup_sattrargs(void)
+{
+	wire_begin(&bw);
+	putfh(&bw, 28);
+	put32(&bw, 1); put32(&bw, 0600);
+	put32(&bw, 0); put32(&bw, 0); put32(&bw, 0); put32(&bw, 0); put32(&bw, 0);
+	put32(&bw, 0);
+	rq_args(&bw);
+}
+
+static void setup_diropargs(void)
+{
+	wire_begin(&bw);
+	putfh(&bw, 28);
+	putopaque(&bw, "libxyz.so.1", 11);
+	rq_args(&bw);
+}
+
+static void setup_readargs(void)
+{
+	wire_begin(&bw);
+	putfh(&bw, 28);
+	put64(&bw, 0);
+	put32(&bw, 32768);
+	rq_args(&bw);
+}
+
+static void setup_writeargs(void)
+{
+	static char data[4096];
+
+	wire_begin(&bw);
+	putfh(&bw, 28);
+	put64(&bw, 0);
+	put32(&bw, 512);
+	put32(&bw, 0);
+	putopaque(&bw, data, 512);
+	rq_args(&bw);
+}
+
+static void setup_createargs(void)
+{
+	wire_begin(&bw);
+	putfh(&bw, 28);
+	putopaque(&bw, "output.o", 8);
+	put32(&bw, NFS3_CREATE_UNCHECKED);
+	put32(&bw, 1); put32(&bw, 0644);
+	put32(&bw, 0); put32(&bw, 0); put32(&bw, 0); put32(&bw, 0); put32(&bw, 0);
+	rq_args(&bw);
+}
+
+static void setup_readdirplusargs(void)
+{
+	wire_begin(&bw);
+	putfh(&bw, 28);
+	put64(&bw, 0);
+	put32(&bw, 0); put32(&bw, 0);
+	put32(&bw, 4096);
+	put32(&bw, 32768);
+	rq_args(&bw);
+}
+
+static void setup_encode(void)
+{
+	rq_res_begin();
+	xb_fh_attach(&bfh, &xb_file);
+}
+
+static size_t consumed(__be32 *p)
+{
+	return p ? (p - bw.start) * 4 : 0;
+}
+
+static size_t bench_decode_file_handle(void)
+{
+	fh_init(&xb_args.sattrargs.fh, NFS3_FHSIZE);
+	return consumed(decode_file_handle(bw.start, &xb_args.sattrargs.fh));
+}
+
+static size_t bench_decode_file_name(void)
+{
+	struct nfsd3_diropargs *args = &xb_args.diropargs;
+
+	return consumed(decode_file_name(bw.start, &args->name, &args->len));
+}
+
+static size_t bench_decode_sattr3(void)
+{
+	return consumed(decode_sattr3(bw.start, &xb_args.sattrargs.attrs));
+}
+
+/* the nfs3svc_decode_* routines are timed as svc_process() calls them */
+#define BENCH_DECODE(n, type)						\
+static size_t bench_decode_##n(void)					\
+{									\
+	rq.rq_next_page = rq.rq_respages + 1;				\
+	fh_init(&((type *)&xb_args)->fh, NFS3_FHSIZE);			\
+	if (!nfs3svc_decode_##n(&rq, bw.start, (type *)&xb_args))	\
+		return 0;						\
+	return rq.rq_arg.head[0].iov_len;				\
+}
+
+BENCH_DECODE(sattrargs, struct nfsd3_sattrargs)
+BENCH_DECODE(diropargs, struct nfsd3_diropargs)
+BENCH_DECODE(readargs, struct nfsd3_readargs)
+BENCH_DECODE(writeargs, struct nfsd3_writeargs)
+BENCH_DECODE(createargs, struct nfsd3_createargs)
+BENCH_DECODE(readdirplusargs, struct nfsd3_readdirargs)
+
+static size_t bench_encode_fh(void)
+{
+	__be32 *p = rq.rq_res.head[0].iov_base;
+
+	return (encode_fh(p, &bfh) - p) * 4;
+}
+
+static size_t bench_encode_fattr3(void)
+{
+	__be32 *p = rq.rq_res.head[0].iov_base;
+
+	return (encode_fattr3(&rq, p, &bfh, &xb_attr) - p) * 4;
+}
+
+static size_t bench_encode_attrstat(void)
+{
+	struct nfsd3_attrstat *resp = (void *)&xb_res;
+
+	resp->fh = bfh;
+	resp->stat = xb_attr;
+	nfs3svc_encode_attrstat(&rq, rq.rq_res.head[0].iov_base, resp);
+	return rq_res_len();
+}
+
+static size_t bench_encode_diropres(void)
+{
+	struct nfsd3_diropres *resp = &xb_res.diropres;
+
+	resp->fh = bfh;
+	resp->dirfh = bfh;
+	resp->dirfh.fh_dentry = &xb_dir;
+	nfs3svc_encode_diropres(&rq, rq.rq_res.head[0].iov_base, resp);
+	return rq_res_len();
+}
+
+static size_t bench_encode_writeres(void)
+{
+	struct nfsd3_writeres *resp = &xb_res.writeres;
+
+	resp->fh = bfh;
+	resp->count = 512;
+	nfs3svc_encode_writeres(&rq, rq.rq_res.head[0].iov_base, resp);
+	return rq_res_len();
+}
+
+static size_t bench_encode_readres(void)
+{
+	struct nfsd3_readres *resp = &xb_res.readres;
+
+	resp->fh = bfh;
+	resp->count = 32768;
+	nfs3svc_encode_readres(&rq, rq.rq_res.head[0].iov_base, resp);
+	return rq_res_len();
+}
+
+static size_t bench_encode_fsinfores(void)
+{
+	nfs3svc_encode_fsinfores(&rq, rq.rq_res.head[0].iov_base,
+				 &xb_res.fsinfores);
+	return rq_res_len();
+}
+
+/* one entry into a fresh page each time, so the buffer never fills */
+static size_t bench_entry(int plus)
+{
+	struct nfsd3_readdirres *cd = &xb_res.readdirres;
+	__be32 *start = page_address(rq.rq_respages[1]);
+
+	cd->fh = bfh;
+	cd->fh.fh_dentry = &xb_dir;
+	cd->rqstp = &rq;
+	cd->buffer = start;
+	cd->buflen = PAGE_SIZE / 4;
+	cd->offset = NULL;
+	rq.rq_next_page = rq.rq_respages + 2;
+	if (plus)
+		nfs3svc_encode_entry_plus(&cd->common, "gamma.c", 7, 3,
+					  xb_lookup_ino, 0);
+	else
+		nfs3svc_encode_entry(&cd->common, "gamma.c", 7, 3,
+				     xb_lookup_ino, 0);
+	return (cd->buffer - start) * 4;
+}
+
+static size_t bench_encode_entry(void)
+{
+	return bench_entry(0);
+}
+
+static size_t bench_encode_entry_plus(void)
+{
+	return bench_entry(1);
+}
+
+struct xb_bench {
+	const char	*name;
+	void		(*setup)(void);
+	size_t		(*run)(void);
+};
+
+#define XB_BENCH(n, s)	{ #n, setup_##s, bench_##n }
+
+static const struct xb_bench xb_benches[] = {
+	XB_BENCH(decode_file_handle, fh),
+	XB_BENCH(decode_file_name, name),
+	XB_BENCH(decode_sattr3, sattr3),
+	XB_BENCH(decode_sattrargs, sattrargs),
+	XB_BENCH(decode_diropargs, diropargs),
+	XB_BENCH(decode_readargs, readargs),
+	XB_BENCH(decode_writeargs, writeargs),
+	XB_BENCH(decode_createargs, createargs),
+	XB_BENCH(decode_readdirplusargs, readdirplusargs),
+	XB_BENCH(encode_fh, encode),
+	XB_BENCH(encode_fattr3, encode),
+	XB_BENCH(encode_attrstat, encode),
+	XB_BENCH(encode_diropres, encode),
+	XB_BENCH(encode_writeres, encode),
+	XB_BENCH(encode_readres, encode),
+	XB_BENCH(encode_fsinfores, encode),
+	XB_BENCH(encode_entry, encode),
+	XB_BENCH(encode_entry_plus, encode),
+};
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static u64 bench_loop(const struct xb_bench *b, u64 iters, size_t *bytes)
+{
+	u64 i, start;
+
+	start = now_ns();
+	for (i = 0; i < iters; i++) {
+		*bytes = b->run();
+		/* keep the compiler from merging or hoisting iterations */
+		__asm__ __volatile__("" ::: "memory");
+	}
+	return now_ns() - start;
+}
+
+static void run_bench(const struct xb_bench *b, u64 fixed_iters)
+{
+	u64 iters = fixed_iters ? fixed_iters : 1000;
+	u64 elapsed;
+	size_t bytes = 0;
+
+	b->setup();
+	bench_loop(b, 1000, &bytes);		/* warm up */
+	for (;;) {
+		elapsed = bench_loop(b, iters, &bytes);
+		if (fixed_iters || elapsed >= 100000000ULL ||
+		    iters >= (1ULL << 40))
+			break;
+		iters *= elapsed < 10000000ULL ? 10 : 2;
+	}
+	printf("%-26s %10.1f ns/op %8zu bytes/op %12llu ops\n", b->name,
+	       (double)elapsed / iters, bytes, (unsigned long long)iters);
+}
+
+static bool selected(const char *name, int argc, char **argv)
+{
+	int i;
+
+	if (argc == 0)
+		return true;
+	for (i = 0; i < argc; i++)
+		if (strstr(name, argv[i]))
+			return true;
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	bool tests = true, benches = true;
+	u64 iters = 0;
+	int passed = 0, failed = 0;
+	unsigned int i;
+	int c;
+
+	while ((c = getopt(argc, argv, "tbn:")) != -1) {
+		switch (c) {
+		case 't':
+			benches = false;
+			break;
+		case 'b':
+			tests = false;
+			break;
+		case 'n':
+			iters = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t | -b] [-n iterations] "
+				"[name...]\n", argv[0]);
+			return 2;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	fixture_init();
+
+	if (tests) {
+		for (i = 0; i < ARRAY_SIZE(xb_tests); i++) {
+			if (!selected(xb_tests[i].name, argc, argv))
+				continue;
+			checks_failed = 0;
+			xb_tests[i].fn();
+			printf("%s %s\n", checks_failed ? "FAIL" : "PASS",
+			       xb_tests[i].name);
+			if (checks_failed)
+				failed++;
+			else
+				passed++;
+		}
+		printf("%d passed, %d failed\n", passed, failed);
+	}
+
+	if (benches) {
+		if (tests)
+			printf("\n");
+		for (i = 0; i < ARRAY_SIZE(xb_benches); i++)
+			if (selected(xb_benches[i].name, argc, argv))
+				run_bench(&xb_benches[i], iters);
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,418 @@
+/*
+ * Per-client and per-export traffic accounting.
+ *
+ * Finding the noisy neighbour needs per-client and per-export totals:
+ * calls by procedure, bytes read and written, errors and time spent in
+ * nfsd_dispatch().  Clients are identified by the name of their auth
+ * domain, exports by the exported path, so that the same directory
+ * exported to several clients is counted once, and an export that is
+ * flushed and exported again keeps its totals.  The path is looked up
+ * once per export cache entry, which remembers its slot.
+ *
+ * Each net has two tables with a fixed number of slots.  A slot is
+ * claimed, under the table lock, the first time a name is seen and is
+ * never given back, so requests find their slot by probing without a
+ * lock.  Names that find no slot within a few probes are counted in
+ * slot 0, "(other)".  Each slot has per-cpu counters of its own,
+ * allocated when it is claimed, so requests share no cache lines and
+ * memory grows with the slots in use, one small per-cpu allocation at
+ * a time.
+ */
+
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/jhash.h>
+#include <linux/sort.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+#include <linux/sunrpc/svcauth.h>
+
+#include "nfsd.h"
+#include "xdr.h"
+#include "netns.h"
+#include "stats.h"
+#include "traffic.h"
+
+#define NFSD_TRAFFIC_CLIENTS	128
+#define NFSD_TRAFFIC_EXPORTS	64
+#define NFSD_TRAFFIC_PROBES	16
+#define NFSD_TRAFFIC_NAMELEN	64
+
+struct nfsd_traffic_counters {
+	u64			ops[NFSD3_NPROCS];
+	u64			errors;
+	u64			read_bytes;
+	u64			write_bytes;
+	u64			latency_ns;
+	u64			throttled;	/* put off or delayed */
+};
+
+struct nfsd_traffic_slot {
+	u32			ts_hash;	/* 0 while the slot is free */
+	struct nfsd_traffic_counters __percpu *ts_counters;
+	char			ts_name[NFSD_TRAFFIC_NAMELEN];
+};
+
+struct nfsd_traffic_table {
+	spinlock_t		tt_lock;	/* claiming slots */
+	unsigned int		tt_size;	/* a power of two */
+	struct nfsd_traffic_slot *tt_slots;
+};
+
+struct nfsd_traffic {
+	struct nfsd_traffic_table nt_clients;
+	struct nfsd_traffic_table nt_exports;
+};
+
+static struct nfsd_traffic *traffic(struct svc_rqst *rqstp)
+{
+	struct nfsd_net *nn = net_generic(SVC_NET(rqstp), nfsd_net_id);
+
+	return nn->traffic;
+}
+
+static bool traffic_match(struct nfsd_traffic_slot *ts, u32 hash,
+			  const char *name)
+{
+	return ts->ts_hash == hash &&
+	       !strncmp(ts->ts_name, name, NFSD_TRAFFIC_NAMELEN - 1);
+}
+
+/*
+ * Find the slot of @name, claiming a free one if it has none yet.
+ * Slot 0 stands for everything that did not fit.
+ */
+static unsigned int traffic_slot(struct nfsd_traffic_table *tt,
+				 const char *name)
+{
+	struct nfsd_traffic_counters __percpu *counters;
+	unsigned int mask = tt->tt_size - 1;
+	struct nfsd_traffic_slot *ts;
+	unsigned int i, idx;
+	u32 hash;
+
+	hash = jhash(name, strlen(name), 0) ?: 1;
+	for (i = 0; i < NFSD_TRAFFIC_PROBES; i++) {
+		idx = ((hash + i) & mask) ?: 1;
+		ts = &tt->tt_slots[idx];
+		/* pairs with smp_store_release() below */
+		if (!smp_load_acquire(&ts->ts_hash))
+			break;
+		if (traffic_match(ts, hash, name))
+			return idx;
+	}
+	if (i == NFSD_TRAFFIC_PROBES)
+		return 0;
+
+	/* allocates, so not under the lock; freed if not needed after all */
+	counters = alloc_percpu(struct nfsd_traffic_counters);
+	if (!counters)
+		return 0;
+	spin_lock(&tt->tt_lock);
+	for (i = 0; i < NFSD_TRAFFIC_PROBES; i++) {
+		idx = ((hash + i) & mask) ?: 1;
+		ts = &tt->tt_slots[idx];
+		if (!ts->ts_hash) {
+			ts->ts_counters = counters;
+			counters = NULL;
+			strlcpy(ts->ts_name, name, sizeof(ts->ts_name));
+			smp_store_release(&ts->ts_hash, hash);
+			break;
+		}
+		if (traffic_match(ts, hash, name))
+			break;
+	}
+	spin_unlock(&tt->tt_lock);
+	free_percpu(counters);
+	return i == NFSD_TRAFFIC_PROBES ? 0 : idx;
+}
+
+/* the slot of @exp, looking its path up the first time */
+static unsigned int traffic_export_slot(struct nfsd_traffic *nt,
+					struct svc_export *exp)
+{
+	int idx = READ_ONCE(exp->ex_traffic_slot);
+	char *buf, *name;
+
+	if (idx >= 0)
+		return idx;
+	buf = __getname();
+	if (!buf)
+		return 0;
+	name = d_path(&exp->ex_path, buf, PATH_MAX);
+	idx = IS_ERR(name) ? 0 : traffic_slot(&nt->nt_exports, name);
+	__putname(buf);
+	WRITE_ONCE(exp->ex_traffic_slot, idx);
+	return idx;
+}
+
+static unsigned int traffic_client_slot(struct nfsd_traffic *nt,
+					struct auth_domain *dom)
+{
+	if (!dom)
+		return 0;
+	return traffic_slot(&nt->nt_clients, dom->name);
+}
+
+/* the counters of slot @idx of @tt on this cpu; put_cpu_ptr() them */
+static struct nfsd_traffic_counters *
+traffic_get_counters(struct nfsd_traffic_table *tt, unsigned int idx)
+{
+	return get_cpu_ptr(tt->tt_slots[idx].ts_counters);
+}
+
+/*
+ * Called by fh_verify() with the export it found; the first export of
+ * a request is the one the request is charged to.
+ */
+void
+nfsd_traffic_export(struct svc_rqst *rqstp, struct svc_export *exp)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_traffic *nt = traffic(rqstp);
+
+	if (!nt || ctx->tc_export_slot >= 0 || ctx->tc_bench)
+		return;
+	ctx->tc_export_slot = traffic_export_slot(nt, exp);
+}
+
+/*
+ * Called by the throttle (throttle.c) when it puts off or delays a
+ * request for @exp.
+ */
+void
+nfsd_traffic_throttled(struct svc_rqst *rqstp, struct svc_export *exp)
+{
+	struct nfsd_traffic *nt = traffic(rqstp);
+	struct nfsd_traffic_counters *c;
+	unsigned int idx;
+
+	if (!nt)
+		return;
+	idx = traffic_client_slot(nt, rqstp->rq_client);
+	c = traffic_get_counters(&nt->nt_clients, idx);
+	c->throttled++;
+	put_cpu_ptr(c);
+
+	idx = traffic_export_slot(nt, exp);
+	c = traffic_get_counters(&nt->nt_exports, idx);
+	c->throttled++;
+	put_cpu_ptr(c);
+}
+
+/*
+ * Called by nfsd_dispatch() once the reply has been encoded, with the
+ * time the request took.
+ */
+void
+nfsd_traffic_account(struct svc_rqst *rqstp, u64 elapsed_ns, __be32 nfserr)
+{
+	struct nfsd_thread_ctx *ctx = nfsd_rqst_ctx(rqstp);
+	struct nfsd_traffic *nt = traffic(rqstp);
+	struct nfsd_traffic_counters *c;
+	u64 rbytes = 0, wbytes = 0;
+	unsigned int idx;
+	u32 proc = rqstp->rq_proc;
+
+	if (!nt || rqstp->rq_prog != NFS_PROGRAM || rqstp->rq_vers != 3 ||
+	    proc >= NFSD3_NPROCS)
+		return;
+	if (!nfserr && proc == NFS3PROC_READ)
+		rbytes = ((struct nfsd3_readres *)rqstp->rq_resp)->count;
+	if (!nfserr && proc == NFS3PROC_WRITE)
+		wbytes = ((struct nfsd3_writeres *)rqstp->rq_resp)->count;
+	idx = traffic_client_slot(nt, rqstp->rq_client);
+
+	c = traffic_get_counters(&nt->nt_clients, idx);
+	c->ops[proc]++;
+	c->errors += nfserr != 0;
+	c->read_bytes += rbytes;
+	c->write_bytes += wbytes;
+	c->latency_ns += elapsed_ns;
+	put_cpu_ptr(c);
+
+	/* NULL, and requests whose handle was not found, have no export */
+	if (ctx->tc_export_slot < 0)
+		return;
+	c = traffic_get_counters(&nt->nt_exports, ctx->tc_export_slot);
+	c->ops[proc]++;
+	c->errors += nfserr != 0;
+	c->read_bytes += rbytes;
+	c->write_bytes += wbytes;
+	c->latency_ns += elapsed_ns;
+	put_cpu_ptr(c);
+}
+
+struct traffic_total {
+	unsigned int		idx;
+	u64			ops;
+};
+
+static int traffic_cmp(const void *a, const void *b)
+{
+	const struct traffic_total *x = a, *y = b;
+
+	if (x->ops != y->ops)
+		return x->ops < y->ops ? 1 : -1;
+	return 0;
+}
+
+/*
+ * List the slots of @tt that have seen requests, busiest first: totals
+ * on one line, calls per procedure on the next.
+ */
+static int traffic_show(struct seq_file *m, struct nfsd_traffic_table *tt)
+{
+	struct nfsd_traffic_counters *sum, *c;
+	struct traffic_total *tot;
+	unsigned int n = 0, i, idx;
+	int cpu, p;
+
+	tot = kmalloc_array(tt->tt_size, sizeof(*tot), GFP_KERNEL);
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	if (!tot || !sum) {
+		kfree(tot);
+		kfree(sum);
+		return -ENOMEM;
+	}
+
+	for (idx = 0; idx < tt->tt_size; idx++) {
+		u64 ops = 0;
+
+		/* pairs with smp_store_release() in traffic_slot() */
+		if (idx && !smp_load_acquire(&tt->tt_slots[idx].ts_hash))
+			continue;
+		for_each_possible_cpu(cpu) {
+			c = per_cpu_ptr(tt->tt_slots[idx].ts_counters, cpu);
+			for (p = 0; p < NFSD3_NPROCS; p++)
+				ops += c->ops[p];
+		}
+		if (ops) {
+			tot[n].idx = idx;
+			tot[n].ops = ops;
+			n++;
+		}
+	}
+	sort(tot, n, sizeof(*tot), traffic_cmp, NULL);
+
+	seq_printf(m, "%-32s %12s %9s %14s %14s %10s %9s\n", "name", "ops",
+		   "errors", "read_bytes", "write_bytes", "avg_usecs",
+		   "throttled");
+	for (i = 0; i < n; i++) {
+		idx = tot[i].idx;
+		memset(sum, 0, sizeof(*sum));
+		for_each_possible_cpu(cpu) {
+			c = per_cpu_ptr(tt->tt_slots[idx].ts_counters, cpu);
+			for (p = 0; p < NFSD3_NPROCS; p++)
+				sum->ops[p] += c->ops[p];
+			sum->errors += c->errors;
+			sum->read_bytes += c->read_bytes;
+			sum->write_bytes += c->write_bytes;
+			sum->latency_ns += c->latency_ns;
+			sum->throttled += c->throttled;
+		}
+		seq_printf(m, "%-32s %12llu %9llu %14llu %14llu %10llu %9llu\n",
+			   idx ? tt->tt_slots[idx].ts_name : "(other)",
+			   (unsigned long long)tot[i].ops,
+			   (unsigned long long)sum->errors,
+			   (unsigned long long)sum->read_bytes,
+			   (unsigned long long)sum->write_bytes,
+			   (unsigned long long)div64_u64(sum->latency_ns,
+						tot[i].ops * NSEC_PER_USEC),
+			   (unsigned long long)sum->throttled);
+		seq_puts(m, "\t");
+		for (p = 0; p < NFSD3_NPROCS; p++)
+			if (sum->ops[p])
+				seq_printf(m, " %s %llu", nfsd3_procname[p],
+					   (unsigned long long)sum->ops[p]);
+		seq_putc(m, '\n');
+	}
+	kfree(sum);
+	kfree(tot);
+	return 0;
+}
+
+/* the "clients" file; m->private is the net */
+int
+nfsd_traffic_clients_show(struct seq_file *m, void *v)
+{
+	struct nfsd_net *nn = net_generic(m->private, nfsd_net_id);
+
+	return traffic_show(m, &nn->traffic->nt_clients);
+}
+
+/* the "exports" file; m->private is the net */
+int
+nfsd_traffic_exports_show(struct seq_file *m, void *v)
+{
+	struct nfsd_net *nn = net_generic(m->private, nfsd_net_id);
+
+	return traffic_show(m, &nn->traffic->nt_exports);
+}
+
+static int traffic_table_init(struct nfsd_traffic_table *tt,
+			      unsigned int size)
+{
+	spin_lock_init(&tt->tt_lock);
+	tt->tt_size = size;
+	tt->tt_slots = kcalloc(size, sizeof(*tt->tt_slots), GFP_KERNEL);
+	if (!tt->tt_slots)
+		return -ENOMEM;
+	/* "(other)" is always there */
+	tt->tt_slots[0].ts_counters =
+		alloc_percpu(struct nfsd_traffic_counters);
+	if (!tt->tt_slots[0].ts_counters) {
+		kfree(tt->tt_slots);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static void traffic_table_free(struct nfsd_traffic_table *tt)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < tt->tt_size; idx++)
+		free_percpu(tt->tt_slots[idx].ts_counters);
+	kfree(tt->tt_slots);
+}
+
+int
+nfsd_traffic_init(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_traffic *nt;
+	int err;
+
+	nt = kzalloc(sizeof(*nt), GFP_KERNEL);
+	if (!nt)
+		return -ENOMEM;
+	err = traffic_table_init(&nt->nt_clients, NFSD_TRAFFIC_CLIENTS);
+	if (err)
+		goto out_free;
+	err = traffic_table_init(&nt->nt_exports, NFSD_TRAFFIC_EXPORTS);
+	if (err)
+		goto out_free_clients;
+	nn->traffic = nt;
+	return 0;
+
+out_free_clients:
+	traffic_table_free(&nt->nt_clients);
+out_free:
+	kfree(nt);
+	return err;
+}
+
+void
+nfsd_traffic_shutdown(struct net *net)
+{
+	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
+	struct nfsd_traffic *nt = nn->traffic;
+
+	if (!nt)
+		return;
+	nn->traffic = NULL;
+	traffic_table_free(&nt->nt_exports);
+	traffic_table_free(&nt->nt_clients);
+	kfree(nt);
+}
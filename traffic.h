@@ -0,0 +1,25 @@
+/*
+ * Per-client and per-export traffic accounting.
+ *
+ * nfsd_dispatch() charges every NFSv3 request to the auth domain of
+ * its client and to the export its file handle was found in; the
+ * "clients" and "exports" files list the totals, busiest first.
+ */
+
+#ifndef LINUX_NFSD_TRAFFIC_H
+#define LINUX_NFSD_TRAFFIC_H
+
+struct net;
+struct svc_rqst;
+struct svc_export;
+struct seq_file;
+
+int	nfsd_traffic_init(struct net *);
+void	nfsd_traffic_shutdown(struct net *);
+void	nfsd_traffic_export(struct svc_rqst *, struct svc_export *);
+void	nfsd_traffic_throttled(struct svc_rqst *, struct svc_export *);
+void	nfsd_traffic_account(struct svc_rqst *, u64 elapsed_ns, __be32 nfserr);
+int	nfsd_traffic_clients_show(struct seq_file *, void *);
+int	nfsd_traffic_exports_show(struct seq_file *, void *);
+
+#endif /* LINUX_NFSD_TRAFFIC_H */
@@ -32,16 +32,21 @@
 #include "xdr.h"
 #include "nfsd.h"
 #include "vfs.h"
+#include "negcache.h"
+#include "stats.h"
 
 __be32
 nfsd_lookup_dentry(struct svc_rqst *rqstp, struct svc_fh *fhp,
 		   const char *name, unsigned int len,
-		   struct svc_export **exp_ret, struct dentry **dentry_ret)
+		   struct svc_export **exp_ret, struct dentry **dentry_ret,
+		   struct nfsd_negcache_stamp *stamp)
 {
 	struct svc_export	*exp;
+	struct inode		*dir;
 	struct dentry		*dparent;
 	struct dentry		*dentry = NULL;
 	int			host_err;
+	int			stage;
 
 	printk(KERN_INFO "nfsd: nfsd_lookup(fh %s, %.*s)\n", SVCFH_fmt(fhp), len,name);
 
@@ -63,7 +68,17 @@ nfsd_lookup_dentry(struct svc_rqst *rqstp, struct svc_fh *fhp,
 		 * subsequent open and delegation acquisition which may
 		 * need to take the child's i_mutex:
 		 */
+		dir = dparent->d_inode;
+		stage = nfsd_stage_enter(rqstp, NFSD_STAGE_VFS);
+		mutex_lock_nested(&dir->i_mutex, I_MUTEX_PARENT);
+		/* what a miss found here stays true for, see negcache.c */
+		if (stamp) {
+			stamp->ns_ctime = dir->i_ctime;
+			stamp->ns_version = dir->i_version;
+		}
 		dentry = lookup_one_len(name, dparent, len);
+		mutex_unlock(&dir->i_mutex);
+		nfsd_stage_exit(rqstp, stage);
 		host_err = PTR_ERR(dentry);
 		if (IS_ERR(dentry))
 			goto out_nfserr;
@@ -93,6 +108,7 @@ __be32
 nfsd_lookup(struct svc_rqst *rqstp, struct svc_fh *fhp, const char *name,
 				unsigned int len, struct svc_fh *resfh)
 {
+	struct nfsd_negcache_stamp stamp;
 	struct svc_export	*exp;
 	struct dentry		*dentry;
 	__be32 err;
@@ -100,16 +116,21 @@ nfsd_lookup(struct svc_rqst *rqstp, struct svc_fh *fhp, const char *name,
 	err = fh_verify(rqstp, fhp);
 	if (err)
 		return err;
-	err = nfsd_lookup_dentry(rqstp, fhp, name, len, &exp, &dentry);
+	/* Names we recently failed to find in an unchanged directory */
+	if (nfsd_negcache_lookup(rqstp, fhp, name, len))
+		return nfserr_noent;
+	err = nfsd_lookup_dentry(rqstp, fhp, name, len, &exp, &dentry, &stamp);
 	if (err)
 		return err;
 	/*
-	 * Note: we compose the file handle now, but as the
-	 * dentry may be negative, it may need to be updated.
+	 * A negative dentry gets no file handle in the reply, so don't
+	 * bother composing one; just remember the miss.
 	 */
-	err = fh_compose(resfh, exp, dentry, fhp);
-	if (!err && !dentry->d_inode)
+	if (!dentry->d_inode) {
+		nfsd_negcache_insert(rqstp, fhp, name, len, &stamp);
 		err = nfserr_noent;
+	} else
+		err = fh_compose(resfh, exp, dentry, fhp);
 	dput(dentry);
 	exp_put(exp);
 	return err;
@@ -119,20 +140,24 @@ nfsd_lookup(struct svc_rqst *rqstp, struct svc_fh *fhp, const char *name,
  * Commit metadata changes to stable storage.
  */
 static int
-commit_metadata(struct svc_fh *fhp)
+commit_metadata(struct svc_rqst *rqstp, struct svc_fh *fhp)
 {
 	struct inode *inode = fhp->fh_dentry->d_inode;
 	const struct export_operations *export_ops = inode->i_sb->s_export_op;
+	int stage, ret;
 
 	if (!EX_ISSYNC(fhp->fh_export))
 		return 0;
 
+	stage = nfsd_stage_enter(rqstp, NFSD_STAGE_COMMIT);
 	if (export_ops->commit_metadata){
 		/* xfs has its own commit metadata function. */
 		printk(KERN_INFO "this file system does have its own commit metadata function.\n");
-		return export_ops->commit_metadata(inode);
-	}
-	return sync_inode_metadata(inode, 1);
+		ret = export_ops->commit_metadata(inode);
+	} else
+		ret = sync_inode_metadata(inode, 1);
+	nfsd_stage_exit(rqstp, stage);
+	return ret;
 }
 
 /*
@@ -178,6 +203,7 @@ nfsd_setattr(struct svc_rqst *rqstp, struct svc_fh *fhp, struct iattr *iap,
 	int		host_err;
 	bool		get_write_count;
 	bool		size_change = (iap->ia_valid & ATTR_SIZE);
+	int		stage;
 
 	if (iap->ia_valid & ATTR_SIZE)
 		ftype = S_IFREG;
@@ -223,7 +249,9 @@ nfsd_setattr(struct svc_rqst *rqstp, struct svc_fh *fhp, struct iattr *iap,
 			.ia_size	= iap->ia_size,
 		};
 
+		stage = nfsd_stage_enter(rqstp, NFSD_STAGE_VFS);
 		host_err = notify_change(dentry, &size_attr, NULL);
+		nfsd_stage_exit(rqstp, stage);
 		if (host_err)
 			goto out;
 		iap->ia_valid &= ~ATTR_SIZE;
@@ -238,11 +266,13 @@ nfsd_setattr(struct svc_rqst *rqstp, struct svc_fh *fhp, struct iattr *iap,
 	}
 
 	iap->ia_valid |= ATTR_CTIME;
+	stage = nfsd_stage_enter(rqstp, NFSD_STAGE_VFS);
 	host_err = notify_change(dentry, iap, NULL);
+	nfsd_stage_exit(rqstp, stage);
 
 out:
 	if (!host_err)
-		host_err = commit_metadata(fhp);
+		host_err = commit_metadata(rqstp, fhp);
 	return nfserrno(host_err);
 }
 
@@ -270,6 +300,7 @@ nfsd_open(struct svc_rqst *rqstp, struct svc_fh *fhp, umode_t type,
 	int		flags = O_RDONLY|O_LARGEFILE;
 	__be32		err;
 	int		host_err = 0;
+	int		stage;
 
 	validate_process_creds();
 
@@ -311,7 +342,9 @@ nfsd_open(struct svc_rqst *rqstp, struct svc_fh *fhp, umode_t type,
 			flags = O_WRONLY|O_LARGEFILE;
 	}
 
+	stage = nfsd_stage_enter(rqstp, NFSD_STAGE_VFS);
 	file = dentry_open(&path, flags, current_cred());
+	nfsd_stage_exit(rqstp, stage);
 	if (IS_ERR(file)) {
 		host_err = PTR_ERR(file);
 		goto out_nfserr;
@@ -359,7 +392,13 @@ static __be32
 nfsd_vfs_read(struct svc_rqst *rqstp, struct file *file,
 	      loff_t offset, struct kvec *vec, int vlen, unsigned long *count)
 {
-	return nfsd_readv(file, offset, vec, vlen, count);
+	__be32 err;
+	int stage;
+
+	stage = nfsd_stage_enter(rqstp, NFSD_STAGE_VFS);
+	err = nfsd_readv(file, offset, vec, vlen, count);
+	nfsd_stage_exit(rqstp, stage);
+	return err;
 }
 
 __be32
@@ -376,6 +415,7 @@ nfsd_vfs_write(struct svc_rqst *rqstp, struct svc_fh *fhp, struct file *file,
 	loff_t			pos = offset;
 	loff_t			end = LLONG_MAX;
 	unsigned int		pflags = current->flags;
+	int			stage;
 
 	if (test_bit(RQ_LOCAL, &rqstp->rq_flags))
 		/*
@@ -395,9 +435,11 @@ nfsd_vfs_write(struct svc_rqst *rqstp, struct svc_fh *fhp, struct file *file,
 		stable = NFS_UNSTABLE;
 
 	/* Write the data. */
+	stage = nfsd_stage_enter(rqstp, NFSD_STAGE_VFS);
 	oldfs = get_fs(); set_fs(KERNEL_DS);
 	host_err = vfs_writev(file, (struct iovec __user *)vec, vlen, &pos);
 	set_fs(oldfs);
+	nfsd_stage_exit(rqstp, stage);
 	if (host_err < 0)
 		goto out_nfserr;
 	*cnt = host_err;
@@ -406,7 +448,9 @@ nfsd_vfs_write(struct svc_rqst *rqstp, struct svc_fh *fhp, struct file *file,
 	if (stable) {
 		if (*cnt)
 			end = offset + *cnt - 1;
+		stage = nfsd_stage_enter(rqstp, NFSD_STAGE_COMMIT);
 		host_err = vfs_fsync_range(file, offset, end, 0);
+		nfsd_stage_exit(rqstp, stage);
 	}
 
 out_nfserr:
@@ -482,7 +526,7 @@ nfsd_create_setattr(struct svc_rqst *rqstp, struct svc_fh *resfhp,
 	if (iap->ia_valid)
 		return nfsd_setattr(rqstp, resfhp, iap, 0, (time_t)0);
 	/* Callers expect file metadata to be committed here */
-	return nfserrno(commit_metadata(resfhp));
+	return nfserrno(commit_metadata(rqstp, resfhp));
 }
 
 /*
@@ -503,6 +547,7 @@ nfsd_create(struct svc_rqst *rqstp, struct svc_fh *fhp,
 	__be32		err;
 	__be32		err2;
 	int		host_err;
+	int		stage;
 
 	err = nfserr_perm;
 	if (!flen)
@@ -531,7 +576,9 @@ nfsd_create(struct svc_rqst *rqstp, struct svc_fh *fhp,
 			goto out_nfserr;
 
 		/* called from nfsd_proc_mkdir, or possibly nfsd3_proc_create */
+		stage = nfsd_stage_enter(rqstp, NFSD_STAGE_VFS);
 		dchild = lookup_one_len(fname, dentry, flen);
+		nfsd_stage_exit(rqstp, stage);
 		host_err = PTR_ERR(dchild);
 		if (IS_ERR(dchild))
 			goto out_nfserr;
@@ -568,6 +615,7 @@ nfsd_create(struct svc_rqst *rqstp, struct svc_fh *fhp,
 	 */
 	err = 0;
 	host_err = 0;
+	stage = nfsd_stage_enter(rqstp, NFSD_STAGE_VFS);
 	switch (type) {
 	case S_IFREG:
 		host_err = vfs_create(dirp, dchild, iap->ia_mode, true);
@@ -576,6 +624,7 @@ nfsd_create(struct svc_rqst *rqstp, struct svc_fh *fhp,
 		host_err = vfs_mkdir(dirp, dchild, iap->ia_mode);
 		break;
 	}
+	nfsd_stage_exit(rqstp, stage);
 	if (host_err < 0)
 		goto out_nfserr;
 
@@ -587,7 +636,7 @@ nfsd_create(struct svc_rqst *rqstp, struct svc_fh *fhp,
 	 * child * simultaneously making the following commit_metadata a
 	 * noop.
 	 */
-	err2 = nfserrno(commit_metadata(fhp));
+	err2 = nfserrno(commit_metadata(rqstp, fhp));
 	if (err2)
 		err = err2;
 	/*
@@ -618,6 +667,7 @@ do_nfsd_create(struct svc_rqst *rqstp, struct svc_fh *fhp,
 	struct inode	*dirp;
 	__be32		err;
 	int		host_err;
+	int		stage;
 	__u32		v_mtime=0, v_atime=0;
 
 	err = nfserr_perm;
@@ -648,7 +698,9 @@ do_nfsd_create(struct svc_rqst *rqstp, struct svc_fh *fhp,
 	/*
 	 * Compose the response file handle.
 	 */
+	stage = nfsd_stage_enter(rqstp, NFSD_STAGE_VFS);
 	dchild = lookup_one_len(fname, dentry, flen);
+	nfsd_stage_exit(rqstp, stage);
 	host_err = PTR_ERR(dchild);
 	if (IS_ERR(dchild))
 		goto out_nfserr;
@@ -702,7 +754,9 @@ do_nfsd_create(struct svc_rqst *rqstp, struct svc_fh *fhp,
 		goto out;
 	}
 
+	stage = nfsd_stage_enter(rqstp, NFSD_STAGE_VFS);
 	host_err = vfs_create(dirp, dchild, iap->ia_mode, true);
+	nfsd_stage_exit(rqstp, stage);
 	if (host_err < 0) {
 		fh_drop_write(fhp);
 		goto out_nfserr;
@@ -718,7 +772,7 @@ do_nfsd_create(struct svc_rqst *rqstp, struct svc_fh *fhp,
 	 * (and possibly also the parent).
 	 */
 	if (!err)
-		err = nfserrno(commit_metadata(fhp));
+		err = nfserrno(commit_metadata(rqstp, fhp));
 
 	/*
 	 * Update the filehandle to get the new inode info.
@@ -750,6 +804,7 @@ nfsd_unlink(struct svc_rqst *rqstp, struct svc_fh *fhp, int type,
 	struct inode	*dirp;
 	__be32		err;
 	int		host_err;
+	int		stage;
 
 	err = nfserr_acces;
 	/* file name lenth can't be 0, maybe we should use <=0? and you can't delete '.' or '..'. */
@@ -773,7 +828,9 @@ nfsd_unlink(struct svc_rqst *rqstp, struct svc_fh *fhp, int type,
 
 	/* the dentry which represents the child that we are going to delete. this function looks up fname inside the directory which is represented by dentry, 
 	 * if found, this function returns the corresponding dentry. */
+	stage = nfsd_stage_enter(rqstp, NFSD_STAGE_VFS);
 	rdentry = lookup_one_len(fname, dentry, flen);
+	nfsd_stage_exit(rqstp, stage);
 	/* if rdentry is an invalid pointer, goto out_nfserr. */
 	host_err = PTR_ERR(rdentry);
 	if (IS_ERR(rdentry))
@@ -789,14 +846,16 @@ nfsd_unlink(struct svc_rqst *rqstp, struct svc_fh *fhp, int type,
 		goto out;
 	}
 
+	stage = nfsd_stage_enter(rqstp, NFSD_STAGE_VFS);
 	/* not a directory */
 	if (type != S_IFDIR)
 		host_err = vfs_unlink(dirp, rdentry, NULL);
 	/* if it is a directory */
 	else
 		host_err = vfs_rmdir(dirp, rdentry);
+	nfsd_stage_exit(rqstp, stage);
 	if (!host_err)
-		host_err = commit_metadata(fhp);
+		host_err = commit_metadata(rqstp, fhp);
 	/* now it's the right time to release the dentry. */
 	dput(rdentry);
 
@@ -851,13 +910,15 @@ static int nfsd_buffered_filldir(void *__buf, const char *name, int namlen,
 	return 0;
 }
 
-static __be32 nfsd_buffered_readdir(struct file *file, filldir_t func,
-				    struct readdir_cd *cdp, loff_t *offsetp)
+static __be32 nfsd_buffered_readdir(struct svc_rqst *rqstp, struct file *file,
+				    filldir_t func, struct readdir_cd *cdp,
+				    loff_t *offsetp)
 {
 	struct readdir_data buf;
 	struct buffered_dirent *de;
 	int host_err;
 	int size;
+	int stage;
 	loff_t offset;
 
 	buf.ctx.actor = nfsd_buffered_filldir;
@@ -874,7 +935,9 @@ static __be32 nfsd_buffered_readdir(struct file *file, filldir_t func,
 		buf.used = 0;
 		buf.full = 0;
 
+		stage = nfsd_stage_enter(rqstp, NFSD_STAGE_VFS);
 		host_err = iterate_dir(file, &buf.ctx);
+		nfsd_stage_exit(rqstp, stage);
 		if (buf.full)
 			host_err = 0;
 
@@ -940,7 +1003,7 @@ nfsd_readdir(struct svc_rqst *rqstp, struct svc_fh *fhp, loff_t *offsetp,
 		goto out_close;
 	}
 
-	err = nfsd_buffered_readdir(file, func, cdp, offsetp);
+	err = nfsd_buffered_readdir(rqstp, file, func, cdp, offsetp);
 
 	if (err == nfserr_eof || err == nfserr_toosmall)
 		err = nfs_ok; /* can still be found in ->err */
@@ -958,6 +1021,7 @@ __be32
 nfsd_statfs(struct svc_rqst *rqstp, struct svc_fh *fhp, struct kstatfs *stat, int access)
 {
 	__be32 err;
+	int stage;
 
 	err = fh_verify(rqstp, fhp);
 	if (!err) {
@@ -965,8 +1029,10 @@ nfsd_statfs(struct svc_rqst *rqstp, struct svc_fh *fhp, struct kstatfs *stat, in
 			.mnt	= fhp->fh_export->ex_path.mnt,
 			.dentry	= fhp->fh_dentry,
 		};
+		stage = nfsd_stage_enter(rqstp, NFSD_STAGE_VFS);
 		if (vfs_statfs(&path, stat))
 			err = nfserr_io;
+		nfsd_stage_exit(rqstp, stage);
 	}
 	return err;
 }
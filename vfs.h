@@ -8,6 +8,8 @@
 #include "nfsfh.h"
 #include "nfsd.h"
 
+struct nfsd_negcache_stamp;
+
 /*
  * Flags for nfsd_permission
  */
@@ -33,7 +35,8 @@ __be32		nfsd_lookup(struct svc_rqst *, struct svc_fh *,
 				const char *, unsigned int, struct svc_fh *);
 __be32		 nfsd_lookup_dentry(struct svc_rqst *, struct svc_fh *,
 				const char *, unsigned int,
-				struct svc_export **, struct dentry **);
+				struct svc_export **, struct dentry **,
+				struct nfsd_negcache_stamp *);
 __be32		nfsd_setattr(struct svc_rqst *, struct svc_fh *,
 				struct iattr *, int, time_t);
 __be32		nfsd_create(struct svc_rqst *, struct svc_fh *,
@@ -8,6 +8,7 @@
 #include "xdr.h"
 #include "netns.h"
 #include "vfs.h"
+#include "stats.h"
 
 /*
  * XDR functions for basic NFS types
@@ -128,13 +129,22 @@ static __be32 *
 encode_post_op_attr(struct svc_rqst *rqstp, __be32 *p, struct svc_fh *fhp)
 {
 	struct dentry *dentry = fhp->fh_dentry;
+	if (dentry && dentry->d_inode && fhp->fh_post_saved) {
+		/* the operation already fetched them, e.g. a cached LOOKUP miss */
+		*p++ = xdr_one;
+		return encode_fattr3(rqstp, p, fhp, &fhp->fh_post_attr);
+	}
 	if (dentry && dentry->d_inode) {
 		__be32 err;
 		struct kstat stat;
         	struct path path = {.mnt = fhp->fh_export->ex_path.mnt, .dentry = fhp->fh_dentry};
 
 		/* stat stores the attributes of the parent */
+		int stage;
+
+		stage = nfsd_stage_enter(rqstp, NFSD_STAGE_GETATTR);
 		err = nfserrno(vfs_getattr(&path, &stat));
+		nfsd_stage_exit(rqstp, stage);
 		if (!err) {
 			printk(KERN_INFO "vfs getattr success");
 			*p++ = xdr_one;		/* attributes follow. post_op_attr starts with a boolean value, if it's true, then the next few bytes are the attributes. */
@@ -583,23 +593,22 @@ out:
 	return rv;
 }
 
-static __be32 *encode_entryplus_baggage(struct nfsd3_readdirres *cd, __be32 *p, const char *name, int namlen, u64 ino)
+/*
+ * The handle in cd->scratch has already been composed by encode_entry(),
+ * which needed its length; @err is the result of composing it.
+ */
+static __be32 *encode_entryplus_baggage(struct nfsd3_readdirres *cd, __be32 *p, __be32 err)
 {
 	struct svc_fh	*fh = &cd->scratch;
-	__be32 err;
 
-	fh_init(fh, NFS3_FHSIZE);
-	err = compose_entry_fh(cd, fh, name, namlen, ino);
 	if (err) {
 		*p++ = 0;
 		*p++ = 0;
-		goto out;
+		return p;
 	}
 	p = encode_post_op_attr(cd->rqstp, p, fh);
 	*p++ = xdr_one;			/* yes, a file handle follows */
 	p = encode_fh(p, fh);
-out:
-	fh_put(fh);
 	return p;
 }
 
@@ -609,12 +618,15 @@ out:
  * The normal readdir reply requires 2 (fileid) + 1 (stringlen)
  * + string + 2 (cookie) + 1 (next) words, i.e. 6 + strlen.
  * 
- * The readdirplus baggage is 1+21 words for post_op_attr, plus the
- * file handle.
+ * The readdirplus baggage is 1+21 words for post_op_attr, 1 for the
+ * handle_follows flag and 1 for the handle length, plus the file handle
+ * itself.  The handle is composed up front so that we reserve room for
+ * its actual length rather than for NFS3_FHSIZE; with compact handles
+ * that lets a lot more entries fit in a reply.
  */
 
 #define NFS3_ENTRY_BAGGAGE	(2 + 1 + 2 + 1)
-#define NFS3_ENTRYPLUS_BAGGAGE	(1 + 21 + 1 + (NFS3_FHSIZE >> 2))
+#define NFS3_ENTRYPLUS_BAGGAGE	(1 + 21 + 1 + 1)
 static int
 encode_entry(struct readdir_cd *ccd, const char *name, int namlen,
 	     loff_t offset, u64 ino, unsigned int d_type, int plus)
@@ -627,6 +639,7 @@ encode_entry(struct readdir_cd *ccd, const char *name, int namlen,
 	int		slen;		/* string (name) length */
 	int		elen;		/* estimated entry length in words */
 	int		num_entry_words = 0;	/* actual number of words */
+	__be32		fherr = 0;
 
 	if (cd->offset) {
 		u64 offset64 = offset;
@@ -650,14 +663,20 @@ encode_entry(struct readdir_cd *ccd, const char *name, int namlen,
 	namlen = min(namlen, NFS3_MAXNAMLEN);
 
 	slen = XDR_QUADLEN(namlen);
-	elen = slen + NFS3_ENTRY_BAGGAGE
-		+ (plus? NFS3_ENTRYPLUS_BAGGAGE : 0);
-
-	if (cd->buflen < elen) {
-		cd->common.err = nfserr_toosmall;
-		return -EINVAL;
+	elen = slen + NFS3_ENTRY_BAGGAGE;
+	if (plus) {
+		fh_init(&cd->scratch, NFS3_FHSIZE);
+		fherr = compose_entry_fh(cd, &cd->scratch, name, namlen, ino);
+		if (fherr)
+			elen += 2;
+		else
+			elen += NFS3_ENTRYPLUS_BAGGAGE +
+				XDR_QUADLEN(cd->scratch.fh_handle.fh_size);
 	}
 
+	if (cd->buflen < elen)
+		goto out_toosmall;
+
 	/* determine which page in rq_respages[] we are currently filling */
 	for (page = cd->rqstp->rq_respages + 1;
 				page < cd->rqstp->rq_next_page; page++) {
@@ -674,7 +693,7 @@ encode_entry(struct readdir_cd *ccd, const char *name, int namlen,
 		p = encode_entry_baggage(cd, p, name, namlen, ino);
 
 		if (plus)
-			p = encode_entryplus_baggage(cd, p, name, namlen, ino);
+			p = encode_entryplus_baggage(cd, p, fherr);
 		num_entry_words = p - cd->buffer;
 	} else if (*(page+1) != NULL) {
 		/* temporarily encode entry into next page, then move back to
@@ -688,7 +707,7 @@ encode_entry(struct readdir_cd *ccd, const char *name, int namlen,
 		p1 = encode_entry_baggage(cd, p1, name, namlen, ino);
 
 		if (plus)
-			p1 = encode_entryplus_baggage(cd, p1, name, namlen, ino);
+			p1 = encode_entryplus_baggage(cd, p1, fherr);
 
 		/* determine entry word length and lengths to go in pages */
 		num_entry_words = p1 - tmp;
@@ -732,16 +751,21 @@ encode_entry(struct readdir_cd *ccd, const char *name, int namlen,
 			p = tmp + (len2 >> 2);
 		}
 	}
-	else {
-		cd->common.err = nfserr_toosmall;
-		return -EINVAL;
-	}
+	else
+		goto out_toosmall;
 
+	if (plus)
+		fh_put(&cd->scratch);
 	cd->buflen -= num_entry_words;
 	cd->buffer = p;
 	cd->common.err = nfs_ok;
 	return 0;
 
+out_toosmall:
+	if (plus)
+		fh_put(&cd->scratch);
+	cd->common.err = nfserr_toosmall;
+	return -EINVAL;
 }
 
 int
@@ -166,6 +166,16 @@ union nfsd3_xdrstore {
 
 #define NFS3_SVC_XDRSIZE		sizeof(union nfsd3_xdrstore)
 
+/* the buffer is followed by the thread context, see struct nfsd_thread_ctx */
+#define NFSD_THREAD_CTX_OFFSET		ALIGN(NFS3_SVC_XDRSIZE, sizeof(u64))
+#define NFSD_SVC_XDRSIZE		(NFSD_THREAD_CTX_OFFSET + \
+					 sizeof(struct nfsd_thread_ctx))
+
+static inline struct nfsd_thread_ctx *nfsd_rqst_ctx(struct svc_rqst *rqstp)
+{
+	return rqstp->rq_argp + NFSD_THREAD_CTX_OFFSET;
+}
+
 int nfs3svc_decode_fhandle(struct svc_rqst *, __be32 *, struct nfsd_fhandle *);
 int nfs3svc_decode_sattrargs(struct svc_rqst *, __be32 *,
 				struct nfsd3_sattrargs *);